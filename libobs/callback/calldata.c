@@ -39,6 +39,9 @@
  *
  *   Strings and string sizes always include the null terminator to allow for
  * direct referencing.
+ *
+ *   A layout is just a prepared stack in this same format, so call data that
+ * was laid out can still be used with the functions that take names.
  */
 
 static inline void cd_serialize(uint8_t **pos, void *ptr, size_t size)
@@ -247,3 +250,78 @@ bool calldata_get_string(const calldata_t *data, const char *name,
 	*str = cd_serialize_string(&pos);
 	return true;
 }
+
+/* ------------------------------------------------------------------------- */
+
+/* the parameter is only at its slot if nothing was set out of place, which
+ * the name and data size in front of it tell */
+static inline bool cd_laid_out(const calldata_t *data,
+			       const calldata_layout_t *layout,
+			       const struct calldata_slot *slot)
+{
+	size_t name_offset = slot->name_offset;
+	size_t data_offset = slot->data_offset;
+
+	if (!data->stack || !data_offset ||
+	    data->size < data_offset + slot->data_size)
+		return false;
+
+	return memcmp(data->stack + name_offset, layout->stack + name_offset,
+		      data_offset - name_offset) == 0;
+}
+
+void calldata_set_layout(calldata_t *data, const calldata_layout_t *layout)
+{
+	uint8_t *pos;
+
+	if (!data || !layout)
+		return;
+
+	pos = data->stack;
+	if (!cd_ensure_capacity(data, &pos, layout->size))
+		return;
+
+	memcpy(data->stack, layout->stack, layout->size);
+	data->size = layout->size;
+}
+
+bool calldata_get_data_at(const calldata_t *data,
+			  const calldata_layout_t *layout, size_t idx,
+			  const char *name, void *out, size_t size)
+{
+	const struct calldata_slot *slot;
+
+	if (!data)
+		return false;
+	if (!layout || idx >= layout->num_params)
+		return calldata_get_data(data, name, out, size);
+
+	slot = layout->slots + idx;
+	if (!cd_laid_out(data, layout, slot))
+		return calldata_get_data(data, name, out, size);
+	if (slot->data_size != size)
+		return false;
+
+	memcpy(out, data->stack + slot->data_offset, size);
+	return true;
+}
+
+void calldata_set_data_at(calldata_t *data, const calldata_layout_t *layout,
+			  size_t idx, const char *name, const void *in,
+			  size_t size)
+{
+	const struct calldata_slot *slot;
+
+	if (!data)
+		return;
+	if (!layout || idx >= layout->num_params) {
+		calldata_set_data(data, name, in, size);
+		return;
+	}
+
+	slot = layout->slots + idx;
+	if (slot->data_size == size && cd_laid_out(data, layout, slot))
+		memcpy(data->stack + slot->data_offset, in, size);
+	else
+		calldata_set_data(data, name, in, size);
+}
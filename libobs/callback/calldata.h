@@ -52,6 +52,33 @@ struct calldata {
 
 typedef struct calldata calldata_t;
 
+/*
+ * Parameter layout
+ *
+ *   Built from a signal or procedure declaration.  Setting a layout on call
+ * data lays out every declared parameter up front, in declaration order with
+ * strings last, so fixed size parameters always sit at the same offset and
+ * can be set and read by their index in the declaration without looking up
+ * their names.
+ */
+
+struct calldata_slot {
+	const char *name;
+	enum call_param_type type;
+	size_t name_offset; /* offset of the serialized name */
+	size_t data_offset; /* offset of the data, 0 for strings */
+	size_t data_size;
+};
+
+struct calldata_layout {
+	size_t num_params;
+	struct calldata_slot *slots;
+	uint8_t *stack; /* laid out stack, all values zero/NULL */
+	size_t size;
+};
+
+typedef struct calldata_layout calldata_layout_t;
+
 static inline void calldata_init(struct calldata *data)
 {
 	memset(data, 0, sizeof(struct calldata));
@@ -80,6 +107,15 @@ EXPORT bool calldata_get_data(const calldata_t *data, const char *name,
 EXPORT void calldata_set_data(calldata_t *data, const char *name,
 			      const void *in, size_t new_size);
 
+EXPORT void calldata_set_layout(calldata_t *data,
+				const calldata_layout_t *layout);
+EXPORT bool calldata_get_data_at(const calldata_t *data,
+				 const calldata_layout_t *layout, size_t idx,
+				 const char *name, void *out, size_t size);
+EXPORT void calldata_set_data_at(calldata_t *data,
+				 const calldata_layout_t *layout, size_t idx,
+				 const char *name, const void *in, size_t size);
+
 static inline void calldata_clear(struct calldata *data)
 {
 	if (data->stack) {
@@ -204,6 +240,137 @@ static inline void calldata_set_string(calldata_t *data, const char *name,
 		calldata_set_data(data, name, NULL, 0);
 }
 
+/* ------------------------------------------------------------------------- */
+/* parameter access by index, see calldata_layout.  the parameter's name is
+ * passed along with its index, and these fall back to looking it up by name
+ * if there is no layout or the data wasn't laid out.  strings are always
+ * looked up by name. */
+
+static inline bool calldata_get_int_at(const calldata_t *data,
+				       const calldata_layout_t *layout,
+				       size_t idx, const char *name,
+				       long long *val)
+{
+	return calldata_get_data_at(data, layout, idx, name, val,
+				    sizeof(*val));
+}
+
+static inline bool calldata_get_float_at(const calldata_t *data,
+					 const calldata_layout_t *layout,
+					 size_t idx, const char *name,
+					 double *val)
+{
+	return calldata_get_data_at(data, layout, idx, name, val,
+				    sizeof(*val));
+}
+
+static inline bool calldata_get_bool_at(const calldata_t *data,
+					const calldata_layout_t *layout,
+					size_t idx, const char *name,
+					bool *val)
+{
+	return calldata_get_data_at(data, layout, idx, name, val,
+				    sizeof(*val));
+}
+
+static inline bool calldata_get_ptr_at(const calldata_t *data,
+				       const calldata_layout_t *layout,
+				       size_t idx, const char *name,
+				       void *p_ptr)
+{
+	return calldata_get_data_at(data, layout, idx, name, p_ptr,
+				    sizeof(p_ptr));
+}
+
+static inline long long calldata_int_at(const calldata_t *data,
+					const calldata_layout_t *layout,
+					size_t idx, const char *name)
+{
+	long long val = 0;
+	calldata_get_int_at(data, layout, idx, name, &val);
+	return val;
+}
+
+static inline double calldata_float_at(const calldata_t *data,
+				       const calldata_layout_t *layout,
+				       size_t idx, const char *name)
+{
+	double val = 0.0;
+	calldata_get_float_at(data, layout, idx, name, &val);
+	return val;
+}
+
+static inline bool calldata_bool_at(const calldata_t *data,
+				    const calldata_layout_t *layout, size_t idx,
+				    const char *name)
+{
+	bool val = false;
+	calldata_get_bool_at(data, layout, idx, name, &val);
+	return val;
+}
+
+static inline void *calldata_ptr_at(const calldata_t *data,
+				    const calldata_layout_t *layout, size_t idx,
+				    const char *name)
+{
+	void *val = NULL;
+	calldata_get_ptr_at(data, layout, idx, name, &val);
+	return val;
+}
+
+static inline const char *calldata_string_at(const calldata_t *data,
+					     const calldata_layout_t *layout,
+					     size_t idx, const char *name)
+{
+	const char *val = NULL;
+	calldata_get_string(data, name, &val);
+
+	UNUSED_PARAMETER(layout);
+	UNUSED_PARAMETER(idx);
+	return val;
+}
+
+static inline void calldata_set_int_at(calldata_t *data,
+				       const calldata_layout_t *layout,
+				       size_t idx, const char *name,
+				       long long val)
+{
+	calldata_set_data_at(data, layout, idx, name, &val, sizeof(val));
+}
+
+static inline void calldata_set_float_at(calldata_t *data,
+					 const calldata_layout_t *layout,
+					 size_t idx, const char *name,
+					 double val)
+{
+	calldata_set_data_at(data, layout, idx, name, &val, sizeof(val));
+}
+
+static inline void calldata_set_bool_at(calldata_t *data,
+					const calldata_layout_t *layout,
+					size_t idx, const char *name, bool val)
+{
+	calldata_set_data_at(data, layout, idx, name, &val, sizeof(val));
+}
+
+static inline void calldata_set_ptr_at(calldata_t *data,
+				       const calldata_layout_t *layout,
+				       size_t idx, const char *name, void *ptr)
+{
+	calldata_set_data_at(data, layout, idx, name, &ptr, sizeof(ptr));
+}
+
+static inline void calldata_set_string_at(calldata_t *data,
+					  const calldata_layout_t *layout,
+					  size_t idx, const char *name,
+					  const char *str)
+{
+	calldata_set_string(data, name, str);
+
+	UNUSED_PARAMETER(layout);
+	UNUSED_PARAMETER(idx);
+}
+
 #ifdef __cplusplus
 }
 #endif
@@ -171,6 +171,83 @@ static void parse_params(struct cf_parser *cfp, struct decl_info *decl)
 		cf_next_token_should_be(cfp, ")", NULL, NULL);
 }
 
+static size_t get_param_size(enum call_param_type type)
+{
+	switch (type) {
+	case CALL_PARAM_TYPE_INT:
+		return sizeof(long long);
+	case CALL_PARAM_TYPE_FLOAT:
+		return sizeof(double);
+	case CALL_PARAM_TYPE_BOOL:
+		return sizeof(bool);
+	case CALL_PARAM_TYPE_PTR:
+		return sizeof(void *);
+	case CALL_PARAM_TYPE_VOID:
+	case CALL_PARAM_TYPE_STRING:
+		break;
+	}
+
+	return 0;
+}
+
+static inline void layout_write(uint8_t **pos, const void *data, size_t size)
+{
+	memcpy(*pos, data, size);
+	*pos += size;
+}
+
+/* fixed size parameters first, so setting strings never moves them */
+static void build_layout(struct decl_info *decl)
+{
+	size_t num = decl->params.num;
+	size_t size = sizeof(size_t);
+	calldata_layout_t *layout;
+	uint8_t *pos;
+
+	for (size_t i = 0; i < num; i++) {
+		struct decl_param *param = decl->params.array + i;
+		size += sizeof(size_t) * 2 + strlen(param->name) + 1 +
+			get_param_size(param->type);
+	}
+
+	layout = bzalloc(sizeof(calldata_layout_t) +
+			 sizeof(struct calldata_slot) * num + size);
+	layout->num_params = num;
+	layout->slots = (struct calldata_slot *)(layout + 1);
+	layout->stack = (uint8_t *)(layout->slots + num);
+	layout->size = size;
+
+	pos = layout->stack;
+
+	for (int pass = 0; pass < 2; pass++) {
+		for (size_t i = 0; i < num; i++) {
+			struct decl_param *param = decl->params.array + i;
+			struct calldata_slot *slot = layout->slots + i;
+			size_t name_len = strlen(param->name) + 1;
+			bool is_string = param->type == CALL_PARAM_TYPE_STRING;
+
+			if (is_string != (pass == 1))
+				continue;
+
+			slot->type = param->type;
+			slot->data_size = get_param_size(param->type);
+			slot->name_offset = pos - layout->stack;
+			layout_write(&pos, &name_len, sizeof(size_t));
+
+			slot->name = (const char *)pos;
+			layout_write(&pos, param->name, name_len);
+			layout_write(&pos, &slot->data_size, sizeof(size_t));
+
+			if (!is_string) {
+				slot->data_offset = pos - layout->stack;
+				pos += slot->data_size;
+			}
+		}
+	}
+
+	decl->layout = layout;
+}
+
 static void print_errors(struct cf_parser *cfp, const char *decl_string)
 {
 	char *errors = error_data_buildstring(&cfp->error_list);
@@ -226,7 +303,9 @@ fail:
 		da_push_back(decl->params, &ret_param);
 	}
 
-	if (!success)
+	if (success)
+		build_layout(decl);
+	else
 		decl_info_free(decl);
 
 	print_errors(&cfp, decl_string);
@@ -40,6 +40,7 @@ struct decl_info {
 	char *name;
 	const char *decl_string;
 	DARRAY(struct decl_param) params;
+	calldata_layout_t *layout;
 };
 
 static inline void decl_info_free(struct decl_info *decl)
@@ -49,6 +50,7 @@ static inline void decl_info_free(struct decl_info *decl)
 			decl_param_free(decl->params.array + i);
 		da_free(decl->params);
 
+		bfree(decl->layout);
 		bfree(decl->name);
 		memset(decl, 0, sizeof(struct decl_info));
 	}
@@ -73,20 +73,37 @@ void proc_handler_add(proc_handler_t *handler, const char *decl_string,
 	da_push_back(handler->procs, &pi);
 }
 
+static struct proc_info *getproc(proc_handler_t *handler, const char *name)
+{
+	for (size_t i = 0; i < handler->procs.num; i++) {
+		struct proc_info *info = handler->procs.array + i;
+
+		if (strcmp(info->func.name, name) == 0)
+			return info;
+	}
+
+	return NULL;
+}
+
 bool proc_handler_call(proc_handler_t *handler, const char *name,
 		       calldata_t *params)
 {
+	struct proc_info *info;
+
 	if (!handler)
 		return false;
 
-	for (size_t i = 0; i < handler->procs.num; i++) {
-		struct proc_info *info = handler->procs.array + i;
+	info = getproc(handler, name);
+	if (!info)
+		return false;
 
-		if (strcmp(info->func.name, name) == 0) {
-			info->callback(info->data, params);
-			return true;
-		}
-	}
+	info->callback(info->data, params);
+	return true;
+}
 
-	return false;
+const calldata_layout_t *proc_handler_get_layout(proc_handler_t *handler,
+						 const char *name)
+{
+	struct proc_info *info = handler ? getproc(handler, name) : NULL;
+	return info ? info->func.layout : NULL;
 }
@@ -49,6 +49,13 @@ EXPORT void proc_handler_add(proc_handler_t *handler, const char *decl_string,
 EXPORT bool proc_handler_call(proc_handler_t *handler, const char *name,
 			      calldata_t *params);
 
+/**
+ * Returns the parameter layout of a procedure, valid for as long as the
+ * procedure handler.  Returns NULL if the named procedure is not found.
+ */
+EXPORT const calldata_layout_t *proc_handler_get_layout(proc_handler_t *handler,
+							const char *name);
+
 #ifdef __cplusplus
 }
 #endif
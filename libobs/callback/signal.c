@@ -16,111 +16,222 @@
 
 #include "../util/darray.h"
 #include "../util/threading.h"
+#include "../util/platform.h"
 
 #include "decl.h"
 #include "signal.h"
 
+#define SIGNAL_BUCKETS 32
+
 struct signal_callback {
+	volatile long refs;
 	signal_callback_t callback;
+	global_signal_callback_t global;
 	void *data;
-	bool remove;
+	volatile bool remove;
 	bool keep_ref;
+
+	/* set when a disconnect waits for emissions to finish with the
+	 * callback, signaled by the last one instead of freeing it */
+	os_event_t *released;
+};
+
+/* Callback arrays are copy-on-write: connecting or disconnecting swaps in a
+ * new array under the handler mutex, and emitting only references the
+ * current one, so callbacks are called without any lock held.  Callbacks
+ * are shared between the arrays they are in, so a callback flagged for
+ * removal is skipped by every emission still walking an older array. */
+struct signal_callbacks {
+	volatile long refs;
+	size_t num;
+	struct signal_callback **array;
 };
 
 struct signal_info {
 	struct decl_info func;
-	DARRAY(struct signal_callback) callbacks;
-	pthread_mutex_t mutex;
-	bool signalling;
+	uint32_t hash;
+	struct signal_callbacks *callbacks;
 
 	struct signal_info *next;
 };
 
-static inline struct signal_info *signal_info_create(struct decl_info *info)
-{
-	pthread_mutexattr_t attr;
-	struct signal_info *si;
+struct signal_handler {
+	struct signal_info *buckets[SIGNAL_BUCKETS];
+	pthread_mutex_t mutex;
+	volatile long refs;
 
-	if (pthread_mutexattr_init(&attr) != 0)
-		return NULL;
-	if (pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE) != 0)
-		return NULL;
+	struct signal_callbacks *global_callbacks;
+};
 
-	si = bmalloc(sizeof(struct signal_info));
+/* emissions in progress on the current thread */
+struct signal_emission {
+	struct signal_handler *handler;
+	struct signal_callbacks **list;
+	struct signal_callback *current;
+	long remove_refs;
 
-	si->func = *info;
-	si->next = NULL;
-	si->signalling = false;
-	da_init(si->callbacks);
+	struct signal_emission *prev;
+};
 
-	if (pthread_mutex_init(&si->mutex, &attr) != 0) {
-		blog(LOG_ERROR, "Could not create signal");
+static THREAD_LOCAL struct signal_emission *current_emission = NULL;
 
-		decl_info_free(&si->func);
-		bfree(si);
-		return NULL;
+static inline uint32_t hash_signal_name(const char *name)
+{
+	uint32_t hash = 2166136261u;
+	while (*name) {
+		hash ^= (uint8_t)*(name++);
+		hash *= 16777619u;
 	}
+	return hash;
+}
 
-	return si;
+static inline void callback_release(struct signal_callback *cb)
+{
+	if (os_atomic_dec_long(&cb->refs) == 0) {
+		if (cb->released)
+			os_event_signal(cb->released);
+		else
+			bfree(cb);
+	}
 }
 
-static inline void signal_info_destroy(struct signal_info *si)
+static struct signal_callbacks *callbacks_create(size_t num)
 {
-	if (si) {
-		pthread_mutex_destroy(&si->mutex);
-		decl_info_free(&si->func);
-		da_free(si->callbacks);
-		bfree(si);
+	struct signal_callbacks *cbs;
+
+	cbs = bmalloc(sizeof(struct signal_callbacks) +
+		      sizeof(struct signal_callback *) * num);
+	cbs->refs = 1;
+	cbs->num = num;
+	cbs->array = (struct signal_callback **)(cbs + 1);
+	return cbs;
+}
+
+static inline void callbacks_addref(struct signal_callbacks *cbs)
+{
+	if (cbs)
+		os_atomic_inc_long(&cbs->refs);
+}
+
+static void callbacks_release(struct signal_callbacks *cbs)
+{
+	if (cbs && os_atomic_dec_long(&cbs->refs) == 0) {
+		for (size_t i = 0; i < cbs->num; i++)
+			callback_release(cbs->array[i]);
+		bfree(cbs);
 	}
 }
 
-static inline size_t signal_get_callback_idx(struct signal_info *si,
-					     signal_callback_t callback,
-					     void *data)
+static inline size_t callbacks_find(struct signal_callbacks *cbs,
+				    const struct signal_callback *find)
 {
-	for (size_t i = 0; i < si->callbacks.num; i++) {
-		struct signal_callback *sc = si->callbacks.array + i;
+	if (!cbs)
+		return DARRAY_INVALID;
 
-		if (sc->callback == callback && sc->data == data)
+	for (size_t i = 0; i < cbs->num; i++) {
+		struct signal_callback *cb = cbs->array[i];
+
+		if (cb->callback == find->callback &&
+		    cb->global == find->global && cb->data == find->data)
 			return i;
 	}
 
 	return DARRAY_INVALID;
 }
 
-struct global_callback_info {
-	global_signal_callback_t callback;
-	void *data;
-	long signaling;
-	bool remove;
-};
+/* must be called with the handler mutex held */
+static void callbacks_push_back(struct signal_callbacks **list,
+				const struct signal_callback *cb)
+{
+	struct signal_callbacks *old = *list;
+	size_t num = old ? old->num : 0;
+	struct signal_callbacks *cbs = callbacks_create(num + 1);
 
-struct signal_handler {
-	struct signal_info *first;
-	pthread_mutex_t mutex;
-	volatile long refs;
+	for (size_t i = 0; i < num; i++) {
+		cbs->array[i] = old->array[i];
+		os_atomic_inc_long(&cbs->array[i]->refs);
+	}
 
-	DARRAY(struct global_callback_info) global_callbacks;
-	pthread_mutex_t global_callbacks_mutex;
-};
+	cbs->array[num] = bmemdup(cb, sizeof(*cb));
+	cbs->array[num]->refs = 1;
+
+	*list = cbs;
+	callbacks_release(old);
+}
+
+/* must be called with the handler mutex held, returns a reference to the
+ * erased callback.  released is set before taking the reference, so every
+ * later release sees it. */
+static struct signal_callback *callbacks_erase(struct signal_callbacks **list,
+					       size_t idx,
+					       os_event_t *released)
+{
+	struct signal_callbacks *old = *list;
+	struct signal_callbacks *cbs = NULL;
+	struct signal_callback *erased = old->array[idx];
+
+	erased->released = released;
+	os_atomic_store_bool(&erased->remove, true);
+	os_atomic_inc_long(&erased->refs);
+
+	if (old->num > 1) {
+		cbs = callbacks_create(old->num - 1);
+
+		for (size_t i = 0, j = 0; i < old->num; i++) {
+			if (i == idx)
+				continue;
+			cbs->array[j] = old->array[i];
+			os_atomic_inc_long(&cbs->array[j++]->refs);
+		}
+	}
+
+	*list = cbs;
+	callbacks_release(old);
+	return erased;
+}
+
+static inline struct signal_emission *
+find_emission(struct signal_callbacks **list)
+{
+	struct signal_emission *emission = current_emission;
+	while (emission && emission->list != list)
+		emission = emission->prev;
+	return emission;
+}
+
+static inline struct signal_info *signal_info_create(struct decl_info *info)
+{
+	struct signal_info *si = bzalloc(sizeof(struct signal_info));
+
+	si->func = *info;
+	si->hash = hash_signal_name(info->name);
+	return si;
+}
+
+static inline void signal_info_destroy(struct signal_info *si)
+{
+	if (si) {
+		decl_info_free(&si->func);
+		callbacks_release(si->callbacks);
+		bfree(si);
+	}
+}
 
 static struct signal_info *getsignal(signal_handler_t *handler,
-				     const char *name,
-				     struct signal_info **p_last)
+				     const char *name)
 {
-	struct signal_info *signal, *last = NULL;
+	uint32_t hash = hash_signal_name(name);
+	struct signal_info *signal;
 
-	signal = handler->first;
+	signal = handler->buckets[hash % SIGNAL_BUCKETS];
 	while (signal != NULL) {
-		if (strcmp(signal->func.name, name) == 0)
+		if (signal->hash == hash &&
+		    strcmp(signal->func.name, name) == 0)
 			break;
 
-		last = signal;
 		signal = signal->next;
 	}
 
-	if (p_last)
-		*p_last = last;
 	return signal;
 }
 
@@ -129,42 +240,29 @@ static struct signal_info *getsignal(signal_handler_t *handler,
 signal_handler_t *signal_handler_create(void)
 {
 	struct signal_handler *handler = bzalloc(sizeof(struct signal_handler));
-	handler->first = NULL;
 	handler->refs = 1;
 
-	pthread_mutexattr_t attr;
-	if (pthread_mutexattr_init(&attr) != 0)
-		return NULL;
-	if (pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE) != 0)
-		return NULL;
-
 	if (pthread_mutex_init(&handler->mutex, NULL) != 0) {
 		blog(LOG_ERROR, "Couldn't create signal handler mutex!");
 		bfree(handler);
 		return NULL;
 	}
-	if (pthread_mutex_init(&handler->global_callbacks_mutex, &attr) != 0) {
-		blog(LOG_ERROR, "Couldn't create signal handler global "
-				"callbacks mutex!");
-		pthread_mutex_destroy(&handler->mutex);
-		bfree(handler);
-		return NULL;
-	}
 
 	return handler;
 }
 
 static void signal_handler_actually_destroy(signal_handler_t *handler)
 {
-	struct signal_info *sig = handler->first;
-	while (sig != NULL) {
-		struct signal_info *next = sig->next;
-		signal_info_destroy(sig);
-		sig = next;
+	for (size_t i = 0; i < SIGNAL_BUCKETS; i++) {
+		struct signal_info *sig = handler->buckets[i];
+		while (sig != NULL) {
+			struct signal_info *next = sig->next;
+			signal_info_destroy(sig);
+			sig = next;
+		}
 	}
 
-	da_free(handler->global_callbacks);
-	pthread_mutex_destroy(&handler->global_callbacks_mutex);
+	callbacks_release(handler->global_callbacks);
 	pthread_mutex_destroy(&handler->mutex);
 	bfree(handler);
 }
@@ -179,7 +277,7 @@ void signal_handler_destroy(signal_handler_t *handler)
 bool signal_handler_add(signal_handler_t *handler, const char *signal_decl)
 {
 	struct decl_info func = {0};
-	struct signal_info *sig, *last;
+	struct signal_info *sig;
 	bool success = true;
 
 	if (!parse_decl_string(&func, signal_decl)) {
@@ -189,17 +287,18 @@ bool signal_handler_add(signal_handler_t *handler, const char *signal_decl)
 
 	pthread_mutex_lock(&handler->mutex);
 
-	sig = getsignal(handler, func.name, &last);
+	sig = getsignal(handler, func.name);
 	if (sig) {
 		blog(LOG_WARNING, "Signal declaration '%s' exists", func.name);
 		decl_info_free(&func);
 		success = false;
 	} else {
+		struct signal_info **bucket;
+
 		sig = signal_info_create(&func);
-		if (!last)
-			handler->first = sig;
-		else
-			last->next = sig;
+		bucket = &handler->buckets[sig->hash % SIGNAL_BUCKETS];
+		sig->next = *bucket;
+		*bucket = sig;
 	}
 
 	pthread_mutex_unlock(&handler->mutex);
@@ -212,18 +311,19 @@ static void signal_handler_connect_internal(signal_handler_t *handler,
 					    signal_callback_t callback,
 					    void *data, bool keep_ref)
 {
-	struct signal_info *sig, *last;
-	struct signal_callback cb_data = {callback, data, false, keep_ref};
+	struct signal_info *sig;
+	struct signal_callback cb_data = {
+		.callback = callback, .data = data, .keep_ref = keep_ref};
 	size_t idx;
 
 	if (!handler)
 		return;
 
 	pthread_mutex_lock(&handler->mutex);
-	sig = getsignal(handler, signal, &last);
-	pthread_mutex_unlock(&handler->mutex);
 
+	sig = getsignal(handler, signal);
 	if (!sig) {
+		pthread_mutex_unlock(&handler->mutex);
 		blog(LOG_WARNING,
 		     "signal_handler_connect: "
 		     "signal '%s' not found",
@@ -231,18 +331,14 @@ static void signal_handler_connect_internal(signal_handler_t *handler,
 		return;
 	}
 
-	/* -------------- */
-
-	pthread_mutex_lock(&sig->mutex);
-
 	if (keep_ref)
 		os_atomic_inc_long(&handler->refs);
 
-	idx = signal_get_callback_idx(sig, callback, data);
+	idx = callbacks_find(sig->callbacks, &cb_data);
 	if (keep_ref || idx == DARRAY_INVALID)
-		da_push_back(sig->callbacks, &cb_data);
+		callbacks_push_back(&sig->callbacks, &cb_data);
 
-	pthread_mutex_unlock(&sig->mutex);
+	pthread_mutex_unlock(&handler->mutex);
 }
 
 void signal_handler_connect(signal_handler_t *handler, const char *signal,
@@ -257,170 +353,223 @@ void signal_handler_connect_ref(signal_handler_t *handler, const char *signal,
 	signal_handler_connect_internal(handler, signal, callback, data, true);
 }
 
-static inline struct signal_info *getsignal_locked(signal_handler_t *handler,
-						   const char *name)
+/* drops the disconnecting thread's reference to an erased callback, and if
+ * emissions on other threads still hold it, sleeps until the last of them
+ * lets go */
+static void wait_released(struct signal_callback *erased)
 {
-	struct signal_info *sig;
+	os_event_t *released = erased->released;
 
-	if (!handler)
-		return NULL;
+	if (os_atomic_dec_long(&erased->refs) != 0)
+		os_event_wait(released);
+
+	os_event_destroy(released);
+	bfree(erased);
+}
+
+/* Once disconnect returns, the callback must not be called anymore, so wait
+ * for other threads still walking the old array to finish with it.  If this
+ * thread is emitting the signal itself, the callback has just been flagged
+ * and the emission skips it instead. */
+static void disconnect_internal(signal_handler_t *handler,
+				struct signal_callbacks **list,
+				const struct signal_callback *find)
+{
+	/* every array still holding the callback is being emitted */
+	struct signal_emission *emission = find_emission(list);
+	struct signal_callback *erased = NULL;
+	os_event_t *released = NULL;
+	bool keep_ref;
+	size_t idx;
+
+	if (!emission && os_event_init(&released, OS_EVENT_TYPE_MANUAL) != 0) {
+		blog(LOG_ERROR, "disconnect_internal: failed to create event");
+		return;
+	}
 
 	pthread_mutex_lock(&handler->mutex);
-	sig = getsignal(handler, name, NULL);
+
+	idx = callbacks_find(*list, find);
+	if (idx != DARRAY_INVALID)
+		erased = callbacks_erase(list, idx, released);
+
 	pthread_mutex_unlock(&handler->mutex);
 
-	return sig;
+	if (!erased) {
+		if (released)
+			os_event_destroy(released);
+		return;
+	}
+
+	keep_ref = erased->keep_ref;
+	if (released)
+		wait_released(erased);
+	else
+		callback_release(erased);
+
+	if (keep_ref) {
+		if (emission)
+			emission->remove_refs++;
+		else if (os_atomic_dec_long(&handler->refs) == 0)
+			signal_handler_actually_destroy(handler);
+	}
 }
 
 void signal_handler_disconnect(signal_handler_t *handler, const char *signal,
 			       signal_callback_t callback, void *data)
 {
-	struct signal_info *sig = getsignal_locked(handler, signal);
-	bool keep_ref = false;
-	size_t idx;
+	struct signal_callback find = {.callback = callback, .data = data};
+	struct signal_info *sig;
+
+	if (!handler)
+		return;
+
+	pthread_mutex_lock(&handler->mutex);
+	sig = getsignal(handler, signal);
+	pthread_mutex_unlock(&handler->mutex);
+
+	if (sig)
+		disconnect_internal(handler, &sig->callbacks, &find);
+}
 
-	if (!sig)
+void signal_handler_remove_current(void)
+{
+	struct signal_emission *emission = current_emission;
+	struct signal_callback *erased = NULL;
+	struct signal_callbacks *cbs;
+
+	if (!emission || !emission->current)
 		return;
 
-	pthread_mutex_lock(&sig->mutex);
+	pthread_mutex_lock(&emission->handler->mutex);
 
-	idx = signal_get_callback_idx(sig, callback, data);
-	if (idx != DARRAY_INVALID) {
-		if (sig->signalling) {
-			sig->callbacks.array[idx].remove = true;
-		} else {
-			keep_ref = sig->callbacks.array[idx].keep_ref;
-			da_erase(sig->callbacks, idx);
+	cbs = *emission->list;
+	for (size_t i = 0; cbs && i < cbs->num; i++) {
+		if (cbs->array[i] == emission->current) {
+			erased = callbacks_erase(emission->list, i, NULL);
+			break;
 		}
 	}
 
-	pthread_mutex_unlock(&sig->mutex);
+	pthread_mutex_unlock(&emission->handler->mutex);
 
-	if (keep_ref && os_atomic_dec_long(&handler->refs) == 0) {
-		signal_handler_actually_destroy(handler);
+	if (erased) {
+		if (erased->keep_ref)
+			emission->remove_refs++;
+		callback_release(erased);
 	}
 }
 
-static THREAD_LOCAL struct signal_callback *current_signal_cb = NULL;
-static THREAD_LOCAL struct global_callback_info *current_global_cb = NULL;
-
-void signal_handler_remove_current(void)
+static void signal_emit(struct signal_emission *emission,
+			struct signal_callbacks *cbs, const char *signal,
+			calldata_t *params)
 {
-	if (current_signal_cb)
-		current_signal_cb->remove = true;
-	else if (current_global_cb)
-		current_global_cb->remove = true;
+	emission->prev = current_emission;
+	current_emission = emission;
+
+	for (size_t i = 0; i < cbs->num; i++) {
+		struct signal_callback *cb = cbs->array[i];
+		if (os_atomic_load_bool(&cb->remove))
+			continue;
+
+		emission->current = cb;
+		if (cb->global)
+			cb->global(cb->data, signal, params);
+		else
+			cb->callback(cb->data, params);
+	}
+
+	current_emission = emission->prev;
+	callbacks_release(cbs);
 }
 
 void signal_handler_signal(signal_handler_t *handler, const char *signal,
 			   calldata_t *params)
 {
-	struct signal_info *sig = getsignal_locked(handler, signal);
-	long remove_refs = 0;
+	struct signal_callbacks *cbs = NULL;
+	struct signal_callbacks *global_cbs;
+	struct signal_info *sig;
 
-	if (!sig)
+	if (!handler)
 		return;
 
-	pthread_mutex_lock(&sig->mutex);
-	sig->signalling = true;
-
-	for (size_t i = 0; i < sig->callbacks.num; i++) {
-		struct signal_callback *cb = sig->callbacks.array + i;
-		if (!cb->remove) {
-			current_signal_cb = cb;
-			cb->callback(cb->data, params);
-			current_signal_cb = NULL;
-		}
-	}
-
-	for (size_t i = sig->callbacks.num; i > 0; i--) {
-		struct signal_callback *cb = sig->callbacks.array + i - 1;
-		if (cb->remove) {
-			if (cb->keep_ref)
-				remove_refs++;
+	pthread_mutex_lock(&handler->mutex);
 
-			da_erase(sig->callbacks, i - 1);
-		}
+	sig = getsignal(handler, signal);
+	if (sig) {
+		cbs = sig->callbacks;
+		callbacks_addref(cbs);
 	}
 
-	sig->signalling = false;
-	pthread_mutex_unlock(&sig->mutex);
+	global_cbs = handler->global_callbacks;
+	callbacks_addref(global_cbs);
 
-	pthread_mutex_lock(&handler->global_callbacks_mutex);
+	pthread_mutex_unlock(&handler->mutex);
 
-	if (handler->global_callbacks.num) {
-		for (size_t i = 0; i < handler->global_callbacks.num; i++) {
-			struct global_callback_info *cb =
-				handler->global_callbacks.array + i;
+	if (!sig) {
+		callbacks_release(global_cbs);
+		return;
+	}
 
-			if (!cb->remove) {
-				cb->signaling++;
-				current_global_cb = cb;
-				cb->callback(cb->data, signal, params);
-				current_global_cb = NULL;
-				cb->signaling--;
-			}
-		}
+	struct signal_emission emission = {handler, &sig->callbacks};
 
-		for (size_t i = handler->global_callbacks.num; i > 0; i--) {
-			struct global_callback_info *cb =
-				handler->global_callbacks.array + (i - 1);
+	if (cbs)
+		signal_emit(&emission, cbs, signal, params);
 
-			if (cb->remove && !cb->signaling)
-				da_erase(handler->global_callbacks, i - 1);
-		}
+	if (global_cbs) {
+		emission.list = &handler->global_callbacks;
+		emission.current = NULL;
+		signal_emit(&emission, global_cbs, signal, params);
 	}
 
-	pthread_mutex_unlock(&handler->global_callbacks_mutex);
-
-	if (remove_refs) {
+	if (emission.remove_refs) {
 		os_atomic_set_long(&handler->refs,
 				   os_atomic_load_long(&handler->refs) -
-					   remove_refs);
+					   emission.remove_refs);
 	}
 }
 
+const calldata_layout_t *signal_handler_get_layout(signal_handler_t *handler,
+						   const char *signal)
+{
+	struct signal_info *sig;
+
+	if (!handler)
+		return NULL;
+
+	pthread_mutex_lock(&handler->mutex);
+	sig = getsignal(handler, signal);
+	pthread_mutex_unlock(&handler->mutex);
+
+	return sig ? sig->func.layout : NULL;
+}
+
 void signal_handler_connect_global(signal_handler_t *handler,
 				   global_signal_callback_t callback,
 				   void *data)
 {
-	struct global_callback_info cb_data = {callback, data, 0, false};
-	size_t idx;
+	struct signal_callback cb_data = {.global = callback, .data = data};
 
 	if (!handler || !callback)
 		return;
 
-	pthread_mutex_lock(&handler->global_callbacks_mutex);
+	pthread_mutex_lock(&handler->mutex);
 
-	idx = da_find(handler->global_callbacks, &cb_data, 0);
-	if (idx == DARRAY_INVALID)
-		da_push_back(handler->global_callbacks, &cb_data);
+	if (callbacks_find(handler->global_callbacks, &cb_data) ==
+	    DARRAY_INVALID)
+		callbacks_push_back(&handler->global_callbacks, &cb_data);
 
-	pthread_mutex_unlock(&handler->global_callbacks_mutex);
+	pthread_mutex_unlock(&handler->mutex);
 }
 
 void signal_handler_disconnect_global(signal_handler_t *handler,
 				      global_signal_callback_t callback,
 				      void *data)
 {
-	struct global_callback_info cb_data = {callback, data, false};
-	size_t idx;
+	struct signal_callback find = {.global = callback, .data = data};
 
 	if (!handler || !callback)
 		return;
 
-	pthread_mutex_lock(&handler->global_callbacks_mutex);
-
-	idx = da_find(handler->global_callbacks, &cb_data, 0);
-	if (idx != DARRAY_INVALID) {
-		struct global_callback_info *cb =
-			handler->global_callbacks.array + idx;
-
-		if (cb->signaling)
-			cb->remove = true;
-		else
-			da_erase(handler->global_callbacks, idx);
-	}
-
-	pthread_mutex_unlock(&handler->global_callbacks_mutex);
+	disconnect_internal(handler, &handler->global_callbacks, &find);
 }
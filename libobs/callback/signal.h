@@ -78,6 +78,13 @@ EXPORT void signal_handler_remove_current(void);
 EXPORT void signal_handler_signal(signal_handler_t *handler, const char *signal,
 				  calldata_t *params);
 
+/**
+ * Returns the parameter layout of a signal, valid for as long as the signal
+ * handler.  Returns NULL if the signal is not found.
+ */
+EXPORT const calldata_layout_t *
+signal_handler_get_layout(signal_handler_t *handler, const char *signal);
+
 #ifdef __cplusplus
 }
 #endif
@@ -27,6 +27,7 @@
 
 #include "audio-io.h"
 #include "audio-resampler.h"
+#include "audio-mix.h"
 
 extern profiler_name_store_t *obs_get_profiler_name_store(void);
 
@@ -133,17 +134,8 @@ static inline void clamp_audio_output(struct audio_output *audio, size_t bytes)
 		if (!mix->inputs.num)
 			continue;
 
-		for (size_t plane = 0; plane < audio->planes; plane++) {
-			float *mix_data = mix->buffer[plane];
-			float *mix_end = &mix_data[float_size];
-
-			while (mix_data < mix_end) {
-				float val = *mix_data;
-				val = (val > 1.0f) ? 1.0f : val;
-				val = (val < -1.0f) ? -1.0f : val;
-				*(mix_data++) = val;
-			}
-		}
+		for (size_t plane = 0; plane < audio->planes; plane++)
+			clamp_audio_samples(mix->buffer[plane], float_size);
 	}
 }
 
@@ -0,0 +1,74 @@
+/******************************************************************************
+    Copyright (C) 2015 by Hugh Bailey <obs.jim@gmail.com>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+******************************************************************************/
+
+#include "audio-mix.h"
+#include "../util/sse-intrin.h"
+
+/* out[i] += in[i] */
+void mix_audio_samples(float *out, const float *in, size_t count)
+{
+	size_t i = 0;
+
+	for (; i + 8 <= count; i += 8) {
+		__m128 a0 = _mm_loadu_ps(out + i);
+		__m128 a1 = _mm_loadu_ps(out + i + 4);
+		__m128 b0 = _mm_loadu_ps(in + i);
+		__m128 b1 = _mm_loadu_ps(in + i + 4);
+		_mm_storeu_ps(out + i, _mm_add_ps(a0, b0));
+		_mm_storeu_ps(out + i + 4, _mm_add_ps(a1, b1));
+	}
+
+	for (; i < count; i++)
+		out[i] += in[i];
+}
+
+/* out[i] += in[i] * mul[i] */
+void mix_audio_samples_mul(float *out, const float *in, const float *mul,
+			   size_t count)
+{
+	size_t i = 0;
+
+	for (; i + 4 <= count; i += 4) {
+		__m128 v = _mm_mul_ps(_mm_loadu_ps(in + i),
+				      _mm_loadu_ps(mul + i));
+		_mm_storeu_ps(out + i, _mm_add_ps(_mm_loadu_ps(out + i), v));
+	}
+
+	for (; i < count; i++)
+		out[i] += in[i] * mul[i];
+}
+
+/* clamps samples to -1.0..1.0, NaNs are left as they are */
+void clamp_audio_samples(float *data, size_t count)
+{
+	const __m128 min_val = _mm_set1_ps(-1.0f);
+	const __m128 max_val = _mm_set1_ps(1.0f);
+	size_t i = 0;
+
+	/* min/max return the second operand if either one is NaN */
+	for (; i + 4 <= count; i += 4) {
+		__m128 v = _mm_max_ps(min_val, _mm_loadu_ps(data + i));
+		_mm_storeu_ps(data + i, _mm_min_ps(max_val, v));
+	}
+
+	for (; i < count; i++) {
+		float val = data[i];
+		val = (val > 1.0f) ? 1.0f : val;
+		val = (val < -1.0f) ? -1.0f : val;
+		data[i] = val;
+	}
+}
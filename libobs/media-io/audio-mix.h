@@ -0,0 +1,44 @@
+/******************************************************************************
+    Copyright (C) 2015 by Hugh Bailey <obs.jim@gmail.com>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+******************************************************************************/
+
+#pragma once
+
+#include "../util/c99defs.h"
+
+/*
+ * Float sample kernels used by the libobs audio mixers.  These are vectorized
+ * with SSE (via SIMDe on other architectures) in audio-mix.c, so that the
+ * public audio-math.h header doesn't have to pull in the intrinsics headers.
+ */
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* out[i] += in[i] */
+EXPORT void mix_audio_samples(float *out, const float *in, size_t count);
+
+/* out[i] += in[i] * mul[i] */
+EXPORT void mix_audio_samples_mul(float *out, const float *in,
+				  const float *mul, size_t count);
+
+/* clamps samples to -1.0..1.0, NaNs are left as they are */
+EXPORT void clamp_audio_samples(float *data, size_t count);
+
+#ifdef __cplusplus
+}
+#endif
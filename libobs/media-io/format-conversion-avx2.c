@@ -0,0 +1,220 @@
+#include <string.h>
+
+#include "format-conversion-avx2.h"
+
+#ifdef FORMAT_CONVERSION_AVX2
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#define AVX2_TARGET
+#else
+#include <immintrin.h>
+#define AVX2_TARGET __attribute__((target("avx2")))
+#endif
+
+#ifdef _MSC_VER
+static bool detect_avx2(void)
+{
+	int info[4];
+
+	__cpuid(info, 0);
+	if (info[0] < 7)
+		return false;
+
+	/* OSXSAVE and AVX, then make sure the OS saves the YMM state */
+	__cpuid(info, 1);
+	if ((info[2] & (1 << 27)) == 0 || (info[2] & (1 << 28)) == 0)
+		return false;
+	if ((_xgetbv(0) & 6) != 6)
+		return false;
+
+	__cpuidex(info, 7, 0);
+	return (info[1] & (1 << 5)) != 0;
+}
+
+bool format_conversion_avx2_available(void)
+{
+	static int avx2 = -1;
+
+	if (avx2 == -1)
+		avx2 = detect_avx2();
+	return avx2 == 1;
+}
+#else
+bool format_conversion_avx2_available(void)
+{
+	return __builtin_cpu_supports("avx2");
+}
+#endif
+
+static FORCE_INLINE uint32_t min_uint32(uint32_t a, uint32_t b)
+{
+	return a < b ? a : b;
+}
+
+/* extracts one byte of each of the 8 UYVX pixels of two lines and writes
+ * them as 8 bytes to each of the two output lines */
+#define pack_shift_avx2(plane, pos0, pos1, line1, line2, mask, sh, order)     \
+	do {                                                                   \
+		__m256i pack_val = _mm256_packs_epi32(                         \
+			_mm256_and_si256(_mm256_srli_epi32(line1, sh), mask),  \
+			_mm256_and_si256(_mm256_srli_epi32(line2, sh), mask)); \
+		pack_val = _mm256_packus_epi16(pack_val, pack_val);            \
+		pack_val = _mm256_permutevar8x32_epi32(pack_val, order);       \
+		__m128i pack_lo = _mm256_castsi256_si128(pack_val);            \
+                                                                               \
+		_mm_storel_epi64((__m128i *)(plane + pos0), pack_lo);          \
+		_mm_storel_epi64((__m128i *)(plane + pos1),                    \
+				 _mm_srli_si128(pack_lo, 8));                  \
+	} while (false)
+
+/* averages the chroma of 8 UYVX pixels of two lines down to 4 UV pairs,
+ * returned as 8 interleaved UV bytes in the low 64 bits */
+static FORCE_INLINE AVX2_TARGET __m128i avg_ch_avx2(__m256i line1,
+						   __m256i line2,
+						   __m256i uv_mask)
+{
+	__m256i add_val = _mm256_add_epi16(_mm256_and_si256(line1, uv_mask),
+					   _mm256_and_si256(line2, uv_mask));
+	__m256i avg_val = _mm256_add_epi16(
+		add_val, _mm256_shuffle_epi32(add_val, _MM_SHUFFLE(2, 3, 0, 1)));
+	avg_val = _mm256_srai_epi16(avg_val, 2);
+	avg_val = _mm256_shuffle_epi32(avg_val, _MM_SHUFFLE(3, 1, 2, 0));
+	avg_val = _mm256_permute4x64_epi64(avg_val, _MM_SHUFFLE(3, 1, 2, 0));
+
+	__m128i uv = _mm256_castsi256_si128(avg_val);
+	return _mm_packus_epi16(uv, uv);
+}
+
+uint32_t AVX2_TARGET compress_uyvx_to_i420_avx2(
+	const uint8_t *input, uint32_t in_linesize, uint32_t start_y,
+	uint32_t end_y, uint8_t *output[], const uint32_t out_linesize[])
+{
+	uint8_t *lum_plane = output[0];
+	uint8_t *u_plane = output[1];
+	uint8_t *v_plane = output[2];
+	uint32_t width = min_uint32(in_linesize, out_linesize[0]) & ~7;
+	uint32_t y;
+
+	__m256i lum_mask = _mm256_set1_epi32(0x000000FF);
+	__m256i uv_mask = _mm256_set1_epi32(0x00FF00FF);
+	__m256i order = _mm256_setr_epi32(0, 4, 1, 5, 0, 4, 1, 5);
+	__m128i uv_split = _mm_setr_epi8(0, 2, 4, 6, 1, 3, 5, 7, 0, 0, 0, 0, 0,
+					 0, 0, 0);
+
+	for (y = start_y; y < end_y; y += 2) {
+		uint32_t y_pos = y * in_linesize;
+		uint32_t chroma_y_pos = (y >> 1) * out_linesize[1];
+		uint32_t lum_y_pos = y * out_linesize[0];
+		uint32_t x;
+
+		for (x = 0; x < width; x += 8) {
+			const uint8_t *img = input + y_pos + x * 4;
+			uint32_t lum_pos0 = lum_y_pos + x;
+			uint32_t lum_pos1 = lum_pos0 + out_linesize[0];
+			uint32_t chroma_pos = chroma_y_pos + (x >> 1);
+
+			__m256i line1 =
+				_mm256_loadu_si256((const __m256i *)img);
+			__m256i line2 = _mm256_loadu_si256(
+				(const __m256i *)(img + in_linesize));
+
+			pack_shift_avx2(lum_plane, lum_pos0, lum_pos1, line1,
+					line2, lum_mask, 8, order);
+
+			__m128i uv = _mm_shuffle_epi8(
+				avg_ch_avx2(line1, line2, uv_mask), uv_split);
+			uint32_t u = (uint32_t)_mm_cvtsi128_si32(uv);
+			uint32_t v = (uint32_t)_mm_cvtsi128_si32(
+				_mm_srli_si128(uv, 4));
+
+			/* chroma lines of odd block counts aren't aligned */
+			memcpy(u_plane + chroma_pos, &u, sizeof(u));
+			memcpy(v_plane + chroma_pos, &v, sizeof(v));
+		}
+	}
+
+	return width;
+}
+
+uint32_t AVX2_TARGET compress_uyvx_to_nv12_avx2(
+	const uint8_t *input, uint32_t in_linesize, uint32_t start_y,
+	uint32_t end_y, uint8_t *output[], const uint32_t out_linesize[])
+{
+	uint8_t *lum_plane = output[0];
+	uint8_t *chroma_plane = output[1];
+	uint32_t width = min_uint32(in_linesize, out_linesize[0]) & ~7;
+	uint32_t y;
+
+	__m256i lum_mask = _mm256_set1_epi32(0x000000FF);
+	__m256i uv_mask = _mm256_set1_epi32(0x00FF00FF);
+	__m256i order = _mm256_setr_epi32(0, 4, 1, 5, 0, 4, 1, 5);
+
+	for (y = start_y; y < end_y; y += 2) {
+		uint32_t y_pos = y * in_linesize;
+		uint32_t chroma_y_pos = (y >> 1) * out_linesize[1];
+		uint32_t lum_y_pos = y * out_linesize[0];
+		uint32_t x;
+
+		for (x = 0; x < width; x += 8) {
+			const uint8_t *img = input + y_pos + x * 4;
+			uint32_t lum_pos0 = lum_y_pos + x;
+			uint32_t lum_pos1 = lum_pos0 + out_linesize[0];
+
+			__m256i line1 =
+				_mm256_loadu_si256((const __m256i *)img);
+			__m256i line2 = _mm256_loadu_si256(
+				(const __m256i *)(img + in_linesize));
+
+			pack_shift_avx2(lum_plane, lum_pos0, lum_pos1, line1,
+					line2, lum_mask, 8, order);
+			_mm_storel_epi64(
+				(__m128i *)(chroma_plane + chroma_y_pos + x),
+				avg_ch_avx2(line1, line2, uv_mask));
+		}
+	}
+
+	return width;
+}
+
+uint32_t AVX2_TARGET convert_uyvx_to_i444_avx2(
+	const uint8_t *input, uint32_t in_linesize, uint32_t start_y,
+	uint32_t end_y, uint8_t *output[], const uint32_t out_linesize[])
+{
+	uint8_t *lum_plane = output[0];
+	uint8_t *u_plane = output[1];
+	uint8_t *v_plane = output[2];
+	uint32_t width = min_uint32(in_linesize, out_linesize[0]) & ~7;
+	uint32_t y;
+
+	__m256i mask = _mm256_set1_epi32(0x000000FF);
+	__m256i order = _mm256_setr_epi32(0, 4, 1, 5, 0, 4, 1, 5);
+
+	for (y = start_y; y < end_y; y += 2) {
+		uint32_t y_pos = y * in_linesize;
+		uint32_t lum_y_pos = y * out_linesize[0];
+		uint32_t x;
+
+		for (x = 0; x < width; x += 8) {
+			const uint8_t *img = input + y_pos + x * 4;
+			uint32_t lum_pos0 = lum_y_pos + x;
+			uint32_t lum_pos1 = lum_pos0 + out_linesize[0];
+
+			__m256i line1 =
+				_mm256_loadu_si256((const __m256i *)img);
+			__m256i line2 = _mm256_loadu_si256(
+				(const __m256i *)(img + in_linesize));
+
+			pack_shift_avx2(lum_plane, lum_pos0, lum_pos1, line1,
+					line2, mask, 8, order);
+			pack_shift_avx2(u_plane, lum_pos0, lum_pos1, line1,
+					line2, mask, 0, order);
+			pack_shift_avx2(v_plane, lum_pos0, lum_pos1, line1,
+					line2, mask, 16, order);
+		}
+	}
+
+	return width;
+}
+
+#endif
@@ -0,0 +1,50 @@
+#pragma once
+
+#include "../util/c99defs.h"
+
+/*
+ * AVX2 versions of the packed 444 YUV conversions.  These are built for x86
+ * regardless of the compiler's baseline instruction set and selected at
+ * runtime.  Other architectures keep using the SSE2 code, which SIMDe maps
+ * to NEON/VSX.
+ *
+ * The kernels only process whole blocks of 8 pixels and return the number
+ * of pixels per line they handled; the caller converts the remainder.
+ */
+
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || \
+	defined(_M_IX86)
+#define FORMAT_CONVERSION_AVX2
+#endif
+
+#ifdef FORMAT_CONVERSION_AVX2
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+extern bool format_conversion_avx2_available(void);
+
+extern uint32_t compress_uyvx_to_i420_avx2(const uint8_t *input,
+					   uint32_t in_linesize,
+					   uint32_t start_y, uint32_t end_y,
+					   uint8_t *output[],
+					   const uint32_t out_linesize[]);
+
+extern uint32_t compress_uyvx_to_nv12_avx2(const uint8_t *input,
+					   uint32_t in_linesize,
+					   uint32_t start_y, uint32_t end_y,
+					   uint8_t *output[],
+					   const uint32_t out_linesize[]);
+
+extern uint32_t convert_uyvx_to_i444_avx2(const uint8_t *input,
+					  uint32_t in_linesize,
+					  uint32_t start_y, uint32_t end_y,
+					  uint8_t *output[],
+					  const uint32_t out_linesize[]);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -16,8 +16,10 @@
 ******************************************************************************/
 
 #include "format-conversion.h"
+#include "format-conversion-avx2.h"
 
 #include "../util/sse-intrin.h"
+#include "../util/threading.h"
 
 /* ...surprisingly, if I don't use a macro to force inlining, it causes the
  * CPU usage to boost by a tremendous amount in debug builds. */
@@ -90,6 +92,32 @@ static FORCE_INLINE uint32_t min_uint32(uint32_t a, uint32_t b)
 	return a < b ? a : b;
 }
 
+static volatile long conversion_path = FORMAT_CONVERSION_PATH_AUTO;
+
+bool format_conversion_set_path(enum format_conversion_path path)
+{
+#ifdef FORMAT_CONVERSION_AVX2
+	if (path == FORMAT_CONVERSION_PATH_AVX2 &&
+	    !format_conversion_avx2_available())
+		return false;
+#else
+	if (path == FORMAT_CONVERSION_PATH_AVX2)
+		return false;
+#endif
+
+	os_atomic_set_long(&conversion_path, (long)path);
+	return true;
+}
+
+#ifdef FORMAT_CONVERSION_AVX2
+static inline bool use_avx2(void)
+{
+	return os_atomic_load_long(&conversion_path) !=
+		       FORMAT_CONVERSION_PATH_SSE2 &&
+	       format_conversion_avx2_available();
+}
+#endif
+
 void compress_uyvx_to_i420(const uint8_t *input, uint32_t in_linesize,
 			   uint32_t start_y, uint32_t end_y, uint8_t *output[],
 			   const uint32_t out_linesize[])
@@ -98,18 +126,26 @@ void compress_uyvx_to_i420(const uint8_t *input, uint32_t in_linesize,
 	uint8_t *u_plane = output[1];
 	uint8_t *v_plane = output[2];
 	uint32_t width = min_uint32(in_linesize, out_linesize[0]);
+	uint32_t x_start = 0;
 	uint32_t y;
 
 	__m128i lum_mask = _mm_set1_epi32(0x0000FF00);
 	__m128i uv_mask = _mm_set1_epi16(0x00FF);
 
+#ifdef FORMAT_CONVERSION_AVX2
+	if (use_avx2())
+		x_start = compress_uyvx_to_i420_avx2(
+			input, in_linesize, start_y, end_y, output,
+			out_linesize);
+#endif
+
 	for (y = start_y; y < end_y; y += 2) {
 		uint32_t y_pos = y * in_linesize;
 		uint32_t chroma_y_pos = (y >> 1) * out_linesize[1];
 		uint32_t lum_y_pos = y * out_linesize[0];
 		uint32_t x;
 
-		for (x = 0; x < width; x += 4) {
+		for (x = x_start; x < width; x += 4) {
 			const uint8_t *img = input + y_pos + x * 4;
 			uint32_t lum_pos0 = lum_y_pos + x;
 			uint32_t lum_pos1 = lum_pos0 + out_linesize[0];
@@ -134,18 +170,26 @@ void compress_uyvx_to_nv12(const uint8_t *input, uint32_t in_linesize,
 	uint8_t *lum_plane = output[0];
 	uint8_t *chroma_plane = output[1];
 	uint32_t width = min_uint32(in_linesize, out_linesize[0]);
+	uint32_t x_start = 0;
 	uint32_t y;
 
 	__m128i lum_mask = _mm_set1_epi32(0x0000FF00);
 	__m128i uv_mask = _mm_set1_epi16(0x00FF);
 
+#ifdef FORMAT_CONVERSION_AVX2
+	if (use_avx2())
+		x_start = compress_uyvx_to_nv12_avx2(
+			input, in_linesize, start_y, end_y, output,
+			out_linesize);
+#endif
+
 	for (y = start_y; y < end_y; y += 2) {
 		uint32_t y_pos = y * in_linesize;
 		uint32_t chroma_y_pos = (y >> 1) * out_linesize[1];
 		uint32_t lum_y_pos = y * out_linesize[0];
 		uint32_t x;
 
-		for (x = 0; x < width; x += 4) {
+		for (x = x_start; x < width; x += 4) {
 			const uint8_t *img = input + y_pos + x * 4;
 			uint32_t lum_pos0 = lum_y_pos + x;
 			uint32_t lum_pos1 = lum_pos0 + out_linesize[0];
@@ -170,18 +214,26 @@ void convert_uyvx_to_i444(const uint8_t *input, uint32_t in_linesize,
 	uint8_t *u_plane = output[1];
 	uint8_t *v_plane = output[2];
 	uint32_t width = min_uint32(in_linesize, out_linesize[0]);
+	uint32_t x_start = 0;
 	uint32_t y;
 
 	__m128i lum_mask = _mm_set1_epi32(0x0000FF00);
 	__m128i u_mask = _mm_set1_epi32(0x000000FF);
 	__m128i v_mask = _mm_set1_epi32(0x00FF0000);
 
+#ifdef FORMAT_CONVERSION_AVX2
+	if (use_avx2())
+		x_start = convert_uyvx_to_i444_avx2(
+			input, in_linesize, start_y, end_y, output,
+			out_linesize);
+#endif
+
 	for (y = start_y; y < end_y; y += 2) {
 		uint32_t y_pos = y * in_linesize;
 		uint32_t lum_y_pos = y * out_linesize[0];
 		uint32_t x;
 
-		for (x = 0; x < width; x += 4) {
+		for (x = x_start; x < width; x += 4) {
 			const uint8_t *img = input + y_pos + x * 4;
 			uint32_t lum_pos0 = lum_y_pos + x;
 			uint32_t lum_pos1 = lum_pos0 + out_linesize[0];
@@ -200,10 +252,31 @@ void convert_uyvx_to_i444(const uint8_t *input, uint32_t in_linesize,
 	}
 }
 
+/* writes 16 pixels of one line as packed 444, duplicating each of the 8
+ * chroma values (given as 16 bit U << 8 | V) horizontally */
+#define unpack_lum_420(out, lum, uv)                                           \
+	do {                                                                   \
+		__m128i lum_val = _mm_loadu_si128((const __m128i *)lum);       \
+		__m128i uv_lo = _mm_unpacklo_epi16(uv, uv);                    \
+		__m128i uv_hi = _mm_unpackhi_epi16(uv, uv);                    \
+		__m128i lum_lo = _mm_unpacklo_epi8(lum_val, zero);             \
+		__m128i lum_hi = _mm_unpackhi_epi8(lum_val, zero);             \
+                                                                               \
+		_mm_storeu_si128((__m128i *)(out),                             \
+				 _mm_unpacklo_epi16(uv_lo, lum_lo));           \
+		_mm_storeu_si128((__m128i *)(out + 4),                         \
+				 _mm_unpackhi_epi16(uv_lo, lum_lo));           \
+		_mm_storeu_si128((__m128i *)(out + 8),                         \
+				 _mm_unpacklo_epi16(uv_hi, lum_hi));           \
+		_mm_storeu_si128((__m128i *)(out + 12),                        \
+				 _mm_unpackhi_epi16(uv_hi, lum_hi));           \
+	} while (false)
+
 void decompress_420(const uint8_t *const input[], const uint32_t in_linesize[],
 		    uint32_t start_y, uint32_t end_y, uint8_t *output,
 		    uint32_t out_linesize)
 {
+	__m128i zero = _mm_setzero_si128();
 	uint32_t start_y_d2 = start_y / 2;
 	uint32_t width_d2 = in_linesize[0] / 2;
 	uint32_t height_d2 = end_y / 2;
@@ -221,7 +294,25 @@ void decompress_420(const uint8_t *const input[], const uint32_t in_linesize[],
 		output0 = (uint32_t *)(output + y * 2 * out_linesize);
 		output1 = (uint32_t *)((uint8_t *)output0 + out_linesize);
 
-		for (x = 0; x < width_d2; x++) {
+		for (x = 0; x + 8 <= width_d2; x += 8) {
+			__m128i u = _mm_unpacklo_epi8(
+				_mm_loadl_epi64((const __m128i *)chroma0), zero);
+			__m128i v = _mm_unpacklo_epi8(
+				_mm_loadl_epi64((const __m128i *)chroma1), zero);
+			__m128i uv = _mm_or_si128(_mm_slli_epi16(u, 8), v);
+
+			unpack_lum_420(output0, lum0, uv);
+			unpack_lum_420(output1, lum1, uv);
+
+			chroma0 += 8;
+			chroma1 += 8;
+			lum0 += 16;
+			lum1 += 16;
+			output0 += 16;
+			output1 += 16;
+		}
+
+		for (; x < width_d2; x++) {
 			uint32_t out;
 			out = (*(chroma0++) << 8) | *(chroma1++);
 
@@ -234,10 +325,36 @@ void decompress_420(const uint8_t *const input[], const uint32_t in_linesize[],
 	}
 }
 
+/* writes 16 pixels of one line as packed 444, duplicating each of the 8
+ * interleaved UV pairs horizontally */
+#define unpack_lum_nv12(out, lum, u, v)                                        \
+	do {                                                                   \
+		__m128i lum_val = _mm_loadu_si128((const __m128i *)lum);       \
+		__m128i lum_lo = _mm_or_si128(                                 \
+			_mm_unpacklo_epi8(lum_val, zero),                      \
+			_mm_slli_epi16(_mm_unpacklo_epi16(u, u), 8));          \
+		__m128i lum_hi = _mm_or_si128(                                 \
+			_mm_unpackhi_epi8(lum_val, zero),                      \
+			_mm_slli_epi16(_mm_unpackhi_epi16(u, u), 8));          \
+		__m128i v_lo = _mm_unpacklo_epi16(v, v);                       \
+		__m128i v_hi = _mm_unpackhi_epi16(v, v);                       \
+                                                                               \
+		_mm_storeu_si128((__m128i *)(out),                             \
+				 _mm_unpacklo_epi16(lum_lo, v_lo));            \
+		_mm_storeu_si128((__m128i *)(out + 4),                         \
+				 _mm_unpackhi_epi16(lum_lo, v_lo));            \
+		_mm_storeu_si128((__m128i *)(out + 8),                         \
+				 _mm_unpacklo_epi16(lum_hi, v_hi));            \
+		_mm_storeu_si128((__m128i *)(out + 12),                        \
+				 _mm_unpackhi_epi16(lum_hi, v_hi));            \
+	} while (false)
+
 void decompress_nv12(const uint8_t *const input[], const uint32_t in_linesize[],
 		     uint32_t start_y, uint32_t end_y, uint8_t *output,
 		     uint32_t out_linesize)
 {
+	__m128i zero = _mm_setzero_si128();
+	__m128i u_mask = _mm_set1_epi16(0x00FF);
 	uint32_t start_y_d2 = start_y / 2;
 	uint32_t width_d2 = min_uint32(in_linesize[0], out_linesize) / 2;
 	uint32_t height_d2 = end_y / 2;
@@ -255,7 +372,22 @@ void decompress_nv12(const uint8_t *const input[], const uint32_t in_linesize[],
 		output0 = (uint32_t *)(output + y * 2 * out_linesize);
 		output1 = (uint32_t *)((uint8_t *)output0 + out_linesize);
 
-		for (x = 0; x < width_d2; x++) {
+		for (x = 0; x + 8 <= width_d2; x += 8) {
+			__m128i uv = _mm_loadu_si128((const __m128i *)chroma);
+			__m128i u = _mm_and_si128(uv, u_mask);
+			__m128i v = _mm_srli_epi16(uv, 8);
+
+			unpack_lum_nv12(output0, lum0, u, v);
+			unpack_lum_nv12(output1, lum1, u, v);
+
+			chroma += 8;
+			lum0 += 16;
+			lum1 += 16;
+			output0 += 16;
+			output1 += 16;
+		}
+
+		for (; x < width_d2; x++) {
 			uint32_t out = *(chroma++) << 8;
 
 			*(output0++) = *(lum0++) | out;
@@ -278,12 +410,33 @@ void decompress_422(const uint8_t *input, uint32_t in_linesize,
 	register const uint32_t *input32_end;
 	register uint32_t *output32;
 
+	__m128i lum_mask = _mm_set1_epi32(0xFF);
+
 	if (leading_lum) {
+		__m128i keep_mask = _mm_set1_epi32((int)0xFFFFFF00);
+
 		for (y = start_y; y < end_y; y++) {
 			input32 = (const uint32_t *)(input + y * in_linesize);
 			input32_end = input32 + width_d2;
 			output32 = (uint32_t *)(output + y * out_linesize);
 
+			while (input32 + 4 <= input32_end) {
+				__m128i dw = _mm_loadu_si128(
+					(const __m128i *)input32);
+				__m128i dw2 = _mm_or_si128(
+					_mm_and_si128(dw, keep_mask),
+					_mm_and_si128(_mm_srli_epi32(dw, 16),
+						      lum_mask));
+
+				_mm_storeu_si128((__m128i *)output32,
+						 _mm_unpacklo_epi32(dw, dw2));
+				_mm_storeu_si128((__m128i *)(output32 + 4),
+						 _mm_unpackhi_epi32(dw, dw2));
+
+				output32 += 8;
+				input32 += 4;
+			}
+
 			while (input32 < input32_end) {
 				register uint32_t dw = *input32;
 
@@ -297,11 +450,31 @@ void decompress_422(const uint8_t *input, uint32_t in_linesize,
 			}
 		}
 	} else {
+		__m128i keep_mask = _mm_set1_epi32((int)0xFFFF00FF);
+		lum_mask = _mm_set1_epi32(0xFF00);
+
 		for (y = start_y; y < end_y; y++) {
 			input32 = (const uint32_t *)(input + y * in_linesize);
 			input32_end = input32 + width_d2;
 			output32 = (uint32_t *)(output + y * out_linesize);
 
+			while (input32 + 4 <= input32_end) {
+				__m128i dw = _mm_loadu_si128(
+					(const __m128i *)input32);
+				__m128i dw2 = _mm_or_si128(
+					_mm_and_si128(dw, keep_mask),
+					_mm_and_si128(_mm_srli_epi32(dw, 16),
+						      lum_mask));
+
+				_mm_storeu_si128((__m128i *)output32,
+						 _mm_unpacklo_epi32(dw, dw2));
+				_mm_storeu_si128((__m128i *)(output32 + 4),
+						 _mm_unpackhi_epi32(dw, dw2));
+
+				output32 += 8;
+				input32 += 4;
+			}
+
 			while (input32 < input32_end) {
 				register uint32_t dw = *input32;
 
@@ -56,6 +56,20 @@ EXPORT void decompress_422(const uint8_t *input, uint32_t in_linesize,
 			   uint32_t start_y, uint32_t end_y, uint8_t *output,
 			   uint32_t out_linesize, bool leading_lum);
 
+/*
+ * Instruction set used by the conversions above.  The default picks the best
+ * one the CPU supports; the others are meant for tests and benchmarks.
+ * Returns false if the CPU doesn't support the requested one.
+ */
+
+enum format_conversion_path {
+	FORMAT_CONVERSION_PATH_AUTO,
+	FORMAT_CONVERSION_PATH_SSE2,
+	FORMAT_CONVERSION_PATH_AVX2,
+};
+
+EXPORT bool format_conversion_set_path(enum format_conversion_path path);
+
 #ifdef __cplusplus
 }
 #endif
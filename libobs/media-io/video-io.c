@@ -34,28 +34,73 @@ extern profiler_name_store_t *obs_get_profiler_name_store(void);
 #define MAX_CONVERT_BUFFERS 3
 #define MAX_CACHE_SIZE 16
 
+/* number of frames an input may have queued before it starts duplicating
+ * frames.  must be a power of two. */
+#define INPUT_QUEUE_SIZE 2
+
 struct cached_frame_info {
 	struct video_data frame;
 	int skipped;
 	int count;
+	uint64_t id;
+
+	/* in_use is set while the frame is being rendered, waiting to be
+	 * dispatched, or referenced by at least one input */
+	volatile bool in_use;
+	volatile long refs;
 };
 
-struct video_input {
+struct video_input_entry {
+	struct cached_frame_info *frame_info;
+	uint64_t timestamp;
+
+	/* frames dropped right after this one because the queue was full,
+	 * replaced by repeats of this frame at their own timestamps */
+	long duplicates;
+};
+
+struct scaled_frame {
+	struct video_frame frame;
+	uint64_t frame_id;
+	uint64_t last_used;
+	long refs;
+};
+
+/* inputs with identical conversion parameters share one scaler and its
+ * output frames, so each cached frame is only scaled once per conversion */
+struct video_scaler_group {
 	struct video_scale_info conversion;
 	video_scaler_t *scaler;
-	struct video_frame frame[MAX_CONVERT_BUFFERS];
-	int cur_frame;
+
+	pthread_mutex_t mutex;
+	DARRAY(struct scaled_frame *) frames;
+	uint64_t use_count;
+	long refs;
+};
+
+struct video_input {
+	struct video_scale_info conversion;
+	struct video_scaler_group *scaler_group;
+	struct scaled_frame *scaled;
 
 	void (*callback)(void *param, struct video_data *frame);
 	void *param;
-};
 
-static inline void video_input_free(struct video_input *input)
-{
-	for (size_t i = 0; i < MAX_CONVERT_BUFFERS; i++)
-		video_frame_free(&input->frame[i]);
-	video_scaler_destroy(input->scaler);
-}
+	/* single producer (video thread), single consumer (input thread).
+	 * pushing is lock free, queue_mutex keeps the last entry from being
+	 * popped while a dropped frame is counted on it */
+	struct video_input_entry queue[INPUT_QUEUE_SIZE];
+	volatile long queue_head;
+	volatile long queue_tail;
+	pthread_mutex_t queue_mutex;
+
+	struct video_output *video;
+	pthread_t thread;
+	os_sem_t *update_semaphore;
+	volatile bool stop;
+	volatile bool exited;
+	bool thread_created;
+};
 
 struct video_output {
 	struct video_output_info info;
@@ -72,11 +117,21 @@ struct video_output {
 	bool initialized;
 
 	pthread_mutex_t input_mutex;
-	DARRAY(struct video_input) inputs;
-
-	size_t available_frames;
-	size_t first_added;
+	DARRAY(struct video_input *) inputs;
+	DARRAY(struct video_scaler_group *) scaler_groups;
+
+	/* inputs that disconnected from within their own callback, joined
+	 * and freed once their threads have exited */
+	DARRAY(struct video_input *) stopped_inputs;
+
+	/* frames ready to be dispatched to inputs, in order */
+	size_t ready[MAX_CACHE_SIZE];
+	size_t ready_first;
+	size_t ready_count;
+	size_t locked_idx;
 	size_t last_added;
+	int missed_frames;
+	uint64_t frame_id;
 	struct cached_frame_info cache[MAX_CACHE_SIZE];
 
 	volatile bool raw_active;
@@ -85,89 +140,455 @@ struct video_output {
 
 /* ------------------------------------------------------------------------- */
 
+static inline void release_frame(struct cached_frame_info *frame_info)
+{
+	if (os_atomic_dec_long(&frame_info->refs) == 0)
+		os_atomic_set_bool(&frame_info->in_use, false);
+}
+
+static inline bool input_queue_push(struct video_input *input,
+				    struct cached_frame_info *frame_info,
+				    uint64_t timestamp)
+{
+	long head = os_atomic_load_long(&input->queue_head);
+	long tail = os_atomic_load_long(&input->queue_tail);
+	struct video_input_entry *entry;
+
+	if (tail - head == INPUT_QUEUE_SIZE)
+		return false;
+
+	os_atomic_inc_long(&frame_info->refs);
+
+	entry = &input->queue[tail & (INPUT_QUEUE_SIZE - 1)];
+	entry->frame_info = frame_info;
+	entry->timestamp = timestamp;
+	entry->duplicates = 0;
+
+	os_atomic_set_long(&input->queue_tail, tail + 1);
+	os_sem_post(input->update_semaphore);
+	return true;
+}
+
+/* if the queue is full, the frame is dropped and counted on the newest
+ * entry, which the consumer then repeats in its place */
+static inline bool input_queue_push_or_drop(struct video_input *input,
+					    struct cached_frame_info *frame_info,
+					    uint64_t timestamp)
+{
+	bool pushed;
+	long tail;
+
+	if (input_queue_push(input, frame_info, timestamp))
+		return true;
+
+	pthread_mutex_lock(&input->queue_mutex);
+
+	/* the consumer may have made room in the meantime */
+	pushed = input_queue_push(input, frame_info, timestamp);
+	if (!pushed) {
+		tail = os_atomic_load_long(&input->queue_tail);
+		input->queue[(tail - 1) & (INPUT_QUEUE_SIZE - 1)].duplicates++;
+	}
+
+	pthread_mutex_unlock(&input->queue_mutex);
+	return pushed;
+}
+
+static inline bool input_queue_pop(struct video_input *input,
+				   struct video_input_entry *entry)
+{
+	long head, tail;
+	bool popped = false;
+
+	pthread_mutex_lock(&input->queue_mutex);
+
+	head = os_atomic_load_long(&input->queue_head);
+	tail = os_atomic_load_long(&input->queue_tail);
+
+	if (head != tail) {
+		*entry = input->queue[head & (INPUT_QUEUE_SIZE - 1)];
+		os_atomic_set_long(&input->queue_head, head + 1);
+		popped = true;
+	}
+
+	pthread_mutex_unlock(&input->queue_mutex);
+	return popped;
+}
+
+static inline bool
+video_scale_info_equal(const struct video_scale_info *a,
+		       const struct video_scale_info *b)
+{
+	return a->format == b->format && a->width == b->width &&
+	       a->height == b->height && a->range == b->range &&
+	       a->colorspace == b->colorspace;
+}
+
+static void video_scaler_group_destroy(struct video_scaler_group *group)
+{
+	for (size_t i = 0; i < group->frames.num; i++) {
+		video_frame_free(&group->frames.array[i]->frame);
+		bfree(group->frames.array[i]);
+	}
+	da_free(group->frames);
+
+	video_scaler_destroy(group->scaler);
+	pthread_mutex_destroy(&group->mutex);
+	bfree(group);
+}
+
+static struct video_scaler_group *
+video_scaler_group_create(struct video_output *video,
+			  const struct video_scale_info *conversion)
+{
+	struct video_scaler_group *group;
+	struct video_scale_info from = {.format = video->info.format,
+					.width = video->info.width,
+					.height = video->info.height,
+					.range = video->info.range,
+					.colorspace = video->info.colorspace};
+	int ret;
+
+	group = bzalloc(sizeof(*group));
+	group->conversion = *conversion;
+
+	if (pthread_mutex_init(&group->mutex, NULL) != 0) {
+		bfree(group);
+		return NULL;
+	}
+
+	ret = video_scaler_create(&group->scaler, &group->conversion, &from,
+				  VIDEO_SCALE_FAST_BILINEAR);
+	if (ret != VIDEO_SCALER_SUCCESS) {
+		if (ret == VIDEO_SCALER_BAD_CONVERSION)
+			blog(LOG_ERROR, "video_input_init: Bad "
+					"scale conversion type");
+		else
+			blog(LOG_ERROR, "video_input_init: Failed to "
+					"create scaler");
+
+		video_scaler_group_destroy(group);
+		return NULL;
+	}
+
+	return group;
+}
+
+/* must be called with the input mutex locked */
+static struct video_scaler_group *
+video_scaler_group_get(struct video_output *video,
+		       const struct video_scale_info *conversion)
+{
+	struct video_scaler_group *group;
+
+	for (size_t i = 0; i < video->scaler_groups.num; i++) {
+		group = video->scaler_groups.array[i];
+
+		if (video_scale_info_equal(&group->conversion, conversion)) {
+			group->refs++;
+			return group;
+		}
+	}
+
+	group = video_scaler_group_create(video, conversion);
+	if (group) {
+		group->refs = 1;
+		da_push_back(video->scaler_groups, &group);
+	}
+
+	return group;
+}
+
+static void video_scaler_group_release(struct video_output *video,
+				       struct video_scaler_group *group)
+{
+	if (!group)
+		return;
+
+	pthread_mutex_lock(&video->input_mutex);
+
+	if (--group->refs == 0) {
+		da_erase_item(video->scaler_groups, &group);
+		video_scaler_group_destroy(group);
+	}
+
+	pthread_mutex_unlock(&video->input_mutex);
+}
+
+/* returns the scaled version of a cached frame, scaling it only if no other
+ * input of this group has scaled it already.  finished frames are kept
+ * around (least recently used first) for at least MAX_CONVERT_BUFFERS
+ * frames. */
+static struct scaled_frame *
+video_scaler_group_scale(struct video_scaler_group *group,
+			 const struct cached_frame_info *frame_info)
+{
+	struct scaled_frame *scaled = NULL;
+	struct scaled_frame *oldest = NULL;
+	size_t free_frames = 0;
+
+	pthread_mutex_lock(&group->mutex);
+
+	for (size_t i = 0; i < group->frames.num; i++) {
+		struct scaled_frame *cur = group->frames.array[i];
+
+		if (cur->frame_id == frame_info->id) {
+			scaled = cur;
+			break;
+		}
+		if (cur->refs == 0) {
+			if (!oldest || cur->last_used < oldest->last_used)
+				oldest = cur;
+			free_frames++;
+		}
+	}
+
+	if (!scaled) {
+		if (!oldest || free_frames < MAX_CONVERT_BUFFERS) {
+			oldest = bzalloc(sizeof(*oldest));
+			video_frame_init(&oldest->frame,
+					 group->conversion.format,
+					 group->conversion.width,
+					 group->conversion.height);
+			da_push_back(group->frames, &oldest);
+		}
+
+		scaled = oldest;
+		scaled->frame_id = 0;
+
+		if (!video_scaler_scale(group->scaler, scaled->frame.data,
+					scaled->frame.linesize,
+					(const uint8_t *const *)frame_info
+						->frame.data,
+					frame_info->frame.linesize)) {
+			blog(LOG_WARNING, "video-io: Could not scale frame!");
+			scaled = NULL;
+		} else {
+			scaled->frame_id = frame_info->id;
+		}
+	}
+
+	if (scaled) {
+		scaled->refs++;
+		scaled->last_used = ++group->use_count;
+	}
+
+	pthread_mutex_unlock(&group->mutex);
+
+	return scaled;
+}
+
+static inline void video_scaler_group_unref(struct video_scaler_group *group,
+					    struct scaled_frame *scaled)
+{
+	pthread_mutex_lock(&group->mutex);
+	scaled->refs--;
+	pthread_mutex_unlock(&group->mutex);
+}
+
+static inline void video_input_free(struct video_input *input)
+{
+	struct video_input_entry entry;
+
+	while (input_queue_pop(input, &entry))
+		release_frame(entry.frame_info);
+
+	video_scaler_group_release(input->video, input->scaler_group);
+	os_sem_destroy(input->update_semaphore);
+	pthread_mutex_destroy(&input->queue_mutex);
+	bfree(input);
+}
+
 static inline bool scale_video_output(struct video_input *input,
+				      const struct cached_frame_info *frame_info,
 				      struct video_data *data)
 {
-	bool success = true;
+	struct scaled_frame *scaled;
 
-	if (input->scaler) {
-		struct video_frame *frame;
+	if (!input->scaler_group)
+		return true;
 
-		if (++input->cur_frame == MAX_CONVERT_BUFFERS)
-			input->cur_frame = 0;
+	scaled = video_scaler_group_scale(input->scaler_group, frame_info);
+	if (!scaled)
+		return false;
 
-		frame = &input->frame[input->cur_frame];
+	for (size_t i = 0; i < MAX_AV_PLANES; i++) {
+		data->data[i] = scaled->frame.data[i];
+		data->linesize[i] = scaled->frame.linesize[i];
+	}
 
-		success = video_scaler_scale(input->scaler, frame->data,
-					     frame->linesize,
-					     (const uint8_t *const *)data->data,
-					     data->linesize);
+	input->scaled = scaled;
+	return true;
+}
 
-		if (success) {
-			for (size_t i = 0; i < MAX_AV_PLANES; i++) {
-				data->data[i] = frame->data[i];
-				data->linesize[i] = frame->linesize[i];
-			}
-		} else {
-			blog(LOG_WARNING, "video-io: Could not scale frame!");
+static inline void video_input_cur_frame(struct video_input *input,
+					 struct video_input_entry *entry)
+{
+	struct video_data frame = entry->frame_info->frame;
+
+	frame.timestamp = entry->timestamp;
+
+	if (scale_video_output(input, entry->frame_info, &frame)) {
+		input->callback(input->param, &frame);
+
+		/* frames this input could not keep up with are replaced by
+		 * duplicates of the current frame so that the consumer's frame
+		 * count (and therefore its timing) stays intact.  they were
+		 * the frames right after this one, one frame_time apart. */
+		for (long i = 0; i < entry->duplicates &&
+				 !os_atomic_load_bool(&input->stop);
+		     i++) {
+			frame.timestamp += input->video->frame_time;
+			input->callback(input->param, &frame);
 		}
 	}
 
-	return success;
+	if (input->scaled) {
+		video_scaler_group_unref(input->scaler_group, input->scaled);
+		input->scaled = NULL;
+	}
+
+	release_frame(entry->frame_info);
 }
 
-static inline bool video_output_cur_frame(struct video_output *video)
+static void *video_input_thread(void *param)
 {
-	struct cached_frame_info *frame_info;
-	bool complete;
-	bool skipped;
+	struct video_input *input = param;
+	struct video_input_entry entry;
 
-	/* -------------------------------- */
+	os_set_thread_name("video-io: input thread");
 
-	pthread_mutex_lock(&video->data_mutex);
+	const char *input_thread_name = profile_store_name(
+		obs_get_profiler_name_store(), "video_input_thread(%s)",
+		input->video->info.name);
 
-	frame_info = &video->cache[video->first_added];
+	while (os_sem_wait(input->update_semaphore) == 0) {
+		if (os_atomic_load_bool(&input->stop))
+			break;
+		if (!input_queue_pop(input, &entry))
+			continue;
 
-	pthread_mutex_unlock(&video->data_mutex);
+		profile_start(input_thread_name);
+		video_input_cur_frame(input, &entry);
+		profile_end(input_thread_name);
+
+		profile_reenable_thread();
+
+		if (os_atomic_load_bool(&input->stop))
+			break;
+	}
+
+	os_atomic_set_bool(&input->exited, true);
+	return NULL;
+}
 
-	/* -------------------------------- */
+static inline void video_input_stop(struct video_input *input)
+{
+	if (!input->thread_created) {
+		video_input_free(input);
+		return;
+	}
+
+	os_atomic_set_bool(&input->stop, true);
+	os_sem_post(input->update_semaphore);
+	pthread_join(input->thread, NULL);
+	video_input_free(input);
+}
+
+/* joins and frees the inputs that disconnected from within their own
+ * callback, either all of them or only those whose threads have exited */
+static void video_output_reap_inputs(struct video_output *video, bool wait)
+{
+	DARRAY(struct video_input *) stopped;
+	da_init(stopped);
 
 	pthread_mutex_lock(&video->input_mutex);
 
-	for (size_t i = 0; i < video->inputs.num; i++) {
-		struct video_input *input = video->inputs.array + i;
-		struct video_data frame = frame_info->frame;
+	for (size_t i = video->stopped_inputs.num; i > 0; i--) {
+		struct video_input *input = video->stopped_inputs.array[i - 1];
 
-		if (scale_video_output(input, &frame))
-			input->callback(input->param, &frame);
+		if (wait || os_atomic_load_bool(&input->exited)) {
+			da_push_back(stopped, &input);
+			da_erase(video->stopped_inputs, i - 1);
+		}
 	}
 
 	pthread_mutex_unlock(&video->input_mutex);
 
-	/* -------------------------------- */
+	for (size_t i = 0; i < stopped.num; i++) {
+		pthread_join(stopped.array[i]->thread, NULL);
+		video_input_free(stopped.array[i]);
+	}
+
+	da_free(stopped);
+}
+
+/* ------------------------------------------------------------------------- */
+
+static inline bool video_output_pop_frame(struct video_output *video,
+					  struct cached_frame_info **frame_info,
+					  int *count, int *skipped)
+{
+	bool popped = false;
 
 	pthread_mutex_lock(&video->data_mutex);
 
-	frame_info->frame.timestamp += video->frame_time;
-	complete = --frame_info->count == 0;
-	skipped = frame_info->skipped > 0;
+	if (video->ready_count) {
+		*frame_info = &video->cache[video->ready[video->ready_first]];
+
+		if (++video->ready_first == video->info.cache_size)
+			video->ready_first = 0;
+		video->ready_count--;
 
-	if (complete) {
-		if (++video->first_added == video->info.cache_size)
-			video->first_added = 0;
+		*count = (*frame_info)->count + video->missed_frames;
+		*skipped = (*frame_info)->skipped + video->missed_frames;
+		video->missed_frames = 0;
 
-		if (++video->available_frames == video->info.cache_size)
-			video->last_added = video->first_added;
-	} else if (skipped) {
-		--frame_info->skipped;
-		os_atomic_inc_long(&video->skipped_frames);
+		/* the video thread holds a reference while dispatching */
+		os_atomic_set_long(&(*frame_info)->refs, 1);
+		popped = true;
 	}
 
 	pthread_mutex_unlock(&video->data_mutex);
 
-	/* -------------------------------- */
+	return popped;
+}
 
-	return complete;
+static inline void video_output_cur_frame(struct video_output *video)
+{
+	struct cached_frame_info *frame_info;
+	uint64_t timestamp;
+	int count;
+	int skipped;
+
+	if (!video_output_pop_frame(video, &frame_info, &count, &skipped))
+		return;
+
+	timestamp = frame_info->frame.timestamp;
+
+	pthread_mutex_lock(&video->input_mutex);
+
+	for (int i = 0; i < count; i++) {
+		bool skip = i >= count - skipped;
+
+		for (size_t j = 0; j < video->inputs.num; j++) {
+			struct video_input *input = video->inputs.array[j];
+
+			if (!input_queue_push_or_drop(input, frame_info,
+						      timestamp))
+				skip = true;
+		}
+
+		if (skip)
+			os_atomic_inc_long(&video->skipped_frames);
+		os_atomic_inc_long(&video->total_frames);
+
+		timestamp += video->frame_time;
+	}
+
+	pthread_mutex_unlock(&video->input_mutex);
+
+	release_frame(frame_info);
 }
 
 static void *video_thread(void *param)
@@ -185,11 +606,7 @@ static void *video_thread(void *param)
 			break;
 
 		profile_start(video_thread_name);
-		while (!video->stop && !video_output_cur_frame(video)) {
-			os_atomic_inc_long(&video->total_frames);
-		}
-
-		os_atomic_inc_long(&video->total_frames);
+		video_output_cur_frame(video);
 		profile_end(video_thread_name);
 
 		profile_reenable_thread();
@@ -218,8 +635,6 @@ static inline void init_cache(struct video_output *video)
 		video_frame_init(frame, video->info.format, video->info.width,
 				 video->info.height);
 	}
-
-	video->available_frames = video->info.cache_size;
 }
 
 int video_output_open(video_t **video, struct video_output_info *info)
@@ -270,9 +685,26 @@ void video_output_close(video_t *video)
 
 	video_output_stop(video);
 
-	for (size_t i = 0; i < video->inputs.num; i++)
-		video_input_free(&video->inputs.array[i]);
+	if (video->inputs.num || video->stopped_inputs.num) {
+		DARRAY(struct video_input *) inputs;
+		da_init(inputs);
+
+		/* inputs can still disconnect themselves from their callbacks
+		 * until their threads are stopped */
+		pthread_mutex_lock(&video->input_mutex);
+		da_move(inputs, video->inputs);
+		pthread_mutex_unlock(&video->input_mutex);
+
+		for (size_t i = 0; i < inputs.num; i++)
+			video_input_stop(inputs.array[i]);
+		da_free(inputs);
+
+		video_output_reap_inputs(video, true);
+	}
+
 	da_free(video->inputs);
+	da_free(video->stopped_inputs);
+	da_free(video->scaler_groups);
 
 	for (size_t i = 0; i < video->info.cache_size; i++)
 		video_frame_free((struct video_frame *)&video->cache[i]);
@@ -289,7 +721,7 @@ static size_t video_get_input_idx(const video_t *video,
 				  void *param)
 {
 	for (size_t i = 0; i < video->inputs.num; i++) {
-		struct video_input *input = video->inputs.array + i;
+		struct video_input *input = video->inputs.array[i];
 		if (input->callback == callback && input->param == param)
 			return i;
 	}
@@ -300,38 +732,25 @@ static size_t video_get_input_idx(const video_t *video,
 static inline bool video_input_init(struct video_input *input,
 				    struct video_output *video)
 {
+	input->video = video;
+
+	if (pthread_mutex_init(&input->queue_mutex, NULL) != 0)
+		return false;
+	if (os_sem_init(&input->update_semaphore, 0) != 0)
+		return false;
+
 	if (input->conversion.width != video->info.width ||
 	    input->conversion.height != video->info.height ||
 	    input->conversion.format != video->info.format) {
-		struct video_scale_info from = {.format = video->info.format,
-						.width = video->info.width,
-						.height = video->info.height,
-						.range = video->info.range,
-						.colorspace =
-							video->info.colorspace};
-
-		int ret = video_scaler_create(&input->scaler,
-					      &input->conversion, &from,
-					      VIDEO_SCALE_FAST_BILINEAR);
-		if (ret != VIDEO_SCALER_SUCCESS) {
-			if (ret == VIDEO_SCALER_BAD_CONVERSION)
-				blog(LOG_ERROR, "video_input_init: Bad "
-						"scale conversion type");
-			else
-				blog(LOG_ERROR, "video_input_init: Failed to "
-						"create scaler");
-
+		input->scaler_group =
+			video_scaler_group_get(video, &input->conversion);
+		if (!input->scaler_group)
 			return false;
-		}
-
-		for (size_t i = 0; i < MAX_CONVERT_BUFFERS; i++)
-			video_frame_init(&input->frame[i],
-					 input->conversion.format,
-					 input->conversion.width,
-					 input->conversion.height);
 	}
 
-	return true;
+	input->thread_created = pthread_create(&input->thread, NULL,
+					       video_input_thread, input) == 0;
+	return input->thread_created;
 }
 
 static inline void reset_frames(video_t *video)
@@ -349,30 +768,34 @@ bool video_output_connect(
 	if (!video || !callback)
 		return false;
 
+	video_output_reap_inputs(video, false);
+
 	pthread_mutex_lock(&video->input_mutex);
 
 	if (video_get_input_idx(video, callback, param) == DARRAY_INVALID) {
-		struct video_input input;
-		memset(&input, 0, sizeof(input));
+		struct video_input *input = bzalloc(sizeof(*input));
 
-		input.callback = callback;
-		input.param = param;
+		pthread_mutex_init_value(&input->queue_mutex);
+		input->callback = callback;
+		input->param = param;
 
 		if (conversion) {
-			input.conversion = *conversion;
+			input->conversion = *conversion;
 		} else {
-			input.conversion.format = video->info.format;
-			input.conversion.width = video->info.width;
-			input.conversion.height = video->info.height;
+			input->conversion.format = video->info.format;
+			input->conversion.width = video->info.width;
+			input->conversion.height = video->info.height;
 		}
 
-		if (input.conversion.width == 0)
-			input.conversion.width = video->info.width;
-		if (input.conversion.height == 0)
-			input.conversion.height = video->info.height;
+		if (input->conversion.width == 0)
+			input->conversion.width = video->info.width;
+		if (input->conversion.height == 0)
+			input->conversion.height = video->info.height;
 
-		success = video_input_init(&input, video);
-		if (success) {
+		success = video_input_init(input, video);
+		if (!success) {
+			video_input_stop(input);
+		} else {
 			if (video->inputs.num == 0) {
 				if (!os_atomic_load_long(&video->gpu_refs)) {
 					reset_frames(video);
@@ -413,13 +836,26 @@ void video_output_disconnect(video_t *video,
 	if (!video || !callback)
 		return;
 
+	struct video_input *input = NULL;
+
+	video_output_reap_inputs(video, false);
+
 	pthread_mutex_lock(&video->input_mutex);
 
 	size_t idx = video_get_input_idx(video, callback, param);
 	if (idx != DARRAY_INVALID) {
-		video_input_free(video->inputs.array + idx);
+		input = video->inputs.array[idx];
 		da_erase(video->inputs, idx);
 
+		/* disconnected from within its own callback: the thread can't
+		 * join itself, so it is joined once it has exited */
+		if (input->thread_created &&
+		    pthread_equal(pthread_self(), input->thread)) {
+			os_atomic_set_bool(&input->stop, true);
+			da_push_back(video->stopped_inputs, &input);
+			input = NULL;
+		}
+
 		if (video->inputs.num == 0) {
 			os_atomic_set_bool(&video->raw_active, false);
 			if (!os_atomic_load_long(&video->gpu_refs)) {
@@ -429,6 +865,11 @@ void video_output_disconnect(video_t *video,
 	}
 
 	pthread_mutex_unlock(&video->input_mutex);
+
+	/* stopped outside of the input mutex so the video thread can keep
+	 * feeding other inputs while this one finishes its current frame */
+	if (input)
+		video_input_stop(input);
 }
 
 bool video_output_active(const video_t *video)
@@ -443,10 +884,25 @@ const struct video_output_info *video_output_get_info(const video_t *video)
 	return video ? &video->info : NULL;
 }
 
+static inline size_t find_free_frame(struct video_output *video)
+{
+	size_t idx = video->last_added;
+
+	for (size_t i = 0; i < video->info.cache_size; i++) {
+		if (++idx >= video->info.cache_size)
+			idx = 0;
+		if (!os_atomic_load_bool(&video->cache[idx].in_use))
+			return idx;
+	}
+
+	return DARRAY_INVALID;
+}
+
 bool video_output_lock_frame(video_t *video, struct video_frame *frame,
 			     int count, uint64_t timestamp)
 {
 	struct cached_frame_info *cfi;
+	size_t idx;
 	bool locked;
 
 	if (!video)
@@ -454,19 +910,30 @@ bool video_output_lock_frame(video_t *video, struct video_frame *frame,
 
 	pthread_mutex_lock(&video->data_mutex);
 
-	if (video->available_frames == 0) {
-		video->cache[video->last_added].count += count;
-		video->cache[video->last_added].skipped += count;
+	idx = find_free_frame(video);
+
+	if (idx == DARRAY_INVALID) {
+		/* repeat the last frame that has not been dispatched yet, or
+		 * the next one if every queued frame is already in use */
+		if (video->ready_count) {
+			size_t last = (video->ready_first + video->ready_count -
+				       1) % video->info.cache_size;
+
+			video->cache[video->ready[last]].count += count;
+			video->cache[video->ready[last]].skipped += count;
+		} else {
+			video->missed_frames += count;
+		}
 		locked = false;
 
 	} else {
-		if (video->available_frames != video->info.cache_size) {
-			if (++video->last_added == video->info.cache_size)
-				video->last_added = 0;
-		}
+		video->last_added = idx;
+		video->locked_idx = idx;
 
-		cfi = &video->cache[video->last_added];
+		cfi = &video->cache[idx];
+		os_atomic_set_bool(&cfi->in_use, true);
 		cfi->frame.timestamp = timestamp;
+		cfi->id = ++video->frame_id;
 		cfi->count = count;
 		cfi->skipped = 0;
 
@@ -487,7 +954,9 @@ void video_output_unlock_frame(video_t *video)
 
 	pthread_mutex_lock(&video->data_mutex);
 
-	video->available_frames--;
+	video->ready[(video->ready_first + video->ready_count) %
+		     video->info.cache_size] = video->locked_idx;
+	video->ready_count++;
 	os_sem_post(video->update_semaphore);
 
 	pthread_mutex_unlock(&video->data_mutex);
@@ -53,6 +53,7 @@ struct obs_fader {
 	float min_db;
 	float cur_db;
 	bool ignore_next_signal;
+	const calldata_layout_t *volume_layout;
 
 	pthread_mutex_t callback_mutex;
 	DARRAY(struct fader_cb) callbacks;
@@ -68,6 +69,7 @@ struct obs_volmeter {
 	obs_source_t *source;
 	enum obs_fader_type type;
 	float cur_db;
+	const calldata_layout_t *volume_layout;
 
 	pthread_mutex_t callback_mutex;
 	DARRAY(struct meter_cb) callbacks;
@@ -224,7 +226,10 @@ static void fader_source_volume_changed(void *vptr, calldata_t *calldata)
 		return;
 	}
 
-	const float mul = (float)calldata_float(calldata, "volume");
+	const float mul = (float)calldata_float_at(calldata,
+						   fader->volume_layout,
+						   SOURCE_VOLUME_PARAM_VOLUME,
+						   "volume");
 	const float db = mul_to_db(mul);
 	fader->cur_db = db;
 
@@ -239,7 +244,9 @@ static void volmeter_source_volume_changed(void *vptr, calldata_t *calldata)
 
 	pthread_mutex_lock(&volmeter->mutex);
 
-	float mul = (float)calldata_float(calldata, "volume");
+	float mul = (float)calldata_float_at(calldata, volmeter->volume_layout,
+					     SOURCE_VOLUME_PARAM_VOLUME,
+					     "volume");
 	volmeter->cur_db = mul_to_db(mul);
 
 	pthread_mutex_unlock(&volmeter->mutex);
@@ -705,6 +712,7 @@ bool obs_fader_attach_source(obs_fader_t *fader, obs_source_t *source)
 	obs_fader_detach_source(fader);
 
 	sh = obs_source_get_signal_handler(source);
+	fader->volume_layout = signal_handler_get_layout(sh, "volume");
 	signal_handler_connect(sh, "volume", fader_source_volume_changed,
 			       fader);
 	signal_handler_connect(sh, "destroy", fader_source_destroyed, fader);
@@ -815,6 +823,7 @@ bool obs_volmeter_attach_source(obs_volmeter_t *volmeter, obs_source_t *source)
 	obs_volmeter_detach_source(volmeter);
 
 	sh = obs_source_get_signal_handler(source);
+	volmeter->volume_layout = signal_handler_get_layout(sh, "volume");
 	signal_handler_connect(sh, "volume", volmeter_source_volume_changed,
 			       volmeter);
 	signal_handler_connect(sh, "destroy", volmeter_source_destroyed,
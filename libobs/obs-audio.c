@@ -18,6 +18,8 @@
 #include <inttypes.h>
 #include "obs-internal.h"
 #include "util/util_uint64.h"
+#include "media-io/audio-math.h"
+#include "media-io/audio-mix.h"
 
 struct ts_info {
 	uint64_t start;
@@ -41,15 +43,109 @@ static void push_audio_tree(obs_source_t *parent, obs_source_t *source, void *p)
 	UNUSED_PARAMETER(parent);
 }
 
+/* leaf sources only use their own buffers when rendering, so they can be
+ * rendered at the same time.  composite and submix sources read the output of
+ * other sources and are rendered afterwards, in order */
+static inline bool audio_render_independent(const struct obs_source *source)
+{
+	return !source->info.audio_render && !source->info.audio_mix;
+}
+
+struct audio_render_params {
+	struct obs_core_audio *audio;
+	size_t parts;
+	uint32_t mixers;
+	size_t channels;
+	size_t sample_rate;
+	size_t audio_size;
+};
+
+static void render_independent_audio(struct audio_render_params *p,
+				     size_t start, size_t end)
+{
+	for (size_t i = start; i < end; i++) {
+		obs_source_t *source = p->audio->render_order.array[i];
+
+		if (audio_render_independent(source))
+			obs_source_audio_render(source, p->mixers, p->channels,
+						p->sample_rate, p->audio_size);
+	}
+}
+
+/* each part renders a contiguous range of the render order, so the pool is
+ * only woken once per tick rather than once per source */
+static void render_independent_audio_part(void *param, size_t idx)
+{
+	struct audio_render_params *p = param;
+	size_t num = p->audio->render_order.num;
+
+	render_independent_audio(p, idx * num / p->parts,
+				 (idx + 1) * num / p->parts);
+}
+
+#define MIN_PARALLEL_AUDIO_SOURCES 8
+
+/* rendering on the pool saves at most threads / (threads + 1) of the serial
+ * cost, and pays for waking up the pool threads and waiting for them.  200 us
+ * is around 16 leaf sources, far enough above a wake-up round trip (both are
+ * printed by bench_audio_render) that a slow wake-up doesn't eat the whole
+ * saving.  the serial cost is measured, and measured again every so often in
+ * case it has changed */
+#define MIN_PARALLEL_AUDIO_NS 200000ULL
+#define AUDIO_RENDER_SAMPLE_TICKS 512
+
+/* returns true if the independent sources have been rendered, either on the
+ * render pool or timed on this thread */
+static bool render_audio_parallel(struct obs_core_audio *audio,
+				  uint32_t mixers, size_t channels,
+				  size_t sample_rate, size_t audio_size)
+{
+	struct audio_render_params params = {audio, 0, mixers, channels,
+					     sample_rate, audio_size};
+	size_t threads = worker_pool_threads(audio->render_pool);
+	size_t independent = 0;
+
+	if (!threads)
+		return false;
+
+	for (size_t i = 0; i < audio->render_order.num; i++) {
+		if (audio_render_independent(audio->render_order.array[i]))
+			independent++;
+	}
+
+	if (independent < MIN_PARALLEL_AUDIO_SOURCES)
+		return false;
+
+	if (audio->render_sample_ticks-- <= 0 ||
+	    audio->independent_render_ns < MIN_PARALLEL_AUDIO_NS) {
+		uint64_t start = os_gettime_ns();
+
+		render_independent_audio(&params, 0, audio->render_order.num);
+		audio->independent_render_ns = os_gettime_ns() - start;
+
+		if (audio->render_sample_ticks < 0)
+			audio->render_sample_ticks = AUDIO_RENDER_SAMPLE_TICKS;
+		return true;
+	}
+
+	params.parts = threads + 1;
+	worker_pool_run(audio->render_pool, render_independent_audio_part,
+			&params, params.parts);
+	return true;
+}
+
 static inline size_t convert_time_to_frames(size_t sample_rate, uint64_t t)
 {
 	return (size_t)util_mul_div64(t, sample_rate, 1000000000ULL);
 }
 
 static inline void mix_audio(struct audio_output_data *mixes,
-			     obs_source_t *source, size_t channels,
-			     size_t sample_rate, struct ts_info *ts)
+			     obs_source_t *source, uint32_t mixers,
+			     size_t channels, size_t sample_rate,
+			     struct ts_info *ts)
 {
+	/* mixes the source isn't routed to have been zeroed when rendering */
+	uint32_t source_mixers = mixers & source->audio_mixers;
 	size_t total_floats = AUDIO_OUTPUT_FRAMES;
 	size_t start_point = 0;
 
@@ -66,17 +162,15 @@ static inline void mix_audio(struct audio_output_data *mixes,
 	}
 
 	for (size_t mix_idx = 0; mix_idx < MAX_AUDIO_MIXES; mix_idx++) {
-		for (size_t ch = 0; ch < channels; ch++) {
-			register float *mix = mixes[mix_idx].data[ch];
-			register float *aud =
-				source->audio_output_buf[mix_idx][ch];
-			register float *end;
+		if ((source_mixers & (1 << mix_idx)) == 0)
+			continue;
 
-			mix += start_point;
-			end = aud + total_floats;
+		for (size_t ch = 0; ch < channels; ch++) {
+			float *mix = mixes[mix_idx].data[ch];
+			float *aud = source->audio_output_buf[mix_idx][ch];
 
-			while (aud < end)
-				*(mix++) += *(aud++);
+			mix_audio_samples(mix + start_point, aud,
+					  total_floats);
 		}
 	}
 }
@@ -493,10 +587,14 @@ bool audio_callback(void *param, uint64_t start_ts_in, uint64_t end_ts_in,
 
 	/* ------------------------------------------------ */
 	/* render audio data */
+	bool rendered_independent = render_audio_parallel(
+		audio, mixers, channels, sample_rate, audio_size);
+
 	for (size_t i = 0; i < audio->render_order.num; i++) {
 		obs_source_t *source = audio->render_order.array[i];
-		obs_source_audio_render(source, mixers, channels, sample_rate,
-					audio_size);
+		if (!rendered_independent || !audio_render_independent(source))
+			obs_source_audio_render(source, mixers, channels,
+						sample_rate, audio_size);
 
 		/* if a source has gone backward in time and we can no
 		 * longer buffer, drop some or all of its audio */
@@ -555,8 +653,8 @@ bool audio_callback(void *param, uint64_t start_ts_in, uint64_t end_ts_in,
 			pthread_mutex_lock(&source->audio_buf_mutex);
 
 			if (source->audio_output_buf[0][0] && source->audio_ts)
-				mix_audio(mixes, source, channels, sample_rate,
-					  &ts);
+				mix_audio(mixes, source, mixers, channels,
+					  sample_rate, &ts);
 
 			pthread_mutex_unlock(&source->audio_buf_mutex);
 		}
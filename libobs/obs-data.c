@@ -26,7 +26,10 @@
 #include "graphics/quat.h"
 #include "obs-data.h"
 
-#include <jansson.h>
+#include <ctype.h>
+#include <errno.h>
+#include <locale.h>
+#include <math.h>
 
 struct obs_data_item {
 	volatile long ref;
@@ -40,12 +43,21 @@ struct obs_data_item {
 	size_t default_size;
 	size_t autoselect_size;
 	size_t capacity;
+	uint32_t name_hash;
 };
 
 struct obs_data {
 	volatile long ref;
 	char *json;
 	struct obs_data_item *first_item;
+	struct obs_data_item *last_item;
+	size_t num_items;
+
+	/* open addressing name index, only built once an object has more
+	 * than a handful of items (source settings, scene collections) */
+	struct obs_data_item **index;
+	size_t index_size;
+	size_t index_used;
 };
 
 struct obs_data_array {
@@ -261,6 +273,110 @@ static inline void item_autoselect_data_addref(struct obs_data_item *item)
 	}
 }
 
+/* ------------------------------------------------------------------------- */
+/* Name index, linear probing keyed on the item name hash */
+
+#define INDEX_MIN_ITEMS 16
+#define INDEX_MIN_SIZE 32
+
+static char index_tombstone;
+#define INDEX_TOMBSTONE ((struct obs_data_item *)&index_tombstone)
+
+static inline uint32_t hash_name(const char *name)
+{
+	uint32_t hash = 2166136261u;
+
+	while (*name) {
+		hash ^= (uint8_t)*name++;
+		hash *= 16777619u;
+	}
+
+	return hash;
+}
+
+static void index_insert(struct obs_data *data, struct obs_data_item *item)
+{
+	size_t mask = data->index_size - 1;
+	size_t i = item->name_hash & mask;
+
+	while (data->index[i] && data->index[i] != INDEX_TOMBSTONE)
+		i = (i + 1) & mask;
+
+	if (!data->index[i])
+		data->index_used++;
+	data->index[i] = item;
+}
+
+static void index_rebuild(struct obs_data *data)
+{
+	size_t size = INDEX_MIN_SIZE;
+
+	while (size < data->num_items * 2)
+		size *= 2;
+
+	bfree(data->index);
+	data->index = bzalloc(size * sizeof(*data->index));
+	data->index_size = size;
+	data->index_used = 0;
+
+	for (struct obs_data_item *item = data->first_item; item;
+	     item = item->next)
+		index_insert(data, item);
+}
+
+static void index_add(struct obs_data *data, struct obs_data_item *item)
+{
+	if (!data->index) {
+		if (data->num_items >= INDEX_MIN_ITEMS)
+			index_rebuild(data);
+		return;
+	}
+
+	/* keep at least a quarter of the slots empty so probes stay short;
+	 * rebuilding also drops the tombstones left by erased items */
+	if ((data->index_used + 1) * 4 > data->index_size * 3)
+		index_rebuild(data);
+	else
+		index_insert(data, item);
+}
+
+/* compares pointers only: when an item has been reallocated the slot still
+ * holds the old, already freed, pointer */
+static struct obs_data_item **index_find_ptr(struct obs_data *data,
+					     uint32_t hash,
+					     struct obs_data_item *ptr)
+{
+	size_t mask = data->index_size - 1;
+	size_t i = hash & mask;
+
+	while (data->index[i]) {
+		if (data->index[i] == ptr)
+			return &data->index[i];
+		i = (i + 1) & mask;
+	}
+
+	return NULL;
+}
+
+static struct obs_data_item *index_get(struct obs_data *data, const char *name)
+{
+	uint32_t hash = hash_name(name);
+	size_t mask = data->index_size - 1;
+	size_t i = hash & mask;
+	struct obs_data_item *item;
+
+	while ((item = data->index[i]) != NULL) {
+		if (item != INDEX_TOMBSTONE && item->name_hash == hash &&
+		    strcmp(get_item_name(item), name) == 0)
+			return item;
+		i = (i + 1) & mask;
+	}
+
+	return NULL;
+}
+
+/* ------------------------------------------------------------------------- */
+
 static struct obs_data_item *obs_data_item_create(const char *name,
 						  const void *data, size_t size,
 						  enum obs_data_type type,
@@ -295,6 +411,7 @@ static struct obs_data_item *obs_data_item_create(const char *name,
 		item->data_size = size;
 	}
 
+	item->name_hash = hash_name(name);
 	strcpy(get_item_name(item), name);
 	memcpy(get_item_data(item), data, size);
 
@@ -322,25 +439,84 @@ static struct obs_data_item **get_item_prev_next(struct obs_data *data,
 	return NULL;
 }
 
+static inline struct obs_data_item *
+get_prev_item(struct obs_data_item **prev_next)
+{
+	return (struct obs_data_item *)((uint8_t *)prev_next -
+					offsetof(struct obs_data_item, next));
+}
+
+static void obs_data_item_insert(struct obs_data *data,
+				 struct obs_data_item *new_item)
+{
+	const char *name = get_item_name(new_item);
+	struct obs_data_item **prev_next = &data->first_item;
+
+	/* items are kept sorted by name, and objects loaded from saved json
+	 * arrive in that same order, so try appending first */
+	if (data->last_item &&
+	    strcmp(get_item_name(data->last_item), name) < 0) {
+		prev_next = &data->last_item->next;
+	} else {
+		while (*prev_next &&
+		       strcmp(get_item_name(*prev_next), name) < 0)
+			prev_next = &(*prev_next)->next;
+	}
+
+	new_item->parent = data;
+	new_item->next = *prev_next;
+	*prev_next = new_item;
+
+	if (!new_item->next)
+		data->last_item = new_item;
+
+	data->num_items++;
+	index_add(data, new_item);
+}
+
 static inline void obs_data_item_detach(struct obs_data_item *item)
 {
-	struct obs_data_item **prev_next =
-		get_item_prev_next(item->parent, item);
+	struct obs_data *data = item->parent;
+	struct obs_data_item **prev_next = get_item_prev_next(data, item);
 
 	if (prev_next) {
+		if (data->last_item == item)
+			data->last_item = prev_next != &data->first_item
+						  ? get_prev_item(prev_next)
+						  : NULL;
+
+		if (data->index) {
+			struct obs_data_item **slot =
+				index_find_ptr(data, item->name_hash, item);
+			if (slot)
+				*slot = INDEX_TOMBSTONE;
+		}
+
 		*prev_next = item->next;
 		item->next = NULL;
+		data->num_items--;
 	}
 }
 
 static inline void obs_data_item_reattach(struct obs_data_item *old_ptr,
 					  struct obs_data_item *new_ptr)
 {
-	struct obs_data_item **prev_next =
-		get_item_prev_next(new_ptr->parent, old_ptr);
+	struct obs_data *data = new_ptr->parent;
+	struct obs_data_item **prev_next = get_item_prev_next(data, old_ptr);
 
-	if (prev_next)
+	if (prev_next) {
 		*prev_next = new_ptr;
+
+		if (data->last_item == old_ptr)
+			data->last_item = new_ptr;
+
+		if (data->index) {
+			struct obs_data_item **slot = index_find_ptr(
+				data, new_ptr->name_hash, old_ptr);
+			if (slot)
+				*slot = new_ptr;
+		}
+	}
 }
 
 static struct obs_data_item *
@@ -469,155 +645,673 @@ obs_data_item_set_autoselect_data(struct obs_data_item **p_item,
 }
 
 /* ------------------------------------------------------------------------- */
+/* JSON parsing, done in a single pass straight into obs_data */
+
+#define JSON_MAX_DEPTH 512
+
+static struct obs_data_item *get_item(struct obs_data *data, const char *name);
+
+struct json_parser {
+	const char *pos;
+	int line;
+	int depth;
+
+	/* scratch buffers reused for every key and string value */
+	struct dstr key;
+	struct dstr str;
+	struct dstr error;
+};
+
+static bool json_error(struct json_parser *p, const char *format, ...)
+{
+	va_list args;
 
-static void obs_data_add_json_item(obs_data_t *data, const char *key,
-				   json_t *json);
+	if (!p->error.len) {
+		va_start(args, format);
+		dstr_vprintf(&p->error, format, args);
+		va_end(args);
+	}
 
-static inline void obs_data_add_json_object_data(obs_data_t *data, json_t *jobj)
+	return false;
+}
+
+static inline void scratch_reset(struct dstr *str)
 {
-	const char *item_key;
-	json_t *jitem;
+	dstr_ensure_capacity(str, 64);
+	str->array[0] = 0;
+	str->len = 0;
+}
 
-	json_object_foreach (jobj, item_key, jitem) {
-		obs_data_add_json_item(data, item_key, jitem);
+static inline void json_skip_whitespace(struct json_parser *p)
+{
+	for (;;) {
+		char ch = *p->pos;
+		if (ch == '\n')
+			p->line++;
+		else if (ch != ' ' && ch != '\t' && ch != '\r')
+			break;
+		p->pos++;
 	}
 }
 
-static inline void obs_data_add_json_object(obs_data_t *data, const char *key,
-					    json_t *jobj)
+/* returns the length of a valid utf-8 sequence, or 0 */
+static size_t utf8_sequence_size(const uint8_t *str)
 {
-	obs_data_t *sub_obj = obs_data_create();
+	uint32_t codepoint;
+	size_t size;
+
+	if (str[0] < 0x80)
+		return 1;
+	else if (str[0] >= 0xC2 && str[0] <= 0xDF)
+		size = 2;
+	else if (str[0] >= 0xE0 && str[0] <= 0xEF)
+		size = 3;
+	else if (str[0] >= 0xF0 && str[0] <= 0xF4)
+		size = 4;
+	else
+		return 0;
+
+	codepoint = str[0] & (0x7F >> size);
+	for (size_t i = 1; i < size; i++) {
+		if ((str[i] & 0xC0) != 0x80)
+			return 0;
+		codepoint = (codepoint << 6) | (str[i] & 0x3F);
+	}
+
+	/* overlong, surrogate or out of range */
+	if ((size == 3 && codepoint < 0x800) ||
+	    (size == 4 && codepoint < 0x10000) || codepoint > 0x10FFFF ||
+	    (codepoint >= 0xD800 && codepoint <= 0xDFFF))
+		return 0;
 
-	obs_data_add_json_object_data(sub_obj, jobj);
-	obs_data_set_obj(data, key, sub_obj);
-	obs_data_release(sub_obj);
+	return size;
 }
 
-static void obs_data_add_json_array(obs_data_t *data, const char *key,
-				    json_t *jarray)
+static void utf8_encode(struct dstr *str, uint32_t codepoint)
 {
-	obs_data_array_t *array = obs_data_array_create();
-	size_t idx;
-	json_t *jitem;
+	char buf[4];
+	size_t size;
 
-	json_array_foreach (jarray, idx, jitem) {
-		obs_data_t *item;
+	if (codepoint < 0x80) {
+		buf[0] = (char)codepoint;
+		size = 1;
+	} else if (codepoint < 0x800) {
+		buf[0] = (char)(0xC0 | (codepoint >> 6));
+		buf[1] = (char)(0x80 | (codepoint & 0x3F));
+		size = 2;
+	} else if (codepoint < 0x10000) {
+		buf[0] = (char)(0xE0 | (codepoint >> 12));
+		buf[1] = (char)(0x80 | ((codepoint >> 6) & 0x3F));
+		buf[2] = (char)(0x80 | (codepoint & 0x3F));
+		size = 3;
+	} else {
+		buf[0] = (char)(0xF0 | (codepoint >> 18));
+		buf[1] = (char)(0x80 | ((codepoint >> 12) & 0x3F));
+		buf[2] = (char)(0x80 | ((codepoint >> 6) & 0x3F));
+		buf[3] = (char)(0x80 | (codepoint & 0x3F));
+		size = 4;
+	}
 
-		if (!json_is_object(jitem))
-			continue;
+	dstr_ncat(str, buf, size);
+}
+
+static bool json_parse_hex4(struct json_parser *p, uint32_t *val)
+{
+	*val = 0;
 
-		item = obs_data_create();
-		obs_data_add_json_object_data(item, jitem);
-		obs_data_array_push_back(array, item);
-		obs_data_release(item);
+	for (int i = 0; i < 4; i++) {
+		char ch = *p->pos++;
+		*val <<= 4;
+
+		if (ch >= '0' && ch <= '9')
+			*val |= (uint32_t)(ch - '0');
+		else if (ch >= 'a' && ch <= 'f')
+			*val |= (uint32_t)(ch - 'a' + 10);
+		else if (ch >= 'A' && ch <= 'F')
+			*val |= (uint32_t)(ch - 'A' + 10);
+		else
+			return json_error(p, "invalid escape");
 	}
 
-	obs_data_set_array(data, key, array);
-	obs_data_array_release(array);
+	return true;
 }
 
-static void obs_data_add_json_item(obs_data_t *data, const char *key,
-				   json_t *json)
+static bool json_parse_escape(struct json_parser *p, struct dstr *out)
 {
-	if (json_is_object(json))
-		obs_data_add_json_object(data, key, json);
-	else if (json_is_array(json))
-		obs_data_add_json_array(data, key, json);
-	else if (json_is_string(json))
-		obs_data_set_string(data, key, json_string_value(json));
-	else if (json_is_integer(json))
-		obs_data_set_int(data, key, json_integer_value(json));
-	else if (json_is_real(json))
-		obs_data_set_double(data, key, json_real_value(json));
-	else if (json_is_true(json))
-		obs_data_set_bool(data, key, true);
-	else if (json_is_false(json))
-		obs_data_set_bool(data, key, false);
+	uint32_t codepoint, low;
+	char ch = *p->pos++;
+
+	switch (ch) {
+	case '"':
+	case '\\':
+	case '/':
+		dstr_cat_ch(out, ch);
+		return true;
+	case 'b':
+		dstr_cat_ch(out, '\b');
+		return true;
+	case 'f':
+		dstr_cat_ch(out, '\f');
+		return true;
+	case 'n':
+		dstr_cat_ch(out, '\n');
+		return true;
+	case 'r':
+		dstr_cat_ch(out, '\r');
+		return true;
+	case 't':
+		dstr_cat_ch(out, '\t');
+		return true;
+	case 'u':
+		break;
+	default:
+		return json_error(p, "invalid escape");
+	}
+
+	if (!json_parse_hex4(p, &codepoint))
+		return false;
+
+	if (codepoint >= 0xD800 && codepoint <= 0xDBFF) {
+		if (p->pos[0] != '\\' || p->pos[1] != 'u')
+			return json_error(p, "invalid Unicode '\\u%04X'",
+					  codepoint);
+
+		p->pos += 2;
+		if (!json_parse_hex4(p, &low))
+			return false;
+		if (low < 0xDC00 || low > 0xDFFF)
+			return json_error(p,
+					  "invalid Unicode '\\u%04X\\u%04X'",
+					  codepoint, low);
+
+		codepoint = 0x10000 + ((codepoint - 0xD800) << 10) +
+			    (low - 0xDC00);
+
+	} else if (codepoint >= 0xDC00 && codepoint <= 0xDFFF) {
+		return json_error(p, "invalid Unicode '\\u%04X'", codepoint);
+
+	} else if (codepoint == 0) {
+		return json_error(p, "\\u0000 is not allowed");
+	}
+
+	utf8_encode(out, codepoint);
+	return true;
 }
 
-/* ------------------------------------------------------------------------- */
+static bool json_parse_string(struct json_parser *p, struct dstr *out)
+{
+	const char *run;
+
+	scratch_reset(out);
+	run = ++p->pos;
+
+	for (;;) {
+		uint8_t ch = (uint8_t)*p->pos;
+
+		if (ch >= 0x20 && ch < 0x80 && ch != '"' && ch != '\\') {
+			p->pos++;
+			continue;
+		}
+
+		if (ch >= 0x80) {
+			size_t size = utf8_sequence_size((const uint8_t *)p->pos);
+			if (!size)
+				return json_error(p, "invalid UTF-8");
+			p->pos += size;
+			continue;
+		}
+
+		if (p->pos != run)
+			dstr_ncat(out, run, p->pos - run);
+
+		if (ch == '"') {
+			p->pos++;
+			return true;
+		} else if (ch == '\\') {
+			p->pos++;
+			if (!json_parse_escape(p, out))
+				return false;
+			run = p->pos;
+		} else if (!ch) {
+			return json_error(p, "premature end of input");
+		} else {
+			return json_error(p, "control character 0x%x", ch);
+		}
+	}
+}
 
-static inline void set_json_string(json_t *json, const char *name,
-				   obs_data_item_t *item)
+static inline bool is_digit(char ch)
 {
-	const char *val = obs_data_item_get_string(item);
-	json_object_set_new(json, name, json_string(val));
+	return ch >= '0' && ch <= '9';
 }
 
-static inline void set_json_number(json_t *json, const char *name,
-				   obs_data_item_t *item)
+static bool json_parse_number(struct json_parser *p, obs_data_t *data,
+			      const char *key)
 {
-	enum obs_data_number_type type = obs_data_item_numtype(item);
+	const char *start = p->pos;
+	bool real = false;
+
+	if (*p->pos == '-')
+		p->pos++;
 
-	if (type == OBS_DATA_NUM_INT) {
-		long long val = obs_data_item_get_int(item);
-		json_object_set_new(json, name, json_integer(val));
+	if (*p->pos == '0') {
+		p->pos++;
+	} else if (is_digit(*p->pos)) {
+		while (is_digit(*p->pos))
+			p->pos++;
 	} else {
-		double val = obs_data_item_get_double(item);
-		json_object_set_new(json, name, json_real(val));
+		return json_error(p, "invalid token");
+	}
+
+	if (*p->pos == '.') {
+		real = true;
+		if (!is_digit(*++p->pos))
+			return json_error(p, "invalid token");
+		while (is_digit(*p->pos))
+			p->pos++;
+	}
+
+	if (*p->pos == 'e' || *p->pos == 'E') {
+		real = true;
+		p->pos++;
+		if (*p->pos == '+' || *p->pos == '-')
+			p->pos++;
+		if (!is_digit(*p->pos))
+			return json_error(p, "invalid token");
+		while (is_digit(*p->pos))
+			p->pos++;
 	}
+
+	errno = 0;
+
+	if (!real) {
+		long long val = strtoll(start, NULL, 10);
+		if (errno == ERANGE)
+			return json_error(p, *start == '-'
+						     ? "too big negative integer"
+						     : "too big integer");
+		if (data)
+			obs_data_set_int(data, key, val);
+
+	} else {
+		const char *point = localeconv()->decimal_point;
+		double val;
+
+		dstr_ncopy(&p->str, start, p->pos - start);
+		if (*point != '.') {
+			char *pos = strchr(p->str.array, '.');
+			if (pos)
+				*pos = *point;
+		}
+
+		val = strtod(p->str.array, NULL);
+		if (errno == ERANGE && (val == HUGE_VAL || val == -HUGE_VAL))
+			return json_error(p, "real number overflow");
+		if (data)
+			obs_data_set_double(data, key, val);
+	}
+
+	return true;
 }
 
-static inline void set_json_bool(json_t *json, const char *name,
-				 obs_data_item_t *item)
+static bool json_parse_object(struct json_parser *p, obs_data_t *data);
+static bool json_parse_array(struct json_parser *p, obs_data_array_t *array);
+
+static inline bool json_parse_literal(struct json_parser *p,
+				      const char *literal)
 {
-	bool val = obs_data_item_get_bool(item);
-	json_object_set_new(json, name, val ? json_true() : json_false());
+	size_t len = strlen(literal);
+
+	if (strncmp(p->pos, literal, len) != 0 || isalnum(p->pos[len]))
+		return json_error(p, "invalid token");
+
+	p->pos += len;
+	return true;
 }
 
-static json_t *obs_data_to_json(obs_data_t *data);
+/* parses a value, setting it on data unless data is NULL, in which case it
+ * is only validated (values obs_data has no place for, like arrays of
+ * anything but objects) */
+static bool json_parse_value(struct json_parser *p, obs_data_t *data,
+			     const char *key)
+{
+	bool success;
+
+	switch (*p->pos) {
+	case '{': {
+		obs_data_t *obj = data ? obs_data_create() : NULL;
+		obs_data_set_obj(data, key, obj);
+		success = json_parse_object(p, obj);
+		obs_data_release(obj);
+		return success;
+	}
+
+	case '[': {
+		obs_data_array_t *array = data ? obs_data_array_create() : NULL;
+		obs_data_set_array(data, key, array);
+		success = json_parse_array(p, array);
+		obs_data_array_release(array);
+		return success;
+	}
+
+	case '"':
+		if (!json_parse_string(p, &p->str))
+			return false;
+		if (data)
+			obs_data_set_string(data, key, p->str.array);
+		return true;
+
+	case 't':
+		if (!json_parse_literal(p, "true"))
+			return false;
+		if (data)
+			obs_data_set_bool(data, key, true);
+		return true;
+
+	case 'f':
+		if (!json_parse_literal(p, "false"))
+			return false;
+		if (data)
+			obs_data_set_bool(data, key, false);
+		return true;
+
+	case 'n':
+		return json_parse_literal(p, "null");
 
-static inline void set_json_obj(json_t *json, const char *name,
-				obs_data_item_t *item)
+	default:
+		return json_parse_number(p, data, key);
+	}
+}
+
+static bool json_parse_object(struct json_parser *p, obs_data_t *data)
 {
-	obs_data_t *obj = obs_data_item_get_obj(item);
-	json_object_set_new(json, name, obs_data_to_json(obj));
-	obs_data_release(obj);
+	if (++p->depth > JSON_MAX_DEPTH)
+		return json_error(p, "maximum parsing depth reached");
+
+	p->pos++;
+	json_skip_whitespace(p);
+
+	if (*p->pos == '}') {
+		p->pos++;
+		p->depth--;
+		return true;
+	}
+
+	for (;;) {
+		if (*p->pos != '"')
+			return json_error(p, "string or '}' expected");
+		if (!json_parse_string(p, &p->key))
+			return false;
+
+		json_skip_whitespace(p);
+		if (*p->pos != ':')
+			return json_error(p, "':' expected");
+		p->pos++;
+		json_skip_whitespace(p);
+
+		if (data && get_item(data, p->key.array))
+			return json_error(p, "duplicate object key");
+
+		/* objects and arrays are set on their parent before they are
+		 * filled, so the key buffer is free to be reused */
+		if (!json_parse_value(p, data, p->key.array))
+			return false;
+
+		json_skip_whitespace(p);
+		if (*p->pos == '}')
+			break;
+		if (*p->pos != ',')
+			return json_error(p, "'}' expected");
+
+		p->pos++;
+		json_skip_whitespace(p);
+	}
+
+	p->pos++;
+	p->depth--;
+	return true;
+}
+
+static bool json_parse_array(struct json_parser *p, obs_data_array_t *array)
+{
+	if (++p->depth > JSON_MAX_DEPTH)
+		return json_error(p, "maximum parsing depth reached");
+
+	p->pos++;
+	json_skip_whitespace(p);
+
+	if (*p->pos == ']') {
+		p->pos++;
+		p->depth--;
+		return true;
+	}
+
+	for (;;) {
+		bool success;
+
+		if (array && *p->pos == '{') {
+			obs_data_t *obj = obs_data_create();
+			obs_data_array_push_back(array, obj);
+			success = json_parse_object(p, obj);
+			obs_data_release(obj);
+		} else {
+			success = json_parse_value(p, NULL, NULL);
+		}
+
+		if (!success)
+			return false;
+
+		json_skip_whitespace(p);
+		if (*p->pos == ']')
+			break;
+		if (*p->pos != ',')
+			return json_error(p, "']' expected");
+
+		p->pos++;
+		json_skip_whitespace(p);
+	}
+
+	p->pos++;
+	p->depth--;
+	return true;
+}
+
+static bool json_parse_root(struct json_parser *p, obs_data_t *data)
+{
+	bool success;
+
+	json_skip_whitespace(p);
+
+	/* a root array is valid json, but has nothing to add to data */
+	if (*p->pos == '{')
+		success = json_parse_object(p, data);
+	else if (*p->pos == '[')
+		success = json_parse_array(p, NULL);
+	else
+		return json_error(p, "'[' or '{' expected");
+
+	if (!success)
+		return false;
+
+	json_skip_whitespace(p);
+	if (*p->pos)
+		return json_error(p, "end of file expected");
+
+	return true;
 }
 
-static inline void set_json_array(json_t *json, const char *name,
-				  obs_data_item_t *item)
+/* ------------------------------------------------------------------------- */
+/* JSON writing, appended straight to one string */
+
+static bool json_write_string(struct dstr *out, const char *str)
+{
+	const char *run = str;
+
+	dstr_cat_ch(out, '"');
+
+	for (;;) {
+		uint8_t ch = (uint8_t)*str;
+
+		if (ch >= 0x20 && ch < 0x80 && ch != '"' && ch != '\\') {
+			str++;
+			continue;
+		}
+
+		if (ch >= 0x80) {
+			size_t size = utf8_sequence_size((const uint8_t *)str);
+			if (!size)
+				return false;
+			str += size;
+			continue;
+		}
+
+		if (str != run)
+			dstr_ncat(out, run, str - run);
+		if (!ch)
+			break;
+
+		switch (ch) {
+		case '"':
+			dstr_cat(out, "\\\"");
+			break;
+		case '\\':
+			dstr_cat(out, "\\\\");
+			break;
+		case '\b':
+			dstr_cat(out, "\\b");
+			break;
+		case '\f':
+			dstr_cat(out, "\\f");
+			break;
+		case '\n':
+			dstr_cat(out, "\\n");
+			break;
+		case '\r':
+			dstr_cat(out, "\\r");
+			break;
+		case '\t':
+			dstr_cat(out, "\\t");
+			break;
+		default:
+			dstr_catf(out, "\\u%04X", ch);
+		}
+
+		run = ++str;
+	}
+
+	dstr_cat_ch(out, '"');
+	return true;
+}
+
+static void json_write_object(struct dstr *out, obs_data_t *data);
+
+static bool json_write_number(struct dstr *out, obs_data_item_t *item)
+{
+	char buf[64];
+	int len;
+
+	if (obs_data_item_numtype(item) == OBS_DATA_NUM_INT) {
+		len = snprintf(buf, sizeof(buf), "%lld",
+			       obs_data_item_get_int(item));
+	} else {
+		double val = obs_data_item_get_double(item);
+		if (!isfinite(val))
+			return false;
+
+		/* os_dtostr doesn't terminate the string again after trimming
+		 * the exponent, only the returned length is right */
+		len = os_dtostr(val, buf, sizeof(buf));
+	}
+
+	if (len < 0)
+		return false;
+
+	dstr_ncat(out, buf, len);
+	return true;
+}
+
+static void json_write_array(struct dstr *out, obs_data_array_t *array)
 {
-	json_t *jarray = json_array();
-	obs_data_array_t *array = obs_data_item_get_array(item);
 	size_t count = obs_data_array_count(array);
 
+	dstr_cat_ch(out, '[');
+
 	for (size_t idx = 0; idx < count; idx++) {
 		obs_data_t *sub_item = obs_data_array_item(array, idx);
-		json_t *jitem = obs_data_to_json(sub_item);
-		json_array_append_new(jarray, jitem);
+		if (idx)
+			dstr_cat_ch(out, ',');
+		json_write_object(out, sub_item);
 		obs_data_release(sub_item);
 	}
 
-	json_object_set_new(json, name, jarray);
-	obs_data_array_release(array);
+	dstr_cat_ch(out, ']');
 }
 
-static json_t *obs_data_to_json(obs_data_t *data)
+static bool json_write_value(struct dstr *out, obs_data_item_t *item)
+{
+	switch (obs_data_item_gettype(item)) {
+	case OBS_DATA_STRING:
+		return json_write_string(out, obs_data_item_get_string(item));
+
+	case OBS_DATA_NUMBER:
+		return json_write_number(out, item);
+
+	case OBS_DATA_BOOLEAN:
+		dstr_cat(out, obs_data_item_get_bool(item) ? "true" : "false");
+		return true;
+
+	case OBS_DATA_OBJECT: {
+		obs_data_t *obj = obs_data_item_get_obj(item);
+		json_write_object(out, obj);
+		obs_data_release(obj);
+		return true;
+	}
+
+	case OBS_DATA_ARRAY: {
+		obs_data_array_t *array = obs_data_item_get_array(item);
+		json_write_array(out, array);
+		obs_data_array_release(array);
+		return true;
+	}
+
+	case OBS_DATA_NULL:
+		break;
+	}
+
+	return false;
+}
+
+static void json_write_object(struct dstr *out, obs_data_t *data)
 {
-	json_t *json = json_object();
 	obs_data_item_t *item = NULL;
+	bool first = true;
+
+	dstr_cat_ch(out, '{');
 
 	for (item = obs_data_first(data); item; obs_data_item_next(&item)) {
-		enum obs_data_type type = obs_data_item_gettype(item);
-		const char *name = get_item_name(item);
+		size_t start = out->len;
 
 		if (!obs_data_item_has_user_value(item))
 			continue;
 
-		if (type == OBS_DATA_STRING)
-			set_json_string(json, name, item);
-		else if (type == OBS_DATA_NUMBER)
-			set_json_number(json, name, item);
-		else if (type == OBS_DATA_BOOLEAN)
-			set_json_bool(json, name, item);
-		else if (type == OBS_DATA_OBJECT)
-			set_json_obj(json, name, item);
-		else if (type == OBS_DATA_ARRAY)
-			set_json_array(json, name, item);
+		if (!first)
+			dstr_cat_ch(out, ',');
+
+		/* values json can't represent (invalid utf-8, nan) are left
+		 * out, same as before */
+		if (json_write_string(out, get_item_name(item))) {
+			dstr_cat_ch(out, ':');
+			if (json_write_value(out, item)) {
+				first = false;
+				continue;
+			}
+		}
+
+		out->len = start;
+		out->array[start] = 0;
 	}
 
-	return json;
+	dstr_cat_ch(out, '}');
 }
 
 /* ------------------------------------------------------------------------- */
@@ -633,22 +1327,23 @@ obs_data_t *obs_data_create()
 obs_data_t *obs_data_create_from_json(const char *json_string)
 {
 	obs_data_t *data = obs_data_create();
+	struct json_parser parser = {0};
 
-	json_error_t error;
-	json_t *root = json_loads(json_string, JSON_REJECT_DUPLICATES, &error);
+	parser.pos = json_string ? json_string : "";
+	parser.line = 1;
 
-	if (root) {
-		obs_data_add_json_object_data(data, root);
-		json_decref(root);
-	} else {
+	if (!json_parse_root(&parser, data)) {
 		blog(LOG_ERROR,
 		     "obs-data.c: [obs_data_create_from_json] "
 		     "Failed reading json string (%d): %s",
-		     error.line, error.text);
+		     parser.line, parser.error.array);
 		obs_data_release(data);
 		data = NULL;
 	}
 
+	dstr_free(&parser.key);
+	dstr_free(&parser.str);
+	dstr_free(&parser.error);
 	return data;
 }
 
@@ -706,14 +1401,16 @@ static inline void obs_data_destroy(struct obs_data *data)
 {
 	struct obs_data_item *item = data->first_item;
 
+	bfree(data->index);
+	data->index = NULL;
+
 	while (item) {
 		struct obs_data_item *next = item->next;
 		obs_data_item_release(&item);
 		item = next;
 	}
 
-	/* NOTE: don't use bfree for json text, allocated by json */
-	free(data->json);
+	bfree(data->json);
 	bfree(data);
 }
 
@@ -731,13 +1428,11 @@ const char *obs_data_get_json(obs_data_t *data)
 	if (!data)
 		return NULL;
 
-	/* NOTE: don't use libobs bfree for json text */
-	free(data->json);
-	data->json = NULL;
+	struct dstr json = {0};
 
-	json_t *root = obs_data_to_json(data);
-	data->json = json_dumps(root, JSON_PRESERVE_ORDER | JSON_COMPACT);
-	json_decref(root);
+	bfree(data->json);
+	json_write_object(&json, data);
+	data->json = json.array;
 
 	return data->json;
 }
@@ -869,6 +1564,9 @@ static struct obs_data_item *get_item(struct obs_data *data, const char *name)
 	if (!data)
 		return NULL;
 
+	if (data->index)
+		return index_get(data, name);
+
 	struct obs_data_item *item = data->first_item;
 
 	while (item) {
@@ -891,31 +1589,8 @@ static void set_item_data(struct obs_data *data, struct obs_data_item **item,
 	if ((!item || !*item) && data) {
 		new_item = obs_data_item_create(name, ptr, size, type,
 						default_data, autoselect_data);
-
-		obs_data_item_t *prev = obs_data_first(data);
-		obs_data_item_t *next = obs_data_first(data);
-		obs_data_item_next(&next);
-		for (; prev && next;
-		     obs_data_item_next(&prev), obs_data_item_next(&next)) {
-			if (strcmp(get_item_name(next), name) > 0)
-				break;
-		}
-
-		new_item->parent = data;
-		if (prev && strcmp(get_item_name(prev), name) < 0) {
-			prev->next = new_item;
-			new_item->next = next;
-
-		} else {
-			data->first_item = new_item;
-			new_item->next = prev;
-		}
-
-		if (!prev)
-			data->first_item = new_item;
-
-		obs_data_item_release(&prev);
-		obs_data_item_release(&next);
+		if (new_item)
+			obs_data_item_insert(data, new_item);
 
 	} else if (default_data) {
 		obs_data_item_set_default_data(item, ptr, size, type);
@@ -851,38 +851,44 @@ static inline bool get_sei(const struct obs_encoder *encoder, uint8_t **sei,
 	return false;
 }
 
+/* set in the reference count of packet data allocated with bpool_malloc, other
+ * packet data (e.g. from obs_parse_avc_packet) comes from bmalloc */
+#define PACKET_POOL_FLAG (1L << 30)
+
 static void send_first_video_packet(struct obs_encoder *encoder,
 				    struct encoder_callback *cb,
 				    struct encoder_packet *packet)
 {
 	struct encoder_packet first_packet;
-	DARRAY(uint8_t) data;
 	uint8_t *sei;
 	size_t size;
+	long *p_refs;
 
 	/* always wait for first keyframe */
 	if (!packet->keyframe)
 		return;
 
-	da_init(data);
-
 	if (!get_sei(encoder, &sei, &size) || !sei || !size) {
 		cb->new_packet(cb->param, packet);
 		cb->sent_first_packet = true;
 		return;
 	}
 
-	da_push_back_array(data, sei, size);
-	da_push_back_array(data, packet->data, packet->size);
+	/* outputs reference packets rather than copying them, so this needs
+	 * the same refcounted layout as obs_encoder_packet_create_instance */
+	p_refs = bpool_malloc(sizeof(long) + size + packet->size);
+	*p_refs = PACKET_POOL_FLAG | 1;
 
 	first_packet = *packet;
-	first_packet.data = data.array;
-	first_packet.size = data.num;
+	first_packet.data = (uint8_t *)(p_refs + 1);
+	first_packet.size = size + packet->size;
+	memcpy(first_packet.data, sei, size);
+	memcpy(first_packet.data + size, packet->data, packet->size);
 
 	cb->new_packet(cb->param, &first_packet);
 	cb->sent_first_packet = true;
 
-	da_free(data);
+	obs_encoder_packet_release(&first_packet);
 }
 
 static inline void send_packet(struct obs_encoder *encoder,
@@ -947,10 +953,19 @@ void send_off_encoder_packet(obs_encoder_t *encoder, bool success,
 
 		pthread_mutex_lock(&encoder->callbacks_mutex);
 
-		for (size_t i = encoder->callbacks.num; i > 0; i--) {
-			struct encoder_callback *cb;
-			cb = encoder->callbacks.array + (i - 1);
-			send_packet(encoder, cb, pkt);
+		/* the packet data is copied once and then shared by every
+		 * output, which only take references to it */
+		if (encoder->callbacks.num) {
+			struct encoder_packet shared;
+			obs_encoder_packet_create_instance(&shared, pkt);
+
+			for (size_t i = encoder->callbacks.num; i > 0; i--) {
+				struct encoder_callback *cb;
+				cb = encoder->callbacks.array + (i - 1);
+				send_packet(encoder, cb, &shared);
+			}
+
+			obs_encoder_packet_release(&shared);
 		}
 
 		pthread_mutex_unlock(&encoder->callbacks_mutex);
@@ -1314,9 +1329,9 @@ void obs_encoder_packet_create_instance(struct encoder_packet *dst,
 	long *p_refs;
 
 	*dst = *src;
-	p_refs = bmalloc(src->size + sizeof(long));
+	p_refs = bpool_malloc(src->size + sizeof(long));
 	dst->data = (void *)(p_refs + 1);
-	*p_refs = 1;
+	*p_refs = PACKET_POOL_FLAG | 1;
 	memcpy(dst->data, src->data, src->size);
 }
 
@@ -1354,8 +1369,12 @@ void obs_encoder_packet_release(struct encoder_packet *pkt)
 
 	if (pkt->data) {
 		long *p_refs = ((long *)pkt->data) - 1;
-		if (os_atomic_dec_long(p_refs) == 0)
+		long refs = os_atomic_dec_long(p_refs);
+
+		if (refs == 0)
 			bfree(p_refs);
+		else if (refs == PACKET_POOL_FLAG)
+			bpool_free(p_refs);
 	}
 
 	memset(pkt, 0, sizeof(struct encoder_packet));
@@ -0,0 +1,173 @@
+/******************************************************************************
+    Copyright (C) 2015 by Hugh Bailey <obs.jim@gmail.com>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+******************************************************************************/
+
+#include <stdlib.h>
+#include "obs-interleave.h"
+
+bool interleave_packet_before(const struct encoder_packet *a,
+			      const struct encoder_packet *b)
+{
+	if (a->dts_usec != b->dts_usec)
+		return a->dts_usec < b->dts_usec;
+	if (a->type != b->type)
+		return a->type == OBS_ENCODER_VIDEO;
+	return a->track_idx < b->track_idx;
+}
+
+#define INTERLEAVE_QUEUE_MIN_COMPACT 64
+
+void interleave_queue_pop_front(struct interleave_queue *q,
+				struct encoder_packet *out)
+{
+	*out = q->packets.array[q->first++];
+
+	if (q->first == q->packets.num) {
+		da_resize(q->packets, 0);
+		q->first = 0;
+
+	} else if (q->first >= INTERLEAVE_QUEUE_MIN_COMPACT &&
+		   q->first * 2 >= q->packets.num) {
+		da_erase_range(q->packets, 0, q->first);
+		q->first = 0;
+	}
+}
+
+void interleave_insert(struct interleave_queue *queues,
+		       const struct encoder_packet *packet)
+{
+	struct interleave_queue *q =
+		interleave_get_queue(queues, packet->type, packet->track_idx);
+	size_t idx = q->packets.num;
+
+	/* packets of a track normally arrive in order, so this rarely has to
+	 * look further back than the last packet */
+	while (idx > q->first &&
+	       interleave_packet_before(packet, q->packets.array + idx - 1))
+		idx--;
+
+	da_insert(q->packets, idx, packet);
+}
+
+struct interleave_queue *interleave_first_queue(struct interleave_queue *queues)
+{
+	struct interleave_queue *first = NULL;
+
+	for (size_t i = 0; i < INTERLEAVE_TRACKS; i++) {
+		struct interleave_queue *q = &queues[i];
+
+		if (!interleave_queue_count(q))
+			continue;
+		if (!first ||
+		    interleave_packet_before(interleave_queue_front(q),
+					     interleave_queue_front(first)))
+			first = q;
+	}
+
+	return first;
+}
+
+struct encoder_packet *interleave_get_start(struct interleave_queue *queues)
+{
+	int64_t closest_diff = 0x7FFFFFFFFFFFFFFFLL;
+	struct encoder_packet *first_video =
+		interleave_queue_front(&queues[0]);
+	struct encoder_packet *closest = NULL;
+
+	if (!first_video)
+		return NULL;
+
+	for (size_t i = 1; i < INTERLEAVE_TRACKS; i++) {
+		struct interleave_queue *q = &queues[i];
+
+		for (size_t j = 0; j < interleave_queue_count(q); j++) {
+			struct encoder_packet *packet =
+				interleave_queue_get(q, j);
+			int64_t diff =
+				llabs(packet->dts_usec - first_video->dts_usec);
+
+			if (diff < closest_diff ||
+			    (diff == closest_diff &&
+			     interleave_packet_before(packet, closest))) {
+				closest_diff = diff;
+				closest = packet;
+			}
+
+			/* the queue is sorted, so it only gets further away
+			 * from here */
+			if (packet->dts_usec >= first_video->dts_usec)
+				break;
+		}
+	}
+
+	if (!closest)
+		return NULL;
+
+	return interleave_packet_before(first_video, closest) ? first_video
+							      : closest;
+}
+
+void interleave_discard_to(struct interleave_queue *queues,
+			   const struct encoder_packet *start, bool inclusive)
+{
+	struct encoder_packet key = *start;
+
+	for (size_t i = 0; i < INTERLEAVE_TRACKS; i++) {
+		struct interleave_queue *q = &queues[i];
+
+		while (interleave_queue_count(q)) {
+			struct encoder_packet *packet =
+				interleave_queue_front(q);
+			struct encoder_packet out;
+
+			if (inclusive ? interleave_packet_before(&key, packet)
+				      : !interleave_packet_before(packet, &key))
+				break;
+
+			interleave_queue_pop_front(q, &out);
+			obs_encoder_packet_release(&out);
+		}
+	}
+}
+
+void interleave_discard_before(struct interleave_queue *queues,
+			       int64_t dts_usec)
+{
+	for (size_t i = 0; i < INTERLEAVE_TRACKS; i++) {
+		struct interleave_queue *q = &queues[i];
+
+		while (interleave_queue_count(q) &&
+		       interleave_queue_front(q)->dts_usec < dts_usec) {
+			struct encoder_packet out;
+
+			interleave_queue_pop_front(q, &out);
+			obs_encoder_packet_release(&out);
+		}
+	}
+}
+
+void interleave_free(struct interleave_queue *queues)
+{
+	for (size_t i = 0; i < INTERLEAVE_TRACKS; i++) {
+		struct interleave_queue *q = &queues[i];
+
+		for (size_t j = q->first; j < q->packets.num; j++)
+			obs_encoder_packet_release(q->packets.array + j);
+
+		da_free(q->packets);
+		q->first = 0;
+	}
+}
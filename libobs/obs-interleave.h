@@ -0,0 +1,101 @@
+/******************************************************************************
+    Copyright (C) 2015 by Hugh Bailey <obs.jim@gmail.com>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+******************************************************************************/
+
+#pragma once
+
+#include "util/darray.h"
+#include "obs.h"
+
+/*
+ * Queues of encoded packets waiting to be interleaved by an output, one per
+ * track (the video track first, followed by each audio track).  Every queue
+ * is sorted by dts, so the next packet to send is the earliest of the queue
+ * fronts.
+ */
+
+#define INTERLEAVE_TRACKS (MAX_AUDIO_MIXES + 1)
+
+/* popping only advances 'first', the consumed part of the array is dropped
+ * once it makes up half of it */
+struct interleave_queue {
+	DARRAY(struct encoder_packet) packets;
+	size_t first;
+};
+
+static inline size_t interleave_queue_count(const struct interleave_queue *q)
+{
+	return q->packets.num - q->first;
+}
+
+static inline struct encoder_packet *
+interleave_queue_get(struct interleave_queue *q, size_t idx)
+{
+	return q->packets.array + q->first + idx;
+}
+
+static inline struct encoder_packet *
+interleave_queue_front(struct interleave_queue *q)
+{
+	return interleave_queue_count(q) ? interleave_queue_get(q, 0) : NULL;
+}
+
+static inline struct encoder_packet *
+interleave_queue_back(struct interleave_queue *q)
+{
+	return interleave_queue_count(q) ? q->packets.array + q->packets.num - 1
+					 : NULL;
+}
+
+static inline struct interleave_queue *
+interleave_get_queue(struct interleave_queue *queues,
+		     enum obs_encoder_type type, size_t audio_idx)
+{
+	return type == OBS_ENCODER_VIDEO ? &queues[0] : &queues[audio_idx + 1];
+}
+
+/* order in which packets are sent: by dts, and video ahead of audio with the
+ * same dts */
+extern bool interleave_packet_before(const struct encoder_packet *a,
+				     const struct encoder_packet *b);
+
+extern void interleave_queue_pop_front(struct interleave_queue *q,
+				       struct encoder_packet *out);
+
+extern void interleave_insert(struct interleave_queue *queues,
+			      const struct encoder_packet *packet);
+
+/* gets the queue holding the next packet to send, or NULL if all are empty */
+extern struct interleave_queue *
+interleave_first_queue(struct interleave_queue *queues);
+
+/* gets the packet at which audio and video are closest together, NULL if
+ * there's no video or no audio */
+extern struct encoder_packet *
+interleave_get_start(struct interleave_queue *queues);
+
+/* releases every packet sent before 'start' (or, if 'inclusive' is set,
+ * every packet up to and including it) */
+extern void interleave_discard_to(struct interleave_queue *queues,
+				  const struct encoder_packet *start,
+				  bool inclusive);
+
+/* releases every packet with a dts lower than dts_usec */
+extern void interleave_discard_before(struct interleave_queue *queues,
+				      int64_t dts_usec);
+
+/* releases every queued packet and frees the queues */
+extern void interleave_free(struct interleave_queue *queues);
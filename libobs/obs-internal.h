@@ -24,6 +24,7 @@
 #include "util/threading.h"
 #include "util/platform.h"
 #include "util/profiler.h"
+#include "util/worker-pool.h"
 #include "callback/signal.h"
 #include "callback/proc.h"
 
@@ -35,6 +36,7 @@
 #include "media-io/audio-io.h"
 
 #include "obs.h"
+#include "obs-interleave.h"
 
 #include <caption/caption.h>
 
@@ -328,6 +330,10 @@ struct obs_core_audio {
 	DARRAY(struct obs_source *) render_order;
 	DARRAY(struct obs_source *) root_nodes;
 
+	worker_pool_t *render_pool;
+	uint64_t independent_render_ns;
+	int render_sample_ticks;
+
 	uint64_t buffered_ts;
 	struct circlebuf buffered_timestamps;
 	int buffering_wait_ticks;
@@ -341,6 +347,16 @@ struct obs_core_audio {
 	char *monitoring_device_id;
 };
 
+/* name lookup for public contexts, chained through the contexts themselves.
+ * lookups only take the read lock, so they don't wait on the list mutex that
+ * the graphics thread holds while it ticks every source */
+struct obs_name_index {
+	pthread_rwlock_t lock;
+	struct obs_context_data **buckets;
+	size_t num_buckets;
+	size_t count;
+};
+
 /* user sources, output channels, and displays */
 struct obs_core_data {
 	struct obs_source *first_source;
@@ -357,6 +373,7 @@ struct obs_core_data {
 	pthread_mutex_t services_mutex;
 	pthread_mutex_t audio_sources_mutex;
 	pthread_mutex_t draw_callbacks_mutex;
+	struct obs_name_index source_names;
 	DARRAY(struct draw_callback) draw_callbacks;
 	DARRAY(struct tick_callback) tick_callbacks;
 
@@ -426,6 +443,10 @@ struct obs_core {
 	bool name_store_owned;
 	profiler_name_store_t *name_store;
 
+	/* shared by anything that wants to split large CPU work (such as
+	 * copying async frames) across threads */
+	worker_pool_t *worker_pool;
+
 	/* segmented into multiple sub-structures to keep things a bit more
 	 * clean and organized */
 	struct obs_core_video video;
@@ -497,6 +518,10 @@ struct obs_context_data {
 	struct obs_context_data *next;
 	struct obs_context_data **prev_next;
 
+	struct obs_name_index *name_index;
+	struct obs_context_data *name_next;
+	uint32_t name_hash;
+
 	bool private;
 };
 
@@ -513,6 +538,13 @@ extern void obs_context_data_remove(struct obs_context_data *context);
 extern void obs_context_data_setname(struct obs_context_data *context,
 				     const char *name);
 
+extern bool obs_name_index_init(struct obs_name_index *index);
+extern void obs_name_index_free(struct obs_name_index *index);
+extern void obs_name_index_add(struct obs_name_index *index,
+			       struct obs_context_data *context);
+extern void *obs_name_index_find(struct obs_name_index *index,
+				 const char *name, void *(*addref)(void *));
+
 /* ------------------------------------------------------------------------- */
 /* ref-counting  */
 
@@ -563,6 +595,24 @@ struct async_frame {
 	bool used;
 };
 
+/* frame whose planes are owned by the source that output it, rather than by
+ * the async cache.  frame.borrowed is set so the frame can be told apart from
+ * cached frames without looking it up */
+struct async_borrowed_frame {
+	struct obs_source_frame frame;
+	struct obs_source *source;
+	void (*release)(void *param);
+	void *param;
+	bool queued;
+};
+
+/* parameter slots of "void volume(ptr source, in out float volume)" in
+ * source_signals, for volume_layout */
+enum source_volume_param {
+	SOURCE_VOLUME_PARAM_SOURCE,
+	SOURCE_VOLUME_PARAM_VOLUME,
+};
+
 enum audio_action_type {
 	AUDIO_ACTION_VOL,
 	AUDIO_ACTION_MUTE,
@@ -668,6 +718,7 @@ struct obs_source {
 	uint32_t audio_mixers;
 	float user_volume;
 	float volume;
+	const calldata_layout_t *volume_layout;
 	int64_t sync_offset;
 	int64_t last_sync_offset;
 	float balance;
@@ -691,6 +742,7 @@ struct obs_source {
 	bool async_decoupled;
 	struct obs_source_frame *async_preload_frame;
 	DARRAY(struct async_frame) async_cache;
+	DARRAY(struct async_borrowed_frame *) async_borrowed;
 	DARRAY(struct obs_source_frame *) async_frames;
 	pthread_mutex_t async_mutex;
 	uint32_t async_width;
@@ -940,7 +992,7 @@ struct obs_output {
 	pthread_t end_data_capture_thread;
 	os_event_t *stopping_event;
 	pthread_mutex_t interleaved_mutex;
-	DARRAY(struct encoder_packet) interleaved_packets;
+	struct interleave_queue interleaved_packets[INTERLEAVE_TRACKS];
 	int stop_code;
 
 	int reconnect_retry_sec;
@@ -167,10 +167,7 @@ fail:
 
 static inline void free_packets(struct obs_output *output)
 {
-	for (size_t i = 0; i < output->interleaved_packets.num; i++)
-		obs_encoder_packet_release(output->interleaved_packets.array +
-					   i);
-	da_free(output->interleaved_packets);
+	interleave_free(output->interleaved_packets);
 }
 
 static inline void clear_audio_buffers(obs_output_t *output)
@@ -1304,15 +1301,20 @@ double last_caption_timestamp = 0;
 
 static inline void send_interleaved(struct obs_output *output)
 {
-	struct encoder_packet out = output->interleaved_packets.array[0];
+	struct interleave_queue *q =
+		interleave_first_queue(output->interleaved_packets);
+	struct encoder_packet out;
+
+	if (!q)
+		return;
 
 	/* do not send an interleaved packet if there's no packet of the
 	 * opposing type of a higher timestamp in the interleave buffer.
 	 * this ensures that the timestamps are monotonic */
-	if (!has_higher_opposing_ts(output, &out))
+	if (!has_higher_opposing_ts(output, interleave_queue_front(q)))
 		return;
 
-	da_erase(output->interleaved_packets, 0);
+	interleave_queue_pop_front(q, &out);
 
 	if (out.type == OBS_ENCODER_VIDEO) {
 		output->total_frames++;
@@ -1364,184 +1366,104 @@ static inline void set_higher_ts(struct obs_output *output,
 
 static inline struct encoder_packet *
 find_first_packet_type(struct obs_output *output, enum obs_encoder_type type,
-		       size_t audio_idx);
-static int find_first_packet_type_idx(struct obs_output *output,
-				      enum obs_encoder_type type,
-				      size_t audio_idx);
-
-/* gets the point where audio and video are closest together */
-static size_t get_interleaved_start_idx(struct obs_output *output)
-{
-	int64_t closest_diff = 0x7FFFFFFFFFFFFFFFLL;
-	struct encoder_packet *first_video =
-		find_first_packet_type(output, OBS_ENCODER_VIDEO, 0);
-	size_t video_idx = DARRAY_INVALID;
-	size_t idx = 0;
-
-	for (size_t i = 0; i < output->interleaved_packets.num; i++) {
-		struct encoder_packet *packet =
-			&output->interleaved_packets.array[i];
-		int64_t diff;
-
-		if (packet->type != OBS_ENCODER_AUDIO) {
-			if (packet == first_video)
-				video_idx = i;
-			continue;
-		}
-
-		diff = llabs(packet->dts_usec - first_video->dts_usec);
-		if (diff < closest_diff) {
-			closest_diff = diff;
-			idx = i;
-		}
-	}
+		       size_t audio_idx)
+{
+	return interleave_queue_front(interleave_get_queue(
+		output->interleaved_packets, type, audio_idx));
+}
 
-	return video_idx < idx ? video_idx : idx;
+static inline struct encoder_packet *
+find_last_packet_type(struct obs_output *output, enum obs_encoder_type type,
+		      size_t audio_idx)
+{
+	return interleave_queue_back(interleave_get_queue(
+		output->interleaved_packets, type, audio_idx));
 }
 
-static int prune_premature_packets(struct obs_output *output)
+/* returns -1 if a track hasn't received any packets yet.  otherwise, if the
+ * first video packet is too far away from audio, returns 1 and sets *last to
+ * the last of the first packets of each track, which should all be pruned */
+static int prune_premature_packets(struct obs_output *output,
+				   struct encoder_packet **last)
 {
 	size_t audio_mixes = num_audio_mixes(output);
 	struct encoder_packet *video;
-	int video_idx;
-	int max_idx;
 	int64_t duration_usec;
 	int64_t max_diff = 0;
 	int64_t diff = 0;
 
-	video_idx = find_first_packet_type_idx(output, OBS_ENCODER_VIDEO, 0);
-	if (video_idx == -1) {
+	video = find_first_packet_type(output, OBS_ENCODER_VIDEO, 0);
+	if (!video) {
 		output->received_video = false;
 		return -1;
 	}
 
-	max_idx = video_idx;
-	video = &output->interleaved_packets.array[video_idx];
+	*last = video;
 	duration_usec = video->timebase_num * 1000000LL / video->timebase_den;
 
 	for (size_t i = 0; i < audio_mixes; i++) {
 		struct encoder_packet *audio;
-		int audio_idx;
 
-		audio_idx = find_first_packet_type_idx(output,
-						       OBS_ENCODER_AUDIO, i);
-		if (audio_idx == -1) {
+		audio = find_first_packet_type(output, OBS_ENCODER_AUDIO, i);
+		if (!audio) {
 			output->received_audio = false;
 			return -1;
 		}
 
-		audio = &output->interleaved_packets.array[audio_idx];
-		if (audio_idx > max_idx)
-			max_idx = audio_idx;
+		if (interleave_packet_before(*last, audio))
+			*last = audio;
 
 		diff = audio->dts_usec - video->dts_usec;
 		if (diff > max_diff)
 			max_diff = diff;
 	}
 
-	return diff > duration_usec ? max_idx + 1 : 0;
-}
-
-static void discard_to_idx(struct obs_output *output, size_t idx)
-{
-	for (size_t i = 0; i < idx; i++) {
-		struct encoder_packet *packet =
-			&output->interleaved_packets.array[i];
-		obs_encoder_packet_release(packet);
-	}
-
-	da_erase_range(output->interleaved_packets, 0, idx);
+	return diff > duration_usec ? 1 : 0;
 }
 
 #define DEBUG_STARTING_PACKETS 0
 
 static bool prune_interleaved_packets(struct obs_output *output)
 {
-	size_t start_idx = 0;
-	int prune_start = prune_premature_packets(output);
+	struct encoder_packet *last_premature = NULL;
+	int prune_start = prune_premature_packets(output, &last_premature);
 
 #if DEBUG_STARTING_PACKETS == 1
 	blog(LOG_DEBUG, "--------- Pruning! %d ---------", prune_start);
-	for (size_t i = 0; i < output->interleaved_packets.num; i++) {
-		struct encoder_packet *packet =
-			&output->interleaved_packets.array[i];
-		blog(LOG_DEBUG, "packet: %s %d, ts: %lld, pruned = %s",
-		     packet->type == OBS_ENCODER_AUDIO ? "audio" : "video",
-		     (int)packet->track_idx, packet->dts_usec,
-		     (int)i < prune_start ? "true" : "false");
+	for (size_t i = 0; i < INTERLEAVE_TRACKS; i++) {
+		struct interleave_queue *q = &output->interleaved_packets[i];
+
+		for (size_t j = 0; j < interleave_queue_count(q); j++) {
+			struct encoder_packet *packet =
+				interleave_queue_get(q, j);
+			blog(LOG_DEBUG, "packet: %s %d, ts: %lld, pruned = %s",
+			     packet->type == OBS_ENCODER_AUDIO ? "audio"
+							       : "video",
+			     (int)packet->track_idx, packet->dts_usec,
+			     prune_start == 1 && !interleave_packet_before(
+							     last_premature,
+							     packet)
+				     ? "true"
+				     : "false");
+		}
 	}
 #endif
 
 	/* prunes the first video packet if it's too far away from audio */
-	if (prune_start == -1)
+	if (prune_start == -1) {
 		return false;
-	else if (prune_start != 0)
-		start_idx = (size_t)prune_start;
-	else
-		start_idx = get_interleaved_start_idx(output);
-
-	if (start_idx)
-		discard_to_idx(output, start_idx);
-
-	return true;
-}
-
-static int find_first_packet_type_idx(struct obs_output *output,
-				      enum obs_encoder_type type,
-				      size_t audio_idx)
-{
-	for (size_t i = 0; i < output->interleaved_packets.num; i++) {
-		struct encoder_packet *packet =
-			&output->interleaved_packets.array[i];
-
-		if (packet->type == type) {
-			if (type == OBS_ENCODER_AUDIO &&
-			    packet->track_idx != audio_idx) {
-				continue;
-			}
-
-			return (int)i;
-		}
-	}
-
-	return -1;
-}
-
-static int find_last_packet_type_idx(struct obs_output *output,
-				     enum obs_encoder_type type,
-				     size_t audio_idx)
-{
-	for (size_t i = output->interleaved_packets.num; i > 0; i--) {
-		struct encoder_packet *packet =
-			&output->interleaved_packets.array[i - 1];
-
-		if (packet->type == type) {
-			if (type == OBS_ENCODER_AUDIO &&
-			    packet->track_idx != audio_idx) {
-				continue;
-			}
-
-			return (int)(i - 1);
-		}
+	} else if (prune_start != 0) {
+		interleave_discard_to(output->interleaved_packets,
+				      last_premature, true);
+	} else {
+		struct encoder_packet *start =
+			interleave_get_start(output->interleaved_packets);
+		if (start)
+			interleave_discard_to(output->interleaved_packets,
+					      start, false);
 	}
 
-	return -1;
-}
-
-static inline struct encoder_packet *
-find_first_packet_type(struct obs_output *output, enum obs_encoder_type type,
-		       size_t audio_idx)
-{
-	int idx = find_first_packet_type_idx(output, type, audio_idx);
-	return (idx != -1) ? &output->interleaved_packets.array[idx] : NULL;
-}
-
-static inline struct encoder_packet *
-find_last_packet_type(struct obs_output *output, enum obs_encoder_type type,
-		      size_t audio_idx)
-{
-	int idx = find_last_packet_type_idx(output, type, audio_idx);
-	return (idx != -1) ? &output->interleaved_packets.array[idx] : NULL;
+	return true;
 }
 
 static bool get_audio_and_video_packets(struct obs_output *output,
@@ -1574,7 +1496,7 @@ static bool initialize_interleaved_packets(struct obs_output *output)
 	struct encoder_packet *audio[MAX_AUDIO_MIXES];
 	struct encoder_packet *last_audio[MAX_AUDIO_MIXES];
 	size_t audio_mixes = num_audio_mixes(output);
-	size_t start_idx;
+	struct encoder_packet *start;
 
 	if (!get_audio_and_video_packets(output, &video, audio, audio_mixes))
 		return false;
@@ -1592,9 +1514,10 @@ static bool initialize_interleaved_packets(struct obs_output *output)
 	}
 
 	/* clear out excess starting audio if it hasn't been already */
-	start_idx = get_interleaved_start_idx(output);
-	if (start_idx) {
-		discard_to_idx(output, start_idx);
+	start = interleave_get_start(output->interleaved_packets);
+	if (start) {
+		interleave_discard_to(output->interleaved_packets, start,
+				      false);
 		if (!get_audio_and_video_packets(output, &video, audio,
 						 audio_mixes))
 			return false;
@@ -1620,64 +1543,17 @@ static bool initialize_interleaved_packets(struct obs_output *output)
 	output->highest_audio_ts -= audio[0]->dts_usec;
 	output->highest_video_ts -= video->dts_usec;
 
-	/* apply new offsets to all existing packet DTS/PTS values */
-	for (size_t i = 0; i < output->interleaved_packets.num; i++) {
-		struct encoder_packet *packet =
-			&output->interleaved_packets.array[i];
-		apply_interleaved_packet_offset(output, packet);
-	}
-
-	return true;
-}
-
-static inline void insert_interleaved_packet(struct obs_output *output,
-					     struct encoder_packet *out)
-{
-	size_t idx;
-	for (idx = 0; idx < output->interleaved_packets.num; idx++) {
-		struct encoder_packet *cur_packet;
-		cur_packet = output->interleaved_packets.array + idx;
-
-		if (out->dts_usec == cur_packet->dts_usec &&
-		    out->type == OBS_ENCODER_VIDEO) {
-			break;
-		} else if (out->dts_usec < cur_packet->dts_usec) {
-			break;
-		}
-	}
-
-	da_insert(output->interleaved_packets, idx, out);
-}
-
-static void resort_interleaved_packets(struct obs_output *output)
-{
-	DARRAY(struct encoder_packet) old_array;
-
-	old_array.da = output->interleaved_packets.da;
-	memset(&output->interleaved_packets, 0,
-	       sizeof(output->interleaved_packets));
-
-	for (size_t i = 0; i < old_array.num; i++)
-		insert_interleaved_packet(output, &old_array.array[i]);
-
-	da_free(old_array);
-}
-
-static void discard_unused_audio_packets(struct obs_output *output,
-					 int64_t dts_usec)
-{
-	size_t idx = 0;
+	/* apply new offsets to all existing packet DTS/PTS values.  each track
+	 * is offset as a whole, so the queues stay sorted */
+	for (size_t i = 0; i < INTERLEAVE_TRACKS; i++) {
+		struct interleave_queue *q = &output->interleaved_packets[i];
 
-	for (; idx < output->interleaved_packets.num; idx++) {
-		struct encoder_packet *p =
-			&output->interleaved_packets.array[idx];
-
-		if (p->dts_usec >= dts_usec)
-			break;
+		for (size_t j = 0; j < interleave_queue_count(q); j++)
+			apply_interleaved_packet_offset(
+				output, interleave_queue_get(q, j));
 	}
 
-	if (idx)
-		discard_to_idx(output, idx);
+	return true;
 }
 
 static void interleave_packets(void *data, struct encoder_packet *packet)
@@ -1697,7 +1573,8 @@ static void interleave_packets(void *data, struct encoder_packet *packet)
 	/* if first video frame is not a keyframe, discard until received */
 	if (!output->received_video && packet->type == OBS_ENCODER_VIDEO &&
 	    !packet->keyframe) {
-		discard_unused_audio_packets(output, packet->dts_usec);
+		interleave_discard_before(output->interleaved_packets,
+					  packet->dts_usec);
 		pthread_mutex_unlock(&output->interleaved_mutex);
 
 		if (output->active_delay_ns)
@@ -1710,14 +1587,14 @@ static void interleave_packets(void *data, struct encoder_packet *packet)
 	if (output->active_delay_ns)
 		out = *packet;
 	else
-		obs_encoder_packet_create_instance(&out, packet);
+		obs_encoder_packet_ref(&out, packet);
 
 	if (was_started)
 		apply_interleaved_packet_offset(output, &out);
 	else
 		check_received(output, packet);
 
-	insert_interleaved_packet(output, &out);
+	interleave_insert(output->interleaved_packets, &out);
 	set_higher_ts(output, &out);
 
 	/* when both video and audio have been received, we're ready
@@ -1725,10 +1602,8 @@ static void interleave_packets(void *data, struct encoder_packet *packet)
 	if (output->received_audio && output->received_video) {
 		if (!was_started) {
 			if (prune_interleaved_packets(output)) {
-				if (initialize_interleaved_packets(output)) {
-					resort_interleaved_packets(output);
+				if (initialize_interleaved_packets(output))
 					send_interleaved(output);
-				}
 			}
 		} else {
 			send_interleaved(output);
@@ -19,6 +19,8 @@
 #include "util/threading.h"
 #include "util/util_uint64.h"
 #include "graphics/math-defs.h"
+#include "media-io/audio-math.h"
+#include "media-io/audio-mix.h"
 #include "obs-scene.h"
 #include "obs-internal.h"
 
@@ -59,6 +61,12 @@ static const char *obs_scene_signals[] = {
 	NULL,
 };
 
+/* parameter slots of "item_transform", for transform_layout */
+enum item_transform_param {
+	ITEM_TRANSFORM_PARAM_SCENE,
+	ITEM_TRANSFORM_PARAM_ITEM,
+};
+
 static inline void signal_item_remove(struct obs_scene_item *item)
 {
 	struct calldata params;
@@ -97,6 +105,8 @@ static void *scene_create(obs_data_t *settings, struct obs_source *source)
 
 	signal_handler_add_array(obs_source_get_signal_handler(source),
 				 obs_scene_signals);
+	scene->transform_layout = signal_handler_get_layout(
+		obs_source_get_signal_handler(source), "item_transform");
 
 	if (pthread_mutexattr_init(&attr) != 0)
 		goto fail;
@@ -112,6 +122,11 @@ static void *scene_create(obs_data_t *settings, struct obs_source *source)
 				"mutex");
 		goto fail;
 	}
+	if (pthread_rwlock_init(&scene->id_index_lock, NULL) != 0) {
+		blog(LOG_ERROR, "scene_create: Couldn't initialize id index "
+				"lock");
+		goto fail;
+	}
 
 	UNUSED_PARAMETER(settings);
 	return scene;
@@ -141,12 +156,15 @@ static inline void full_unlock(struct obs_scene *scene)
 
 static void set_visibility(struct obs_scene_item *item, bool vis);
 static inline void detach_sceneitem(struct obs_scene_item *item);
+static inline void id_index_remove(struct obs_scene *scene,
+				   struct obs_scene_item *item);
 
 static inline void remove_without_release(struct obs_scene_item *item)
 {
 	item->removed = true;
 	set_visibility(item, false);
 	signal_item_remove(item);
+	id_index_remove(item->parent, item);
 	detach_sceneitem(item);
 }
 
@@ -184,6 +202,8 @@ static void scene_destroy(void *data)
 
 	pthread_mutex_destroy(&scene->video_mutex);
 	pthread_mutex_destroy(&scene->audio_mutex);
+	pthread_rwlock_destroy(&scene->id_index_lock);
+	bfree(scene->id_buckets);
 	bfree(scene);
 }
 
@@ -251,6 +271,105 @@ static void scene_enum_all_sources(void *data,
 	scene_enum_sources(data, enum_callback, param, false);
 }
 
+/* ------------------------------------------------------------------------- */
+/* item id index */
+
+#define ID_INDEX_MIN_BUCKETS 16
+
+static inline size_t id_bucket(struct obs_scene *scene, int64_t id)
+{
+	uint64_t hash = (uint64_t)id * 0x9E3779B97F4A7C15ULL;
+	return (size_t)(hash >> 32) & (scene->id_num_buckets - 1);
+}
+
+static inline void id_index_link(struct obs_scene *scene,
+				 struct obs_scene_item *item)
+{
+	size_t bucket = id_bucket(scene, item->id);
+
+	item->id_next = scene->id_buckets[bucket];
+	scene->id_buckets[bucket] = item;
+}
+
+static void id_index_add_locked(struct obs_scene *scene,
+				struct obs_scene_item *item)
+{
+	if (scene->id_count >= scene->id_num_buckets) {
+		struct obs_scene_item **old = scene->id_buckets;
+		size_t old_size = scene->id_num_buckets;
+
+		scene->id_num_buckets = old_size ? old_size * 2
+						 : ID_INDEX_MIN_BUCKETS;
+		scene->id_buckets =
+			bzalloc(scene->id_num_buckets * sizeof(*old));
+
+		for (size_t i = 0; i < old_size; i++) {
+			struct obs_scene_item *cur = old[i];
+			while (cur) {
+				struct obs_scene_item *next = cur->id_next;
+				id_index_link(scene, cur);
+				cur = next;
+			}
+		}
+
+		bfree(old);
+	}
+
+	id_index_link(scene, item);
+	scene->id_count++;
+}
+
+static void id_index_remove_locked(struct obs_scene *scene,
+				   struct obs_scene_item *item)
+{
+	struct obs_scene_item **prev_next;
+
+	if (!scene->id_num_buckets)
+		return;
+
+	prev_next = &scene->id_buckets[id_bucket(scene, item->id)];
+	while (*prev_next) {
+		if (*prev_next == item) {
+			*prev_next = item->id_next;
+			item->id_next = NULL;
+			scene->id_count--;
+			break;
+		}
+		prev_next = &(*prev_next)->id_next;
+	}
+}
+
+static inline void id_index_add(struct obs_scene *scene,
+				struct obs_scene_item *item)
+{
+	pthread_rwlock_wrlock(&scene->id_index_lock);
+	id_index_add_locked(scene, item);
+	pthread_rwlock_unlock(&scene->id_index_lock);
+}
+
+static inline void id_index_remove(struct obs_scene *scene,
+				   struct obs_scene_item *item)
+{
+	pthread_rwlock_wrlock(&scene->id_index_lock);
+	id_index_remove_locked(scene, item);
+	pthread_rwlock_unlock(&scene->id_index_lock);
+}
+
+/* for when items were moved between scenes by relinking them directly */
+static void id_index_rebuild_locked(struct obs_scene *scene)
+{
+	if (scene->id_num_buckets)
+		memset(scene->id_buckets, 0,
+		       scene->id_num_buckets * sizeof(*scene->id_buckets));
+	scene->id_count = 0;
+
+	for (struct obs_scene_item *item = scene->first_item; item;
+	     item = item->next)
+		id_index_add_locked(scene, item);
+}
+
+/* ------------------------------------------------------------------------- */
+
 static inline void detach_sceneitem(struct obs_scene_item *item)
 {
 	if (item->prev)
@@ -439,8 +558,13 @@ static void update_item_transform(struct obs_scene_item *item, bool update_tex)
 	/* ----------------------- */
 
 	calldata_init_fixed(&params, stack, sizeof(stack));
-	calldata_set_ptr(&params, "item", item);
-	signal_parent(item->parent, "item_transform", &params);
+	calldata_set_layout(&params, item->parent->transform_layout);
+	calldata_set_ptr_at(&params, item->parent->transform_layout,
+			    ITEM_TRANSFORM_PARAM_SCENE, "scene", item->parent);
+	calldata_set_ptr_at(&params, item->parent->transform_layout,
+			    ITEM_TRANSFORM_PARAM_ITEM, "item", item);
+	signal_handler_signal(item->parent->source->context.signals,
+			      "item_transform", &params);
 
 	if (!update_tex)
 		return;
@@ -806,7 +930,7 @@ static void scene_load_item(struct obs_scene *scene, obs_data_t *item_data)
 				 OBS_ALIGN_TOP | OBS_ALIGN_LEFT);
 
 	if (obs_data_has_user_value(item_data, "id"))
-		item->id = obs_data_get_int(item_data, "id");
+		obs_sceneitem_set_id(item, obs_data_get_int(item_data, "id"));
 
 	item->rot = (float)obs_data_get_double(item_data, "rot");
 	item->align = (uint32_t)obs_data_get_int(item_data, "align");
@@ -1120,27 +1244,16 @@ static void process_all_audio_actions(struct obs_scene_item *item,
 		;
 }
 
-static void mix_audio_with_buf(float *p_out, float *p_in, float *buf_in,
-			       size_t pos, size_t count)
+static inline void mix_audio_with_buf(float *p_out, float *p_in,
+				      float *buf_in, size_t pos, size_t count)
 {
-	register float *out = p_out;
-	register float *buf = buf_in + pos;
-	register float *in = p_in + pos;
-	register float *end = in + count;
-
-	while (in < end)
-		*(out++) += *(in++) * *(buf++);
+	mix_audio_samples_mul(p_out, p_in + pos, buf_in + pos, count);
 }
 
 static inline void mix_audio(float *p_out, float *p_in, size_t pos,
 			     size_t count)
 {
-	register float *out = p_out;
-	register float *in = p_in + pos;
-	register float *end = in + count;
-
-	while (in < end)
-		*(out++) += *(in++);
+	mix_audio_samples(p_out, p_in + pos, count);
 }
 
 static bool scene_audio_render(void *data, uint64_t *ts_out,
@@ -1232,8 +1345,11 @@ static bool scene_audio_render(void *data, uint64_t *ts_out,
 
 		obs_source_get_audio_mix(source, &child_audio);
 
+		/* mixes the child isn't routed to are silent, skip them */
+		uint32_t child_mixers = mixers & source->audio_mixers;
+
 		for (size_t mix = 0; mix < MAX_AUDIO_MIXES; mix++) {
-			if ((mixers & (1 << mix)) == 0)
+			if ((child_mixers & (1 << mix)) == 0)
 				continue;
 
 			for (size_t ch = 0; ch < channels; ch++) {
@@ -1628,17 +1744,18 @@ obs_sceneitem_t *obs_scene_find_sceneitem_by_id(obs_scene_t *scene, int64_t id)
 	if (!scene)
 		return NULL;
 
-	full_lock(scene);
+	pthread_rwlock_rdlock(&scene->id_index_lock);
 
-	item = scene->first_item;
+	item = scene->id_num_buckets ? scene->id_buckets[id_bucket(scene, id)]
+				     : NULL;
 	while (item) {
 		if (item->id == id)
 			break;
 
-		item = item->next;
+		item = item->id_next;
 	}
 
-	full_unlock(scene);
+	pthread_rwlock_unlock(&scene->id_index_lock);
 
 	return item;
 }
@@ -1878,6 +1995,7 @@ static obs_sceneitem_t *obs_scene_add_internal(obs_scene_t *scene,
 		}
 	}
 
+	id_index_add(scene, item);
 	full_unlock(scene);
 
 	if (!scene->source->context.private)
@@ -1971,6 +2089,7 @@ void obs_sceneitem_remove(obs_sceneitem_t *item)
 	set_visibility(item, false);
 
 	signal_item_remove(item);
+	id_index_remove(scene, item);
 	detach_sceneitem(item);
 
 	full_unlock(scene);
@@ -2762,7 +2881,18 @@ int64_t obs_sceneitem_get_id(const obs_sceneitem_t *item)
 
 void obs_sceneitem_set_id(obs_sceneitem_t *item, int64_t id)
 {
+	struct obs_scene *scene = item->parent;
+
+	if (!scene) {
+		item->id = id;
+		return;
+	}
+
+	pthread_rwlock_wrlock(&scene->id_index_lock);
+	id_index_remove_locked(scene, item);
 	item->id = id;
+	id_index_add_locked(scene, item);
+	pthread_rwlock_unlock(&scene->id_index_lock);
 }
 
 obs_data_t *obs_sceneitem_get_private_settings(obs_sceneitem_t *item)
@@ -2991,6 +3121,7 @@ obs_sceneitem_t *obs_scene_insert_group(obs_scene_t *scene, const char *name,
 	for (size_t i = count; i > 0; i--) {
 		size_t idx = i - 1;
 		remove_group_transform(item, items[idx]);
+		id_index_remove(scene, items[idx]);
 		detach_sceneitem(items[idx]);
 	}
 	for (size_t i = 0; i < count; i++) {
@@ -3006,6 +3137,9 @@ obs_sceneitem_t *obs_scene_insert_group(obs_scene_t *scene, const char *name,
 		apply_group_transform(items[idx], item);
 	}
 	items[0]->prev = NULL;
+	pthread_rwlock_wrlock(&sub_scene->id_index_lock);
+	id_index_rebuild_locked(sub_scene);
+	pthread_rwlock_unlock(&sub_scene->id_index_lock);
 	resize_group(item);
 	full_unlock(sub_scene);
 	full_unlock(scene);
@@ -3100,6 +3234,7 @@ void obs_sceneitem_group_ungroup(obs_sceneitem_t *item)
 
 	/* ------------------------- */
 
+	id_index_remove(scene, item);
 	detach_sceneitem(item);
 	full_unlock(scene);
 
@@ -3135,8 +3270,10 @@ void obs_sceneitem_group_add_item(obs_sceneitem_t *group, obs_sceneitem_t *item)
 
 	remove_group_transform(group, item);
 
+	id_index_remove(scene, item);
 	detach_sceneitem(item);
 	attach_sceneitem(groupscene, item, NULL);
+	id_index_add(groupscene, item);
 
 	apply_group_transform(item, group);
 
@@ -3166,8 +3303,10 @@ void obs_sceneitem_group_remove_item(obs_sceneitem_t *group,
 
 	remove_group_transform(group, item);
 
+	id_index_remove(groupscene, item);
 	detach_sceneitem(item);
 	attach_sceneitem(scene, item, NULL);
+	id_index_add(scene, item);
 
 	resize_group(group);
 
@@ -3274,6 +3413,10 @@ bool obs_scene_reorder_items2(obs_scene_t *scene,
 		return false;
 	}
 
+	/* items can move in and out of groups here, so the id indices are
+	 * rebuilt, blocking lookups until they are consistent again */
+	pthread_rwlock_wrlock(&scene->id_index_lock);
+
 	for (size_t i = 0; i < item_order_size; i++) {
 		struct obs_sceneitem_order_info *info = &item_order[i];
 		if (!info->item->is_group) {
@@ -3299,6 +3442,7 @@ bool obs_scene_reorder_items2(obs_scene_t *scene,
 
 			obs_scene_addref(sub_scene);
 			full_lock(sub_scene);
+			pthread_rwlock_wrlock(&sub_scene->id_index_lock);
 
 			for (i++; i < item_order_size; i++) {
 				struct obs_sceneitem_order_info *sub_info =
@@ -3326,6 +3470,8 @@ bool obs_scene_reorder_items2(obs_scene_t *scene,
 				sub_prev = sub_item;
 			}
 
+			id_index_rebuild_locked(sub_scene);
+			pthread_rwlock_unlock(&sub_scene->id_index_lock);
 			resize_group(info->item);
 			full_unlock(sub_scene);
 			obs_scene_release(sub_scene);
@@ -3341,6 +3487,8 @@ bool obs_scene_reorder_items2(obs_scene_t *scene,
 		prev = item;
 	}
 
+	id_index_rebuild_locked(scene);
+	pthread_rwlock_unlock(&scene->id_index_lock);
 	full_unlock(scene);
 
 	signal_reorder(scene->first_item);
@@ -86,6 +86,9 @@ struct obs_scene_item {
 	/* would do **prev_next, but not really great for reordering */
 	struct obs_scene_item *prev;
 	struct obs_scene_item *next;
+
+	/* next item in the same id bucket of the parent scene */
+	struct obs_scene_item *id_next;
 };
 
 struct obs_scene {
@@ -98,7 +101,18 @@ struct obs_scene {
 
 	int64_t id_counter;
 
+	/* item_transform is signalled for every transform change, so its
+	 * parameters are set by index */
+	const calldata_layout_t *transform_layout;
+
 	pthread_mutex_t video_mutex;
 	pthread_mutex_t audio_mutex;
 	struct obs_scene_item *first_item;
+
+	/* item id lookup.  only changed with the scene locked, but lookups
+	 * just take the read lock so they don't wait for the scene to render */
+	pthread_rwlock_t id_index_lock;
+	struct obs_scene_item **id_buckets;
+	size_t id_num_buckets;
+	size_t id_count;
 };
@@ -83,6 +83,7 @@ static const char *source_signals[] = {
 	"void push_to_talk_delay(ptr source, int delay)",
 	"void enable(ptr source, bool enabled)",
 	"void rename(ptr source, string new_name, string prev_name)",
+	/* parameters match enum source_volume_param */
 	"void volume(ptr source, in out float volume)",
 	"void update_properties(ptr source)",
 	"void update_flags(ptr source, int flags)",
@@ -115,8 +116,12 @@ bool obs_source_init_context(struct obs_source *source, obs_data_t *settings,
 				   settings, name, hotkey_data, private))
 		return false;
 
-	return signal_handler_add_array(source->context.signals,
-					source_signals);
+	if (!signal_handler_add_array(source->context.signals, source_signals))
+		return false;
+
+	source->volume_layout =
+		signal_handler_get_layout(source->context.signals, "volume");
+	return true;
 }
 
 const char *obs_source_get_display_name(const char *id)
@@ -241,6 +246,9 @@ static void obs_source_init_finalize(struct obs_source *source)
 
 	obs_context_data_insert(&source->context, &obs->data.sources_mutex,
 				&obs->data.first_source);
+
+	if (!source->context.private)
+		obs_name_index_add(&obs->data.source_names, &source->context);
 }
 
 static bool obs_source_hotkey_mute(void *data, obs_hotkey_pair_id id,
@@ -603,10 +611,43 @@ void obs_source_frame_init(struct obs_source_frame *frame,
 	}
 }
 
-static inline void obs_source_frame_decref(struct obs_source_frame *frame)
+static inline struct async_borrowed_frame *
+get_borrowed_frame(struct obs_source_frame *frame)
 {
-	if (os_atomic_dec_long(&frame->refs) == 0)
+	return frame && frame->borrowed ? (struct async_borrowed_frame *)frame
+					: NULL;
+}
+
+static void destroy_async_frame(struct obs_source *source,
+				struct obs_source_frame *frame)
+{
+	struct async_borrowed_frame *bf = get_borrowed_frame(frame);
+
+	if (bf) {
+		da_erase_item(source->async_borrowed, &bf);
+		bf->release(bf->param);
+		bfree(bf);
+	} else {
 		obs_source_frame_destroy(frame);
+	}
+}
+
+static inline void obs_source_frame_decref(struct obs_source *source,
+					   struct obs_source_frame *frame)
+{
+	if (os_atomic_dec_long(&frame->refs) == 0)
+		destroy_async_frame(source, frame);
+}
+
+/* drops the reference a borrowed frame holds while it's waiting to be (or
+ * being) displayed */
+static inline void unqueue_borrowed_frame(struct obs_source *source,
+					  struct async_borrowed_frame *bf)
+{
+	if (bf->queued) {
+		bf->queued = false;
+		obs_source_frame_decref(source, &bf->frame);
+	}
 }
 
 static bool obs_source_filter_remove_refless(obs_source_t *source,
@@ -656,7 +697,13 @@ void obs_source_destroy(struct obs_source *source)
 	obs_hotkey_pair_unregister(source->mute_unmute_key);
 
 	for (i = 0; i < source->async_cache.num; i++)
-		obs_source_frame_decref(source->async_cache.array[i].frame);
+		obs_source_frame_decref(source,
+					source->async_cache.array[i].frame);
+	for (i = 0; i < source->async_borrowed.num; i++) {
+		struct async_borrowed_frame *bf = source->async_borrowed.array[i];
+		bf->release(bf->param);
+		bfree(bf);
+	}
 
 	gs_enter_context(obs->video.graphics);
 	if (source->async_texrender)
@@ -688,6 +735,7 @@ void obs_source_destroy(struct obs_source *source)
 	da_free(source->audio_cb_list);
 	da_free(source->caption_cb_list);
 	da_free(source->async_cache);
+	da_free(source->async_borrowed);
 	da_free(source->async_frames);
 	da_free(source->filters);
 	pthread_mutex_destroy(&source->filter_mutex);
@@ -2704,49 +2752,44 @@ static inline void copy_frame_data_line(struct obs_source_frame *dst,
 	memcpy(dst->data[plane] + pos_dst, src->data[plane] + pos_src, bytes);
 }
 
-static inline void copy_frame_data_plane(struct obs_source_frame *dst,
+static inline void copy_frame_data_lines(struct obs_source_frame *dst,
 					 const struct obs_source_frame *src,
-					 uint32_t plane, uint32_t lines)
+					 uint32_t plane, uint32_t start_y,
+					 uint32_t end_y)
 {
 	if (dst->linesize[plane] != src->linesize[plane]) {
-		for (uint32_t y = 0; y < lines; y++)
+		for (uint32_t y = start_y; y < end_y; y++)
 			copy_frame_data_line(dst, src, plane, y);
 	} else {
-		memcpy(dst->data[plane], src->data[plane],
-		       (size_t)dst->linesize[plane] * (size_t)lines);
+		size_t linesize = dst->linesize[plane];
+		memcpy(dst->data[plane] + linesize * start_y,
+		       src->data[plane] + linesize * start_y,
+		       linesize * (size_t)(end_y - start_y));
 	}
 }
 
-static void copy_frame_data(struct obs_source_frame *dst,
-			    const struct obs_source_frame *src)
+static void get_frame_plane_lines(enum video_format format, uint32_t height,
+				  uint32_t lines[MAX_AV_PLANES])
 {
-	dst->flip = src->flip;
-	dst->full_range = src->full_range;
-	dst->timestamp = src->timestamp;
-	memcpy(dst->color_matrix, src->color_matrix, sizeof(float) * 16);
-	if (!dst->full_range) {
-		size_t const size = sizeof(float) * 3;
-		memcpy(dst->color_range_min, src->color_range_min, size);
-		memcpy(dst->color_range_max, src->color_range_max, size);
-	}
+	memset(lines, 0, sizeof(uint32_t) * MAX_AV_PLANES);
 
-	switch (src->format) {
+	switch (format) {
 	case VIDEO_FORMAT_I420:
-		copy_frame_data_plane(dst, src, 0, dst->height);
-		copy_frame_data_plane(dst, src, 1, dst->height / 2);
-		copy_frame_data_plane(dst, src, 2, dst->height / 2);
+		lines[0] = height;
+		lines[1] = height / 2;
+		lines[2] = height / 2;
 		break;
 
 	case VIDEO_FORMAT_NV12:
-		copy_frame_data_plane(dst, src, 0, dst->height);
-		copy_frame_data_plane(dst, src, 1, dst->height / 2);
+		lines[0] = height;
+		lines[1] = height / 2;
 		break;
 
 	case VIDEO_FORMAT_I444:
 	case VIDEO_FORMAT_I422:
-		copy_frame_data_plane(dst, src, 0, dst->height);
-		copy_frame_data_plane(dst, src, 1, dst->height);
-		copy_frame_data_plane(dst, src, 2, dst->height);
+		lines[0] = height;
+		lines[1] = height;
+		lines[2] = height;
 		break;
 
 	case VIDEO_FORMAT_YVYU:
@@ -2759,26 +2802,85 @@ static void copy_frame_data(struct obs_source_frame *dst,
 	case VIDEO_FORMAT_Y800:
 	case VIDEO_FORMAT_BGR3:
 	case VIDEO_FORMAT_AYUV:
-		copy_frame_data_plane(dst, src, 0, dst->height);
+		lines[0] = height;
 		break;
 
 	case VIDEO_FORMAT_I40A:
-		copy_frame_data_plane(dst, src, 0, dst->height);
-		copy_frame_data_plane(dst, src, 1, dst->height / 2);
-		copy_frame_data_plane(dst, src, 2, dst->height / 2);
-		copy_frame_data_plane(dst, src, 3, dst->height);
+		lines[0] = height;
+		lines[1] = height / 2;
+		lines[2] = height / 2;
+		lines[3] = height;
 		break;
 
 	case VIDEO_FORMAT_I42A:
 	case VIDEO_FORMAT_YUVA:
-		copy_frame_data_plane(dst, src, 0, dst->height);
-		copy_frame_data_plane(dst, src, 1, dst->height);
-		copy_frame_data_plane(dst, src, 2, dst->height);
-		copy_frame_data_plane(dst, src, 3, dst->height);
+		lines[0] = height;
+		lines[1] = height;
+		lines[2] = height;
+		lines[3] = height;
 		break;
 	}
 }
 
+/* frames at least this large (in bytes) are copied in bands of rows on the
+ * worker pool, smaller ones aren't worth the synchronization */
+#define PARALLEL_COPY_MIN_SIZE (1920 * 1080 * 4)
+
+struct frame_copy_bands {
+	struct obs_source_frame *dst;
+	const struct obs_source_frame *src;
+	uint32_t lines[MAX_AV_PLANES];
+	size_t bands;
+};
+
+static void copy_frame_data_band(void *param, size_t band)
+{
+	struct frame_copy_bands *copy = param;
+
+	for (size_t plane = 0; plane < MAX_AV_PLANES; plane++) {
+		uint64_t lines = copy->lines[plane];
+		uint32_t start_y = (uint32_t)(lines * band / copy->bands);
+		uint32_t end_y = (uint32_t)(lines * (band + 1) / copy->bands);
+
+		if (start_y < end_y)
+			copy_frame_data_lines(copy->dst, copy->src,
+					      (uint32_t)plane, start_y, end_y);
+	}
+}
+
+static void copy_frame_data(struct obs_source_frame *dst,
+			    const struct obs_source_frame *src)
+{
+	struct frame_copy_bands copy = {.dst = dst, .src = src, .bands = 1};
+	/* obs_source_frame_copy may be called without a core instance, in
+	 * which case the frame is copied in a single band */
+	worker_pool_t *pool = obs ? obs->worker_pool : NULL;
+	size_t threads = worker_pool_threads(pool);
+	size_t frame_size = 0;
+
+	dst->flip = src->flip;
+	dst->full_range = src->full_range;
+	dst->timestamp = src->timestamp;
+	memcpy(dst->color_matrix, src->color_matrix, sizeof(float) * 16);
+	if (!dst->full_range) {
+		size_t const size = sizeof(float) * 3;
+		memcpy(dst->color_range_min, src->color_range_min, size);
+		memcpy(dst->color_range_max, src->color_range_max, size);
+	}
+
+	get_frame_plane_lines(src->format, dst->height, copy.lines);
+
+	for (size_t plane = 0; plane < MAX_AV_PLANES; plane++)
+		frame_size += (size_t)dst->linesize[plane] * copy.lines[plane];
+
+	if (threads && frame_size >= PARALLEL_COPY_MIN_SIZE) {
+		copy.bands = threads + 1;
+		worker_pool_run(pool, copy_frame_data_band, &copy, copy.bands);
+	} else {
+		copy_frame_data_band(&copy, 0);
+	}
+}
+
 void obs_source_frame_copy(struct obs_source_frame *dst,
 			   const struct obs_source_frame *src)
 {
@@ -2800,7 +2902,11 @@ static inline bool async_texture_changed(struct obs_source *source,
 static inline void free_async_cache(struct obs_source *source)
 {
 	for (size_t i = 0; i < source->async_cache.num; i++)
-		obs_source_frame_decref(source->async_cache.array[i].frame);
+		obs_source_frame_decref(source,
+					source->async_cache.array[i].frame);
+	for (size_t i = source->async_borrowed.num; i > 0; i--)
+		unqueue_borrowed_frame(source,
+				       source->async_borrowed.array[i - 1]);
 
 	da_resize(source->async_cache, 0);
 	da_resize(source->async_frames, 0);
@@ -2826,19 +2932,16 @@ static void clean_cache(obs_source_t *source)
 }
 
 #define MAX_ASYNC_FRAMES 30
-//if return value is not null then do (os_atomic_dec_long(&output->refs) == 0) && obs_source_frame_destroy(output)
-static inline struct obs_source_frame *
-cache_video(struct obs_source *source, const struct obs_source_frame *frame)
-{
-	struct obs_source_frame *new_frame = NULL;
-
-	pthread_mutex_lock(&source->async_mutex);
 
+/* must be called with async_mutex locked; returns false (after flushing the
+ * queue) if too many frames are waiting */
+static bool prepare_async_cache(struct obs_source *source,
+				const struct obs_source_frame *frame)
+{
 	if (source->async_frames.num >= MAX_ASYNC_FRAMES) {
 		free_async_cache(source);
 		source->last_frame_ts = 0;
-		pthread_mutex_unlock(&source->async_mutex);
-		return NULL;
+		return false;
 	}
 
 	if (async_texture_changed(source, frame)) {
@@ -2847,9 +2950,25 @@ cache_video(struct obs_source *source, const struct obs_source_frame *frame)
 		source->async_cache_height = frame->height;
 	}
 
-	const enum video_format format = frame->format;
-	source->async_cache_format = format;
+	source->async_cache_format = frame->format;
 	source->async_cache_full_range = frame->full_range;
+	return true;
+}
+
+//if return value is not null then do (os_atomic_dec_long(&output->refs) == 0) && obs_source_frame_destroy(output)
+static inline struct obs_source_frame *
+cache_video(struct obs_source *source, const struct obs_source_frame *frame)
+{
+	struct obs_source_frame *new_frame = NULL;
+
+	pthread_mutex_lock(&source->async_mutex);
+
+	if (!prepare_async_cache(source, frame)) {
+		pthread_mutex_unlock(&source->async_mutex);
+		return NULL;
+	}
+
+	const enum video_format format = frame->format;
 
 	for (size_t i = 0; i < source->async_cache.num; i++) {
 		struct async_frame *af = &source->async_cache.array[i];
@@ -2929,6 +3048,32 @@ void obs_source_output_video(obs_source_t *source,
 	obs_source_output_video_internal(source, &new_frame);
 }
 
+static void frame2_to_frame(struct obs_source_frame *dst,
+			    const struct obs_source_frame2 *src)
+{
+	enum video_range_type range =
+		resolve_video_range(src->format, src->range);
+
+	for (size_t i = 0; i < MAX_AV_PLANES; i++) {
+		dst->data[i] = src->data[i];
+		dst->linesize[i] = src->linesize[i];
+	}
+
+	dst->width = src->width;
+	dst->height = src->height;
+	dst->timestamp = src->timestamp;
+	dst->format = src->format;
+	dst->full_range = range == VIDEO_RANGE_FULL;
+	dst->flip = src->flip;
+
+	memcpy(&dst->color_matrix, &src->color_matrix,
+	       sizeof(src->color_matrix));
+	memcpy(&dst->color_range_min, &src->color_range_min,
+	       sizeof(src->color_range_min));
+	memcpy(&dst->color_range_max, &src->color_range_max,
+	       sizeof(src->color_range_max));
+}
+
 void obs_source_output_video2(obs_source_t *source,
 			      const struct obs_source_frame2 *frame)
 {
@@ -2938,29 +3083,49 @@ void obs_source_output_video2(obs_source_t *source,
 	}
 
 	struct obs_source_frame new_frame;
-	enum video_range_type range =
-		resolve_video_range(frame->format, frame->range);
+	frame2_to_frame(&new_frame, frame);
 
-	for (size_t i = 0; i < MAX_AV_PLANES; i++) {
-		new_frame.data[i] = frame->data[i];
-		new_frame.linesize[i] = frame->linesize[i];
+	obs_source_output_video_internal(source, &new_frame);
+}
+
+void obs_source_output_video2_borrowed(obs_source_t *source,
+				       const struct obs_source_frame2 *frame,
+				       void (*release)(void *param),
+				       void *param)
+{
+	if (!obs_ptr_valid(release, "obs_source_output_video2_borrowed"))
+		return;
+	if (!obs_source_valid(source, "obs_source_output_video2_borrowed") ||
+	    !obs_ptr_valid(frame, "obs_source_output_video2_borrowed")) {
+		release(param);
+		return;
 	}
 
-	new_frame.width = frame->width;
-	new_frame.height = frame->height;
-	new_frame.timestamp = frame->timestamp;
-	new_frame.format = frame->format;
-	new_frame.full_range = range == VIDEO_RANGE_FULL;
-	new_frame.flip = frame->flip;
+	struct async_borrowed_frame *bf = bzalloc(sizeof(*bf));
+	struct obs_source_frame *new_frame = &bf->frame;
 
-	memcpy(&new_frame.color_matrix, &frame->color_matrix,
-	       sizeof(frame->color_matrix));
-	memcpy(&new_frame.color_range_min, &frame->color_range_min,
-	       sizeof(frame->color_range_min));
-	memcpy(&new_frame.color_range_max, &frame->color_range_max,
-	       sizeof(frame->color_range_max));
+	frame2_to_frame(new_frame, frame);
+	new_frame->refs = 1;
+	new_frame->borrowed = true;
+	bf->source = source;
+	bf->release = release;
+	bf->param = param;
+	bf->queued = true;
 
-	obs_source_output_video_internal(source, &new_frame);
+	pthread_mutex_lock(&source->async_mutex);
+
+	if (!prepare_async_cache(source, new_frame)) {
+		pthread_mutex_unlock(&source->async_mutex);
+		release(param);
+		bfree(bf);
+		return;
+	}
+
+	da_push_back(source->async_borrowed, &bf);
+	da_push_back(source->async_frames, &new_frame);
+	source->async_active = true;
+
+	pthread_mutex_unlock(&source->async_mutex);
 }
 
 void obs_source_set_async_rotation(obs_source_t *source, long rotation)
@@ -3416,9 +3581,13 @@ void remove_async_frame(obs_source_t *source, struct obs_source_frame *frame)
 
 		if (f->frame == frame) {
 			f->used = false;
-			break;
+			return;
 		}
 	}
+
+	struct async_borrowed_frame *bf = get_borrowed_frame(frame);
+	if (bf)
+		unqueue_borrowed_frame(source, bf);
 }
 
 /* #define DEBUG_ASYNC_FRAMES 1 */
@@ -3565,13 +3734,18 @@ void obs_source_release_frame(obs_source_t *source,
 	if (!frame)
 		return;
 
+	/* borrowed frames have to hand their planes back to the source that
+	 * output them, so never free them as if they were a plain frame */
+	if (!source && frame->borrowed)
+		source = get_borrowed_frame(frame)->source;
+
 	if (!source) {
 		obs_source_frame_destroy(frame);
 	} else {
 		pthread_mutex_lock(&source->async_mutex);
 
 		if (os_atomic_dec_long(&frame->refs) == 0)
-			obs_source_frame_destroy(frame);
+			destroy_async_frame(source, frame);
 		else
 			remove_async_frame(source, frame);
 
@@ -3865,15 +4039,22 @@ void obs_source_set_volume(obs_source_t *source, float volume)
 		uint8_t stack[128];
 
 		calldata_init_fixed(&data, stack, sizeof(stack));
-		calldata_set_ptr(&data, "source", source);
-		calldata_set_float(&data, "volume", volume);
+		calldata_set_layout(&data, source->volume_layout);
+		calldata_set_ptr_at(&data, source->volume_layout,
+				    SOURCE_VOLUME_PARAM_SOURCE, "source",
+				    source);
+		calldata_set_float_at(&data, source->volume_layout,
+				      SOURCE_VOLUME_PARAM_VOLUME, "volume",
+				      volume);
 
 		signal_handler_signal(source->context.signals, "volume", &data);
 		if (!source->context.private)
 			signal_handler_signal(obs->signals, "source_volume",
 					      &data);
 
-		volume = (float)calldata_float(&data, "volume");
+		volume = (float)calldata_float_at(&data, source->volume_layout,
+						  SOURCE_VOLUME_PARAM_VOLUME,
+						  "volume");
 
 		pthread_mutex_lock(&source->audio_actions_mutex);
 		da_push_back(source->audio_actions, &action);
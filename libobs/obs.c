@@ -565,6 +565,22 @@ static void obs_free_graphics(void)
 	}
 }
 
+#define MAX_AUDIO_RENDER_THREADS 2
+
+/* the audio thread has its own pool so that it never waits behind (or helps
+ * with) the large frame copies queued on the main worker pool */
+static void obs_init_audio_render_pool(struct obs_core_audio *audio)
+{
+	int cores = os_get_logical_cores();
+	size_t threads = cores > 1 ? (size_t)cores - 1 : 0;
+
+	if (threads > MAX_AUDIO_RENDER_THREADS)
+		threads = MAX_AUDIO_RENDER_THREADS;
+	if (threads)
+		audio->render_pool =
+			worker_pool_create(threads, "libobs: audio render");
+}
+
 static bool obs_init_audio(struct audio_output_info *ai)
 {
 	struct obs_core_audio *audio = &obs->audio;
@@ -586,6 +602,8 @@ static bool obs_init_audio(struct audio_output_info *ai)
 	audio->monitoring_device_name = bstrdup("Default");
 	audio->monitoring_device_id = bstrdup("default");
 
+	obs_init_audio_render_pool(audio);
+
 	errorcode = audio_output_open(&audio->audio, ai);
 	if (errorcode == AUDIO_OUTPUT_SUCCESS)
 		return true;
@@ -603,6 +621,8 @@ static void obs_free_audio(void)
 	if (audio->audio)
 		audio_output_close(audio->audio);
 
+	worker_pool_destroy(audio->render_pool);
+
 	circlebuf_free(&audio->buffered_timestamps);
 	da_free(audio->render_order);
 	da_free(audio->root_nodes);
@@ -625,6 +645,8 @@ static bool obs_init_data(void)
 	pthread_mutex_init_value(&obs->data.displays_mutex);
 	pthread_mutex_init_value(&obs->data.draw_callbacks_mutex);
 
+	if (!obs_name_index_init(&data->source_names))
+		return false;
 	if (pthread_mutexattr_init(&attr) != 0)
 		return false;
 	if (pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE) != 0)
@@ -701,6 +723,7 @@ static void obs_free_data(void)
 	pthread_mutex_destroy(&data->encoders_mutex);
 	pthread_mutex_destroy(&data->services_mutex);
 	pthread_mutex_destroy(&data->draw_callbacks_mutex);
+	obs_name_index_free(&data->source_names);
 	da_free(data->draw_callbacks);
 	da_free(data->tick_callbacks);
 	obs_data_release(data->private_data);
@@ -845,6 +868,22 @@ const struct obs_source_info audio_line_info = {
 
 extern void log_system_info(void);
 
+#define MAX_WORKER_THREADS 4
+
+static void obs_init_worker_pool(void)
+{
+	/* the thread calling into the pool takes part in the work as well,
+	 * and these jobs are mostly bound by memory bandwidth, so there's
+	 * little use for more than a few threads */
+	int cores = os_get_logical_cores();
+	size_t threads = cores > 1 ? (size_t)cores - 1 : 0;
+
+	if (threads > MAX_WORKER_THREADS)
+		threads = MAX_WORKER_THREADS;
+
+	obs->worker_pool = worker_pool_create(threads, "libobs: worker pool");
+}
+
 static bool obs_init(const char *locale, const char *module_config_path,
 		     profiler_name_store_t *store)
 {
@@ -862,6 +901,7 @@ static bool obs_init(const char *locale, const char *module_config_path,
 	}
 
 	log_system_info();
+	obs_init_worker_pool();
 
 	if (!obs_init_data())
 		return false;
@@ -1041,6 +1081,8 @@ void obs_shutdown(void)
 	obs_free_video();
 	obs_free_hotkeys();
 	obs_free_graphics();
+	worker_pool_destroy(obs->worker_pool);
+	obs->worker_pool = NULL;
 	proc_handler_destroy(obs->procs);
 	signal_handler_destroy(obs->signals);
 	obs->procs = NULL;
@@ -1058,6 +1100,7 @@ void obs_shutdown(void)
 	bfree(obs);
 	obs = NULL;
 	bfree(cmdline_args.argv);
+	bpool_trim();
 
 #ifdef _WIN32
 	if (com_initialized)
@@ -1593,8 +1636,7 @@ static inline void *obs_id_(void *data)
 
 obs_source_t *obs_get_source_by_name(const char *name)
 {
-	return get_context_by_name(&obs->data.first_source, name,
-				   &obs->data.sources_mutex,
+	return obs_name_index_find(&obs->data.source_names, name,
 				   obs_source_addref_safe_);
 }
 
@@ -2123,6 +2165,75 @@ void obs_context_data_free(struct obs_context_data *context)
 	memset(context, 0, sizeof(*context));
 }
 
+#define NAME_INDEX_MIN_BUCKETS 64
+
+static inline uint32_t hash_name(const char *name)
+{
+	uint32_t hash = 2166136261u;
+
+	while (*name) {
+		hash ^= (uint8_t)*name++;
+		hash *= 16777619u;
+	}
+
+	return hash;
+}
+
+static void name_index_link(struct obs_name_index *index,
+			    struct obs_context_data *context)
+{
+	size_t bucket = context->name_hash & (index->num_buckets - 1);
+
+	context->name_next = index->buckets[bucket];
+	index->buckets[bucket] = context;
+}
+
+/* call with the index write-locked */
+static void name_index_insert(struct obs_name_index *index,
+			      struct obs_context_data *context)
+{
+	if (index->count >= index->num_buckets) {
+		struct obs_context_data **old = index->buckets;
+		size_t old_size = index->num_buckets;
+
+		index->num_buckets = old_size ? old_size * 2
+					      : NAME_INDEX_MIN_BUCKETS;
+		index->buckets = bzalloc(index->num_buckets * sizeof(*old));
+
+		for (size_t i = 0; i < old_size; i++) {
+			struct obs_context_data *cur = old[i];
+			while (cur) {
+				struct obs_context_data *next = cur->name_next;
+				name_index_link(index, cur);
+				cur = next;
+			}
+		}
+
+		bfree(old);
+	}
+
+	name_index_link(index, context);
+	index->count++;
+}
+
+/* call with the index write-locked */
+static void name_index_remove(struct obs_name_index *index,
+			      struct obs_context_data *context)
+{
+	size_t bucket = context->name_hash & (index->num_buckets - 1);
+	struct obs_context_data **prev_next = &index->buckets[bucket];
+
+	while (*prev_next) {
+		if (*prev_next == context) {
+			*prev_next = context->name_next;
+			context->name_next = NULL;
+			index->count--;
+			break;
+		}
+		prev_next = &(*prev_next)->name_next;
+	}
+}
+
 void obs_context_data_insert(struct obs_context_data *context,
 			     pthread_mutex_t *mutex, void *pfirst)
 {
@@ -2145,6 +2256,16 @@ void obs_context_data_insert(struct obs_context_data *context,
 
 void obs_context_data_remove(struct obs_context_data *context)
 {
+	if (context && context->name_index) {
+		struct obs_name_index *index = context->name_index;
+
+		pthread_rwlock_wrlock(&index->lock);
+		name_index_remove(index, context);
+		pthread_rwlock_unlock(&index->lock);
+
+		context->name_index = NULL;
+	}
+
 	if (context && context->mutex) {
 		pthread_mutex_lock(context->mutex);
 		if (context->prev_next)
@@ -2160,6 +2281,13 @@ void obs_context_data_remove(struct obs_context_data *context)
 void obs_context_data_setname(struct obs_context_data *context,
 			      const char *name)
 {
+	struct obs_name_index *index = context->name_index;
+
+	if (index) {
+		pthread_rwlock_wrlock(&index->lock);
+		name_index_remove(index, context);
+	}
+
 	pthread_mutex_lock(&context->rename_cache_mutex);
 
 	if (context->name)
@@ -2167,6 +2295,67 @@ void obs_context_data_setname(struct obs_context_data *context,
 	context->name = dup_name(name, context->private);
 
 	pthread_mutex_unlock(&context->rename_cache_mutex);
+
+	if (index) {
+		context->name_hash = hash_name(context->name);
+		name_index_insert(index, context);
+		pthread_rwlock_unlock(&index->lock);
+	}
+}
+
+bool obs_name_index_init(struct obs_name_index *index)
+{
+	memset(index, 0, sizeof(*index));
+	return pthread_rwlock_init(&index->lock, NULL) == 0;
+}
+
+void obs_name_index_free(struct obs_name_index *index)
+{
+	pthread_rwlock_destroy(&index->lock);
+	bfree(index->buckets);
+	memset(index, 0, sizeof(*index));
+}
+
+void obs_name_index_add(struct obs_name_index *index,
+			struct obs_context_data *context)
+{
+	if (!context->name)
+		return;
+
+	pthread_rwlock_wrlock(&index->lock);
+	context->name_index = index;
+	context->name_hash = hash_name(context->name);
+	name_index_insert(index, context);
+	pthread_rwlock_unlock(&index->lock);
+}
+
+void *obs_name_index_find(struct obs_name_index *index, const char *name,
+			  void *(*addref)(void *))
+{
+	struct obs_context_data *context = NULL;
+	uint32_t hash;
+
+	if (!name)
+		return NULL;
+
+	hash = hash_name(name);
+
+	pthread_rwlock_rdlock(&index->lock);
+
+	if (index->num_buckets)
+		context = index->buckets[hash & (index->num_buckets - 1)];
+
+	while (context) {
+		if (context->name_hash == hash &&
+		    strcmp(context->name, name) == 0) {
+			context = addref(context);
+			break;
+		}
+		context = context->name_next;
+	}
+
+	pthread_rwlock_unlock(&index->lock);
+	return context;
 }
 
 profiler_name_store_t *obs_get_profiler_name_store(void)
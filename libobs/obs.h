@@ -249,6 +249,7 @@ struct obs_source_frame {
 	/* used internally by libobs */
 	volatile long refs;
 	bool prev_frame;
+	bool borrowed;
 };
 
 struct obs_source_frame2 {
@@ -1258,6 +1259,19 @@ EXPORT void obs_source_output_video(obs_source_t *source,
 EXPORT void obs_source_output_video2(obs_source_t *source,
 				     const struct obs_source_frame2 *frame);
 
+/**
+ * Outputs asynchronous video data without copying it.  Instead of copying the
+ * frame into its own cache, libobs uses the frame's planes directly until they
+ * are uploaded, and then calls release(param) to hand the buffers back.
+ *
+ * release is always called exactly once (possibly from another thread, and
+ * possibly before this function returns if the frame is dropped), and must
+ * not call back in to the source's async video functions.
+ */
+EXPORT void obs_source_output_video2_borrowed(
+	obs_source_t *source, const struct obs_source_frame2 *frame,
+	void (*release)(void *param), void *param);
+
 EXPORT void obs_source_set_async_rotation(obs_source_t *source, long rotation);
 
 EXPORT void obs_source_output_cea708(obs_source_t *source,
@@ -153,3 +153,202 @@ void *bmemdup(const void *ptr, size_t size)
 
 	return out;
 }
+
+/* ------------------------------------------------------------------------- */
+/* size-class pool */
+
+#define POOL_MIN_SHIFT 8  /* 256 bytes */
+#define POOL_MAX_SHIFT 22 /* 4 megabytes */
+#define POOL_CLASSES (POOL_MAX_SHIFT - POOL_MIN_SHIFT + 1)
+#define POOL_OVERSIZED POOL_CLASSES
+
+/* cached memory per class is limited to this (but at least a few blocks) */
+#define POOL_MAX_CLASS_CACHE (8 * 1024 * 1024)
+#define POOL_MIN_CLASS_BLOCKS 4
+#define POOL_MAX_CLASS_BLOCKS 256
+
+/* keeps the returned memory at the same alignment as bmalloc */
+#define POOL_HEADER_SIZE ALIGNMENT
+
+struct pool_header {
+	size_t class_idx;
+	struct pool_header *next;
+};
+
+struct pool_class {
+	pthread_mutex_t mutex;
+	struct pool_header *first;
+	size_t cached;
+};
+
+static struct pool_class pool_classes[POOL_CLASSES];
+static pthread_once_t pool_init_token = PTHREAD_ONCE_INIT;
+static volatile long pool_allocs = 0;
+static volatile long pool_reused = 0;
+static volatile long pool_oversized = 0;
+
+static void pool_init(void)
+{
+	for (size_t i = 0; i < POOL_CLASSES; i++)
+		pthread_mutex_init(&pool_classes[i].mutex, NULL);
+}
+
+/* the critical sections are a couple of pointer updates, but a plain mutex
+ * is still used rather than a spin lock: the pool is used from every thread
+ * (including ones that may be preempted while holding the lock), and an
+ * uncontended mutex is already just an atomic operation */
+static inline void pool_lock(struct pool_class *pc)
+{
+	pthread_once(&pool_init_token, pool_init);
+	pthread_mutex_lock(&pc->mutex);
+}
+
+static inline void pool_unlock(struct pool_class *pc)
+{
+	pthread_mutex_unlock(&pc->mutex);
+}
+
+static inline size_t pool_class_size(size_t class_idx)
+{
+	return (size_t)1 << (class_idx + POOL_MIN_SHIFT);
+}
+
+static inline size_t pool_class_max_blocks(size_t class_idx)
+{
+	size_t blocks = POOL_MAX_CLASS_CACHE / pool_class_size(class_idx);
+
+	if (blocks < POOL_MIN_CLASS_BLOCKS)
+		return POOL_MIN_CLASS_BLOCKS;
+	if (blocks > POOL_MAX_CLASS_BLOCKS)
+		return POOL_MAX_CLASS_BLOCKS;
+	return blocks;
+}
+
+static inline size_t pool_get_class(size_t size)
+{
+	size_t class_idx = 0;
+
+	while (class_idx < POOL_CLASSES && pool_class_size(class_idx) < size)
+		class_idx++;
+
+	return class_idx;
+}
+
+static inline void *pool_alloc_block(size_t size)
+{
+	void *ptr = alloc.malloc(POOL_HEADER_SIZE + size);
+	if (!ptr) {
+		os_breakpoint();
+		bcrash("Out of memory while trying to allocate %lu bytes",
+		       (unsigned long)size);
+	}
+
+	return ptr;
+}
+
+void *bpool_malloc(size_t size)
+{
+	size_t class_idx = pool_get_class(size);
+	struct pool_header *header = NULL;
+
+	os_atomic_inc_long(&pool_allocs);
+
+	if (class_idx == POOL_OVERSIZED) {
+		os_atomic_inc_long(&pool_oversized);
+		header = pool_alloc_block(size);
+
+	} else {
+		struct pool_class *pc = &pool_classes[class_idx];
+
+		pool_lock(pc);
+		header = pc->first;
+		if (header) {
+			pc->first = header->next;
+			pc->cached--;
+		}
+		pool_unlock(pc);
+
+		if (header)
+			os_atomic_inc_long(&pool_reused);
+		else
+			header = pool_alloc_block(pool_class_size(class_idx));
+	}
+
+	header->class_idx = class_idx;
+	header->next = NULL;
+
+	/* cached blocks are not counted as allocations, so that they don't
+	 * show up as leaks */
+	os_atomic_inc_long(&num_allocs);
+	return (uint8_t *)header + POOL_HEADER_SIZE;
+}
+
+void bpool_free(void *ptr)
+{
+	struct pool_header *header;
+	struct pool_class *pc;
+	bool cached = false;
+
+	if (!ptr)
+		return;
+
+	header = (struct pool_header *)((uint8_t *)ptr - POOL_HEADER_SIZE);
+	os_atomic_dec_long(&num_allocs);
+
+	if (header->class_idx == POOL_OVERSIZED) {
+		alloc.free(header);
+		return;
+	}
+
+	pc = &pool_classes[header->class_idx];
+
+	pool_lock(pc);
+	if (pc->cached < pool_class_max_blocks(header->class_idx)) {
+		header->next = pc->first;
+		pc->first = header;
+		pc->cached++;
+		cached = true;
+	}
+	pool_unlock(pc);
+
+	if (!cached)
+		alloc.free(header);
+}
+
+void bpool_trim(void)
+{
+	for (size_t i = 0; i < POOL_CLASSES; i++) {
+		struct pool_class *pc = &pool_classes[i];
+		struct pool_header *header;
+
+		pool_lock(pc);
+		header = pc->first;
+		pc->first = NULL;
+		pc->cached = 0;
+		pool_unlock(pc);
+
+		while (header) {
+			struct pool_header *next = header->next;
+			alloc.free(header);
+			header = next;
+		}
+	}
+}
+
+void bpool_get_stats(struct bpool_stats *stats)
+{
+	memset(stats, 0, sizeof(*stats));
+
+	stats->allocs = (unsigned long)os_atomic_load_long(&pool_allocs);
+	stats->reused = (unsigned long)os_atomic_load_long(&pool_reused);
+	stats->oversized = (unsigned long)os_atomic_load_long(&pool_oversized);
+
+	for (size_t i = 0; i < POOL_CLASSES; i++) {
+		struct pool_class *pc = &pool_classes[i];
+
+		pool_lock(pc);
+		stats->cached_blocks += pc->cached;
+		stats->cached_bytes += pc->cached * pool_class_size(i);
+		pool_unlock(pc);
+	}
+}
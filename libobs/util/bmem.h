@@ -43,6 +43,29 @@ EXPORT long bnum_allocs(void);
 
 EXPORT void *bmemdup(const void *ptr, size_t size);
 
+/*
+ * Size-class pool for buffers that are allocated and freed at a high rate
+ * (such as encoder packets).  Freed blocks are kept per power-of-two size
+ * class and handed out again instead of going back to the system allocator,
+ * which keeps long running processes from fragmenting the heap.  Memory from
+ * bpool_malloc must be freed with bpool_free.
+ */
+EXPORT void *bpool_malloc(size_t size);
+EXPORT void bpool_free(void *ptr);
+
+/* frees all cached blocks */
+EXPORT void bpool_trim(void);
+
+struct bpool_stats {
+	uint64_t allocs;
+	uint64_t reused;
+	uint64_t oversized;
+	size_t cached_blocks;
+	size_t cached_bytes;
+};
+
+EXPORT void bpool_get_stats(struct bpool_stats *stats);
+
 static inline void *bzalloc(size_t size)
 {
 	void *mem = bmalloc(size);
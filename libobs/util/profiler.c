@@ -747,10 +747,28 @@ void profile_print_func(const char *intro, profile_entry_print_func print,
 	dstr_free(&indent_buffer);
 }
 
+static void profile_print_pool_stats(void)
+{
+	struct bpool_stats stats;
+	bpool_get_stats(&stats);
+
+	if (!stats.allocs)
+		return;
+
+	blog(LOG_INFO,
+	     "Memory pool: %" PRIu64 " allocations, %" PRIu64 " reused "
+	     "(%.1f%%), %" PRIu64 " oversized, %lu blocks (%lu KiB) cached",
+	     stats.allocs, stats.reused,
+	     stats.reused * 100.0 / (double)stats.allocs, stats.oversized,
+	     (unsigned long)stats.cached_blocks,
+	     (unsigned long)(stats.cached_bytes / 1024));
+}
+
 void profiler_print(profiler_snapshot_t *snap)
 {
 	profile_print_func("== Profiler Results =============================",
 			   profile_print_entry, snap);
+	profile_print_pool_stats();
 }
 
 void profiler_print_time_between_calls(profiler_snapshot_t *snap)
@@ -0,0 +1,193 @@
+#include "worker-pool.h"
+#include "threading.h"
+#include "darray.h"
+#include "bmem.h"
+#include "base.h"
+
+struct worker_batch {
+	worker_pool_job_t job;
+	void *param;
+	size_t count;
+	size_t next;
+	size_t remaining;
+};
+
+struct worker_pool {
+	pthread_mutex_t mutex;
+	pthread_cond_t work_cond;
+	pthread_cond_t done_cond;
+	DARRAY(struct worker_batch *) batches;
+	DARRAY(pthread_t) threads;
+	char *name;
+	bool stop;
+};
+
+/* must be called with the mutex locked.  returns false if there is nothing
+ * left to start */
+static bool take_part(struct worker_pool *pool, struct worker_batch **batch,
+		      size_t *idx)
+{
+	if (!pool->batches.num)
+		return false;
+
+	*batch = pool->batches.array[0];
+	*idx = (*batch)->next++;
+
+	if ((*batch)->next == (*batch)->count)
+		da_erase(pool->batches, 0);
+	return true;
+}
+
+/* must be called with the mutex locked.  unlike take_part this only takes
+ * from the given batch, so a thread waiting on its own batch never ends up
+ * running (possibly much longer) parts queued by another subsystem */
+static bool take_own_part(struct worker_pool *pool, struct worker_batch *batch,
+			  size_t *idx)
+{
+	if (batch->next == batch->count)
+		return false;
+
+	*idx = batch->next++;
+
+	if (batch->next == batch->count)
+		da_erase_item(pool->batches, &batch);
+	return true;
+}
+
+static void run_part(struct worker_pool *pool, struct worker_batch *batch,
+		     size_t idx)
+{
+	pthread_mutex_unlock(&pool->mutex);
+	batch->job(batch->param, idx);
+	pthread_mutex_lock(&pool->mutex);
+
+	/* the batch belongs to the thread waiting in worker_pool_run, so it
+	 * must not be touched once remaining hits zero and the mutex is
+	 * released */
+	if (--batch->remaining == 0)
+		pthread_cond_broadcast(&pool->done_cond);
+}
+
+static void *worker_thread(void *param)
+{
+	struct worker_pool *pool = param;
+	struct worker_batch *batch;
+	size_t idx;
+
+	os_set_thread_name(pool->name);
+
+	pthread_mutex_lock(&pool->mutex);
+
+	while (!pool->stop) {
+		if (take_part(pool, &batch, &idx))
+			run_part(pool, batch, idx);
+		else
+			pthread_cond_wait(&pool->work_cond, &pool->mutex);
+	}
+
+	pthread_mutex_unlock(&pool->mutex);
+	return NULL;
+}
+
+worker_pool_t *worker_pool_create(size_t threads, const char *name)
+{
+	struct worker_pool *pool = bzalloc(sizeof(*pool));
+
+	pool->name = bstrdup(name ? name : "worker pool");
+
+	if (pthread_mutex_init(&pool->mutex, NULL) != 0)
+		goto fail_mutex;
+	if (pthread_cond_init(&pool->work_cond, NULL) != 0)
+		goto fail_work_cond;
+	if (pthread_cond_init(&pool->done_cond, NULL) != 0)
+		goto fail_done_cond;
+
+	for (size_t i = 0; i < threads; i++) {
+		pthread_t thread;
+
+		if (pthread_create(&thread, NULL, worker_thread, pool) != 0) {
+			blog(LOG_WARNING,
+			     "worker_pool_create: Failed to create "
+			     "thread %d of '%s'",
+			     (int)i, pool->name);
+			break;
+		}
+
+		da_push_back(pool->threads, &thread);
+	}
+
+	return pool;
+
+fail_done_cond:
+	pthread_cond_destroy(&pool->work_cond);
+fail_work_cond:
+	pthread_mutex_destroy(&pool->mutex);
+fail_mutex:
+	bfree(pool->name);
+	bfree(pool);
+	return NULL;
+}
+
+void worker_pool_destroy(worker_pool_t *pool)
+{
+	if (!pool)
+		return;
+
+	pthread_mutex_lock(&pool->mutex);
+	pool->stop = true;
+	pthread_cond_broadcast(&pool->work_cond);
+	pthread_mutex_unlock(&pool->mutex);
+
+	for (size_t i = 0; i < pool->threads.num; i++)
+		pthread_join(pool->threads.array[i], NULL);
+
+	da_free(pool->threads);
+	da_free(pool->batches);
+	pthread_cond_destroy(&pool->done_cond);
+	pthread_cond_destroy(&pool->work_cond);
+	pthread_mutex_destroy(&pool->mutex);
+	bfree(pool->name);
+	bfree(pool);
+}
+
+size_t worker_pool_threads(const worker_pool_t *pool)
+{
+	return pool ? pool->threads.num : 0;
+}
+
+void worker_pool_run(worker_pool_t *pool, worker_pool_job_t job, void *param,
+		     size_t count)
+{
+	struct worker_batch batch = {
+		.job = job,
+		.param = param,
+		.count = count,
+		.remaining = count,
+	};
+	size_t idx;
+
+	if (!count)
+		return;
+
+	if (!pool || !pool->threads.num || count == 1) {
+		for (size_t i = 0; i < count; i++)
+			job(param, i);
+		return;
+	}
+
+	pthread_mutex_lock(&pool->mutex);
+
+	struct worker_batch *batch_ptr = &batch;
+	da_push_back(pool->batches, &batch_ptr);
+	pthread_cond_broadcast(&pool->work_cond);
+
+	/* help out with our own batch until every part of it has been started,
+	 * then wait for the workers to finish the parts they took */
+	while (take_own_part(pool, &batch, &idx))
+		run_part(pool, &batch, idx);
+
+	while (batch.remaining)
+		pthread_cond_wait(&pool->done_cond, &pool->mutex);
+
+	pthread_mutex_unlock(&pool->mutex);
+}
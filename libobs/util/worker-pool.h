@@ -0,0 +1,34 @@
+#pragma once
+
+#include "c99defs.h"
+
+/*
+ *   Small pool of worker threads for splitting a job into independent parts
+ * (e.g. bands of rows of a frame).  The calling thread takes part in the work
+ * of its own job (never anyone else's) and worker_pool_run returns once every
+ * part has been processed.  Multiple threads may run jobs on the same pool at
+ * the same time; the pool threads pick up parts in FIFO order.
+ */
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+struct worker_pool;
+typedef struct worker_pool worker_pool_t;
+
+typedef void (*worker_pool_job_t)(void *param, size_t idx);
+
+EXPORT worker_pool_t *worker_pool_create(size_t threads, const char *name);
+EXPORT void worker_pool_destroy(worker_pool_t *pool);
+
+EXPORT size_t worker_pool_threads(const worker_pool_t *pool);
+
+/* calls job(param, idx) for every idx in [0, count) and waits for all of
+ * them to finish */
+EXPORT void worker_pool_run(worker_pool_t *pool, worker_pool_job_t job,
+			    void *param, size_t count);
+
+#ifdef __cplusplus
+}
+#endif
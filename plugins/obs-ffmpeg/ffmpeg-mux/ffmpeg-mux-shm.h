@@ -0,0 +1,100 @@
+#pragma once
+
+/*
+ * Shared memory transport between obs and ffmpeg-mux (Linux only).
+ *
+ * obs creates a memfd holding a struct ffm_shm_header followed by a byte
+ * ring, and passes "<pid>:<fd>" to ffmpeg-mux as its last argument.
+ * ffmpeg-mux opens the memfd through /proc and claims it by moving the
+ * state from FFM_SHM_PENDING to FFM_SHM_ATTACHED.  Neither side waits for
+ * the other: obs keeps writing to the pipe until it sees the attach, then
+ * writes an FFM_PACKET_SHM marker to the pipe and continues in the ring.
+ * ffmpeg-mux reads the pipe until it gets the marker.
+ *
+ * The ring carries exactly the same info + payload stream as the pipe.
+ * Positions only ever increase; each side publishes its position and only
+ * wakes the other side through a futex when it is actually sleeping.
+ */
+
+#ifdef __linux__
+#include <limits.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+
+#define FFM_SHM_SIZE (32 * 1024 * 1024)
+#define FFM_SHM_DATA_OFFSET 4096
+#define FFM_SHM_WAIT_MS 100
+
+enum ffm_shm_state {
+	FFM_SHM_PENDING,
+	FFM_SHM_ATTACHED,
+};
+
+struct ffm_shm_header {
+	uint32_t state;
+	int32_t reader_pid;
+	uint32_t writer_closed;
+	uint32_t reader_closed;
+	uint64_t size;
+
+	/* keep each side's position on its own cache line */
+	uint64_t write_pos __attribute__((aligned(64)));
+	uint32_t reader_waiting;
+
+	uint64_t read_pos __attribute__((aligned(64)));
+	uint32_t writer_waiting;
+};
+
+static inline void ffm_futex_wait(uint32_t *addr, uint32_t val, int ms)
+{
+	struct timespec ts = {ms / 1000, (ms % 1000) * 1000000L};
+	syscall(SYS_futex, addr, FUTEX_WAIT, val, &ts, NULL, 0);
+}
+
+static inline void ffm_futex_wake(uint32_t *addr)
+{
+	syscall(SYS_futex, addr, FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+}
+
+/* wakes the other side if it went to sleep on *waiting */
+static inline void ffm_shm_notify(uint32_t *waiting)
+{
+	if (__atomic_exchange_n(waiting, 0, __ATOMIC_SEQ_CST))
+		ffm_futex_wake(waiting);
+}
+
+static inline uint8_t *ffm_shm_data(struct ffm_shm_header *shm)
+{
+	return (uint8_t *)shm + FFM_SHM_DATA_OFFSET;
+}
+
+static inline void ffm_shm_copy_in(struct ffm_shm_header *shm, uint64_t pos,
+				   const void *data, size_t size)
+{
+	size_t offset = (size_t)(pos % shm->size);
+	size_t first = shm->size - offset;
+
+	if (first > size)
+		first = size;
+
+	memcpy(ffm_shm_data(shm) + offset, data, first);
+	memcpy(ffm_shm_data(shm), (const uint8_t *)data + first, size - first);
+}
+
+static inline void ffm_shm_copy_out(struct ffm_shm_header *shm, uint64_t pos,
+				    void *data, size_t size)
+{
+	size_t offset = (size_t)(pos % shm->size);
+	size_t first = shm->size - offset;
+
+	if (first > size)
+		first = size;
+
+	memcpy(data, ffm_shm_data(shm) + offset, first);
+	memcpy((uint8_t *)data + first, ffm_shm_data(shm), size - first);
+}
+#endif
@@ -25,6 +25,14 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include "ffmpeg-mux.h"
+#include "ffmpeg-mux-shm.h"
+
+#ifdef __linux__
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
 
 #include <util/dstr.h>
 #include <libavformat/avformat.h>
@@ -93,6 +101,7 @@ struct main_params {
 	int color_range;
 	char *acodec;
 	char *muxer_settings;
+	char *shm;
 };
 
 struct audio_params {
@@ -349,6 +358,10 @@ static bool init_params(int *argc, char ***argv, struct main_params *params,
 
 	get_opt_str(argc, argv, &params->muxer_settings, "muxer settings");
 
+	/* optional, only passed when obs offers shared memory */
+	if (*argc > 0)
+		get_opt_str(argc, argv, &params->shm, "shared memory");
+
 	return true;
 }
 
@@ -517,11 +530,141 @@ static void ffmpeg_mux_header(struct ffmpeg_mux *ffm, uint8_t *data,
 	}
 }
 
+#ifdef __linux__
+static struct ffm_shm_header *shm = NULL;
+static size_t shm_map_size = 0;
+static uint64_t shm_read_pos = 0;
+static bool shm_active = false;
+
+static void attach_shm(const char *spec)
+{
+	struct ffm_shm_header *header;
+	uint32_t expected = FFM_SHM_PENDING;
+	char path[64];
+	struct stat st;
+	int pid, fd;
+
+	if (sscanf(spec, "%d:%d", &pid, &fd) != 2)
+		return;
+
+	snprintf(path, sizeof(path), "/proc/%d/fd/%d", pid, fd);
+	fd = open(path, O_RDWR | O_CLOEXEC);
+	if (fd == -1)
+		return;
+
+	if (fstat(fd, &st) == -1 || st.st_size <= FFM_SHM_DATA_OFFSET) {
+		close(fd);
+		return;
+	}
+
+	header = mmap(NULL, (size_t)st.st_size, PROT_READ | PROT_WRITE,
+		      MAP_SHARED, fd, 0);
+	close(fd);
+	if (header == MAP_FAILED)
+		return;
+
+	if (header->size != (uint64_t)st.st_size - FFM_SHM_DATA_OFFSET) {
+		munmap(header, (size_t)st.st_size);
+		return;
+	}
+
+	header->reader_pid = (int32_t)getpid();
+
+	/* the pipe is still read until obs marks the switch */
+	if (__atomic_compare_exchange_n(&header->state, &expected,
+					FFM_SHM_ATTACHED, false,
+					__ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST)) {
+		shm = header;
+		shm_map_size = (size_t)st.st_size;
+		shm_read_pos = 0;
+	} else {
+		munmap(header, (size_t)st.st_size);
+	}
+}
+
+static void detach_shm(void)
+{
+	if (!shm)
+		return;
+
+	__atomic_store_n(&shm->reader_closed, 1, __ATOMIC_SEQ_CST);
+	ffm_futex_wake(&shm->writer_waiting);
+	munmap(shm, shm_map_size);
+	shm = NULL;
+	shm_active = false;
+}
+
+static inline bool stdin_closed(void)
+{
+	struct pollfd pfd = {.fd = STDIN_FILENO, .events = POLLIN};
+	return poll(&pfd, 1, 0) == 1 && (pfd.revents & (POLLHUP | POLLERR));
+}
+
+static bool wait_for_shm_data(void)
+{
+	__atomic_store_n(&shm->reader_waiting, 1, __ATOMIC_SEQ_CST);
+
+	if (__atomic_load_n(&shm->write_pos, __ATOMIC_SEQ_CST) ==
+	    shm_read_pos) {
+		if (__atomic_load_n(&shm->writer_closed, __ATOMIC_SEQ_CST))
+			return false;
+
+		ffm_futex_wait(&shm->reader_waiting, 1, FFM_SHM_WAIT_MS);
+	}
+
+	__atomic_store_n(&shm->reader_waiting, 0, __ATOMIC_SEQ_CST);
+
+	/* obs went away without closing the transport */
+	if (__atomic_load_n(&shm->write_pos, __ATOMIC_SEQ_CST) ==
+		    shm_read_pos &&
+	    stdin_closed())
+		return false;
+
+	return true;
+}
+
+static size_t shm_read(uint8_t *data, size_t size)
+{
+	size_t total = size;
+
+	while (size > 0) {
+		uint64_t write_pos =
+			__atomic_load_n(&shm->write_pos, __ATOMIC_ACQUIRE);
+		size_t avail = (size_t)(write_pos - shm_read_pos);
+
+		if (!avail) {
+			if (!wait_for_shm_data())
+				return 0;
+			continue;
+		}
+
+		if (avail > size)
+			avail = size;
+
+		ffm_shm_copy_out(shm, shm_read_pos, data, avail);
+		shm_read_pos += avail;
+		data += avail;
+		size -= avail;
+
+		__atomic_store_n(&shm->read_pos, shm_read_pos,
+				 __ATOMIC_SEQ_CST);
+		ffm_shm_notify(&shm->writer_waiting);
+	}
+
+	return total;
+}
+#endif
+
 static size_t safe_read(void *vdata, size_t size)
 {
 	uint8_t *data = vdata;
 	size_t total = size;
 
+#ifdef __linux__
+	if (shm_active)
+		return shm_read(data, size);
+#endif
+
 	while (size > 0) {
 		size_t in_size = fread(data, 1, size, stdin);
 		if (in_size == 0)
@@ -534,11 +677,29 @@ static size_t safe_read(void *vdata, size_t size)
 	return total;
 }
 
+static bool read_packet_info(struct ffm_packet_info *info)
+{
+	if (safe_read(info, sizeof(*info)) != sizeof(*info))
+		return false;
+
+#ifdef __linux__
+	if (info->type == FFM_PACKET_SHM) {
+		if (!shm || shm_active)
+			return false;
+
+		shm_active = true;
+		return safe_read(info, sizeof(*info)) == sizeof(*info);
+	}
+#endif
+
+	return true;
+}
+
 static bool ffmpeg_mux_get_header(struct ffmpeg_mux *ffm)
 {
 	struct ffm_packet_info info = {0};
 
-	bool success = safe_read(&info, sizeof(info)) == sizeof(info);
+	bool success = read_packet_info(&info);
 	if (success) {
 		uint8_t *data = malloc(info.size);
 
@@ -700,6 +861,11 @@ static int ffmpeg_mux_init_internal(struct ffmpeg_mux *ffm, int argc,
 	if (!init_params(&argc, &argv, &ffm->params, &ffm->audio))
 		return FFM_ERROR;
 
+#ifdef __linux__
+	if (ffm->params.shm)
+		attach_shm(ffm->params.shm);
+#endif
+
 	if (ffm->params.tracks) {
 		ffm->audio_header =
 			calloc(ffm->params.tracks, sizeof(*ffm->audio_header));
@@ -856,10 +1022,13 @@ int main(int argc, char *argv[])
 	ret = ffmpeg_mux_init(&ffm, argc, argv);
 	if (ret != FFM_SUCCESS) {
 		fprintf(stderr, "Couldn't initialize muxer\n");
+#ifdef __linux__
+		detach_shm();
+#endif
 		return ret;
 	}
 
-	while (!fail && safe_read(&info, sizeof(info)) == sizeof(info)) {
+	while (!fail && read_packet_info(&info)) {
 		resize_buf_resize(&rb, info.size);
 
 		if (safe_read(rb.buf, info.size) == info.size) {
@@ -871,6 +1040,9 @@ int main(int argc, char *argv[])
 
 	ffmpeg_mux_free(&ffm);
 	resize_buf_free(&rb);
+#ifdef __linux__
+	detach_shm();
+#endif
 
 #ifdef _WIN32
 	for (int i = 0; i < argc; i++)
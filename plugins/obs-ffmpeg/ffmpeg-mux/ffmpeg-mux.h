@@ -22,6 +22,7 @@
 enum ffm_packet_type {
 	FFM_PACKET_VIDEO,
 	FFM_PACKET_AUDIO,
+	FFM_PACKET_SHM, /* rest of the stream is in shared memory, no data */
 };
 
 #define FFM_SUCCESS 0
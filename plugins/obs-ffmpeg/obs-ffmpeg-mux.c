@@ -15,12 +15,21 @@
     along with this program.  If not, see <http://www.gnu.org/licenses/>.
 ******************************************************************************/
 #include "ffmpeg-mux/ffmpeg-mux.h"
+#include "ffmpeg-mux/ffmpeg-mux-shm.h"
 #include "obs-ffmpeg-mux.h"
+#include "obs-ffmpeg-remux.h"
+#include "obs-ffmpeg-segment.h"
 
 #ifdef _WIN32
 #include "util/windows/win-version.h"
 #endif
 
+#ifdef __linux__
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <linux/memfd.h>
+#endif
+
 #include <libavformat/avformat.h>
 
 #define do_log(level, format, ...)                  \
@@ -42,12 +51,21 @@ static const char *ffmpeg_mpegts_mux_getname(void *type)
 	return obs_module_text("FFmpegMpegtsMuxer");
 }
 
+static inline void replay_buffer_release(struct ffmpeg_muxer *stream,
+					 struct encoder_packet *pkt)
+{
+	if (replay_spill_contains(stream->spill, pkt->data))
+		replay_spill_pop(stream->spill, pkt->data, pkt->size);
+	else
+		obs_encoder_packet_release(pkt);
+}
+
 static inline void replay_buffer_clear(struct ffmpeg_muxer *stream)
 {
 	while (stream->packets.size > 0) {
 		struct encoder_packet pkt;
 		circlebuf_pop_front(&stream->packets, &pkt, sizeof(pkt));
-		obs_encoder_packet_release(&pkt);
+		replay_buffer_release(stream, &pkt);
 	}
 
 	circlebuf_free(&stream->packets);
@@ -66,24 +84,41 @@ static void ffmpeg_mux_destroy(void *data)
 	replay_buffer_clear(stream);
 	if (stream->mux_thread_joinable)
 		pthread_join(stream->mux_thread, NULL);
-	da_free(stream->mux_packets);
 	circlebuf_free(&stream->packets);
+	replay_spill_release(stream->spill);
 
-	os_process_pipe_destroy(stream->pipe);
+	stop_pipe(stream);
 	dstr_free(&stream->path);
 	dstr_free(&stream->printable_path);
 	dstr_free(&stream->stream_key);
 	dstr_free(&stream->muxer_settings);
+	dstr_free(&stream->base_path);
+	dstr_free(&stream->segment_path);
 	bfree(stream);
 }
 
+static void split_file_proc(void *data, calldata_t *cd)
+{
+	struct ffmpeg_muxer *stream = data;
+	os_atomic_set_bool(&stream->split_requested, true);
+	UNUSED_PARAMETER(cd);
+}
+
 static void *ffmpeg_mux_create(obs_data_t *settings, obs_output_t *output)
 {
 	struct ffmpeg_muxer *stream = bzalloc(sizeof(*stream));
 	stream->output = output;
 
-	if (obs_output_get_flags(output) & OBS_OUTPUT_SERVICE)
+	if (obs_output_get_flags(output) & OBS_OUTPUT_SERVICE) {
 		stream->is_network = true;
+	} else {
+		proc_handler_t *ph = obs_output_get_proc_handler(output);
+		proc_handler_add(ph, "void split_file()", split_file_proc,
+				 stream);
+
+		signal_handler_t *sh = obs_output_get_signal_handler(output);
+		signal_handler_add(sh, "void file_changed(string next_file)");
+	}
 
 	UNUSED_PARAMETER(settings);
 	return stream;
@@ -223,6 +258,16 @@ static void add_muxer_params(struct dstr *cmd, struct ffmpeg_muxer *stream)
 		dstr_copy(&mux, stream->muxer_settings.array);
 	}
 
+	/* fragments can be played back while the file is still being
+	 * written, and survive the recording being cut off */
+	if (stream->fragmented && !strstr(mux.array ? mux.array : "",
+					  "movflags")) {
+		if (!dstr_is_empty(&mux))
+			dstr_cat_ch(&mux, ' ');
+		dstr_cat(&mux,
+			 "movflags=frag_keyframe+empty_moov+default_base_moof");
+	}
+
 	log_muxer_params(stream, mux.array);
 
 	dstr_replace(&mux, "\"", "\\\"");
@@ -272,14 +317,190 @@ static void build_command_line(struct ffmpeg_muxer *stream, struct dstr *cmd,
 
 	add_stream_key(cmd, stream);
 	add_muxer_params(cmd, stream);
+
+#ifdef __linux__
+	if (stream->shm)
+		dstr_catf(cmd, "\"%d:%d\" ", (int)getpid(), stream->shm_fd);
+#endif
+}
+
+#ifdef __linux__
+static void shm_destroy(struct ffmpeg_muxer *stream)
+{
+	if (!stream->shm)
+		return;
+
+	munmap(stream->shm, FFM_SHM_DATA_OFFSET + FFM_SHM_SIZE);
+	close(stream->shm_fd);
+	stream->shm = NULL;
+	stream->shm_active = false;
+}
+
+static void shm_create(struct ffmpeg_muxer *stream)
+{
+	const size_t size = FFM_SHM_DATA_OFFSET + FFM_SHM_SIZE;
+	void *mem;
+	int fd;
+
+	fd = (int)syscall(SYS_memfd_create, "obs-ffmpeg-mux", MFD_CLOEXEC);
+	if (fd == -1) {
+		info("memfd_create failed (%d), using pipe transport", errno);
+		return;
+	}
+
+	if (ftruncate(fd, (off_t)size) == -1) {
+		info("ftruncate failed (%d), using pipe transport", errno);
+		close(fd);
+		return;
+	}
+
+	mem = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if (mem == MAP_FAILED) {
+		info("mmap failed (%d), using pipe transport", errno);
+		close(fd);
+		return;
+	}
+
+	stream->shm = mem;
+	stream->shm->size = FFM_SHM_SIZE;
+	stream->shm_fd = fd;
+	stream->shm_pos = 0;
+	stream->shm_active = false;
+}
+
+/* switches to the shared memory once ffmpeg-mux has claimed it, which it
+ * does whenever it gets around to it; until then packets keep going through
+ * the pipe */
+static void shm_try_activate(struct ffmpeg_muxer *stream)
+{
+	struct ffm_packet_info marker = {.type = FFM_PACKET_SHM};
+	size_t ret;
+
+	if (__atomic_load_n(&stream->shm->state, __ATOMIC_ACQUIRE) !=
+	    FFM_SHM_ATTACHED)
+		return;
+
+	/* tells ffmpeg-mux where the pipe data ends */
+	ret = os_process_pipe_write(stream->pipe, (const uint8_t *)&marker,
+				    sizeof(marker));
+	if (ret != sizeof(marker))
+		return;
+
+	info("Using shared memory transport");
+	stream->shm_active = true;
+}
+
+static bool shm_reader_alive(struct ffmpeg_muxer *stream)
+{
+	struct ffm_shm_header *shm = stream->shm;
+	char path[64];
+	char buf[256];
+	char *state;
+	size_t len;
+	FILE *file;
+
+	if (__atomic_load_n(&shm->reader_closed, __ATOMIC_ACQUIRE))
+		return false;
+
+	/* the helper stays a zombie until the pipe is closed, so check the
+	 * process state rather than whether the pid exists */
+	snprintf(path, sizeof(path), "/proc/%d/stat", (int)shm->reader_pid);
+	file = fopen(path, "r");
+	if (!file)
+		return false;
+
+	len = fread(buf, 1, sizeof(buf) - 1, file);
+	fclose(file);
+	buf[len] = 0;
+
+	state = strrchr(buf, ')');
+	return state && state[1] == ' ' && state[2] != 'Z' && state[2] != 'X';
+}
+
+static void shm_publish(struct ffmpeg_muxer *stream)
+{
+	__atomic_store_n(&stream->shm->write_pos, stream->shm_pos,
+			 __ATOMIC_SEQ_CST);
+	ffm_shm_notify(&stream->shm->reader_waiting);
 }
 
+static bool shm_write(struct ffmpeg_muxer *stream, const void *data,
+		      size_t size)
+{
+	struct ffm_shm_header *shm = stream->shm;
+	const uint8_t *ptr = data;
+
+	while (size) {
+		uint64_t read_pos =
+			__atomic_load_n(&shm->read_pos, __ATOMIC_ACQUIRE);
+		size_t space = shm->size - (size_t)(stream->shm_pos - read_pos);
+
+		if (!space) {
+			/* hand over what we have before sleeping */
+			shm_publish(stream);
+
+			__atomic_store_n(&shm->writer_waiting, 1,
+					 __ATOMIC_SEQ_CST);
+			if (__atomic_load_n(&shm->read_pos, __ATOMIC_SEQ_CST) ==
+			    read_pos)
+				ffm_futex_wait(&shm->writer_waiting, 1,
+					       FFM_SHM_WAIT_MS);
+			__atomic_store_n(&shm->writer_waiting, 0,
+					 __ATOMIC_SEQ_CST);
+
+			if (!shm_reader_alive(stream))
+				return false;
+			continue;
+		}
+
+		if (space > size)
+			space = size;
+
+		ffm_shm_copy_in(shm, stream->shm_pos, ptr, space);
+		stream->shm_pos += space;
+		ptr += space;
+		size -= space;
+	}
+
+	return true;
+}
+#endif
+
 void start_pipe(struct ffmpeg_muxer *stream, const char *path)
 {
 	struct dstr cmd;
+#ifdef __linux__
+	shm_create(stream);
+#endif
 	build_command_line(stream, &cmd, path);
 	stream->pipe = os_process_pipe_create(cmd.array, "w");
 	dstr_free(&cmd);
+#ifdef __linux__
+	if (!stream->pipe)
+		shm_destroy(stream);
+#endif
+}
+
+int stop_pipe(struct ffmpeg_muxer *stream)
+{
+	int ret;
+
+#ifdef __linux__
+	if (stream->shm_active) {
+		shm_publish(stream);
+		__atomic_store_n(&stream->shm->writer_closed, 1,
+				 __ATOMIC_SEQ_CST);
+		ffm_futex_wake(&stream->shm->reader_waiting);
+	}
+#endif
+
+	ret = os_process_pipe_destroy(stream->pipe);
+	stream->pipe = NULL;
+
+#ifdef __linux__
+	shm_destroy(stream);
+#endif
+	return ret;
 }
 
 static void set_file_not_readable_error(struct ffmpeg_muxer *stream,
@@ -303,6 +524,33 @@ static void set_file_not_readable_error(struct ffmpeg_muxer *stream,
 	obs_data_release(settings);
 }
 
+static bool is_fragmentable(const char *path)
+{
+	const char *ext = strrchr(path, '.');
+	return ext && (astrcmpi(ext, ".mp4") == 0 ||
+		       astrcmpi(ext, ".m4v") == 0 ||
+		       astrcmpi(ext, ".mov") == 0);
+}
+
+static void start_segments(struct ffmpeg_muxer *stream, obs_data_t *settings,
+			   const char *path)
+{
+	stream->max_time = obs_data_get_int(settings, "max_time_sec") * 1000000LL;
+	stream->max_size = obs_data_get_int(settings, "max_size_mb") *
+			   (1024 * 1024);
+	stream->fragmented = obs_data_get_bool(settings, "fragmented") &&
+			     is_fragmentable(path);
+	stream->remux_segments = stream->fragmented &&
+				 obs_data_get_bool(settings, "remux_segments");
+
+	dstr_copy(&stream->base_path, path);
+	dstr_copy(&stream->segment_path, path);
+	stream->segment = 1;
+	stream->cur_size = 0;
+	stream->cur_time = 0;
+	os_atomic_set_bool(&stream->split_requested, false);
+}
+
 static bool ffmpeg_mux_start(void *data)
 {
 	struct ffmpeg_muxer *stream = data;
@@ -339,6 +587,8 @@ static bool ffmpeg_mux_start(void *data)
 
 		fclose(test_file);
 		os_unlink(path);
+
+		start_segments(stream, settings, path);
 	}
 
 	start_pipe(stream, path);
@@ -375,8 +625,10 @@ int deactivate(struct ffmpeg_muxer *stream, int code)
 	}
 
 	if (active(stream)) {
-		ret = os_process_pipe_destroy(stream->pipe);
-		stream->pipe = NULL;
+		ret = stop_pipe(stream);
+
+		if (stream->remux_segments && ret == 0)
+			ffmpeg_remux_queue_add(stream->segment_path.array);
 
 		os_atomic_set_bool(&stream->active, false);
 		os_atomic_set_bool(&stream->sent_headers, false);
@@ -469,6 +721,25 @@ bool write_packet(struct ffmpeg_muxer *stream, struct encoder_packet *packet)
 							: FFM_PACKET_AUDIO,
 				       .keyframe = packet->keyframe};
 
+#ifdef __linux__
+	if (stream->shm && !stream->shm_active)
+		shm_try_activate(stream);
+
+	if (stream->shm_active) {
+		if (!shm_write(stream, &info, sizeof(info)) ||
+		    !shm_write(stream, packet->data, packet->size)) {
+			warn("ffmpeg-mux stopped reading shared memory");
+			signal_failure(stream);
+			return false;
+		}
+
+		/* one notification for the info structure and payload */
+		shm_publish(stream);
+		stream->total_bytes += packet->size;
+		return true;
+	}
+#endif
+
 	ret = os_process_pipe_write(stream->pipe, (const uint8_t *)&info,
 				    sizeof(info));
 	if (ret != sizeof(info)) {
@@ -530,6 +801,96 @@ bool send_headers(struct ffmpeg_muxer *stream)
 	return true;
 }
 
+static inline bool should_split(struct ffmpeg_muxer *stream,
+				struct encoder_packet *packet)
+{
+	return ffmpeg_segment_should_split(
+		packet, stream->cur_size, stream->cur_time, stream->max_size,
+		stream->max_time, os_atomic_load_bool(&stream->split_requested));
+}
+
+static bool change_file(struct ffmpeg_muxer *stream)
+{
+	int ret = stop_pipe(stream);
+
+	if (ret != 0)
+		warn("ffmpeg-mux exited with code %d for '%s'", ret,
+		     stream->segment_path.array);
+	else if (stream->remux_segments)
+		ffmpeg_remux_queue_add(stream->segment_path.array);
+
+	stream->segment++;
+	ffmpeg_segment_path(&stream->segment_path, stream->base_path.array,
+			    stream->segment);
+
+	start_pipe(stream, stream->segment_path.array);
+	if (!stream->pipe) {
+		warn("Failed to create process pipe for '%s'",
+		     stream->segment_path.array);
+		os_atomic_set_bool(&stream->active, false);
+		obs_output_signal_stop(stream->output, OBS_OUTPUT_ERROR);
+		return false;
+	}
+
+	if (!send_headers(stream))
+		return false;
+
+	/* timestamps of every file start from its first keyframe */
+	stream->found_video = false;
+	memset(stream->found_audio, 0, sizeof(stream->found_audio));
+	stream->cur_size = 0;
+	os_atomic_set_bool(&stream->split_requested, false);
+
+	info("Changed output file to '%s'", stream->segment_path.array);
+
+	calldata_t cd = {0};
+	signal_handler_t *sh = obs_output_get_signal_handler(stream->output);
+	calldata_set_string(&cd, "next_file", stream->segment_path.array);
+	signal_handler_signal(sh, "file_changed", &cd);
+	calldata_free(&cd);
+	return true;
+}
+
+static void offset_segment_packet(struct ffmpeg_muxer *stream,
+				  struct encoder_packet *pkt)
+{
+	if (pkt->type == OBS_ENCODER_VIDEO) {
+		if (!stream->found_video) {
+			stream->video_pts_offset = pkt->pts;
+			stream->found_video = true;
+		}
+
+		pkt->pts -= stream->video_pts_offset;
+		pkt->dts -= stream->video_pts_offset;
+	} else {
+		if (!stream->found_audio[pkt->track_idx]) {
+			stream->audio_dts_offsets[pkt->track_idx] = pkt->dts;
+			stream->found_audio[pkt->track_idx] = true;
+		}
+
+		pkt->pts -= stream->audio_dts_offsets[pkt->track_idx];
+		pkt->dts -= stream->audio_dts_offsets[pkt->track_idx];
+	}
+}
+
+static void write_segment_packet(struct ffmpeg_muxer *stream,
+				 struct encoder_packet *packet)
+{
+	struct encoder_packet pkt = *packet;
+
+	if (should_split(stream, packet) && !change_file(stream))
+		return;
+
+	if (stream->segment > 1)
+		offset_segment_packet(stream, &pkt);
+
+	if (!stream->cur_size)
+		stream->cur_time = pkt.dts_usec;
+
+	if (write_packet(stream, &pkt))
+		stream->cur_size += (int64_t)pkt.size;
+}
+
 static void ffmpeg_mux_data(void *data, struct encoder_packet *packet)
 {
 	struct ffmpeg_muxer *stream = data;
@@ -557,7 +918,10 @@ static void ffmpeg_mux_data(void *data, struct encoder_packet *packet)
 		}
 	}
 
-	write_packet(stream, packet);
+	if (stream->is_network)
+		write_packet(stream, packet);
+	else
+		write_segment_packet(stream, packet);
 }
 
 static obs_properties_t *ffmpeg_mux_properties(void *unused)
@@ -663,8 +1027,47 @@ static void save_replay_proc(void *data, calldata_t *cd)
 static void get_last_replay(void *data, calldata_t *cd)
 {
 	struct ffmpeg_muxer *stream = data;
-	if (!os_atomic_load_bool(&stream->muxing))
-		calldata_set_string(cd, "path", stream->path.array);
+
+	pthread_mutex_lock(&stream->save_mutex);
+	calldata_set_string(cd, "path", stream->last_replay.array);
+	pthread_mutex_unlock(&stream->save_mutex);
+}
+
+struct replay_save {
+	DARRAY(struct encoder_packet) packets;
+
+	/* the file the spilled packets point into */
+	struct replay_spill *spill;
+	uint64_t spill_pin;
+};
+
+#define MAX_PENDING_SAVES 2
+
+static void get_save_progress(void *data, calldata_t *cd)
+{
+	struct ffmpeg_muxer *stream = data;
+	bool saving = os_atomic_load_bool(&stream->muxing);
+	double progress = 0.0;
+	double bytes_per_sec = 0.0;
+	size_t pending;
+
+	pthread_mutex_lock(&stream->save_mutex);
+	if (saving && stream->save_packets) {
+		uint64_t elapsed = os_gettime_ns() - stream->save_start_ns;
+
+		progress = (double)stream->save_written /
+			   (double)stream->save_packets;
+		if (elapsed)
+			bytes_per_sec = (double)stream->save_bytes *
+					1000000000.0 / (double)elapsed;
+	}
+	pending = stream->save_queue.size / sizeof(struct replay_save);
+	pthread_mutex_unlock(&stream->save_mutex);
+
+	calldata_set_bool(cd, "saving", saving);
+	calldata_set_int(cd, "pending", (long long)pending);
+	calldata_set_float(cd, "progress", progress);
+	calldata_set_int(cd, "bytes_per_sec", (long long)bytes_per_sec);
 }
 
 static void *replay_buffer_create(obs_data_t *settings, obs_output_t *output)
@@ -673,6 +1076,12 @@ static void *replay_buffer_create(obs_data_t *settings, obs_output_t *output)
 	struct ffmpeg_muxer *stream = bzalloc(sizeof(*stream));
 	stream->output = output;
 
+	pthread_mutex_init_value(&stream->save_mutex);
+	if (pthread_mutex_init(&stream->save_mutex, NULL) != 0)
+		goto fail;
+	if (os_sem_init(&stream->save_sem, 0) != 0)
+		goto fail;
+
 	stream->hotkey =
 		obs_hotkey_register_output(output, "ReplayBuffer.Save",
 					   obs_module_text("ReplayBuffer.Save"),
@@ -682,11 +1091,33 @@ static void *replay_buffer_create(obs_data_t *settings, obs_output_t *output)
 	proc_handler_add(ph, "void save()", save_replay_proc, stream);
 	proc_handler_add(ph, "void get_last_replay(out string path)",
 			 get_last_replay, stream);
+	proc_handler_add(ph,
+			 "void get_save_progress(out bool saving, "
+			 "out int pending, out float progress, "
+			 "out int bytes_per_sec)",
+			 get_save_progress, stream);
 
 	signal_handler_t *sh = obs_output_get_signal_handler(output);
 	signal_handler_add(sh, "void saved()");
 
 	return stream;
+
+fail:
+	pthread_mutex_destroy(&stream->save_mutex);
+	bfree(stream);
+	return NULL;
+}
+
+/* lets the save thread finish everything queued, then joins it */
+static void replay_buffer_stop_saves(struct ffmpeg_muxer *stream)
+{
+	if (!stream->mux_thread_joinable)
+		return;
+
+	/* a post without a queued save tells the thread to exit */
+	os_sem_post(stream->save_sem);
+	pthread_join(stream->mux_thread, NULL);
+	stream->mux_thread_joinable = false;
 }
 
 static void replay_buffer_destroy(void *data)
@@ -694,9 +1125,48 @@ static void replay_buffer_destroy(void *data)
 	struct ffmpeg_muxer *stream = data;
 	if (stream->hotkey)
 		obs_hotkey_unregister(stream->hotkey);
+
+	replay_buffer_stop_saves(stream);
+	pthread_mutex_destroy(&stream->save_mutex);
+	os_sem_destroy(stream->save_sem);
+	circlebuf_free(&stream->save_queue);
+	dstr_free(&stream->last_replay);
+
 	ffmpeg_mux_destroy(data);
 }
 
+static void replay_buffer_start_spill(struct ffmpeg_muxer *stream,
+				      obs_data_t *settings)
+{
+	const char *dir = obs_data_get_string(settings, "spill_directory");
+	uint64_t capacity;
+
+	/* pending saves hold their own reference to the old file */
+	replay_spill_release(stream->spill);
+	stream->spill = NULL;
+
+	if (!obs_data_get_bool(settings, "spill_to_disk"))
+		return;
+	if (!stream->max_size) {
+		warn("Spilling to disk requires a maximum replay size, "
+		     "keeping the replay buffer in memory");
+		return;
+	}
+
+	if (!*dir)
+		dir = obs_data_get_string(settings, "directory");
+
+	/* leave room for a full buffer to be saved while the next one is
+	 * being written */
+	capacity = (uint64_t)stream->max_size * 2;
+	if (capacity > SIZE_MAX) {
+		warn("Replay buffer is too large to spill to disk");
+		return;
+	}
+
+	stream->spill = replay_spill_create(dir, (size_t)capacity);
+}
+
 static bool replay_buffer_start(void *data)
 {
 	struct ffmpeg_muxer *stream = data;
@@ -709,6 +1179,7 @@ static bool replay_buffer_start(void *data)
 	obs_data_t *s = obs_output_get_settings(stream->output);
 	stream->max_time = obs_data_get_int(s, "max_time_sec") * 1000000LL;
 	stream->max_size = obs_data_get_int(s, "max_size_mb") * (1024 * 1024);
+	replay_buffer_start_spill(stream, s);
 	obs_data_release(s);
 
 	os_atomic_set_bool(&stream->active, true);
@@ -741,7 +1212,7 @@ static bool purge_front(struct ffmpeg_muxer *stream)
 		stream->cur_size -= (int64_t)pkt.size;
 	}
 
-	obs_encoder_packet_release(&pkt);
+	replay_buffer_release(stream, &pkt);
 	return keyframe;
 }
 
@@ -784,13 +1255,11 @@ static void insert_packet(struct darray *array, struct encoder_packet *packet,
 			  int64_t video_offset, int64_t *audio_offsets,
 			  int64_t video_dts_offset, int64_t *audio_dts_offsets)
 {
-	struct encoder_packet pkt;
+	struct encoder_packet pkt = *packet;
 	DARRAY(struct encoder_packet) packets;
 	packets.da = *array;
 	size_t idx;
 
-	obs_encoder_packet_ref(&pkt, packet);
-
 	if (pkt.type == OBS_ENCODER_VIDEO) {
 		pkt.dts_usec -= video_offset;
 		pkt.dts -= video_dts_offset;
@@ -811,59 +1280,9 @@ static void insert_packet(struct darray *array, struct encoder_packet *packet,
 	*array = packets.da;
 }
 
-static void *replay_buffer_mux_thread(void *data)
-{
-	struct ffmpeg_muxer *stream = data;
-	bool error = false;
-
-	start_pipe(stream, stream->path.array);
-
-	if (!stream->pipe) {
-		warn("Failed to create process pipe");
-		error = true;
-		goto error;
-	}
-
-	if (!send_headers(stream)) {
-		warn("Could not write headers for file '%s'",
-		     stream->path.array);
-		error = true;
-		goto error;
-	}
-
-	for (size_t i = 0; i < stream->mux_packets.num; i++) {
-		struct encoder_packet *pkt = &stream->mux_packets.array[i];
-		write_packet(stream, pkt);
-		obs_encoder_packet_release(pkt);
-	}
-
-	info("Wrote replay buffer to '%s'", stream->path.array);
-
-error:
-	os_process_pipe_destroy(stream->pipe);
-	stream->pipe = NULL;
-	da_free(stream->mux_packets);
-	os_atomic_set_bool(&stream->muxing, false);
-
-	if (!error) {
-		calldata_t cd = {0};
-		signal_handler_t *sh =
-			obs_output_get_signal_handler(stream->output);
-		signal_handler_signal(sh, "saved", &cd);
-	}
-
-	return NULL;
-}
-
-static void replay_buffer_save(struct ffmpeg_muxer *stream)
+static void replay_buffer_reorder(struct replay_save *save)
 {
-	const size_t size = sizeof(struct encoder_packet);
-	size_t num_packets = stream->packets.size / size;
-
-	da_reserve(stream->mux_packets, num_packets);
-
-	/* ---------------------------- */
-	/* reorder packets */
+	DARRAY(struct encoder_packet) packets = {0};
 
 	bool found_video = false;
 	bool found_audio[MAX_AUDIO_MIXES] = {0};
@@ -872,9 +1291,10 @@ static void replay_buffer_save(struct ffmpeg_muxer *stream)
 	int64_t audio_offsets[MAX_AUDIO_MIXES] = {0};
 	int64_t audio_dts_offsets[MAX_AUDIO_MIXES] = {0};
 
-	for (size_t i = 0; i < num_packets; i++) {
-		struct encoder_packet *pkt;
-		pkt = circlebuf_data(&stream->packets, i * size);
+	da_reserve(packets, save->packets.num);
+
+	for (size_t i = 0; i < save->packets.num; i++) {
+		struct encoder_packet *pkt = save->packets.array + i;
 
 		if (pkt->type == OBS_ENCODER_VIDEO) {
 			if (!found_video) {
@@ -890,14 +1310,16 @@ static void replay_buffer_save(struct ffmpeg_muxer *stream)
 			}
 		}
 
-		insert_packet(&stream->mux_packets.da, pkt, video_offset,
-			      audio_offsets, video_dts_offset,
-			      audio_dts_offsets);
+		insert_packet(&packets.da, pkt, video_offset, audio_offsets,
+			      video_dts_offset, audio_dts_offsets);
 	}
 
-	/* ---------------------------- */
-	/* generate filename */
+	da_free(save->packets);
+	save->packets.da = packets.da;
+}
 
+static void replay_buffer_generate_path(struct ffmpeg_muxer *stream)
+{
 	obs_data_t *settings = obs_output_get_settings(stream->output);
 	const char *dir = obs_data_get_string(settings, "directory");
 	const char *fmt = obs_data_get_string(settings, "format");
@@ -921,13 +1343,164 @@ static void replay_buffer_save(struct ffmpeg_muxer *stream)
 
 	bfree(filename);
 	obs_data_release(settings);
+}
 
-	/* ---------------------------- */
+static bool replay_buffer_write(struct ffmpeg_muxer *stream,
+				struct replay_save *save)
+{
+	bool success = false;
+
+	replay_buffer_reorder(save);
+	replay_buffer_generate_path(stream);
+
+	pthread_mutex_lock(&stream->save_mutex);
+	stream->save_packets = save->packets.num;
+	stream->save_written = 0;
+	stream->save_bytes = 0;
+	stream->save_start_ns = os_gettime_ns();
+	pthread_mutex_unlock(&stream->save_mutex);
+
+	start_pipe(stream, stream->path.array);
+
+	if (!stream->pipe) {
+		warn("Failed to create process pipe");
+		goto error;
+	}
 
-	os_atomic_set_bool(&stream->muxing, true);
-	stream->mux_thread_joinable = pthread_create(&stream->mux_thread, NULL,
-						     replay_buffer_mux_thread,
-						     stream) == 0;
+	if (!send_headers(stream)) {
+		warn("Could not write headers for file '%s'",
+		     stream->path.array);
+		goto error;
+	}
+
+	for (size_t i = 0; i < save->packets.num; i++) {
+		struct encoder_packet *pkt = &save->packets.array[i];
+		write_packet(stream, pkt);
+
+		pthread_mutex_lock(&stream->save_mutex);
+		stream->save_written++;
+		stream->save_bytes += pkt->size;
+		pthread_mutex_unlock(&stream->save_mutex);
+	}
+
+	info("Wrote replay buffer to '%s'", stream->path.array);
+	success = true;
+
+error:
+	stop_pipe(stream);
+	return success;
+}
+
+static void replay_buffer_free_save(struct replay_save *save)
+{
+	for (size_t i = 0; i < save->packets.num; i++) {
+		struct encoder_packet *pkt = save->packets.array + i;
+		if (!replay_spill_contains(save->spill, pkt->data))
+			obs_encoder_packet_release(pkt);
+	}
+
+	da_free(save->packets);
+
+	if (save->spill) {
+		replay_spill_unpin(save->spill, save->spill_pin);
+		replay_spill_release(save->spill);
+	}
+}
+
+static void *replay_buffer_save_thread(void *data)
+{
+	struct ffmpeg_muxer *stream = data;
+
+	os_set_thread_name("replay-buffer: save thread");
+
+	for (;;) {
+		struct replay_save save;
+		bool saved;
+
+		os_sem_wait(stream->save_sem);
+
+		pthread_mutex_lock(&stream->save_mutex);
+		if (!stream->save_queue.size) {
+			pthread_mutex_unlock(&stream->save_mutex);
+			break;
+		}
+		circlebuf_pop_front(&stream->save_queue, &save, sizeof(save));
+		pthread_mutex_unlock(&stream->save_mutex);
+
+		os_atomic_set_bool(&stream->muxing, true);
+		saved = replay_buffer_write(stream, &save);
+		replay_buffer_free_save(&save);
+
+		if (saved) {
+			pthread_mutex_lock(&stream->save_mutex);
+			dstr_copy_dstr(&stream->last_replay, &stream->path);
+			pthread_mutex_unlock(&stream->save_mutex);
+		}
+
+		os_atomic_set_bool(&stream->muxing, false);
+
+		if (saved) {
+			calldata_t cd = {0};
+			signal_handler_t *sh =
+				obs_output_get_signal_handler(stream->output);
+			signal_handler_signal(sh, "saved", &cd);
+		}
+	}
+
+	return NULL;
+}
+
+/* Takes a reference to every buffered packet and hands the snapshot to the
+ * save thread, so the packet thread never waits on sorting or disk I/O. */
+static void replay_buffer_save(struct ffmpeg_muxer *stream)
+{
+	const size_t size = sizeof(struct encoder_packet);
+	size_t num_packets = stream->packets.size / size;
+	struct replay_save save = {0};
+	size_t pending;
+
+	pthread_mutex_lock(&stream->save_mutex);
+	pending = stream->save_queue.size / sizeof(save);
+	pthread_mutex_unlock(&stream->save_mutex);
+
+	if (pending >= MAX_PENDING_SAVES) {
+		warn("%zu saves are already pending, ignoring save request",
+		     pending);
+		return;
+	}
+
+	if (!stream->mux_thread_joinable) {
+		stream->mux_thread_joinable =
+			pthread_create(&stream->mux_thread, NULL,
+				       replay_buffer_save_thread, stream) == 0;
+		if (!stream->mux_thread_joinable) {
+			warn("Failed to create save thread");
+			return;
+		}
+	}
+
+	if (stream->spill) {
+		save.spill = replay_spill_addref(stream->spill);
+		save.spill_pin = replay_spill_pin(stream->spill);
+	}
+
+	da_resize(save.packets, num_packets);
+
+	for (size_t i = 0; i < num_packets; i++) {
+		struct encoder_packet *pkt;
+		pkt = circlebuf_data(&stream->packets, i * size);
+
+		if (replay_spill_contains(save.spill, pkt->data))
+			save.packets.array[i] = *pkt;
+		else
+			obs_encoder_packet_ref(&save.packets.array[i], pkt);
+	}
+
+	pthread_mutex_lock(&stream->save_mutex);
+	circlebuf_push_back(&stream->save_queue, &save, sizeof(save));
+	pthread_mutex_unlock(&stream->save_mutex);
+
+	os_sem_post(stream->save_sem);
 }
 
 static void deactivate_replay_buffer(struct ffmpeg_muxer *stream, int code)
@@ -965,27 +1538,30 @@ static void replay_buffer_data(void *data, struct encoder_packet *packet)
 		}
 	}
 
-	obs_encoder_packet_ref(&pkt, packet);
-	replay_buffer_purge(stream, &pkt);
+	/* purge first so the packets it drops make room in the spill file */
+	replay_buffer_purge(stream, packet);
+
+	uint8_t *spilled = stream->spill ? replay_spill_push(stream->spill,
+							     packet->data,
+							     packet->size)
+					 : NULL;
+	if (spilled) {
+		pkt = *packet;
+		pkt.data = spilled;
+	} else {
+		obs_encoder_packet_ref(&pkt, packet);
+	}
 
 	if (!stream->packets.size)
 		stream->cur_time = pkt.dts_usec;
 	stream->cur_size += pkt.size;
 
-	circlebuf_push_back(&stream->packets, packet, sizeof(*packet));
+	circlebuf_push_back(&stream->packets, &pkt, sizeof(pkt));
 
 	if (packet->type == OBS_ENCODER_VIDEO && packet->keyframe)
 		stream->keyframes++;
 
 	if (stream->save_ts && packet->sys_dts_usec >= stream->save_ts) {
-		if (os_atomic_load_bool(&stream->muxing))
-			return;
-
-		if (stream->mux_thread_joinable) {
-			pthread_join(stream->mux_thread, NULL);
-			stream->mux_thread_joinable = false;
-		}
-
 		stream->save_ts = 0;
 		replay_buffer_save(stream);
 	}
@@ -995,6 +1571,8 @@ static void replay_buffer_defaults(obs_data_t *s)
 {
 	obs_data_set_default_int(s, "max_time_sec", 15);
 	obs_data_set_default_int(s, "max_size_mb", 500);
+	obs_data_set_default_bool(s, "spill_to_disk", false);
+	obs_data_set_default_string(s, "spill_directory", "");
 	obs_data_set_default_string(s, "format", "%CCYY-%MM-%DD %hh-%mm-%ss");
 	obs_data_set_default_string(s, "extension", "mp4");
 	obs_data_set_default_bool(s, "allow_spaces", true);
@@ -10,6 +10,8 @@
 #include <util/platform.h>
 #include <util/threading.h>
 
+#include "obs-ffmpeg-replay-spill.h"
+
 struct ffmpeg_muxer {
 	obs_output_t *output;
 	os_process_pipe_t *pipe;
@@ -24,7 +26,7 @@ struct ffmpeg_muxer {
 	struct dstr muxer_settings;
 	struct dstr stream_key;
 
-	/* replay buffer */
+	/* replay buffer and segmented recording */
 	int64_t cur_size;
 	int64_t cur_time;
 	int64_t max_size;
@@ -32,8 +34,30 @@ struct ffmpeg_muxer {
 	int64_t save_ts;
 	int keyframes;
 	obs_hotkey_id hotkey;
+	struct replay_spill *spill;
+
+	/* replay buffer saves, written on mux_thread */
+	pthread_mutex_t save_mutex;
+	os_sem_t *save_sem;
+	struct circlebuf save_queue;
+	struct dstr last_replay;
 	volatile bool muxing;
-	DARRAY(struct encoder_packet) mux_packets;
+	size_t save_packets;
+	size_t save_written;
+	uint64_t save_bytes;
+	uint64_t save_start_ns;
+
+	/* segmented recording */
+	struct dstr base_path;
+	struct dstr segment_path;
+	int segment;
+	volatile bool split_requested;
+	bool fragmented;
+	bool remux_segments;
+	bool found_video;
+	bool found_audio[MAX_AUDIO_MIXES];
+	int64_t video_pts_offset;
+	int64_t audio_dts_offsets[MAX_AUDIO_MIXES];
 
 	/* these are accessed both by replay buffer and by HLS */
 	pthread_t mux_thread;
@@ -51,11 +75,20 @@ struct ffmpeg_muxer {
 	int64_t last_dts_usec;
 
 	bool is_network;
+
+#ifdef __linux__
+	/* shared memory transport, see ffmpeg-mux/ffmpeg-mux-shm.h */
+	struct ffm_shm_header *shm;
+	int shm_fd;
+	uint64_t shm_pos;
+	bool shm_active;
+#endif
 };
 
 bool stopping(struct ffmpeg_muxer *stream);
 bool active(struct ffmpeg_muxer *stream);
 void start_pipe(struct ffmpeg_muxer *stream, const char *path);
+int stop_pipe(struct ffmpeg_muxer *stream);
 bool write_packet(struct ffmpeg_muxer *stream, struct encoder_packet *packet);
 bool send_headers(struct ffmpeg_muxer *stream);
 int deactivate(struct ffmpeg_muxer *stream, int code);
@@ -0,0 +1,160 @@
+#include "obs-ffmpeg-remux.h"
+#include "obs-ffmpeg-segment.h"
+
+#include <obs-module.h>
+#include <media-io/media-remux.h>
+#include <util/circlebuf.h>
+#include <util/dstr.h>
+#include <util/platform.h>
+#include <util/threading.h>
+
+#define MAX_REMUX_THREADS 4
+
+static struct {
+	pthread_mutex_t mutex;
+	os_sem_t *sem;
+	struct circlebuf paths;
+	pthread_t threads[MAX_REMUX_THREADS];
+	size_t num_threads;
+	volatile bool stop;
+	bool initialized;
+} remux = {.mutex = PTHREAD_MUTEX_INITIALIZER};
+
+static bool remux_progress(void *data, float percent)
+{
+	UNUSED_PARAMETER(data);
+	UNUSED_PARAMETER(percent);
+
+	/* cancels the job in progress when the module is unloaded */
+	return !os_atomic_load_bool(&remux.stop);
+}
+
+static void remux_file(const char *path)
+{
+	struct dstr temp = {0};
+	media_remux_job_t job;
+	bool success = false;
+	uint64_t start = os_gettime_ns();
+
+	/* "name.remux.ext", so ffmpeg still picks the right format */
+	ffmpeg_segment_add_suffix(&temp, path, ".remux");
+
+	if (media_remux_job_create(&job, path, temp.array)) {
+		success = media_remux_job_process(job, remux_progress, NULL);
+		media_remux_job_destroy(job);
+	}
+
+	/* a cancelled job still finishes the file, but it is incomplete */
+	if (os_atomic_load_bool(&remux.stop))
+		success = false;
+
+	if (success && os_safe_replace(path, temp.array, NULL) == 0) {
+		blog(LOG_INFO, "[ffmpeg remux] Remuxed '%s' in %.1f seconds",
+		     path, (double)(os_gettime_ns() - start) / 1000000000.0);
+	} else {
+		blog(LOG_WARNING, "[ffmpeg remux] Failed to remux '%s'", path);
+		os_unlink(temp.array);
+	}
+
+	dstr_free(&temp);
+}
+
+static void *remux_thread(void *unused)
+{
+	UNUSED_PARAMETER(unused);
+	os_set_thread_name("obs-ffmpeg: remux thread");
+
+	for (;;) {
+		char *path;
+
+		os_sem_wait(remux.sem);
+
+		pthread_mutex_lock(&remux.mutex);
+		if (os_atomic_load_bool(&remux.stop) || !remux.paths.size) {
+			pthread_mutex_unlock(&remux.mutex);
+			break;
+		}
+		circlebuf_pop_front(&remux.paths, &path, sizeof(path));
+		pthread_mutex_unlock(&remux.mutex);
+
+		remux_file(path);
+		bfree(path);
+	}
+
+	return NULL;
+}
+
+static bool init_remux_threads(void)
+{
+	int cores = os_get_physical_cores();
+	size_t count = cores > 1 ? (size_t)cores / 2 : 1;
+
+	if (count > MAX_REMUX_THREADS)
+		count = MAX_REMUX_THREADS;
+
+	if (os_sem_init(&remux.sem, 0) != 0)
+		return false;
+
+	for (size_t i = 0; i < count; i++) {
+		if (pthread_create(&remux.threads[remux.num_threads], NULL,
+				   remux_thread, NULL) == 0)
+			remux.num_threads++;
+	}
+
+	if (!remux.num_threads) {
+		os_sem_destroy(remux.sem);
+		remux.sem = NULL;
+		return false;
+	}
+
+	remux.initialized = true;
+	return true;
+}
+
+void ffmpeg_remux_queue_add(const char *path)
+{
+	char *copy;
+
+	pthread_mutex_lock(&remux.mutex);
+
+	if (!remux.initialized && !init_remux_threads()) {
+		pthread_mutex_unlock(&remux.mutex);
+		blog(LOG_WARNING, "[ffmpeg remux] Failed to start remux "
+				  "threads, not remuxing '%s'",
+		     path);
+		return;
+	}
+
+	copy = bstrdup(path);
+	circlebuf_push_back(&remux.paths, &copy, sizeof(copy));
+	pthread_mutex_unlock(&remux.mutex);
+
+	os_sem_post(remux.sem);
+}
+
+void ffmpeg_remux_queue_free(void)
+{
+	if (!remux.initialized)
+		return;
+
+	os_atomic_set_bool(&remux.stop, true);
+	for (size_t i = 0; i < remux.num_threads; i++)
+		os_sem_post(remux.sem);
+	for (size_t i = 0; i < remux.num_threads; i++)
+		pthread_join(remux.threads[i], NULL);
+
+	/* whatever is left stays fragmented, which is still playable */
+	while (remux.paths.size) {
+		char *path;
+		circlebuf_pop_front(&remux.paths, &path, sizeof(path));
+		blog(LOG_INFO, "[ffmpeg remux] Not remuxing '%s'", path);
+		bfree(path);
+	}
+
+	circlebuf_free(&remux.paths);
+	os_sem_destroy(remux.sem);
+	remux.sem = NULL;
+	remux.num_threads = 0;
+	remux.initialized = false;
+	os_atomic_set_bool(&remux.stop, false);
+}
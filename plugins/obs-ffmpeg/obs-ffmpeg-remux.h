@@ -0,0 +1,13 @@
+#pragma once
+
+/*
+ * Background remuxing of finished recordings.
+ *
+ * Files are queued by path and remuxed in place by a small pool of threads,
+ * which is started on first use and stopped when the module is unloaded.
+ * This is used to turn finished fragmented MP4 segments into regular
+ * progressive files while the recording carries on.
+ */
+
+void ffmpeg_remux_queue_add(const char *path);
+void ffmpeg_remux_queue_free(void);
@@ -0,0 +1,360 @@
+#include "obs-ffmpeg-replay-spill.h"
+
+#include <string.h>
+#include <obs-module.h>
+#include <util/darray.h>
+#include <util/dstr.h>
+#include <util/platform.h>
+#include <util/threading.h>
+
+#ifndef _WIN32
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#endif
+
+#define SPILL_ALIGN 64
+
+/* how much of the most recently written data stays mapped in memory */
+#define SPILL_RESIDENT (16 * 1024 * 1024)
+#define SPILL_RELEASE_STEP (8 * 1024 * 1024)
+
+/* how much of the file the reserve thread allocates at a time */
+#define SPILL_RESERVE_STEP (32 * 1024 * 1024)
+
+struct replay_spill {
+	volatile long refs;
+	uint8_t *base;
+	size_t capacity;
+	int fd;
+
+	/* positions only ever increase, the file offset is pos % capacity */
+	pthread_mutex_t mutex;
+	uint64_t head;
+	uint64_t tail;
+
+	/* the tail at the time of each pin, oldest first since the tail only
+	 * moves forward */
+	DARRAY(uint64_t) pins;
+
+	/* only the start of the file up to here can be written to yet */
+	size_t reserved;
+	pthread_t reserve_thread;
+	bool reserve_thread_active;
+	volatile bool stop_reserving;
+
+	/* pages before this position have been dropped from the mapping */
+	uint64_t released;
+};
+
+static inline size_t spill_align(size_t size)
+{
+	return (size + SPILL_ALIGN - 1) & ~(size_t)(SPILL_ALIGN - 1);
+}
+
+static inline uint64_t next_lap(const struct replay_spill *spill, uint64_t pos)
+{
+	return pos + (spill->capacity - pos % spill->capacity);
+}
+
+#ifdef _WIN32
+struct replay_spill *replay_spill_create(const char *dir, size_t capacity)
+{
+	UNUSED_PARAMETER(dir);
+	UNUSED_PARAMETER(capacity);
+
+	blog(LOG_WARNING, "[replay spill] Spilling the replay buffer to disk "
+			  "is not supported on this platform");
+	return NULL;
+}
+
+static void replay_spill_destroy(struct replay_spill *spill)
+{
+	UNUSED_PARAMETER(spill);
+}
+
+static void release_pages(struct replay_spill *spill)
+{
+	UNUSED_PARAMETER(spill);
+}
+
+#else
+
+static bool open_spill_file(struct replay_spill *spill, const char *dir)
+{
+	struct dstr path = {0};
+
+	dstr_copy(&path, dir);
+	dstr_replace(&path, "\\", "/");
+	if (dstr_end(&path) != '/')
+		dstr_cat_ch(&path, '/');
+	os_mkdirs(path.array);
+	dstr_cat(&path, "obs-replay-XXXXXX");
+
+	spill->fd = mkstemp(path.array);
+	if (spill->fd == -1) {
+		blog(LOG_WARNING, "[replay spill] Failed to create '%s': %d",
+		     path.array, errno);
+		dstr_free(&path);
+		return false;
+	}
+
+	/* nothing else ever needs to open the file, and this way it cannot
+	 * be left behind if obs goes away unexpectedly */
+	unlink(path.array);
+	fcntl(spill->fd, F_SETFD, FD_CLOEXEC);
+
+	dstr_free(&path);
+	return true;
+}
+
+/* Writing into a hole of a sparse file through a mapping raises SIGBUS if
+ * the disk is full, so the file is allocated before it is written to.  That
+ * can take a while for a large buffer, so it is done here rather than on the
+ * thread starting the output, and packets are kept in memory until there is
+ * room for them in the file. */
+static void *reserve_thread(void *data)
+{
+	struct replay_spill *spill = data;
+	size_t reserved = 0;
+
+	os_set_thread_name("replay-buffer: spill reserve");
+
+	while (reserved < spill->capacity &&
+	       !os_atomic_load_bool(&spill->stop_reserving)) {
+		size_t step = spill->capacity - reserved;
+		int ret;
+
+		if (step > SPILL_RESERVE_STEP)
+			step = SPILL_RESERVE_STEP;
+
+#ifdef __linux__
+		ret = posix_fallocate(spill->fd, (off_t)reserved, (off_t)step);
+#else
+		ret = ftruncate(spill->fd, (off_t)(reserved + step)) == 0
+			      ? 0
+			      : errno;
+#endif
+		if (ret != 0) {
+			blog(LOG_WARNING,
+			     "[replay spill] Failed to reserve more than %zu "
+			     "MB: %d, keeping the rest of the replay buffer in "
+			     "memory",
+			     reserved / (1024 * 1024), ret);
+			break;
+		}
+
+		reserved += step;
+
+		pthread_mutex_lock(&spill->mutex);
+		spill->reserved = reserved;
+		pthread_mutex_unlock(&spill->mutex);
+	}
+
+	return NULL;
+}
+
+struct replay_spill *replay_spill_create(const char *dir, size_t capacity)
+{
+	struct replay_spill *spill = bzalloc(sizeof(*spill));
+	void *base;
+
+	spill->refs = 1;
+	spill->capacity = spill_align(capacity);
+	spill->fd = -1;
+
+	if (!open_spill_file(spill, dir))
+		goto fail;
+
+	base = mmap(NULL, spill->capacity, PROT_READ | PROT_WRITE, MAP_SHARED,
+		    spill->fd, 0);
+	if (base == MAP_FAILED) {
+		blog(LOG_WARNING, "[replay spill] Failed to map %zu MB: %d",
+		     spill->capacity / (1024 * 1024), errno);
+		goto fail;
+	}
+
+	spill->base = base;
+	pthread_mutex_init(&spill->mutex, NULL);
+
+	spill->reserve_thread_active = pthread_create(&spill->reserve_thread,
+						      NULL, reserve_thread,
+						      spill) == 0;
+	if (!spill->reserve_thread_active) {
+		blog(LOG_WARNING, "[replay spill] Failed to create thread");
+		munmap(base, spill->capacity);
+		pthread_mutex_destroy(&spill->mutex);
+		goto fail;
+	}
+
+	blog(LOG_INFO, "[replay spill] Spilling up to %zu MB to '%s'",
+	     spill->capacity / (1024 * 1024), dir);
+	return spill;
+
+fail:
+	if (spill->fd != -1)
+		close(spill->fd);
+	bfree(spill);
+	return NULL;
+}
+
+static void replay_spill_destroy(struct replay_spill *spill)
+{
+	if (spill->reserve_thread_active) {
+		os_atomic_set_bool(&spill->stop_reserving, true);
+		pthread_join(spill->reserve_thread, NULL);
+	}
+
+	munmap(spill->base, spill->capacity);
+	close(spill->fd);
+	pthread_mutex_destroy(&spill->mutex);
+	da_free(spill->pins);
+	bfree(spill);
+}
+
+static void drop_range(struct replay_spill *spill, size_t start, size_t end)
+{
+	size_t page = (size_t)sysconf(_SC_PAGESIZE);
+
+	start = (start + page - 1) & ~(page - 1);
+	end &= ~(page - 1);
+
+	/* the mapping is shared, so the data stays in the file and is simply
+	 * faulted back in from disk when a save reads it */
+	if (end > start)
+		madvise(spill->base + start, end - start, MADV_DONTNEED);
+}
+
+/* only called from the thread that pushes packets */
+static void release_pages(struct replay_spill *spill)
+{
+	uint64_t end;
+
+	if (spill->head < SPILL_RESIDENT)
+		return;
+
+	end = spill->head - SPILL_RESIDENT;
+	if (end < spill->released + SPILL_RELEASE_STEP)
+		return;
+	if (end - spill->released > spill->capacity)
+		spill->released = end - spill->capacity;
+
+	while (spill->released < end) {
+		uint64_t lap_end = next_lap(spill, spill->released);
+		uint64_t stop = lap_end < end ? lap_end : end;
+		size_t offset = (size_t)(spill->released % spill->capacity);
+
+		drop_range(spill, offset,
+			   offset + (size_t)(stop - spill->released));
+		spill->released = stop;
+	}
+}
+#endif
+
+struct replay_spill *replay_spill_addref(struct replay_spill *spill)
+{
+	if (spill)
+		os_atomic_inc_long(&spill->refs);
+	return spill;
+}
+
+void replay_spill_release(struct replay_spill *spill)
+{
+	if (spill && os_atomic_dec_long(&spill->refs) == 0)
+		replay_spill_destroy(spill);
+}
+
+size_t replay_spill_reserved(struct replay_spill *spill)
+{
+	size_t reserved;
+
+	pthread_mutex_lock(&spill->mutex);
+	reserved = spill->reserved;
+	pthread_mutex_unlock(&spill->mutex);
+	return reserved;
+}
+
+uint8_t *replay_spill_push(struct replay_spill *spill, const uint8_t *data,
+			   size_t size)
+{
+	size_t aligned = spill_align(size);
+	uint64_t pos, oldest;
+	uint8_t *ptr;
+
+	if (!size || aligned > spill->capacity)
+		return NULL;
+
+	pthread_mutex_lock(&spill->mutex);
+
+	/* a payload never wraps around the end of the file */
+	pos = spill->head;
+	if (pos % spill->capacity + aligned > spill->capacity)
+		pos = next_lap(spill, pos);
+
+	if (pos % spill->capacity + aligned > spill->reserved) {
+		pthread_mutex_unlock(&spill->mutex);
+		return NULL;
+	}
+
+	oldest = spill->pins.num ? spill->pins.array[0] : spill->tail;
+
+	if (pos + aligned - oldest > spill->capacity) {
+		pthread_mutex_unlock(&spill->mutex);
+		return NULL;
+	}
+
+	spill->head = pos + aligned;
+	pthread_mutex_unlock(&spill->mutex);
+
+	ptr = spill->base + pos % spill->capacity;
+	memcpy(ptr, data, size);
+
+	release_pages(spill);
+	return ptr;
+}
+
+void replay_spill_pop(struct replay_spill *spill, const uint8_t *data,
+		      size_t size)
+{
+	size_t offset = (size_t)(data - spill->base);
+	uint64_t pos;
+
+	pthread_mutex_lock(&spill->mutex);
+
+	/* the oldest packet either starts at the tail, or was moved to the
+	 * start of the file because it did not fit at the end */
+	pos = spill->tail;
+	if (pos % spill->capacity != offset)
+		pos = next_lap(spill, pos);
+
+	spill->tail = pos + spill_align(size);
+	pthread_mutex_unlock(&spill->mutex);
+}
+
+uint64_t replay_spill_pin(struct replay_spill *spill)
+{
+	uint64_t pin;
+
+	pthread_mutex_lock(&spill->mutex);
+	pin = spill->tail;
+	da_push_back(spill->pins, &pin);
+	pthread_mutex_unlock(&spill->mutex);
+
+	return pin;
+}
+
+void replay_spill_unpin(struct replay_spill *spill, uint64_t pin)
+{
+	pthread_mutex_lock(&spill->mutex);
+	da_erase_item(spill->pins, &pin);
+	pthread_mutex_unlock(&spill->mutex);
+}
+
+bool replay_spill_contains(const struct replay_spill *spill,
+			   const uint8_t *data)
+{
+	return spill && data >= spill->base &&
+	       data < spill->base + spill->capacity;
+}
@@ -0,0 +1,48 @@
+#pragma once
+
+/*
+ * Disk-backed packet storage for the replay buffer.
+ *
+ * Packet payloads are copied into a memory mapped file that is used as a
+ * FIFO ring, so the replay buffer itself only has to keep the packet
+ * metadata in memory.  Pages that have not been touched recently are
+ * dropped from the mapping and read back from disk only when a replay is
+ * actually saved.
+ *
+ * The file is allocated in the background after it is created.  Until that
+ * has caught up, packets that don't fit in the allocated part are refused
+ * and stay in memory.
+ *
+ * Packets must be popped in the same order they were pushed.  While a save
+ * is in progress, the data it reads can be pinned so it does not get
+ * overwritten by new packets, and the save can hold a reference so the file
+ * outlives the output that created it.
+ */
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+struct replay_spill;
+
+/* returns NULL if the file could not be created or mapped */
+struct replay_spill *replay_spill_create(const char *dir, size_t capacity);
+struct replay_spill *replay_spill_addref(struct replay_spill *spill);
+void replay_spill_release(struct replay_spill *spill);
+
+/* how much of the file has been allocated so far */
+size_t replay_spill_reserved(struct replay_spill *spill);
+
+/* copies a packet payload into the file, returns NULL if there is no room */
+uint8_t *replay_spill_push(struct replay_spill *spill, const uint8_t *data,
+			   size_t size);
+void replay_spill_pop(struct replay_spill *spill, const uint8_t *data,
+		      size_t size);
+
+/* keeps everything currently stored from being overwritten until the
+ * returned pin is passed to replay_spill_unpin */
+uint64_t replay_spill_pin(struct replay_spill *spill);
+void replay_spill_unpin(struct replay_spill *spill, uint64_t pin);
+
+bool replay_spill_contains(const struct replay_spill *spill,
+			   const uint8_t *data);
@@ -0,0 +1,57 @@
+#include "obs-ffmpeg-segment.h"
+
+#include <stdio.h>
+#include <string.h>
+
+bool ffmpeg_segment_should_split(const struct encoder_packet *packet,
+				 int64_t cur_size, int64_t cur_time,
+				 int64_t max_size, int64_t max_time,
+				 bool requested)
+{
+	/* only split in front of a keyframe of the first video track */
+	if (packet->type != OBS_ENCODER_VIDEO || packet->track_idx > 0 ||
+	    !packet->keyframe)
+		return false;
+
+	/* nothing has been written to the current file yet */
+	if (!cur_size)
+		return false;
+
+	if (requested)
+		return true;
+	if (max_size && cur_size + (int64_t)packet->size >= max_size)
+		return true;
+	if (max_time && packet->dts_usec - cur_time >= max_time)
+		return true;
+
+	return false;
+}
+
+void ffmpeg_segment_add_suffix(struct dstr *dst, const char *path,
+			       const char *suffix)
+{
+	const char *slash = strrchr(path, '/');
+	const char *ext = strrchr(path, '.');
+
+#ifdef _WIN32
+	const char *backslash = strrchr(path, '\\');
+	if (backslash > slash)
+		slash = backslash;
+#endif
+
+	if (!ext || (slash && ext < slash))
+		ext = path + strlen(path);
+
+	dstr_ncopy(dst, path, ext - path);
+	dstr_cat(dst, suffix);
+	dstr_cat(dst, ext);
+}
+
+void ffmpeg_segment_path(struct dstr *dst, const char *base_path,
+			 int segment)
+{
+	char suffix[16];
+
+	snprintf(suffix, sizeof(suffix), "_%03d", segment);
+	ffmpeg_segment_add_suffix(dst, base_path, suffix);
+}
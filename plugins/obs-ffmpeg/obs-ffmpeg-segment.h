@@ -0,0 +1,26 @@
+#pragma once
+
+#include <obs.h>
+#include <util/dstr.h>
+
+/*
+ * Split decisions and file names for segmented recordings.  These don't
+ * touch the muxer process, so they live apart from obs-ffmpeg-mux.c.
+ */
+
+/* returns true if the recording should move on to a new file in front of
+ * this packet.  cur_size is what has been written to the current file so
+ * far and cur_time the dts (in microseconds) it started at; a max_size or
+ * max_time of 0 means no limit */
+bool ffmpeg_segment_should_split(const struct encoder_packet *packet,
+				 int64_t cur_size, int64_t cur_time,
+				 int64_t max_size, int64_t max_time,
+				 bool requested);
+
+/* "name.ext" -> "name<suffix>.ext" */
+void ffmpeg_segment_add_suffix(struct dstr *dst, const char *path,
+			       const char *suffix);
+
+/* "name.ext" -> "name_NNN.ext" for the given (1-based) segment */
+void ffmpeg_segment_path(struct dstr *dst, const char *base_path,
+			 int segment);
@@ -5,6 +5,7 @@
 #include <libavformat/avformat.h>
 
 #include "obs-ffmpeg-config.h"
+#include "obs-ffmpeg-remux.h"
 
 #ifdef _WIN32
 #include <dxgi.h>
@@ -268,6 +269,8 @@ bool obs_module_load(void)
 
 void obs_module_unload(void)
 {
+	ffmpeg_remux_queue_free();
+
 #if ENABLE_FFMPEG_LOGGING
 	obs_ffmpeg_unload_logging();
 #endif
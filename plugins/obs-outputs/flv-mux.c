@@ -169,14 +169,51 @@ void flv_meta_data(obs_output_t *context, uint8_t **output, size_t *size,
 static int32_t last_time = 0;
 #endif
 
-static void flv_video(struct serializer *s, int32_t dts_offset,
+void flv_tag_init(struct flv_tag *tag)
+{
+	array_output_serializer_init(&tag->s, &tag->scratch);
+	tag->header_size = 0;
+	tag->payload = NULL;
+	tag->payload_size = 0;
+}
+
+void flv_tag_free(struct flv_tag *tag)
+{
+	array_output_serializer_free(&tag->scratch);
+}
+
+static inline void flv_tag_reset(struct flv_tag *tag)
+{
+	tag->scratch.bytes.num = 0;
+	tag->header_size = 0;
+	tag->payload = NULL;
+	tag->payload_size = 0;
+}
+
+/* ends the header and references the payload in place */
+static inline void flv_tag_set_payload(struct flv_tag *tag,
+				       const uint8_t *data, size_t size)
+{
+	tag->header_size = tag->scratch.bytes.num;
+	tag->payload = data;
+	tag->payload_size = size;
+}
+
+/* write tag size (starting byte doesn't count) */
+static inline void flv_tag_end(struct flv_tag *tag)
+{
+	s_wb32(&tag->s, (uint32_t)flv_tag_size(tag) - 1);
+}
+
+static bool flv_video(struct flv_tag *tag, int32_t dts_offset,
 		      struct encoder_packet *packet, bool is_header)
 {
+	struct serializer *s = &tag->s;
 	int64_t offset = packet->pts - packet->dts;
 	int32_t time_ms = get_ms_time(packet, packet->dts) - dts_offset;
 
 	if (!packet->data || !packet->size)
-		return;
+		return false;
 
 	s_w8(s, RTMP_PACKET_TYPE_VIDEO);
 
@@ -198,19 +235,20 @@ static void flv_video(struct serializer *s, int32_t dts_offset,
 	s_w8(s, packet->keyframe ? 0x17 : 0x27);
 	s_w8(s, is_header ? 0 : 1);
 	s_wb24(s, get_ms_time(packet, offset));
-	s_write(s, packet->data, packet->size);
 
-	/* write tag size (starting byte doesn't count) */
-	s_wb32(s, (uint32_t)serializer_get_pos(s) - 1);
+	flv_tag_set_payload(tag, packet->data, packet->size);
+	flv_tag_end(tag);
+	return true;
 }
 
-static void flv_audio(struct serializer *s, int32_t dts_offset,
+static bool flv_audio(struct flv_tag *tag, int32_t dts_offset,
 		      struct encoder_packet *packet, bool is_header)
 {
+	struct serializer *s = &tag->s;
 	int32_t time_ms = get_ms_time(packet, packet->dts) - dts_offset;
 
 	if (!packet->data || !packet->size)
-		return;
+		return false;
 
 	s_w8(s, RTMP_PACKET_TYPE_AUDIO);
 
@@ -231,27 +269,21 @@ static void flv_audio(struct serializer *s, int32_t dts_offset,
 	/* these are the two extra bytes mentioned above */
 	s_w8(s, 0xaf);
 	s_w8(s, is_header ? 0 : 1);
-	s_write(s, packet->data, packet->size);
 
-	/* write tag size (starting byte doesn't count) */
-	s_wb32(s, (uint32_t)serializer_get_pos(s) - 1);
+	flv_tag_set_payload(tag, packet->data, packet->size);
+	flv_tag_end(tag);
+	return true;
 }
 
-void flv_packet_mux(struct encoder_packet *packet, int32_t dts_offset,
-		    uint8_t **output, size_t *size, bool is_header)
+bool flv_packet_mux_tag(struct flv_tag *tag, struct encoder_packet *packet,
+			int32_t dts_offset, bool is_header)
 {
-	struct array_output_data data;
-	struct serializer s;
-
-	array_output_serializer_init(&s, &data);
+	flv_tag_reset(tag);
 
 	if (packet->type == OBS_ENCODER_VIDEO)
-		flv_video(&s, dts_offset, packet, is_header);
+		return flv_video(tag, dts_offset, packet, is_header);
 	else
-		flv_audio(&s, dts_offset, packet, is_header);
-
-	*output = data.bytes.array;
-	*size = data.bytes.num;
+		return flv_audio(tag, dts_offset, packet, is_header);
 }
 
 /* ------------------------------------------------------------------------- */
@@ -410,55 +442,45 @@ static inline void s_u29b_value(struct serializer *s, uint32_t val)
 	s_u29(s, 1 | ((val & 0xFFFFFFF) << 1));
 }
 
-static void flv_build_additional_audio(uint8_t **data, size_t *size,
-				       struct encoder_packet *packet,
-				       bool is_header, size_t index)
+static void flv_additional_audio_prefix(struct serializer *s,
+					struct encoder_packet *packet,
+					bool is_header, size_t index)
 {
 	UNUSED_PARAMETER(index);
-	struct array_output_data out;
-	struct serializer s;
 
-	array_output_serializer_init(&s, &out);
-
-	s_w8(&s, AMF_STRING);
-	s_amf_conststring(&s, "additionalMedia");
+	s_w8(s, AMF_STRING);
+	s_amf_conststring(s, "additionalMedia");
 
-	s_w8(&s, AMF_OBJECT);
+	s_w8(s, AMF_OBJECT);
 	{
-		s_amf_conststring(&s, "id");
+		s_amf_conststring(s, "id");
 
-		s_w8(&s, AMF_STRING);
-		s_amf_conststring(&s, "stream0");
+		s_w8(s, AMF_STRING);
+		s_amf_conststring(s, "stream0");
 
 		/* ----- */
 
-		s_amf_conststring(&s, "media");
+		s_amf_conststring(s, "media");
 
-		s_w8(&s, AMF_AVMPLUS);
-		s_w8(&s, AMF3_BYTE_ARRAY);
-		s_u29b_value(&s, (uint32_t)packet->size + 2);
-		s_w8(&s, 0xaf);
-		s_w8(&s, is_header ? 0 : 1);
-		s_write(&s, packet->data, packet->size);
+		s_w8(s, AMF_AVMPLUS);
+		s_w8(s, AMF3_BYTE_ARRAY);
+		s_u29b_value(s, (uint32_t)packet->size + 2);
+		s_w8(s, 0xaf);
+		s_w8(s, is_header ? 0 : 1);
 	}
-	s_wb24(&s, AMF_OBJECT_END);
-
-	*data = out.bytes.array;
-	*size = out.bytes.num;
 }
 
-static void flv_additional_audio(struct serializer *s, int32_t dts_offset,
+static bool flv_additional_audio(struct flv_tag *tag, int32_t dts_offset,
 				 struct encoder_packet *packet, bool is_header,
 				 size_t index)
 {
+	struct serializer *s = &tag->s;
 	int32_t time_ms = get_ms_time(packet, packet->dts) - dts_offset;
-	uint8_t *data;
-	size_t size;
+	uint32_t size;
+	uint8_t *header;
 
 	if (!packet->data || !packet->size)
-		return;
-
-	flv_build_additional_audio(&data, &size, packet, is_header, index);
+		return false;
 
 	s_w8(s, RTMP_PACKET_TYPE_INFO); //18
 
@@ -471,33 +493,37 @@ static void flv_additional_audio(struct serializer *s, int32_t dts_offset,
 	last_time = time_ms;
 #endif
 
-	s_wb24(s, (uint32_t)size);
+	/* data size is filled in once the AMF wrapping is written */
+	s_wb24(s, 0);
 	s_wb24(s, time_ms);
 	s_w8(s, (time_ms >> 24) & 0x7F);
 	s_wb24(s, 0);
 
-	serialize(s, data, size);
-	bfree(data);
+	flv_additional_audio_prefix(s, packet, is_header, index);
+	flv_tag_set_payload(tag, packet->data, packet->size);
+	s_wb24(s, AMF_OBJECT_END);
+
+	size = (uint32_t)flv_tag_size(tag) - 11;
+	header = tag->scratch.bytes.array;
+	header[1] = (uint8_t)(size >> 16);
+	header[2] = (uint8_t)(size >> 8);
+	header[3] = (uint8_t)size;
 
-	s_wb32(s, (uint32_t)serializer_get_pos(s) - 1);
+	flv_tag_end(tag);
+	return true;
 }
 
-void flv_additional_packet_mux(struct encoder_packet *packet,
-			       int32_t dts_offset, uint8_t **data, size_t *size,
-			       bool is_header, size_t index)
+bool flv_additional_packet_mux_tag(struct flv_tag *tag,
+				   struct encoder_packet *packet,
+				   int32_t dts_offset, bool is_header,
+				   size_t index)
 {
-	struct array_output_data out;
-	struct serializer s;
-
-	array_output_serializer_init(&s, &out);
+	flv_tag_reset(tag);
 
 	if (packet->type == OBS_ENCODER_VIDEO) {
 		//currently unsupported
 		bcrash("who said you could output an additional video packet?");
-	} else {
-		flv_additional_audio(&s, dts_offset, packet, is_header, index);
 	}
 
-	*data = out.bytes.array;
-	*size = out.bytes.num;
+	return flv_additional_audio(tag, dts_offset, packet, is_header, index);
 }
@@ -18,6 +18,7 @@
 #pragma once
 
 #include <obs.h>
+#include <util/array-serializer.h>
 
 #define MILLISECOND_DEN 1000
 
@@ -26,15 +27,49 @@ static int32_t get_ms_time(struct encoder_packet *packet, int64_t val)
 	return (int32_t)(val * MILLISECOND_DEN / packet->timebase_den);
 }
 
+/* An FLV tag that references the encoder payload instead of copying it.
+ * The header and trailer are serialized into scratch space that is reused
+ * from tag to tag. */
+struct flv_tag {
+	struct array_output_data scratch;
+	struct serializer s;
+	size_t header_size;
+	const uint8_t *payload;
+	size_t payload_size;
+};
+
+static inline const uint8_t *flv_tag_header(const struct flv_tag *tag)
+{
+	return tag->scratch.bytes.array;
+}
+
+static inline const uint8_t *flv_tag_trailer(const struct flv_tag *tag)
+{
+	return tag->scratch.bytes.array + tag->header_size;
+}
+
+static inline size_t flv_tag_trailer_size(const struct flv_tag *tag)
+{
+	return tag->scratch.bytes.num - tag->header_size;
+}
+
+static inline size_t flv_tag_size(const struct flv_tag *tag)
+{
+	return tag->scratch.bytes.num + tag->payload_size;
+}
+
 extern void write_file_info(FILE *file, int64_t duration_ms, int64_t size);
 
 extern void flv_meta_data(obs_output_t *context, uint8_t **output, size_t *size,
 			  bool write_header);
 extern void flv_additional_meta_data(obs_output_t *context, uint8_t **output,
 				     size_t *size);
-extern void flv_packet_mux(struct encoder_packet *packet, int32_t dts_offset,
-			   uint8_t **output, size_t *size, bool is_header);
-extern void flv_additional_packet_mux(struct encoder_packet *packet,
-				      int32_t dts_offset, uint8_t **output,
-				      size_t *size, bool is_header,
-				      size_t index);
+extern void flv_tag_init(struct flv_tag *tag);
+extern void flv_tag_free(struct flv_tag *tag);
+extern bool flv_packet_mux_tag(struct flv_tag *tag,
+			       struct encoder_packet *packet,
+			       int32_t dts_offset, bool is_header);
+extern bool flv_additional_packet_mux_tag(struct flv_tag *tag,
+					  struct encoder_packet *packet,
+					  int32_t dts_offset, bool is_header,
+					  size_t index);
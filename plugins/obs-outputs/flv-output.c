@@ -45,6 +45,8 @@ struct flv_output {
 
 	bool got_first_video;
 	int32_t start_dts_offset;
+
+	struct flv_tag tag;
 };
 
 static inline bool stopping(struct flv_output *stream)
@@ -71,6 +73,7 @@ static void flv_output_destroy(void *data)
 
 	pthread_mutex_destroy(&stream->mutex);
 	dstr_free(&stream->path);
+	flv_tag_free(&stream->tag);
 	bfree(stream);
 }
 
@@ -79,6 +82,7 @@ static void *flv_output_create(obs_data_t *settings, obs_output_t *output)
 	struct flv_output *stream = bzalloc(sizeof(struct flv_output));
 	stream->output = output;
 	pthread_mutex_init(&stream->mutex, NULL);
+	flv_tag_init(&stream->tag);
 
 	UNUSED_PARAMETER(settings);
 	return stream;
@@ -87,16 +91,19 @@ static void *flv_output_create(obs_data_t *settings, obs_output_t *output)
 static int write_packet(struct flv_output *stream,
 			struct encoder_packet *packet, bool is_header)
 {
-	uint8_t *data;
-	size_t size;
+	struct flv_tag *tag = &stream->tag;
 	int ret = 0;
 
 	stream->last_packet_ts = get_ms_time(packet, packet->dts);
 
-	flv_packet_mux(packet, is_header ? 0 : stream->start_dts_offset, &data,
-		       &size, is_header);
-	fwrite(data, 1, size, stream->file);
-	bfree(data);
+	if (flv_packet_mux_tag(tag, packet,
+			       is_header ? 0 : stream->start_dts_offset,
+			       is_header)) {
+		fwrite(flv_tag_header(tag), 1, tag->header_size, stream->file);
+		fwrite(tag->payload, 1, tag->payload_size, stream->file);
+		fwrite(flv_tag_trailer(tag), 1, flv_tag_trailer_size(tag),
+		       stream->file);
+	}
 
 	return ret;
 }
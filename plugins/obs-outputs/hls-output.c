@@ -0,0 +1,719 @@
+#include <obs-module.h>
+#include <obs-avc.h>
+#include <util/curl/curl-helper.h>
+#include <util/circlebuf.h>
+#include <util/dstr.h>
+#include <util/platform.h>
+#include <util/threading.h>
+#include "hls-packager.h"
+
+/*
+ *   In-process HLS output.
+ *
+ *   Packets are packaged to CMAF segments (and low latency HLS parts) on the
+ * data thread, and the resulting files are queued to a write thread that
+ * stores them in a local directory or PUTs them to an HTTP origin, in order,
+ * so a playlist is never visible before the media it refers to.
+ */
+
+#define do_log(level, format, ...)              \
+	blog(level, "[hls output: '%s'] " format, \
+	     obs_output_get_name(stream->output), ##__VA_ARGS__)
+
+#define warn(format, ...) do_log(LOG_WARNING, format, ##__VA_ARGS__)
+#define info(format, ...) do_log(LOG_INFO, format, ##__VA_ARGS__)
+
+#define OPT_PATH "path"
+#define OPT_PLAYLIST_NAME "playlist_name"
+#define OPT_SEGMENT_DURATION "segment_duration"
+#define OPT_PART_DURATION "part_duration_ms"
+#define OPT_PLAYLIST_SIZE "playlist_size"
+#define OPT_DELETE_SEGMENTS "delete_segments"
+
+#define HTTP_CONNECT_TIMEOUT_SEC 5L
+#define HTTP_TIMEOUT_SEC 10L
+#define MAX_HTTP_FAILURES 10
+
+/* media waiting to be written is capped at about this much of the stream,
+ * newer parts and segments are skipped once it falls that far behind */
+#define MAX_QUEUE_SEC 10
+#define MIN_QUEUE_BYTES (4 * 1024 * 1024)
+
+struct hls_file {
+	char *name;
+	uint8_t *data;
+	size_t size;
+	bool remove;
+	/* only the newest queued playlist is written */
+	uint32_t playlist_version;
+};
+
+struct hls_output {
+	obs_output_t *output;
+
+	pthread_mutex_t mutex;
+	struct hls_packager packager;
+	bool packager_ready;
+	bool finished;
+
+	pthread_mutex_t queue_mutex;
+	struct circlebuf queue;
+	os_sem_t *queue_sem;
+	uint32_t playlist_version;
+	size_t queued_bytes;
+	size_t max_queued_bytes;
+	int skipped_files;
+
+	pthread_t write_thread;
+	bool thread_created;
+	volatile bool active;
+	volatile bool stopping;
+	volatile bool encode_error;
+	uint64_t stop_ts;
+
+	struct dstr path;
+	bool http;
+	CURL *curl;
+	int http_failures;
+	uint64_t total_bytes;
+};
+
+static const char *hls_output_getname(void *unused)
+{
+	UNUSED_PARAMETER(unused);
+	return obs_module_text("HLSOutput");
+}
+
+static inline bool active(struct hls_output *stream)
+{
+	return os_atomic_load_bool(&stream->active);
+}
+
+/* ------------------------------------------------------------------------- */
+/* file queue                                                                */
+
+static void free_file(struct hls_file *file)
+{
+	bfree(file->name);
+	bfree(file->data);
+}
+
+/* playlists, removals and the end of the stream are always queued, only
+ * media is skipped when the queue is full */
+static bool queue_full(struct hls_output *stream, struct hls_file *file)
+{
+	if (file->playlist_version || !file->size)
+		return false;
+
+	if (stream->queued_bytes + file->size > stream->max_queued_bytes) {
+		if (!stream->skipped_files++)
+			warn("Writing is falling behind, skipping segments");
+		return true;
+	}
+
+	if (stream->skipped_files) {
+		info("Writing caught up, skipped %d files",
+		     stream->skipped_files);
+		stream->skipped_files = 0;
+	}
+	return false;
+}
+
+static void push_file(struct hls_output *stream, struct hls_file *file)
+{
+	pthread_mutex_lock(&stream->queue_mutex);
+	if (file->name &&
+	    strcmp(file->name, stream->packager.playlist_name.array) == 0)
+		file->playlist_version = ++stream->playlist_version;
+
+	if (queue_full(stream, file)) {
+		pthread_mutex_unlock(&stream->queue_mutex);
+		free_file(file);
+		return;
+	}
+
+	stream->queued_bytes += file->size;
+	circlebuf_push_back(&stream->queue, file, sizeof(*file));
+	pthread_mutex_unlock(&stream->queue_mutex);
+
+	os_sem_post(stream->queue_sem);
+}
+
+static void write_cb(void *param, const char *name, const uint8_t *data,
+		     size_t size)
+{
+	struct hls_file file = {0};
+
+	file.name = bstrdup(name);
+	file.data = bmemdup(data, size);
+	file.size = size;
+	push_file(param, &file);
+}
+
+static void remove_cb(void *param, const char *name)
+{
+	struct hls_file file = {0};
+
+	file.name = bstrdup(name);
+	file.remove = true;
+	push_file(param, &file);
+}
+
+static void clear_queue(struct hls_output *stream)
+{
+	pthread_mutex_lock(&stream->queue_mutex);
+	while (stream->queue.size) {
+		struct hls_file file;
+		circlebuf_pop_front(&stream->queue, &file, sizeof(file));
+		free_file(&file);
+	}
+	stream->queued_bytes = 0;
+	stream->skipped_files = 0;
+	pthread_mutex_unlock(&stream->queue_mutex);
+}
+
+/* ------------------------------------------------------------------------- */
+/* local directory                                                           */
+
+static bool write_local(struct hls_output *stream, struct hls_file *file)
+{
+	struct dstr full = {0};
+	struct dstr temp = {0};
+	bool success = false;
+	FILE *f;
+
+	dstr_printf(&full, "%s/%s", stream->path.array, file->name);
+
+	if (file->remove) {
+		os_unlink(full.array);
+		dstr_free(&full);
+		return true;
+	}
+
+	/* write and rename, so nothing ever reads a half written file */
+	dstr_printf(&temp, "%s.tmp", full.array);
+
+	f = os_fopen(temp.array, "wb");
+	if (f) {
+		success = fwrite(file->data, 1, file->size, f) == file->size;
+		success = fclose(f) == 0 && success;
+	}
+
+	if (success)
+		success = os_rename(temp.array, full.array) == 0;
+	if (!success)
+		warn("Failed to write '%s'", full.array);
+
+	dstr_free(&full);
+	dstr_free(&temp);
+	return success;
+}
+
+/* ------------------------------------------------------------------------- */
+/* HTTP                                                                      */
+
+struct upload {
+	const uint8_t *data;
+	size_t size;
+	size_t pos;
+};
+
+static size_t upload_read(char *buffer, size_t size, size_t nitems,
+			  void *param)
+{
+	struct upload *upload = param;
+	size_t left = upload->size - upload->pos;
+	size_t count = size * nitems;
+
+	if (count > left)
+		count = left;
+
+	memcpy(buffer, upload->data + upload->pos, count);
+	upload->pos += count;
+	return count;
+}
+
+static size_t discard_response(char *ptr, size_t size, size_t nmemb,
+			       void *param)
+{
+	UNUSED_PARAMETER(ptr);
+	UNUSED_PARAMETER(param);
+	return size * nmemb;
+}
+
+static const char *content_type(const char *name)
+{
+	const char *ext = strrchr(name, '.');
+
+	if (ext && strcmp(ext, ".m3u8") == 0)
+		return "Content-Type: application/vnd.apple.mpegurl";
+	if (ext && strcmp(ext, ".m4s") == 0)
+		return "Content-Type: video/iso.segment";
+	return "Content-Type: video/mp4";
+}
+
+static bool write_http(struct hls_output *stream, struct hls_file *file)
+{
+	struct upload upload = {file->data, file->size, 0};
+	struct curl_slist *headers = NULL;
+	struct dstr url = {0};
+	long response = 0;
+	CURLcode code;
+
+	dstr_printf(&url, "%s/%s", stream->path.array, file->name);
+
+	/* reset keeps the connection alive between requests */
+	curl_easy_reset(stream->curl);
+	curl_easy_setopt(stream->curl, CURLOPT_URL, url.array);
+	curl_easy_setopt(stream->curl, CURLOPT_CONNECTTIMEOUT,
+			 HTTP_CONNECT_TIMEOUT_SEC);
+	curl_easy_setopt(stream->curl, CURLOPT_TIMEOUT, HTTP_TIMEOUT_SEC);
+	curl_easy_setopt(stream->curl, CURLOPT_TCP_NODELAY, 1L);
+	curl_easy_setopt(stream->curl, CURLOPT_WRITEFUNCTION,
+			 discard_response);
+	curl_obs_set_revoke_setting(stream->curl);
+
+	if (file->remove) {
+		curl_easy_setopt(stream->curl, CURLOPT_CUSTOMREQUEST, "DELETE");
+	} else {
+		headers = curl_slist_append(headers, content_type(file->name));
+		curl_easy_setopt(stream->curl, CURLOPT_HTTPHEADER, headers);
+		curl_easy_setopt(stream->curl, CURLOPT_UPLOAD, 1L);
+		curl_easy_setopt(stream->curl, CURLOPT_READFUNCTION,
+				 upload_read);
+		curl_easy_setopt(stream->curl, CURLOPT_READDATA, &upload);
+		curl_easy_setopt(stream->curl, CURLOPT_INFILESIZE_LARGE,
+				 (curl_off_t)file->size);
+	}
+
+	code = curl_easy_perform(stream->curl);
+	if (code == CURLE_OK)
+		curl_easy_getinfo(stream->curl, CURLINFO_RESPONSE_CODE,
+				  &response);
+
+	curl_slist_free_all(headers);
+
+	if (code != CURLE_OK || response >= 400) {
+		warn("%s '%s' failed: %s", file->remove ? "DELETE" : "PUT",
+		     url.array,
+		     code != CURLE_OK ? curl_easy_strerror(code)
+				      : "HTTP error");
+		dstr_free(&url);
+		return false;
+	}
+
+	dstr_free(&url);
+	return true;
+}
+
+/* ------------------------------------------------------------------------- */
+
+static bool pop_file(struct hls_output *stream, struct hls_file *file,
+		     bool *stale)
+{
+	pthread_mutex_lock(&stream->queue_mutex);
+	if (!stream->queue.size) {
+		pthread_mutex_unlock(&stream->queue_mutex);
+		return false;
+	}
+
+	circlebuf_pop_front(&stream->queue, file, sizeof(*file));
+	stream->queued_bytes -= file->size;
+
+	/* a newer playlist is already queued behind this one */
+	*stale = file->playlist_version &&
+		 file->playlist_version != stream->playlist_version;
+	pthread_mutex_unlock(&stream->queue_mutex);
+	return true;
+}
+
+static void *write_thread(void *data)
+{
+	struct hls_output *stream = data;
+	int error = OBS_OUTPUT_SUCCESS;
+
+	os_set_thread_name("hls-output: write_thread");
+
+	while (os_sem_wait(stream->queue_sem) == 0) {
+		struct hls_file file;
+		bool success;
+		bool stale;
+
+		if (!pop_file(stream, &file, &stale))
+			continue;
+
+		/* end of the stream */
+		if (!file.name)
+			break;
+
+		if (stale) {
+			free_file(&file);
+			continue;
+		}
+
+		success = stream->http ? write_http(stream, &file)
+				       : write_local(stream, &file);
+
+		if (success && !file.remove)
+			stream->total_bytes += file.size;
+
+		if (!stream->http && !success) {
+			error = OBS_OUTPUT_ERROR;
+
+		} else if (stream->http && !file.remove) {
+			stream->http_failures =
+				success ? 0 : stream->http_failures + 1;
+
+			if (stream->http_failures == MAX_HTTP_FAILURES) {
+				warn("Too many failed uploads, disconnecting");
+				error = OBS_OUTPUT_DISCONNECTED;
+			}
+		}
+
+		free_file(&file);
+
+		if (error != OBS_OUTPUT_SUCCESS)
+			break;
+	}
+
+	if (stream->curl) {
+		curl_easy_cleanup(stream->curl);
+		stream->curl = NULL;
+	}
+
+	os_atomic_set_bool(&stream->active, false);
+
+	if (error != OBS_OUTPUT_SUCCESS) {
+		obs_output_signal_stop(stream->output, error);
+	} else if (os_atomic_load_bool(&stream->encode_error)) {
+		info("Encoder error, stopping");
+		obs_output_signal_stop(stream->output, OBS_OUTPUT_ENCODE_ERROR);
+	} else {
+		info("Output stopped");
+		obs_output_end_data_capture(stream->output);
+	}
+
+	return NULL;
+}
+
+/* ------------------------------------------------------------------------- */
+
+static void finish(struct hls_output *stream)
+{
+	struct hls_file end = {0};
+
+	pthread_mutex_lock(&stream->mutex);
+	if (stream->finished) {
+		pthread_mutex_unlock(&stream->mutex);
+		return;
+	}
+
+	if (stream->packager_ready)
+		hls_packager_finish(&stream->packager);
+	stream->finished = true;
+
+	/* tells the write thread to stop once everything is written */
+	push_file(stream, &end);
+	pthread_mutex_unlock(&stream->mutex);
+}
+
+static void hls_output_data(void *data, struct encoder_packet *packet)
+{
+	struct hls_output *stream = data;
+
+	if (!active(stream))
+		return;
+
+	/* encoder fail */
+	if (!packet) {
+		os_atomic_set_bool(&stream->encode_error, true);
+		finish(stream);
+		return;
+	}
+
+	if (os_atomic_load_bool(&stream->stopping) &&
+	    packet->sys_dts_usec >= (int64_t)stream->stop_ts) {
+		finish(stream);
+		return;
+	}
+
+	pthread_mutex_lock(&stream->mutex);
+	if (stream->packager_ready && !stream->finished)
+		hls_packager_packet(&stream->packager, packet);
+	pthread_mutex_unlock(&stream->mutex);
+}
+
+static bool init_packager(struct hls_output *stream, obs_data_t *settings)
+{
+	obs_output_t *context = stream->output;
+	obs_encoder_t *vencoder = obs_output_get_video_encoder(context);
+	obs_encoder_t *aencoder = obs_output_get_audio_encoder(context, 0);
+	obs_data_t *vsettings = obs_encoder_get_settings(vencoder);
+	obs_data_t *asettings = obs_encoder_get_settings(aencoder);
+	struct hls_packager_info info = {0};
+	struct mp4_frag_video video = {0};
+	struct mp4_frag_audio audio = {0};
+	uint8_t *avcc = NULL;
+	uint8_t *header;
+	uint64_t bytes_per_sec;
+	size_t size;
+	bool success;
+
+	bytes_per_sec = (uint64_t)(obs_data_get_int(vsettings, "bitrate") +
+				   obs_data_get_int(asettings, "bitrate")) *
+			1000 / 8;
+	stream->max_queued_bytes = (size_t)(bytes_per_sec * MAX_QUEUE_SEC);
+	if (stream->max_queued_bytes < MIN_QUEUE_BYTES)
+		stream->max_queued_bytes = MIN_QUEUE_BYTES;
+
+	info.keyint_ms =
+		(uint32_t)obs_data_get_int(vsettings, "keyint_sec") * 1000;
+	if (!info.keyint_ms)
+		warn("Keyframe interval is automatic, segments may be cut "
+		     "between keyframes");
+
+	obs_data_release(vsettings);
+	obs_data_release(asettings);
+
+	if (obs_encoder_get_extra_data(vencoder, &header, &size))
+		video.avcc_size = obs_parse_avc_header(&avcc, header, size);
+	video.avcc = avcc;
+	video.width = obs_encoder_get_width(vencoder);
+	video.height = obs_encoder_get_height(vencoder);
+
+	if (aencoder && obs_encoder_get_extra_data(aencoder, &header, &size)) {
+		audio.asc = header;
+		audio.asc_size = size;
+		audio.sample_rate = obs_encoder_get_sample_rate(aencoder);
+		audio.channels = (uint32_t)audio_output_get_channels(
+			obs_encoder_audio(aencoder));
+	}
+
+	info.playlist_name = obs_data_get_string(settings, OPT_PLAYLIST_NAME);
+	info.segment_ms =
+		(uint32_t)obs_data_get_int(settings, OPT_SEGMENT_DURATION) *
+		1000;
+	info.part_ms = (uint32_t)obs_data_get_int(settings, OPT_PART_DURATION);
+	info.playlist_size =
+		(size_t)obs_data_get_int(settings, OPT_PLAYLIST_SIZE);
+	info.delete_segments = obs_data_get_bool(settings, OPT_DELETE_SEGMENTS);
+	info.video = &video;
+	info.audio = &audio;
+	info.write = write_cb;
+	info.remove = remove_cb;
+	info.param = stream;
+
+	pthread_mutex_lock(&stream->mutex);
+	hls_packager_free(&stream->packager);
+	success = hls_packager_init(&stream->packager, &info);
+	stream->packager_ready = success;
+	stream->finished = false;
+	pthread_mutex_unlock(&stream->mutex);
+
+	bfree(avcc);
+
+	if (!success)
+		warn("Failed to initialize packager, missing codec headers or "
+		     "playlist name");
+	return success;
+}
+
+static bool init_destination(struct hls_output *stream, obs_data_t *settings)
+{
+	dstr_copy(&stream->path, obs_data_get_string(settings, OPT_PATH));
+	dstr_depad(&stream->path);
+	while (dstr_end(&stream->path) == '/' ||
+	       dstr_end(&stream->path) == '\\')
+		dstr_resize(&stream->path, stream->path.len - 1);
+
+	if (dstr_is_empty(&stream->path)) {
+		warn("No path set");
+		return false;
+	}
+
+	stream->http = astrcmpi_n(stream->path.array, "http://", 7) == 0 ||
+		       astrcmpi_n(stream->path.array, "https://", 8) == 0;
+	stream->http_failures = 0;
+
+	if (stream->http) {
+		stream->curl = curl_easy_init();
+		if (!stream->curl) {
+			warn("Failed to initialize curl");
+			return false;
+		}
+
+	} else if (os_mkdirs(stream->path.array) == MKDIR_ERROR) {
+		warn("Failed to create directory '%s'", stream->path.array);
+		return false;
+	}
+
+	info("Writing to '%s'", stream->path.array);
+	return true;
+}
+
+static bool hls_output_start(void *data)
+{
+	struct hls_output *stream = data;
+	obs_data_t *settings;
+	bool success;
+
+	if (!obs_output_can_begin_data_capture(stream->output, 0))
+		return false;
+	if (!obs_output_initialize_encoders(stream->output, 0))
+		return false;
+
+	if (stream->thread_created) {
+		pthread_join(stream->write_thread, NULL);
+		stream->thread_created = false;
+	}
+
+	clear_queue(stream);
+	stream->playlist_version = 0;
+	stream->total_bytes = 0;
+	stream->stop_ts = 0;
+	os_atomic_set_bool(&stream->stopping, false);
+	os_atomic_set_bool(&stream->encode_error, false);
+
+	settings = obs_output_get_settings(stream->output);
+	success = init_destination(stream, settings) &&
+		  init_packager(stream, settings);
+	obs_data_release(settings);
+
+	if (!success)
+		goto fail;
+
+	if (pthread_create(&stream->write_thread, NULL, write_thread, stream) !=
+	    0) {
+		warn("Failed to create write thread");
+		goto fail;
+	}
+
+	stream->thread_created = true;
+	os_atomic_set_bool(&stream->active, true);
+	obs_output_begin_data_capture(stream->output, 0);
+	return true;
+
+fail:
+	if (stream->curl) {
+		curl_easy_cleanup(stream->curl);
+		stream->curl = NULL;
+	}
+	return false;
+}
+
+static void hls_output_stop(void *data, uint64_t ts)
+{
+	struct hls_output *stream = data;
+
+	if (!active(stream)) {
+		obs_output_signal_stop(stream->output, OBS_OUTPUT_SUCCESS);
+		return;
+	}
+
+	stream->stop_ts = ts / 1000ULL;
+	os_atomic_set_bool(&stream->stopping, true);
+
+	if (ts == 0)
+		finish(stream);
+}
+
+static void hls_output_destroy(void *data)
+{
+	struct hls_output *stream = data;
+
+	if (stream->thread_created) {
+		if (active(stream))
+			finish(stream);
+		pthread_join(stream->write_thread, NULL);
+	}
+
+	clear_queue(stream);
+	circlebuf_free(&stream->queue);
+	hls_packager_free(&stream->packager);
+	os_sem_destroy(stream->queue_sem);
+	pthread_mutex_destroy(&stream->mutex);
+	pthread_mutex_destroy(&stream->queue_mutex);
+	dstr_free(&stream->path);
+	bfree(stream);
+}
+
+static void *hls_output_create(obs_data_t *settings, obs_output_t *output)
+{
+	struct hls_output *stream = bzalloc(sizeof(*stream));
+
+	stream->output = output;
+	pthread_mutex_init_value(&stream->mutex);
+	pthread_mutex_init_value(&stream->queue_mutex);
+
+	if (pthread_mutex_init(&stream->mutex, NULL) != 0)
+		goto fail;
+	if (pthread_mutex_init(&stream->queue_mutex, NULL) != 0)
+		goto fail;
+	if (os_sem_init(&stream->queue_sem, 0) != 0)
+		goto fail;
+
+	UNUSED_PARAMETER(settings);
+	return stream;
+
+fail:
+	hls_output_destroy(stream);
+	return NULL;
+}
+
+static void hls_output_defaults(obs_data_t *defaults)
+{
+	obs_data_set_default_string(defaults, OPT_PLAYLIST_NAME, "stream.m3u8");
+	obs_data_set_default_int(defaults, OPT_SEGMENT_DURATION, 2);
+	obs_data_set_default_int(defaults, OPT_PART_DURATION, 500);
+	obs_data_set_default_int(defaults, OPT_PLAYLIST_SIZE, 6);
+	obs_data_set_default_bool(defaults, OPT_DELETE_SEGMENTS, true);
+}
+
+static obs_properties_t *hls_output_properties(void *unused)
+{
+	UNUSED_PARAMETER(unused);
+
+	obs_properties_t *props = obs_properties_create();
+
+	obs_properties_add_text(props, OPT_PATH,
+				obs_module_text("HLSOutput.Path"),
+				OBS_TEXT_DEFAULT);
+	obs_properties_add_text(props, OPT_PLAYLIST_NAME,
+				obs_module_text("HLSOutput.PlaylistName"),
+				OBS_TEXT_DEFAULT);
+	obs_properties_add_int(props, OPT_SEGMENT_DURATION,
+			       obs_module_text("HLSOutput.SegmentDuration"), 1,
+			       20, 1);
+	obs_properties_add_int(props, OPT_PART_DURATION,
+			       obs_module_text("HLSOutput.PartDuration"), 0,
+			       2000, 50);
+	obs_properties_add_int(props, OPT_PLAYLIST_SIZE,
+			       obs_module_text("HLSOutput.PlaylistSize"), 0,
+			       100, 1);
+	obs_properties_add_bool(props, OPT_DELETE_SEGMENTS,
+				obs_module_text("HLSOutput.DeleteSegments"));
+
+	return props;
+}
+
+static uint64_t hls_output_total_bytes(void *data)
+{
+	struct hls_output *stream = data;
+	return stream->total_bytes;
+}
+
+struct obs_output_info hls_output_info = {
+	.id = "hls_output",
+	.flags = OBS_OUTPUT_AV | OBS_OUTPUT_ENCODED,
+	.encoded_video_codecs = "h264",
+	.encoded_audio_codecs = "aac",
+	.get_name = hls_output_getname,
+	.create = hls_output_create,
+	.destroy = hls_output_destroy,
+	.start = hls_output_start,
+	.stop = hls_output_stop,
+	.encoded_packet = hls_output_data,
+	.get_defaults = hls_output_defaults,
+	.get_properties = hls_output_properties,
+	.get_total_bytes = hls_output_total_bytes,
+};
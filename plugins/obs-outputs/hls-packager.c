@@ -0,0 +1,514 @@
+#include "hls-packager.h"
+
+#include <obs-avc.h>
+
+#define VIDEO_CLOCK MP4_FRAG_VIDEO_TIMESCALE
+#define AAC_FRAME_SAMPLES 1024
+
+/* parts are listed for the current segment and this many before it, which
+ * keeps them within about three target durations of the live edge */
+#define PART_SEGMENTS 2
+
+/* files stay around for this many segments after leaving the playlist, for
+ * players still working from an older copy of it */
+#define DELETE_DELAY 2
+
+static const char *init_name(struct hls_packager *pkg)
+{
+	dstr_printf(&pkg->name, "%sinit.mp4", pkg->prefix.array);
+	return pkg->name.array;
+}
+
+static const char *segment_name(struct hls_packager *pkg, uint32_t sequence)
+{
+	dstr_printf(&pkg->name, "%s%u.m4s", pkg->prefix.array, sequence);
+	return pkg->name.array;
+}
+
+static const char *part_name(struct hls_packager *pkg, uint32_t sequence,
+			     size_t part)
+{
+	dstr_printf(&pkg->name, "%s%u.%u.m4s", pkg->prefix.array, sequence,
+		    (unsigned int)part);
+	return pkg->name.array;
+}
+
+static inline void write_file(struct hls_packager *pkg, const char *name,
+			      const struct array_output_data *data)
+{
+	pkg->write(pkg->param, name, data->bytes.array, data->bytes.num);
+}
+
+static inline void remove_file(struct hls_packager *pkg, const char *name)
+{
+	if (pkg->remove)
+		pkg->remove(pkg->param, name);
+}
+
+static void track_free(struct hls_track *track)
+{
+	da_free(track->samples);
+	da_free(track->times);
+	da_free(track->data);
+}
+
+/* drops the first count samples, which take up size bytes */
+static void track_pop_front(struct hls_track *track, size_t count, size_t size)
+{
+	if (!count)
+		return;
+
+	da_erase_range(track->samples, 0, count);
+	da_erase_range(track->times, 0, count);
+	da_erase_range(track->data, 0, size);
+}
+
+static void segment_free(struct hls_segment *segment)
+{
+	da_free(segment->parts);
+}
+
+bool hls_packager_init(struct hls_packager *pkg,
+		       const struct hls_packager_info *info)
+{
+	const char *ext;
+	uint32_t max_ms;
+
+	memset(pkg, 0, sizeof(*pkg));
+
+	if (!info->video || !info->video->avcc_size || !info->write)
+		return false;
+	if (!info->playlist_name || !*info->playlist_name)
+		return false;
+	if (!info->segment_ms)
+		return false;
+
+	dstr_copy(&pkg->playlist_name, info->playlist_name);
+	ext = strrchr(info->playlist_name, '.');
+	if (ext)
+		dstr_ncopy(&pkg->prefix, info->playlist_name,
+			   ext - info->playlist_name);
+	else
+		dstr_copy(&pkg->prefix, info->playlist_name);
+	dstr_cat_ch(&pkg->prefix, '_');
+
+	pkg->segment_target = (uint64_t)info->segment_ms * VIDEO_CLOCK / 1000;
+	pkg->part_target = (uint64_t)info->part_ms * VIDEO_CLOCK / 1000;
+	if (pkg->part_target > pkg->segment_target)
+		pkg->part_target = pkg->segment_target;
+
+	/* segments end on the first keyframe past the segment duration, so
+	 * the longest one is the segment duration rounded up to whole GOPs */
+	max_ms = info->segment_ms;
+	if (info->keyint_ms)
+		max_ms = (max_ms + info->keyint_ms - 1) / info->keyint_ms *
+			 info->keyint_ms;
+	pkg->target_duration = (max_ms + 999) / 1000;
+	pkg->segment_max = (uint64_t)pkg->target_duration * VIDEO_CLOCK;
+	pkg->playlist_size = info->playlist_size;
+	pkg->delete_segments = info->delete_segments;
+
+	pkg->has_audio = info->audio && info->audio->sample_rate &&
+			 info->audio->asc_size;
+	if (pkg->has_audio)
+		pkg->sample_rate = info->audio->sample_rate;
+
+	pkg->write = info->write;
+	pkg->remove = info->remove;
+	pkg->param = info->param;
+
+	mp4_frag_write_init(&pkg->fragment, info->video,
+			    pkg->has_audio ? info->audio : NULL);
+	write_file(pkg, init_name(pkg), &pkg->fragment);
+	pkg->fragment.bytes.num = 0;
+	return true;
+}
+
+void hls_packager_free(struct hls_packager *pkg)
+{
+	for (size_t i = 0; i < pkg->segments.num; i++)
+		segment_free(&pkg->segments.array[i]);
+	da_free(pkg->segments);
+	segment_free(&pkg->current);
+
+	track_free(&pkg->video);
+	track_free(&pkg->audio);
+	array_output_serializer_free(&pkg->segment_data);
+	array_output_serializer_free(&pkg->fragment);
+
+	dstr_free(&pkg->playlist_name);
+	dstr_free(&pkg->prefix);
+	dstr_free(&pkg->playlist);
+	dstr_free(&pkg->name);
+}
+
+/* ------------------------------------------------------------------------- */
+/* playlist                                                                  */
+
+static inline double to_secs(uint64_t duration)
+{
+	return (double)duration / (double)VIDEO_CLOCK;
+}
+
+static void add_parts(struct hls_packager *pkg,
+		      const struct hls_segment *segment)
+{
+	for (size_t i = 0; i < segment->parts.num; i++) {
+		const struct hls_part *part = &segment->parts.array[i];
+
+		dstr_catf(&pkg->playlist, "#EXT-X-PART:DURATION=%.3f,URI=\"",
+			  to_secs(part->duration));
+		dstr_cat(&pkg->playlist,
+			 part_name(pkg, segment->sequence, i));
+		dstr_cat(&pkg->playlist, part->independent
+						 ? "\",INDEPENDENT=YES\n"
+						 : "\"\n");
+	}
+}
+
+static void write_playlist(struct hls_packager *pkg)
+{
+	struct dstr *m3u8 = &pkg->playlist;
+	size_t num = pkg->segments.num;
+	size_t first = 0;
+	uint32_t media_sequence = pkg->current.sequence;
+
+	if (pkg->playlist_size && num > pkg->playlist_size)
+		first = num - pkg->playlist_size;
+	if (first < num)
+		media_sequence = pkg->segments.array[first].sequence;
+
+	dstr_copy(m3u8, "#EXTM3U\n#EXT-X-VERSION:7\n");
+	dstr_catf(m3u8, "#EXT-X-TARGETDURATION:%u\n", pkg->target_duration);
+	if (pkg->part_target) {
+		/* the recommended three part durations behind live */
+		dstr_catf(m3u8, "#EXT-X-SERVER-CONTROL:PART-HOLD-BACK=%.3f\n",
+			  to_secs(pkg->part_target * 3));
+		dstr_catf(m3u8, "#EXT-X-PART-INF:PART-TARGET=%.3f\n",
+			  to_secs(pkg->part_target));
+	}
+	dstr_catf(m3u8, "#EXT-X-MEDIA-SEQUENCE:%u\n", media_sequence);
+	if (!pkg->playlist_size)
+		dstr_cat(m3u8, "#EXT-X-PLAYLIST-TYPE:EVENT\n");
+	if (!pkg->forced_cut)
+		dstr_cat(m3u8, "#EXT-X-INDEPENDENT-SEGMENTS\n");
+	dstr_cat(m3u8, "#EXT-X-MAP:URI=\"");
+	dstr_cat(m3u8, init_name(pkg));
+	dstr_cat(m3u8, "\"\n");
+
+	for (size_t i = first; i < num; i++) {
+		const struct hls_segment *segment = &pkg->segments.array[i];
+
+		if (pkg->part_target && num - i <= PART_SEGMENTS)
+			add_parts(pkg, segment);
+
+		dstr_catf(m3u8, "#EXTINF:%.3f,\n", to_secs(segment->duration));
+		dstr_cat(m3u8, segment_name(pkg, segment->sequence));
+		dstr_cat_ch(m3u8, '\n');
+	}
+
+	if (pkg->ended) {
+		dstr_cat(m3u8, "#EXT-X-ENDLIST\n");
+
+	} else if (pkg->part_target) {
+		add_parts(pkg, &pkg->current);
+
+		dstr_cat(m3u8, "#EXT-X-PRELOAD-HINT:TYPE=PART,URI=\"");
+		dstr_cat(m3u8, part_name(pkg, pkg->current.sequence,
+					 pkg->current.parts.num));
+		dstr_cat(m3u8, "\"\n");
+	}
+
+	pkg->write(pkg->param, pkg->playlist_name.array,
+		   (const uint8_t *)m3u8->array, m3u8->len);
+}
+
+/* ------------------------------------------------------------------------- */
+/* segmenting                                                                */
+
+static void remove_parts(struct hls_packager *pkg, struct hls_segment *segment)
+{
+	if (!pkg->part_target || segment->parts_removed)
+		return;
+
+	for (size_t i = 0; i < segment->parts.num; i++)
+		remove_file(pkg, part_name(pkg, segment->sequence, i));
+	segment->parts_removed = true;
+}
+
+static void remove_old_files(struct hls_packager *pkg)
+{
+	size_t num = pkg->segments.num;
+
+	if (!pkg->delete_segments)
+		goto trim;
+
+	if (num > PART_SEGMENTS + DELETE_DELAY)
+		remove_parts(pkg, &pkg->segments.array[num - PART_SEGMENTS -
+						       DELETE_DELAY - 1]);
+
+trim:
+	if (!pkg->playlist_size)
+		return;
+
+	while (pkg->segments.num > pkg->playlist_size + DELETE_DELAY) {
+		struct hls_segment *segment = &pkg->segments.array[0];
+
+		if (pkg->delete_segments) {
+			remove_parts(pkg, segment);
+			remove_file(pkg, segment_name(pkg, segment->sequence));
+		}
+
+		segment_free(segment);
+		da_erase(pkg->segments, 0);
+	}
+}
+
+static void end_segment(struct hls_packager *pkg, int64_t end)
+{
+	pkg->current.duration = (uint64_t)(end - pkg->segment_start);
+	write_file(pkg, segment_name(pkg, pkg->current.sequence),
+		   &pkg->segment_data);
+
+	da_push_back(pkg->segments, &pkg->current);
+	memset(&pkg->current, 0, sizeof(pkg->current));
+	pkg->current.sequence = ++pkg->segment_sequence;
+
+	pkg->segment_data.bytes.num = 0;
+	pkg->segment_start = end;
+
+	remove_old_files(pkg);
+}
+
+static inline uint64_t audio_time(struct hls_packager *pkg, int64_t usec)
+{
+	return (uint64_t)(((usec - pkg->start_usec) * pkg->sample_rate +
+			   500000) /
+			  1000000);
+}
+
+/* moves all pending video and the audio before end_usec into a fragment */
+static void cut(struct hls_packager *pkg, int64_t end, int64_t end_usec,
+		bool segment_end)
+{
+	struct hls_track *video = &pkg->video;
+	struct hls_track *audio = &pkg->audio;
+	struct mp4_frag_run runs[2] = {0};
+	size_t num_runs = 1;
+	size_t audio_count = 0;
+	size_t audio_size = 0;
+	struct hls_part part;
+
+	runs[0].track_id = MP4_FRAG_VIDEO_TRACK;
+	runs[0].base_time = (uint64_t)video->times.array[0];
+	runs[0].samples = video->samples.array;
+	runs[0].num_samples = video->samples.num;
+	runs[0].data = video->data.array;
+	runs[0].size = video->data.num;
+
+	while (audio_count < audio->samples.num &&
+	       audio->times.array[audio_count] < end_usec)
+		audio_size += audio->samples.array[audio_count++].size;
+
+	if (audio_count) {
+		runs[1].track_id = MP4_FRAG_AUDIO_TRACK;
+		runs[1].base_time = audio_time(pkg, audio->times.array[0]);
+		runs[1].samples = audio->samples.array;
+		runs[1].num_samples = audio_count;
+		runs[1].data = audio->data.array;
+		runs[1].size = audio_size;
+		num_runs++;
+	}
+
+	pkg->fragment.bytes.num = 0;
+	mp4_frag_write_fragment(&pkg->fragment, ++pkg->fragment_sequence, runs,
+				num_runs);
+
+	part.duration = (uint32_t)(end - pkg->part_start);
+	part.independent = video->samples.array[0].keyframe;
+
+	if (pkg->part_target)
+		write_file(pkg,
+			   part_name(pkg, pkg->current.sequence,
+				     pkg->current.parts.num),
+			   &pkg->fragment);
+	da_push_back(pkg->current.parts, &part);
+	da_push_back_array(pkg->segment_data.bytes, pkg->fragment.bytes.array,
+			   pkg->fragment.bytes.num);
+
+	track_pop_front(video, video->samples.num, video->data.num);
+	track_pop_front(audio, audio_count, audio_size);
+	pkg->part_start = end;
+
+	if (segment_end)
+		end_segment(pkg, end);
+	if (segment_end || pkg->part_target)
+		write_playlist(pkg);
+}
+
+/* ------------------------------------------------------------------------- */
+
+static void add_video(struct hls_packager *pkg, struct encoder_packet *packet,
+		      int64_t dts, int64_t cts)
+{
+	struct hls_track *video = &pkg->video;
+	const uint8_t *end = packet->data + packet->size;
+	const uint8_t *nal_start, *nal_end;
+	struct mp4_frag_sample sample = {0};
+	size_t start = video->data.num;
+
+	/* annex B to length prefixed NALs, dropping parameter sets and
+	 * delimiters which are in the init segment or not needed */
+	nal_start = obs_avc_find_startcode(packet->data, end);
+	while (true) {
+		uint32_t size;
+		uint8_t be_size[4];
+		int type;
+
+		while (nal_start < end && !*(nal_start++))
+			;
+
+		if (nal_start == end)
+			break;
+
+		type = nal_start[0] & 0x1F;
+		nal_end = obs_avc_find_startcode(nal_start, end);
+
+		if (type != OBS_NAL_SPS && type != OBS_NAL_PPS &&
+		    type != OBS_NAL_AUD) {
+			size = (uint32_t)(nal_end - nal_start);
+			be_size[0] = (uint8_t)(size >> 24);
+			be_size[1] = (uint8_t)(size >> 16);
+			be_size[2] = (uint8_t)(size >> 8);
+			be_size[3] = (uint8_t)size;
+			da_push_back_array(video->data, be_size, 4);
+			da_push_back_array(video->data, nal_start, size);
+		}
+
+		nal_start = nal_end;
+	}
+
+	sample.size = (uint32_t)(video->data.num - start);
+	sample.cts_offset = (int32_t)cts;
+	sample.keyframe = packet->keyframe;
+
+	da_push_back(video->samples, &sample);
+	da_push_back(video->times, &dts);
+}
+
+static void add_audio(struct hls_packager *pkg, struct encoder_packet *packet)
+{
+	struct hls_track *audio = &pkg->audio;
+	struct mp4_frag_sample sample = {0};
+
+	sample.size = (uint32_t)packet->size;
+	sample.duration = AAC_FRAME_SAMPLES;
+	sample.keyframe = true;
+
+	da_push_back_array(audio->data, packet->data, packet->size);
+	da_push_back(audio->samples, &sample);
+	da_push_back(audio->times, &packet->dts_usec);
+}
+
+static inline int64_t to_video_clock(struct hls_packager *pkg, int64_t val)
+{
+	return val * VIDEO_CLOCK * pkg->timebase_num / pkg->timebase_den;
+}
+
+/* the next segment starts without a keyframe, which players can still
+ * decode when they play the segments in order, but the playlist no longer
+ * claims that every segment can be decoded on its own */
+static void force_segment_end(struct hls_packager *pkg, int64_t end,
+			      int64_t end_usec)
+{
+	if (!pkg->forced_cut) {
+		blog(LOG_WARNING,
+		     "[hls packager] Keyframe interval is longer than the "
+		     "target duration of %u seconds, cutting segments "
+		     "between keyframes",
+		     pkg->target_duration);
+		pkg->forced_cut = true;
+	}
+
+	cut(pkg, end, end_usec, true);
+}
+
+void hls_packager_packet(struct hls_packager *pkg,
+			 struct encoder_packet *packet)
+{
+	struct hls_track *video = &pkg->video;
+	int64_t dts, cts;
+
+	if (pkg->ended)
+		return;
+
+	if (packet->type == OBS_ENCODER_AUDIO) {
+		if (pkg->has_audio && pkg->started && packet->track_idx == 0 &&
+		    packet->dts_usec >= pkg->start_usec)
+			add_audio(pkg, packet);
+		return;
+	}
+
+	if (!pkg->started) {
+		if (!packet->keyframe)
+			return;
+
+		pkg->started = true;
+		pkg->first_dts = packet->dts;
+		pkg->timebase_num = packet->timebase_num;
+		pkg->timebase_den = packet->timebase_den;
+		pkg->start_usec = packet->dts_usec;
+	}
+
+	dts = to_video_clock(pkg, packet->dts - pkg->first_dts);
+	cts = to_video_clock(pkg, packet->pts - packet->dts);
+
+	if (video->samples.num) {
+		int64_t duration = dts - pkg->last_dts;
+		if (duration <= 0)
+			duration = 1;
+
+		video->samples.array[video->samples.num - 1].duration =
+			(uint32_t)duration;
+		pkg->last_duration = duration;
+
+		/* parts must never be longer than the part target, and
+		 * segments never longer than the target duration, so cut
+		 * before the frame that would take them over it */
+		if (packet->keyframe &&
+		    dts - pkg->segment_start >= (int64_t)pkg->segment_target)
+			cut(pkg, dts, packet->dts_usec, true);
+		else if (dts - pkg->segment_start + duration >
+			 (int64_t)pkg->segment_max)
+			force_segment_end(pkg, dts, packet->dts_usec);
+		else if (pkg->part_target &&
+			 dts - pkg->part_start + duration >
+				 (int64_t)pkg->part_target)
+			cut(pkg, dts, packet->dts_usec, false);
+	}
+
+	add_video(pkg, packet, dts, cts);
+	pkg->last_dts = dts;
+}
+
+void hls_packager_finish(struct hls_packager *pkg)
+{
+	struct hls_track *video = &pkg->video;
+	int64_t duration;
+
+	if (!pkg->started || pkg->ended)
+		return;
+
+	pkg->ended = true;
+
+	if (!video->samples.num) {
+		write_playlist(pkg);
+		return;
+	}
+
+	duration = pkg->last_duration ? pkg->last_duration : VIDEO_CLOCK / 30;
+	video->samples.array[video->samples.num - 1].duration =
+		(uint32_t)duration;
+
+	cut(pkg, pkg->last_dts + duration, INT64_MAX, true);
+}
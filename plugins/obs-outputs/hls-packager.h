@@ -0,0 +1,120 @@
+#pragma once
+
+#include <obs.h>
+#include <util/darray.h>
+#include <util/dstr.h>
+#include "mp4-frag.h"
+
+/*
+ *   HLS packager writing CMAF segments straight from encoder packets.
+ *
+ *   Segments start on keyframes once the segment duration is reached, and
+ * are cut early if keyframes come later than the given keyframe interval,
+ * so the playlist's target duration never has to change.  With
+ * partial segments enabled (low latency HLS), every segment is also cut into
+ * parts of at most the part target duration, each one written as soon as it
+ * is complete and announced in the playlist right away, so players can stay
+ * a few parts behind live instead of a few segments.
+ *
+ *   Files are handed to the write callback by name and never touched again,
+ * so the callback can put them in a directory or upload them; files that
+ * fall out of the playlist are passed to the remove callback.
+ */
+
+typedef void (*hls_write_cb)(void *param, const char *name,
+			     const uint8_t *data, size_t size);
+typedef void (*hls_remove_cb)(void *param, const char *name);
+
+struct hls_packager_info {
+	/* file name of the playlist, also used as the prefix of the media
+	 * files: "stream.m3u8" -> "stream_init.mp4", "stream_12.m4s" */
+	const char *playlist_name;
+	uint32_t segment_ms;
+	/* keyframe interval of the video, 0 if unknown */
+	uint32_t keyint_ms;
+	/* 0 disables partial segments */
+	uint32_t part_ms;
+	/* 0 keeps every segment in the playlist */
+	size_t playlist_size;
+	bool delete_segments;
+
+	const struct mp4_frag_video *video;
+	/* may be NULL */
+	const struct mp4_frag_audio *audio;
+
+	hls_write_cb write;
+	hls_remove_cb remove;
+	void *param;
+};
+
+struct hls_part {
+	uint32_t duration;
+	bool independent;
+};
+
+struct hls_segment {
+	uint32_t sequence;
+	uint64_t duration;
+	DARRAY(struct hls_part) parts;
+	bool parts_removed;
+};
+
+struct hls_track {
+	DARRAY(struct mp4_frag_sample) samples;
+	DARRAY(int64_t) times;
+	DARRAY(uint8_t) data;
+};
+
+struct hls_packager {
+	struct dstr playlist_name;
+	struct dstr prefix;
+	uint64_t segment_target;
+	uint64_t part_target;
+	size_t playlist_size;
+	bool delete_segments;
+
+	bool has_audio;
+	uint32_t sample_rate;
+
+	hls_write_cb write;
+	hls_remove_cb remove;
+	void *param;
+
+	bool started;
+	bool ended;
+	int64_t first_dts;
+	int32_t timebase_num;
+	int32_t timebase_den;
+	int64_t start_usec;
+
+	/* video times are in 90 kHz units from the first keyframe */
+	struct hls_track video;
+	struct hls_track audio;
+	int64_t last_dts;
+	int64_t last_duration;
+	int64_t segment_start;
+	int64_t part_start;
+
+	uint32_t fragment_sequence;
+	uint32_t segment_sequence;
+	uint32_t target_duration;
+	uint64_t segment_max;
+	bool forced_cut;
+	struct hls_segment current;
+	struct array_output_data segment_data;
+	struct array_output_data fragment;
+	DARRAY(struct hls_segment) segments;
+
+	struct dstr playlist;
+	struct dstr name;
+};
+
+extern bool hls_packager_init(struct hls_packager *pkg,
+			      const struct hls_packager_info *info);
+extern void hls_packager_free(struct hls_packager *pkg);
+
+extern void hls_packager_packet(struct hls_packager *pkg,
+				struct encoder_packet *packet);
+
+/* writes out what is left and ends the playlist */
+extern void hls_packager_finish(struct hls_packager *pkg);
@@ -1616,6 +1616,102 @@ WriteN(RTMP *r, const char *buffer, int n)
     return n == 0;
 }
 
+#define RTMP_MAX_IOV 64
+
+/* Sends the given buffers, gathering them into a single send call when
+ * writing straight to the socket.  vec is modified to track partial
+ * writes. */
+static int
+WriteNV(RTMP *r, AVal *vec, int count)
+{
+    int direct = !(r->Link.protocol & RTMP_FEATURE_HTTP)
+                 && !(r->m_bCustomSend && r->m_customSendFunc)
+                 && !r->m_sb.sb_ssl;
+
+#ifdef CRYPTO
+    if (r->Link.rc4keyOut)
+        direct = 0;
+#endif
+
+    if (!direct)
+    {
+        for (int i = 0; i < count; i++)
+        {
+            if (vec[i].av_len && !WriteN(r, vec[i].av_val, vec[i].av_len))
+                return FALSE;
+        }
+        return TRUE;
+    }
+
+    while (count > 0)
+    {
+        int nBytes;
+        int num = count < RTMP_MAX_IOV ? count : RTMP_MAX_IOV;
+
+#ifdef _WIN32
+        WSABUF bufs[RTMP_MAX_IOV];
+        DWORD sent = 0;
+
+        for (int i = 0; i < num; i++)
+        {
+            bufs[i].buf = vec[i].av_val;
+            bufs[i].len = (ULONG)vec[i].av_len;
+        }
+
+        nBytes = WSASend(r->m_sb.sb_socket, bufs, num, &sent, 0, NULL, NULL)
+                 ? -1 : (int)sent;
+#else
+        struct iovec iov[RTMP_MAX_IOV];
+        struct msghdr msg;
+
+        for (int i = 0; i < num; i++)
+        {
+            iov[i].iov_base = vec[i].av_val;
+            iov[i].iov_len = (size_t)vec[i].av_len;
+        }
+
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_iov = iov;
+        msg.msg_iovlen = num;
+
+        nBytes = (int)sendmsg(r->m_sb.sb_socket, &msg, MSG_NOSIGNAL);
+#endif
+
+        if (nBytes < 0)
+        {
+            int sockerr = GetSockError();
+            RTMP_Log(RTMP_LOGERROR, "%s, RTMP send error %d", __FUNCTION__,
+                     sockerr);
+
+            if (sockerr == EINTR && !RTMP_ctrlC)
+                continue;
+
+            r->last_error_code = sockerr;
+
+            RTMP_Close(r);
+            return FALSE;
+        }
+
+        if (nBytes == 0)
+            return FALSE;
+
+        while (count && nBytes >= vec->av_len)
+        {
+            nBytes -= vec->av_len;
+            vec++;
+            count--;
+        }
+
+        if (count)
+        {
+            vec->av_val += nBytes;
+            vec->av_len -= nBytes;
+        }
+    }
+
+    return TRUE;
+}
+
 #define SAVC(x)	static const AVal av_##x = AVC(#x)
 
 SAVC(app);
@@ -4063,18 +4159,19 @@ RTMP_SendChunk(RTMP *r, RTMPChunk *chunk)
     return wrote;
 }
 
-int
-RTMP_SendPacket(RTMP *r, RTMPPacket *packet, int queue)
+/* Encodes the chunk header for packet so that it ends at hend, compressing
+ * it against the previous packet sent on the same channel.  Returns the
+ * start of the header, or NULL on failure. */
+static char *
+EncodePacketHeader(RTMP *r, RTMPPacket *packet, char *hend, int *hSizeOut,
+                   int *cSizeOut, char *cOut)
 {
     const RTMPPacket *prevPacket;
     uint32_t last = 0;
     int nSize;
     int hSize, cSize;
-    char *header, *hptr, *hend, hbuf[RTMP_MAX_HEADER_SIZE], c;
+    char *header, *hptr, c;
     uint32_t t;
-    char *buffer, *tbuf = NULL, *toff = NULL;
-    int nChunkSize;
-    int tlen;
 
     if (packet->m_nChannel >= r->m_channelsAllocatedOut)
     {
@@ -4085,7 +4182,7 @@ RTMP_SendPacket(RTMP *r, RTMPPacket *packet, int queue)
             free(r->m_vecChannelsOut);
             r->m_vecChannelsOut = NULL;
             r->m_channelsAllocatedOut = 0;
-            return FALSE;
+            return NULL;
         }
         r->m_vecChannelsOut = packets;
         memset(r->m_vecChannelsOut + r->m_channelsAllocatedOut, 0, sizeof(RTMPPacket*) * (n - r->m_channelsAllocatedOut));
@@ -4111,7 +4208,7 @@ RTMP_SendPacket(RTMP *r, RTMPPacket *packet, int queue)
     {
         RTMP_Log(RTMP_LOGERROR, "sanity failed!! trying to send header of type: 0x%02x.",
                  (unsigned char)packet->m_headerType);
-        return FALSE;
+        return NULL;
     }
 
     nSize = packetSize[packet->m_headerType];
@@ -4119,16 +4216,7 @@ RTMP_SendPacket(RTMP *r, RTMPPacket *packet, int queue)
     cSize = 0;
     t = packet->m_nTimeStamp - last;
 
-    if (packet->m_body)
-    {
-        header = packet->m_body - nSize;
-        hend = packet->m_body;
-    }
-    else
-    {
-        header = hbuf + 6;
-        hend = hbuf + sizeof(hbuf);
-    }
+    header = hend - nSize;
 
     if (packet->m_nChannel > 319)
         cSize = 2;
@@ -4185,6 +4273,36 @@ RTMP_SendPacket(RTMP *r, RTMPPacket *packet, int queue)
     if (nSize > 1 && t >= 0xffffff)
         hptr = AMF_EncodeInt32(hptr, hend, t);
 
+    *hSizeOut = hSize;
+    *cSizeOut = cSize;
+    *cOut = c;
+    return header;
+}
+
+static void
+StoreLastPacket(RTMP *r, const RTMPPacket *packet)
+{
+    if (!r->m_vecChannelsOut[packet->m_nChannel])
+        r->m_vecChannelsOut[packet->m_nChannel] = malloc(sizeof(RTMPPacket));
+    memcpy(r->m_vecChannelsOut[packet->m_nChannel], packet, sizeof(RTMPPacket));
+}
+
+int
+RTMP_SendPacket(RTMP *r, RTMPPacket *packet, int queue)
+{
+    int nSize;
+    int hSize, cSize;
+    char *header, hbuf[RTMP_MAX_HEADER_SIZE], c;
+    char *buffer, *tbuf = NULL, *toff = NULL;
+    int nChunkSize;
+    int tlen;
+
+    header = EncodePacketHeader(r, packet,
+                                packet->m_body ? packet->m_body : hbuf + sizeof(hbuf),
+                                &hSize, &cSize, &c);
+    if (!header)
+        return FALSE;
+
     nSize = packet->m_nBodySize;
     buffer = packet->m_body;
     nChunkSize = r->m_outChunkSize;
@@ -4274,9 +4392,7 @@ RTMP_SendPacket(RTMP *r, RTMPPacket *packet, int queue)
         }
     }
 
-    if (!r->m_vecChannelsOut[packet->m_nChannel])
-        r->m_vecChannelsOut[packet->m_nChannel] = malloc(sizeof(RTMPPacket));
-    memcpy(r->m_vecChannelsOut[packet->m_nChannel], packet, sizeof(RTMPPacket));
+    StoreLastPacket(r, packet);
     return TRUE;
 }
 
@@ -5369,3 +5485,165 @@ RTMP_Write(RTMP *r, const char *buf, int size, int streamIdx)
     }
     return size+s2;
 }
+
+/* reads len bytes spread across vec, advancing the cursor */
+static int
+ReadVec(const AVal *vec, int count, int *idx, int *off, char *out, int len)
+{
+    while (len > 0 && *idx < count)
+    {
+        int num = vec[*idx].av_len - *off;
+        if (num > len)
+            num = len;
+
+        if (out)
+        {
+            memcpy(out, vec[*idx].av_val + *off, num);
+            out += num;
+        }
+
+        len -= num;
+        *off += num;
+        if (*off == vec[*idx].av_len)
+        {
+            (*idx)++;
+            *off = 0;
+        }
+    }
+
+    return len == 0;
+}
+
+/* Like RTMP_Write for a single complete FLV tag, but the tag is given as a
+ * list of buffers that are chunked and sent without copying them into a
+ * packet body first. */
+int
+RTMP_WriteV(RTMP *r, const AVal *vec, int count, int streamIdx)
+{
+    RTMPPacket packet;
+    AVal out[RTMP_MAX_IOV];
+    char tag[11], hbuf[RTMP_MAX_HEADER_SIZE], cont[3], *header, c;
+    int hSize, cSize, nSize, nChunkSize, size = 0;
+    int idx = 0, off = 0, num = 0;
+
+    for (int i = 0; i < count; i++)
+        size += vec[i].av_len;
+
+    if (size < 11 || !ReadVec(vec, count, &idx, &off, tag, 11))
+        return 0;
+
+    if (r->Link.protocol & RTMP_FEATURE_HTTP)
+    {
+        /* RTMPT posts a whole packet at a time anyway */
+        char *buf = malloc(size), *ptr = buf;
+        int ret;
+
+        if (!buf)
+            return FALSE;
+        for (int i = 0; i < count; i++)
+        {
+            memcpy(ptr, vec[i].av_val, vec[i].av_len);
+            ptr += vec[i].av_len;
+        }
+        ret = RTMP_Write(r, buf, size, streamIdx);
+        free(buf);
+        return ret;
+    }
+
+    memset(&packet, 0, sizeof(packet));
+    packet.m_nChannel = 0x04;	/* source channel */
+    packet.m_nInfoField2 = r->Link.streams[streamIdx].id;
+    packet.m_packetType = tag[0];
+    packet.m_nBodySize = AMF_DecodeInt24(tag + 1);
+    packet.m_nTimeStamp = AMF_DecodeInt24(tag + 4);
+    packet.m_nTimeStamp |= (uint32_t)(uint8_t)tag[7] << 24;
+
+    if (packet.m_nBodySize > (uint32_t)(size - 11))
+    {
+        RTMP_Log(RTMP_LOGERROR, "%s, FLV tag body exceeds given data", __FUNCTION__);
+        return FALSE;
+    }
+
+    if (((packet.m_packetType == RTMP_PACKET_TYPE_AUDIO
+            || packet.m_packetType == RTMP_PACKET_TYPE_VIDEO) &&
+            !packet.m_nTimeStamp) || packet.m_packetType == RTMP_PACKET_TYPE_INFO)
+    {
+        packet.m_headerType = RTMP_PACKET_SIZE_LARGE;
+    }
+    else
+    {
+        packet.m_headerType = RTMP_PACKET_SIZE_MEDIUM;
+    }
+
+    header = EncodePacketHeader(r, &packet, hbuf + sizeof(hbuf), &hSize,
+                                &cSize, &c);
+    if (!header)
+        return FALSE;
+
+    /* every continuation chunk gets the same type 3 header */
+    cont[0] = (0xc0 | c);
+    if (cSize)
+    {
+        int tmp = packet.m_nChannel - 64;
+        cont[1] = tmp & 0xff;
+        if (cSize == 2)
+            cont[2] = tmp >> 8;
+    }
+
+    out[num].av_val = header;
+    out[num++].av_len = hSize;
+
+    nSize = packet.m_nBodySize;
+    nChunkSize = r->m_outChunkSize;
+
+    while (nSize > 0)
+    {
+        int chunk = nSize < nChunkSize ? nSize : nChunkSize;
+        nSize -= chunk;
+
+        while (chunk > 0)
+        {
+            int len = vec[idx].av_len - off;
+            if (!len)
+            {
+                idx++;
+                off = 0;
+                continue;
+            }
+            if (len > chunk)
+                len = chunk;
+
+            if (num == RTMP_MAX_IOV)
+            {
+                if (!WriteNV(r, out, num))
+                    return FALSE;
+                num = 0;
+            }
+
+            out[num].av_val = vec[idx].av_val + off;
+            out[num++].av_len = len;
+
+            ReadVec(vec, count, &idx, &off, NULL, len);
+            chunk -= len;
+        }
+
+        if (nSize > 0)
+        {
+            if (num == RTMP_MAX_IOV)
+            {
+                if (!WriteNV(r, out, num))
+                    return FALSE;
+                num = 0;
+            }
+
+            out[num].av_val = cont;
+            out[num++].av_len = 1 + cSize;
+        }
+    }
+
+    if (num && !WriteNV(r, out, num))
+        return FALSE;
+
+    StoreLastPacket(r, &packet);
+    return size;
+}
@@ -0,0 +1,452 @@
+#include "mp4-frag.h"
+
+#include <string.h>
+
+#define SAMPLE_FLAGS_SYNC 0x02000000
+#define SAMPLE_FLAGS_NON_SYNC 0x01010000
+
+#define TFHD_DEFAULT_BASE_IS_MOOF 0x020000
+
+#define TRUN_DATA_OFFSET 0x000001
+#define TRUN_SAMPLE_DURATION 0x000100
+#define TRUN_SAMPLE_SIZE 0x000200
+#define TRUN_SAMPLE_FLAGS 0x000400
+#define TRUN_SAMPLE_CTS 0x000800
+
+static const uint32_t unity_matrix[9] = {0x00010000, 0, 0, 0, 0x00010000,
+					 0, 0, 0, 0x40000000};
+
+static inline void w8(struct array_output_data *out, uint8_t val)
+{
+	da_push_back(out->bytes, &val);
+}
+
+static inline void wb16(struct array_output_data *out, uint16_t val)
+{
+	w8(out, (uint8_t)(val >> 8));
+	w8(out, (uint8_t)val);
+}
+
+static inline void wb24(struct array_output_data *out, uint32_t val)
+{
+	w8(out, (uint8_t)(val >> 16));
+	wb16(out, (uint16_t)val);
+}
+
+static inline void wb32(struct array_output_data *out, uint32_t val)
+{
+	wb16(out, (uint16_t)(val >> 16));
+	wb16(out, (uint16_t)val);
+}
+
+static inline void wb64(struct array_output_data *out, uint64_t val)
+{
+	wb32(out, (uint32_t)(val >> 32));
+	wb32(out, (uint32_t)val);
+}
+
+static inline void wzero(struct array_output_data *out, size_t size)
+{
+	size_t pos = out->bytes.num;
+
+	da_resize(out->bytes, pos + size);
+	memset(out->bytes.array + pos, 0, size);
+}
+
+static inline void wdata(struct array_output_data *out, const void *data,
+			 size_t size)
+{
+	da_push_back_array(out->bytes, (const uint8_t *)data, size);
+}
+
+static inline void patch_b32(struct array_output_data *out, size_t pos,
+			     uint32_t val)
+{
+	uint8_t *p = out->bytes.array + pos;
+
+	p[0] = (uint8_t)(val >> 24);
+	p[1] = (uint8_t)(val >> 16);
+	p[2] = (uint8_t)(val >> 8);
+	p[3] = (uint8_t)val;
+}
+
+static size_t begin_box(struct array_output_data *out, const char *type)
+{
+	size_t pos = out->bytes.num;
+
+	wb32(out, 0);
+	wdata(out, type, 4);
+	return pos;
+}
+
+static size_t begin_full_box(struct array_output_data *out, const char *type,
+			     uint8_t version, uint32_t flags)
+{
+	size_t pos = begin_box(out, type);
+
+	w8(out, version);
+	wb24(out, flags);
+	return pos;
+}
+
+static void end_box(struct array_output_data *out, size_t pos)
+{
+	patch_b32(out, pos, (uint32_t)(out->bytes.num - pos));
+}
+
+/* ------------------------------------------------------------------------- */
+/* init segment                                                              */
+
+static void write_ftyp(struct array_output_data *out)
+{
+	size_t box = begin_box(out, "ftyp");
+
+	wdata(out, "iso6", 4);
+	wb32(out, 0);
+	wdata(out, "iso6", 4);
+	wdata(out, "cmfc", 4);
+	wdata(out, "mp41", 4);
+	end_box(out, box);
+}
+
+static void write_matrix(struct array_output_data *out)
+{
+	for (size_t i = 0; i < 9; i++)
+		wb32(out, unity_matrix[i]);
+}
+
+static void write_mvhd(struct array_output_data *out, uint32_t next_track)
+{
+	size_t box = begin_full_box(out, "mvhd", 0, 0);
+
+	wb32(out, 0); /* creation time */
+	wb32(out, 0); /* modification time */
+	wb32(out, 1000);
+	wb32(out, 0); /* duration, unknown */
+	wb32(out, 0x00010000); /* rate */
+	wb16(out, 0x0100); /* volume */
+	wzero(out, 10);
+	write_matrix(out);
+	wzero(out, 24);
+	wb32(out, next_track);
+	end_box(out, box);
+}
+
+static void write_tkhd(struct array_output_data *out, uint32_t track_id,
+		       bool audio, uint32_t width, uint32_t height)
+{
+	/* enabled, in movie */
+	size_t box = begin_full_box(out, "tkhd", 0, 0x3);
+
+	wb32(out, 0);
+	wb32(out, 0);
+	wb32(out, track_id);
+	wb32(out, 0);
+	wb32(out, 0); /* duration */
+	wzero(out, 8);
+	wb16(out, 0); /* layer */
+	wb16(out, 0); /* alternate group */
+	wb16(out, audio ? 0x0100 : 0);
+	wb16(out, 0);
+	write_matrix(out);
+	wb32(out, width << 16);
+	wb32(out, height << 16);
+	end_box(out, box);
+}
+
+static void write_mdhd(struct array_output_data *out, uint32_t timescale)
+{
+	size_t box = begin_full_box(out, "mdhd", 0, 0);
+
+	wb32(out, 0);
+	wb32(out, 0);
+	wb32(out, timescale);
+	wb32(out, 0);
+	wb16(out, 0x55C4); /* "und" */
+	wb16(out, 0);
+	end_box(out, box);
+}
+
+static void write_hdlr(struct array_output_data *out, const char *type,
+		       const char *name)
+{
+	size_t box = begin_full_box(out, "hdlr", 0, 0);
+
+	wb32(out, 0);
+	wdata(out, type, 4);
+	wzero(out, 12);
+	wdata(out, name, strlen(name) + 1);
+	end_box(out, box);
+}
+
+static void write_dinf(struct array_output_data *out)
+{
+	size_t dinf = begin_box(out, "dinf");
+	size_t dref = begin_full_box(out, "dref", 0, 0);
+	size_t url;
+
+	wb32(out, 1);
+	/* media data is in the same file */
+	url = begin_full_box(out, "url ", 0, 0x1);
+	end_box(out, url);
+
+	end_box(out, dref);
+	end_box(out, dinf);
+}
+
+static void write_empty_tables(struct array_output_data *out)
+{
+	size_t box;
+
+	box = begin_full_box(out, "stts", 0, 0);
+	wb32(out, 0);
+	end_box(out, box);
+
+	box = begin_full_box(out, "stsc", 0, 0);
+	wb32(out, 0);
+	end_box(out, box);
+
+	box = begin_full_box(out, "stsz", 0, 0);
+	wb32(out, 0);
+	wb32(out, 0);
+	end_box(out, box);
+
+	box = begin_full_box(out, "stco", 0, 0);
+	wb32(out, 0);
+	end_box(out, box);
+}
+
+static void write_avc1(struct array_output_data *out,
+		       const struct mp4_frag_video *video)
+{
+	size_t box = begin_box(out, "avc1");
+	size_t avcc;
+
+	wzero(out, 6);
+	wb16(out, 1); /* data reference index */
+	wzero(out, 16);
+	wb16(out, (uint16_t)video->width);
+	wb16(out, (uint16_t)video->height);
+	wb32(out, 0x00480000); /* 72 dpi */
+	wb32(out, 0x00480000);
+	wb32(out, 0);
+	wb16(out, 1); /* frame count */
+	wzero(out, 32); /* compressor name */
+	wb16(out, 0x0018); /* depth */
+	wb16(out, 0xFFFF);
+
+	avcc = begin_box(out, "avcC");
+	wdata(out, video->avcc, video->avcc_size);
+	end_box(out, avcc);
+
+	end_box(out, box);
+}
+
+static inline void write_descriptor(struct array_output_data *out,
+				    uint8_t tag, size_t size)
+{
+	w8(out, tag);
+	w8(out, (uint8_t)size);
+}
+
+static void write_mp4a(struct array_output_data *out,
+		       const struct mp4_frag_audio *audio)
+{
+	size_t box = begin_box(out, "mp4a");
+	size_t esds;
+	size_t dsi_size = audio->asc_size;
+	size_t dcd_size = 13 + 2 + dsi_size;
+	size_t es_size = 3 + 2 + dcd_size + 2 + 1;
+
+	wzero(out, 6);
+	wb16(out, 1); /* data reference index */
+	wzero(out, 8);
+	wb16(out, (uint16_t)audio->channels);
+	wb16(out, 16); /* sample size */
+	wb32(out, 0);
+	wb32(out, audio->sample_rate << 16);
+
+	esds = begin_full_box(out, "esds", 0, 0);
+
+	write_descriptor(out, 0x03, es_size); /* ES_Descriptor */
+	wb16(out, MP4_FRAG_AUDIO_TRACK);
+	w8(out, 0);
+
+	write_descriptor(out, 0x04, dcd_size); /* DecoderConfigDescriptor */
+	w8(out, 0x40); /* MPEG-4 audio */
+	w8(out, 0x15); /* audio stream */
+	wb24(out, 0);
+	wb32(out, 0);
+	wb32(out, 0);
+
+	write_descriptor(out, 0x05, dsi_size); /* DecoderSpecificInfo */
+	wdata(out, audio->asc, audio->asc_size);
+
+	write_descriptor(out, 0x06, 1); /* SLConfigDescriptor */
+	w8(out, 0x02);
+
+	end_box(out, esds);
+	end_box(out, box);
+}
+
+static void write_trak(struct array_output_data *out,
+		       const struct mp4_frag_video *video,
+		       const struct mp4_frag_audio *audio)
+{
+	size_t trak = begin_box(out, "trak");
+	size_t mdia, minf, stbl, stsd, box;
+
+	if (video)
+		write_tkhd(out, MP4_FRAG_VIDEO_TRACK, false, video->width,
+			   video->height);
+	else
+		write_tkhd(out, MP4_FRAG_AUDIO_TRACK, true, 0, 0);
+
+	mdia = begin_box(out, "mdia");
+	write_mdhd(out,
+		   video ? MP4_FRAG_VIDEO_TIMESCALE : audio->sample_rate);
+	if (video)
+		write_hdlr(out, "vide", "VideoHandler");
+	else
+		write_hdlr(out, "soun", "SoundHandler");
+
+	minf = begin_box(out, "minf");
+	if (video) {
+		box = begin_full_box(out, "vmhd", 0, 0x1);
+		wzero(out, 8);
+	} else {
+		box = begin_full_box(out, "smhd", 0, 0);
+		wzero(out, 4);
+	}
+	end_box(out, box);
+	write_dinf(out);
+
+	stbl = begin_box(out, "stbl");
+	stsd = begin_full_box(out, "stsd", 0, 0);
+	wb32(out, 1);
+	if (video)
+		write_avc1(out, video);
+	else
+		write_mp4a(out, audio);
+	end_box(out, stsd);
+	write_empty_tables(out);
+	end_box(out, stbl);
+
+	end_box(out, minf);
+	end_box(out, mdia);
+	end_box(out, trak);
+}
+
+static void write_trex(struct array_output_data *out, uint32_t track_id)
+{
+	size_t box = begin_full_box(out, "trex", 0, 0);
+
+	wb32(out, track_id);
+	wb32(out, 1); /* sample description index */
+	wb32(out, 0);
+	wb32(out, 0);
+	wb32(out, 0);
+	end_box(out, box);
+}
+
+void mp4_frag_write_init(struct array_output_data *out,
+			 const struct mp4_frag_video *video,
+			 const struct mp4_frag_audio *audio)
+{
+	size_t moov, mvex;
+
+	write_ftyp(out);
+
+	moov = begin_box(out, "moov");
+	write_mvhd(out, audio ? MP4_FRAG_AUDIO_TRACK + 1
+			      : MP4_FRAG_VIDEO_TRACK + 1);
+	write_trak(out, video, NULL);
+	if (audio)
+		write_trak(out, NULL, audio);
+
+	mvex = begin_box(out, "mvex");
+	write_trex(out, MP4_FRAG_VIDEO_TRACK);
+	if (audio)
+		write_trex(out, MP4_FRAG_AUDIO_TRACK);
+	end_box(out, mvex);
+
+	end_box(out, moov);
+}
+
+/* ------------------------------------------------------------------------- */
+/* fragments                                                                 */
+
+static size_t write_traf(struct array_output_data *out,
+			 const struct mp4_frag_run *run)
+{
+	bool video = run->track_id == MP4_FRAG_VIDEO_TRACK;
+	uint32_t flags = TRUN_DATA_OFFSET | TRUN_SAMPLE_DURATION |
+			 TRUN_SAMPLE_SIZE | TRUN_SAMPLE_FLAGS;
+	size_t traf = begin_box(out, "traf");
+	size_t box, data_offset;
+
+	box = begin_full_box(out, "tfhd", 0, TFHD_DEFAULT_BASE_IS_MOOF);
+	wb32(out, run->track_id);
+	end_box(out, box);
+
+	box = begin_full_box(out, "tfdt", 1, 0);
+	wb64(out, run->base_time);
+	end_box(out, box);
+
+	if (video)
+		flags |= TRUN_SAMPLE_CTS;
+
+	/* version 1 for signed composition offsets */
+	box = begin_full_box(out, "trun", 1, flags);
+	wb32(out, (uint32_t)run->num_samples);
+	data_offset = out->bytes.num;
+	wb32(out, 0);
+
+	for (size_t i = 0; i < run->num_samples; i++) {
+		const struct mp4_frag_sample *sample = &run->samples[i];
+
+		wb32(out, sample->duration);
+		wb32(out, sample->size);
+		wb32(out, sample->keyframe ? SAMPLE_FLAGS_SYNC
+					   : SAMPLE_FLAGS_NON_SYNC);
+		if (video)
+			wb32(out, (uint32_t)sample->cts_offset);
+	}
+
+	end_box(out, box);
+	end_box(out, traf);
+	return data_offset;
+}
+
+void mp4_frag_write_fragment(struct array_output_data *out, uint32_t sequence,
+			     const struct mp4_frag_run *runs, size_t num_runs)
+{
+	size_t moof = begin_box(out, "moof");
+	size_t offsets[2];
+	size_t data_pos;
+	size_t box;
+
+	if (num_runs > 2)
+		num_runs = 2;
+
+	box = begin_full_box(out, "mfhd", 0, 0);
+	wb32(out, sequence);
+	end_box(out, box);
+
+	for (size_t i = 0; i < num_runs; i++)
+		offsets[i] = write_traf(out, &runs[i]);
+
+	end_box(out, moof);
+
+	/* data offsets are relative to the start of the moof */
+	data_pos = out->bytes.num - moof + 8;
+	for (size_t i = 0; i < num_runs; i++) {
+		patch_b32(out, offsets[i], (uint32_t)data_pos);
+		data_pos += runs[i].size;
+	}
+
+	box = begin_box(out, "mdat");
+	for (size_t i = 0; i < num_runs; i++)
+		wdata(out, runs[i].data, runs[i].size);
+	end_box(out, box);
+}
@@ -0,0 +1,58 @@
+#pragma once
+
+#include <util/array-serializer.h>
+
+/*
+ *   Fragmented MP4 (CMAF) boxes for one H.264 and one optional AAC track.
+ *
+ *   The init segment carries the codec configuration and no samples, and
+ * every fragment is a moof with one run per track followed by a single mdat
+ * with the samples of all runs back to back.  Fragments can be concatenated
+ * to form a segment.
+ */
+
+#define MP4_FRAG_VIDEO_TRACK 1
+#define MP4_FRAG_AUDIO_TRACK 2
+#define MP4_FRAG_VIDEO_TIMESCALE 90000
+
+struct mp4_frag_video {
+	uint32_t width;
+	uint32_t height;
+	/* AVCDecoderConfigurationRecord */
+	const uint8_t *avcc;
+	size_t avcc_size;
+};
+
+struct mp4_frag_audio {
+	uint32_t sample_rate;
+	uint32_t channels;
+	/* AudioSpecificConfig */
+	const uint8_t *asc;
+	size_t asc_size;
+};
+
+struct mp4_frag_sample {
+	uint32_t size;
+	uint32_t duration;
+	int32_t cts_offset;
+	bool keyframe;
+};
+
+struct mp4_frag_run {
+	uint32_t track_id;
+	uint64_t base_time;
+	const struct mp4_frag_sample *samples;
+	size_t num_samples;
+	/* the data of all samples back to back */
+	const uint8_t *data;
+	size_t size;
+};
+
+/* both append to out.  audio may be NULL. */
+extern void mp4_frag_write_init(struct array_output_data *out,
+				const struct mp4_frag_video *video,
+				const struct mp4_frag_audio *audio);
+extern void mp4_frag_write_fragment(struct array_output_data *out,
+				    uint32_t sequence,
+				    const struct mp4_frag_run *runs,
+				    size_t num_runs);
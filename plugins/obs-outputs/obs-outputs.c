@@ -16,6 +16,9 @@ MODULE_EXPORT const char *obs_module_description(void)
 }
 
 extern struct obs_output_info rtmp_output_info;
+extern struct obs_output_info rtmp_multi_output_info;
+extern struct obs_output_info udp_ts_output_info;
+extern struct obs_output_info hls_output_info;
 extern struct obs_output_info null_output_info;
 extern struct obs_output_info flv_output_info;
 #if COMPILE_FTL
@@ -66,6 +69,9 @@ bool obs_module_load(void)
 #endif
 
 	obs_register_output(&rtmp_output_info);
+	obs_register_output(&rtmp_multi_output_info);
+	obs_register_output(&udp_ts_output_info);
+	obs_register_output(&hls_output_info);
 	obs_register_output(&null_output_info);
 	obs_register_output(&flv_output_info);
 #if COMPILE_FTL
@@ -0,0 +1,208 @@
+#include "rtmp-congestion.h"
+
+#include <string.h>
+#include <util/bmem.h>
+
+/* ------------------------------------------------------------------------- */
+/* delay gradient
+ *
+ * Queuing delay is the time the output's own queue holds plus however much
+ * the RTT has grown over the lowest RTT seen recently.  A steadily growing
+ * queuing delay means the bitrate is slightly above what the link can take,
+ * so it is eased down to just below the rate data is actually delivered at.
+ * A high queuing delay means it is well above it, and the bitrate backs off
+ * harder.  While the queuing delay is low, the bitrate ramps back up
+ * smoothly, and more slowly around where it last had to come down, so it does
+ * not keep overshooting the link the way fixed steps do. */
+
+#define DG_MIN_INTERVAL_NS (50ULL * 1000000ULL)
+#define DG_MIN_RTT_WINDOW_NS (10ULL * 1000000000ULL)
+#define DG_HOLD_NS (500ULL * 1000000ULL)
+
+#define DG_QDELAY_LOW_USEC 30000.0
+#define DG_QDELAY_HIGH_USEC 150000.0
+
+/* queuing delay growing by this much per second counts as overuse */
+#define DG_GRADIENT_USEC 10000.0
+
+#define DG_EASE 0.95
+#define DG_BACKOFF 0.85
+#define DG_MAX_BACKOFF 0.5
+#define DG_RAMP 0.08
+#define DG_RAMP_CAREFUL 0.01
+#define DG_CAREFUL_BAND 0.1
+
+struct delay_gradient {
+	double max_kbps;
+	double min_kbps;
+	double target_kbps;
+	double last_backoff_kbps;
+	double delivery_kbps;
+
+	bool started;
+	uint64_t last_time;
+	uint64_t last_bytes;
+	uint32_t last_unacked;
+
+	uint32_t min_rtt;
+	uint64_t min_rtt_time;
+
+	double qdelay_usec;
+	double gradient;
+	uint64_t hold_until;
+};
+
+static void *dg_create(long max_kbps, long min_kbps)
+{
+	struct delay_gradient *dg = bzalloc(sizeof(*dg));
+	dg->max_kbps = (double)max_kbps;
+	dg->min_kbps = (double)min_kbps;
+	dg->target_kbps = dg->max_kbps;
+	return dg;
+}
+
+static void dg_destroy(void *data)
+{
+	bfree(data);
+}
+
+static double dg_delivery_kbps(struct delay_gradient *dg,
+			       const struct congestion_sample *sample,
+			       double seconds)
+{
+	double acked = (double)(sample->bytes_sent - dg->last_bytes);
+
+	/* data sitting in the socket has not been delivered yet */
+	if (sample->has_tcp_info)
+		acked -= (double)sample->unacked_bytes -
+			 (double)dg->last_unacked;
+	if (acked < 0.0)
+		acked = 0.0;
+
+	return acked * 8.0 / 1000.0 / seconds;
+}
+
+static double dg_queuing_delay(struct delay_gradient *dg,
+			       const struct congestion_sample *sample)
+{
+	double qdelay = (double)sample->buffer_usec;
+
+	if (sample->has_tcp_info && sample->rtt_usec) {
+		if (!dg->min_rtt || sample->rtt_usec < dg->min_rtt ||
+		    sample->time_ns - dg->min_rtt_time > DG_MIN_RTT_WINDOW_NS) {
+			dg->min_rtt = sample->rtt_usec;
+			dg->min_rtt_time = sample->time_ns;
+		}
+
+		qdelay += (double)(sample->rtt_usec - dg->min_rtt);
+	}
+
+	return qdelay;
+}
+
+static void dg_backoff(struct delay_gradient *dg, uint64_t time_ns,
+		       double factor)
+{
+	double target = dg->delivery_kbps * factor;
+
+	if (target >= dg->target_kbps)
+		target = dg->target_kbps * factor;
+	if (target < dg->target_kbps * DG_MAX_BACKOFF)
+		target = dg->target_kbps * DG_MAX_BACKOFF;
+
+	dg->last_backoff_kbps = dg->target_kbps;
+	dg->target_kbps = target;
+
+	/* give the queue time to drain before judging the new bitrate */
+	dg->hold_until = time_ns + DG_HOLD_NS + (uint64_t)dg->min_rtt * 2000;
+}
+
+static void dg_ramp(struct delay_gradient *dg, double seconds)
+{
+	double ramp = DG_RAMP;
+
+	if (dg->target_kbps >= dg->last_backoff_kbps * (1.0 - DG_CAREFUL_BAND) &&
+	    dg->target_kbps <= dg->last_backoff_kbps * (1.0 + DG_CAREFUL_BAND))
+		ramp = DG_RAMP_CAREFUL;
+
+	dg->target_kbps += dg->target_kbps * ramp * seconds;
+}
+
+static long dg_update(void *data, const struct congestion_sample *sample)
+{
+	struct delay_gradient *dg = data;
+	uint64_t elapsed = sample->time_ns - dg->last_time;
+	double seconds, qdelay, rate;
+
+	if (!dg->started) {
+		dg->started = true;
+		goto done;
+	}
+	if (elapsed < DG_MIN_INTERVAL_NS)
+		return (long)dg->target_kbps;
+
+	seconds = (double)elapsed / 1000000000.0;
+
+	rate = dg_delivery_kbps(dg, sample, seconds);
+	dg->delivery_kbps = dg->delivery_kbps
+				    ? dg->delivery_kbps * 0.75 + rate * 0.25
+				    : rate;
+
+	qdelay = dg_queuing_delay(dg, sample);
+	dg->gradient = dg->gradient * 0.7 +
+		       (qdelay - dg->qdelay_usec) / seconds * 0.3;
+	dg->qdelay_usec = qdelay;
+
+	if (qdelay > DG_QDELAY_HIGH_USEC) {
+		if (sample->time_ns >= dg->hold_until)
+			dg_backoff(dg, sample->time_ns, DG_BACKOFF);
+
+	} else if (qdelay > DG_QDELAY_LOW_USEC &&
+		   dg->gradient > DG_GRADIENT_USEC) {
+		if (sample->time_ns >= dg->hold_until)
+			dg_backoff(dg, sample->time_ns, DG_EASE);
+
+	} else if (qdelay < DG_QDELAY_LOW_USEC &&
+		   sample->time_ns >= dg->hold_until) {
+		dg_ramp(dg, seconds);
+	}
+
+	if (dg->target_kbps > dg->max_kbps)
+		dg->target_kbps = dg->max_kbps;
+	if (dg->target_kbps < dg->min_kbps)
+		dg->target_kbps = dg->min_kbps;
+
+done:
+	dg->last_time = sample->time_ns;
+	dg->last_bytes = sample->bytes_sent;
+	dg->last_unacked = sample->unacked_bytes;
+	return (long)dg->target_kbps;
+}
+
+const struct congestion_controller_info delay_gradient_controller = {
+	.id = "delay_gradient",
+	.create = dg_create,
+	.destroy = dg_destroy,
+	.update = dg_update,
+};
+
+/* ------------------------------------------------------------------------- */
+
+static const struct congestion_controller_info *controllers[] = {
+	&delay_gradient_controller,
+};
+
+const struct congestion_controller_info *
+congestion_controller_find(const char *id)
+{
+	if (!id)
+		return NULL;
+
+	for (size_t i = 0; i < sizeof(controllers) / sizeof(controllers[0]);
+	     i++) {
+		if (strcmp(controllers[i]->id, id) == 0)
+			return controllers[i];
+	}
+
+	return NULL;
+}
@@ -0,0 +1,50 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/*
+ *   Congestion controllers for dynamic bitrate.
+ *
+ *   The stream periodically hands a controller a sample of how much it has
+ * written and how much is waiting to be sent, plus the socket's TCP state
+ * where the platform exposes it.  The controller answers with the total
+ * bitrate (audio and video, in kbps) the stream should be using.
+ *
+ *   Controllers only ever look at the samples they are given, so they can be
+ * driven from a simulated link as easily as from a real socket.
+ */
+
+struct congestion_sample {
+	uint64_t time_ns;
+
+	/* total bytes written to the socket since the stream started */
+	uint64_t bytes_sent;
+
+	/* duration of the packets waiting in the output's own queue */
+	int64_t buffer_usec;
+
+	/* the following are only valid if has_tcp_info is set */
+	bool has_tcp_info;
+	uint32_t rtt_usec;
+	uint32_t cwnd_bytes;
+
+	/* bytes written to the socket that have not been acknowledged yet */
+	uint32_t unacked_bytes;
+};
+
+struct congestion_controller_info {
+	const char *id;
+
+	void *(*create)(long max_kbps, long min_kbps);
+	void (*destroy)(void *data);
+
+	/* returns the total bitrate to use in kbps */
+	long (*update)(void *data, const struct congestion_sample *sample);
+};
+
+extern const struct congestion_controller_info delay_gradient_controller;
+
+/* returns NULL if there is no controller with that id */
+const struct congestion_controller_info *
+congestion_controller_find(const char *id);
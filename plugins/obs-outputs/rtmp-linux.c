@@ -0,0 +1,361 @@
+#ifdef __linux__
+#include "rtmp-stream.h"
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <linux/sockios.h>
+#include <sys/ioctl.h>
+#include <errno.h>
+
+#define TCP_INFO_SAMPLE_INTERVAL_NS (50ULL * 1000000ULL)
+
+static void fatal_sock_shutdown(struct rtmp_stream *stream)
+{
+	close(stream->rtmp.m_sb.sb_socket);
+	stream->rtmp.m_sb.sb_socket = -1;
+
+	pthread_mutex_lock(&stream->write_buf_mutex);
+	stream->write_buf_start = 0;
+	stream->write_buf_len = 0;
+	pthread_mutex_unlock(&stream->write_buf_mutex);
+
+	os_event_signal(stream->buffer_space_available_event);
+}
+
+static bool discard_incoming(struct rtmp_stream *stream)
+{
+	char discard[16384];
+
+	for (;;) {
+		ssize_t ret = recv(stream->rtmp.m_sb.sb_socket, discard,
+				   sizeof(discard), MSG_DONTWAIT);
+		if (ret > 0)
+			continue;
+
+		int err_code = ret == -1 ? errno : 0;
+		if (ret == -1 && (err_code == EAGAIN || err_code == EWOULDBLOCK))
+			return true;
+		if (ret == -1 && err_code == EINTR)
+			continue;
+
+		blog(LOG_ERROR,
+		     "socket_thread_linux: Socket error, recv() returned "
+		     "%d, errno %d",
+		     (int)ret, err_code);
+		stream->rtmp.last_error_code = err_code;
+		fatal_sock_shutdown(stream);
+		return false;
+	}
+}
+
+static bool socket_event(struct rtmp_stream *stream, uint32_t events,
+			 bool *can_write, uint64_t last_send_time)
+{
+	if (events & EPOLLERR) {
+		int err_code = 0;
+		socklen_t size = sizeof(err_code);
+
+		getsockopt(stream->rtmp.m_sb.sb_socket, SOL_SOCKET, SO_ERROR,
+			   &err_code, &size);
+
+		if (last_send_time) {
+			uint32_t diff =
+				(os_gettime_ns() / 1000000) - last_send_time;
+
+			blog(LOG_ERROR,
+			     "socket_thread_linux: Received EPOLLERR, "
+			     "%u ms since last send (buffer: %zu / %zu)",
+			     diff, stream->write_buf_len,
+			     stream->write_buf_size);
+		}
+
+		blog(LOG_ERROR,
+		     "socket_thread_linux: Aborting due to socket error %d",
+		     err_code);
+		stream->rtmp.last_error_code = err_code;
+		fatal_sock_shutdown(stream);
+		return false;
+	}
+
+	/* a closed connection shows up as a zero-length read */
+	if (events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP)) {
+		if (!discard_incoming(stream))
+			return false;
+	}
+
+	if (events & EPOLLOUT)
+		*can_write = true;
+
+	return true;
+}
+
+static ssize_t send_ring(struct rtmp_stream *stream, size_t start,
+			 size_t len)
+{
+	size_t first = stream->write_buf_size - start;
+	if (first > len)
+		first = len;
+
+	/* TLS has to go through librtmp, one contiguous segment at a time */
+	if (stream->rtmp.m_sb.sb_ssl)
+		return RTMPSockBuf_Send(&stream->rtmp.m_sb,
+					(const char *)stream->write_buf + start,
+					(int)first);
+
+	struct iovec iov[2];
+	struct msghdr msg = {0};
+
+	iov[0].iov_base = stream->write_buf + start;
+	iov[0].iov_len = first;
+	iov[1].iov_base = stream->write_buf;
+	iov[1].iov_len = len - first;
+
+	msg.msg_iov = iov;
+	msg.msg_iovlen = iov[1].iov_len ? 2 : 1;
+
+	return sendmsg(stream->rtmp.m_sb.sb_socket, &msg, MSG_NOSIGNAL);
+}
+
+enum data_ret { RET_BREAK, RET_FATAL, RET_CONTINUE };
+
+static enum data_ret write_data(struct rtmp_stream *stream, bool *can_write,
+				uint64_t *last_send_time,
+				size_t latency_packet_size, int delay_time)
+{
+	size_t start, len;
+	ssize_t ret;
+
+	pthread_mutex_lock(&stream->write_buf_mutex);
+	start = stream->write_buf_start;
+	len = stream->write_buf_len;
+	pthread_mutex_unlock(&stream->write_buf_mutex);
+
+	if (!len)
+		return RET_BREAK;
+
+	if (stream->low_latency_mode && len > latency_packet_size)
+		len = latency_packet_size;
+
+	/* only this thread consumes the buffer, and producers only append
+	 * past the queued data, so the send can happen without the lock */
+	ret = send_ring(stream, start, len);
+
+	if (ret > 0) {
+		pthread_mutex_lock(&stream->write_buf_mutex);
+		stream->write_buf_start += (size_t)ret;
+		if (stream->write_buf_start >= stream->write_buf_size)
+			stream->write_buf_start -= stream->write_buf_size;
+		stream->write_buf_len -= (size_t)ret;
+		if (!stream->write_buf_len)
+			stream->write_buf_start = 0;
+		pthread_mutex_unlock(&stream->write_buf_mutex);
+
+		*last_send_time = os_gettime_ns() / 1000000;
+
+		os_event_signal(stream->buffer_space_available_event);
+	} else {
+		int err_code = ret < 0 ? errno : 0;
+
+		if (ret < 0 && (err_code == EAGAIN || err_code == EWOULDBLOCK)) {
+			*can_write = false;
+			return RET_BREAK;
+		}
+		if (ret < 0 && err_code == EINTR)
+			return RET_CONTINUE;
+
+		blog(LOG_ERROR,
+		     "socket_thread_linux: Socket error, send() returned "
+		     "%d, errno %d",
+		     (int)ret, err_code);
+		stream->rtmp.last_error_code = err_code;
+		fatal_sock_shutdown(stream);
+		return RET_FATAL;
+	}
+
+	if (delay_time)
+		os_sleep_ms(delay_time);
+
+	return RET_CONTINUE;
+}
+
+#define LATENCY_FACTOR 20
+
+static inline void socket_thread_linux_internal(struct rtmp_stream *stream)
+{
+	bool can_write = true;
+
+	int delay_time;
+	size_t latency_packet_size;
+	uint64_t last_send_time = 0;
+
+	struct epoll_event ev = {0};
+	int epoll_fd;
+
+	epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+	if (epoll_fd == -1) {
+		blog(LOG_ERROR,
+		     "socket_thread_linux: Aborting due to "
+		     "epoll_create1 failure, %d",
+		     errno);
+		fatal_sock_shutdown(stream);
+		return;
+	}
+
+	/* edge triggered: EPOLLOUT only fires again once a send has hit
+	 * EAGAIN, which is exactly when can_write gets cleared */
+	ev.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+	ev.data.fd = stream->rtmp.m_sb.sb_socket;
+	if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, ev.data.fd, &ev) == -1)
+		goto epoll_fail;
+
+	ev.events = EPOLLIN;
+	ev.data.fd = stream->socket_wake_fd;
+	if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, ev.data.fd, &ev) == -1)
+		goto epoll_fail;
+
+	if (stream->low_latency_mode) {
+		delay_time = 1000 / LATENCY_FACTOR;
+		latency_packet_size =
+			stream->write_buf_size / (LATENCY_FACTOR - 2);
+	} else {
+		latency_packet_size = stream->write_buf_size;
+		delay_time = 0;
+	}
+
+	for (;;) {
+		socket_sample_tcp_info(stream);
+
+		while (can_write) {
+			enum data_ret ret = write_data(stream, &can_write,
+						       &last_send_time,
+						       latency_packet_size,
+						       delay_time);
+			if (ret == RET_FATAL)
+				goto exit;
+			if (ret == RET_BREAK)
+				break;
+		}
+
+		if (os_event_try(stream->send_thread_signaled_exit) != EAGAIN) {
+			pthread_mutex_lock(&stream->write_buf_mutex);
+			if (stream->write_buf_len == 0) {
+				pthread_mutex_unlock(&stream->write_buf_mutex);
+				os_event_reset(
+					stream->send_thread_signaled_exit);
+				break;
+			}
+
+			pthread_mutex_unlock(&stream->write_buf_mutex);
+		}
+
+		struct epoll_event events[2];
+		int count = epoll_wait(epoll_fd, events, 2, -1);
+		if (count == -1) {
+			if (errno == EINTR)
+				continue;
+
+			blog(LOG_ERROR,
+			     "socket_thread_linux: Aborting due to "
+			     "epoll_wait failure, %d",
+			     errno);
+			fatal_sock_shutdown(stream);
+			goto exit;
+		}
+
+		for (int i = 0; i < count; i++) {
+			if (events[i].data.fd == stream->socket_wake_fd) {
+				uint64_t val;
+				if (read(stream->socket_wake_fd, &val,
+					 sizeof(val)) == -1 &&
+				    errno != EAGAIN)
+					blog(LOG_WARNING,
+					     "socket_thread_linux: Failed to "
+					     "read wake descriptor, %d",
+					     errno);
+				continue;
+			}
+
+			if (!socket_event(stream, events[i].events, &can_write,
+					  last_send_time))
+				goto exit;
+		}
+	}
+
+	blog(LOG_INFO, "socket_thread_linux: Normal exit");
+
+exit:
+	close(epoll_fd);
+	return;
+
+epoll_fail:
+	blog(LOG_ERROR, "socket_thread_linux: Aborting due to epoll_ctl "
+			"failure, %d",
+	     errno);
+	fatal_sock_shutdown(stream);
+	close(epoll_fd);
+}
+
+void *socket_thread_linux(void *data)
+{
+	struct rtmp_stream *stream = data;
+	os_set_thread_name("rtmp-stream: socket_thread");
+	socket_thread_linux_internal(stream);
+	return NULL;
+}
+
+/* The socket can be closed by the thread doing the socket I/O whenever a
+ * send fails, so only that thread queries it, and the packet thread reads
+ * the last values in socket_get_tcp_info(). */
+void socket_sample_tcp_info(struct rtmp_stream *stream)
+{
+	int fd = stream->rtmp.m_sb.sb_socket;
+	struct tcp_info ti;
+	socklen_t size = sizeof(ti);
+	uint64_t t;
+	int queued;
+
+	if (!stream->dbr_controller)
+		return;
+
+	t = os_gettime_ns();
+	if (t - stream->tcp_info_last_sample < TCP_INFO_SAMPLE_INTERVAL_NS)
+		return;
+	stream->tcp_info_last_sample = t;
+
+	if (fd < 0 || getsockopt(fd, IPPROTO_TCP, TCP_INFO, &ti, &size) != 0)
+		return;
+
+	/* unlike tcpi_unacked, this also counts data not sent yet */
+	if (ioctl(fd, SIOCOUTQ, &queued) != 0)
+		queued = (int)(ti.tcpi_unacked * ti.tcpi_snd_mss);
+
+	os_atomic_set_long(&stream->tcp_rtt_usec, (long)ti.tcpi_rtt);
+	os_atomic_set_long(&stream->tcp_cwnd_bytes,
+			   (long)(ti.tcpi_snd_cwnd * ti.tcpi_snd_mss));
+	os_atomic_set_long(&stream->tcp_queued_bytes, (long)queued);
+	os_atomic_set_bool(&stream->has_tcp_info, true);
+}
+
+void socket_get_tcp_info(struct rtmp_stream *stream,
+			 struct congestion_sample *sample)
+{
+	if (!os_atomic_load_bool(&stream->has_tcp_info))
+		return;
+
+	sample->has_tcp_info = true;
+	sample->rtt_usec = (uint32_t)os_atomic_load_long(&stream->tcp_rtt_usec);
+	sample->cwnd_bytes =
+		(uint32_t)os_atomic_load_long(&stream->tcp_cwnd_bytes);
+	sample->unacked_bytes =
+		(uint32_t)os_atomic_load_long(&stream->tcp_queued_bytes);
+
+	/* bytes count as sent once they are in the write buffer */
+	if (stream->new_socket_loop) {
+		pthread_mutex_lock(&stream->write_buf_mutex);
+		sample->unacked_bytes += (uint32_t)stream->write_buf_len;
+		pthread_mutex_unlock(&stream->write_buf_mutex);
+	}
+}
+#endif
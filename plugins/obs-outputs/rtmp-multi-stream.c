@@ -0,0 +1,1012 @@
+#include <obs-module.h>
+#include <obs-avc.h>
+#include <util/darray.h>
+#include <util/dstr.h>
+#include <util/platform.h>
+#include <util/threading.h>
+#include <inttypes.h>
+#include "librtmp/rtmp.h"
+#include "librtmp/log.h"
+#include "flv-mux.h"
+#include "net-if.h"
+#include "rtmp-tag-queue.h"
+
+#ifdef _WIN32
+#include <winsock2.h>
+#else
+#include <sys/ioctl.h>
+#include <errno.h>
+#endif
+
+/*
+ *   Sends one stream to several RTMP servers at once.
+ *
+ *   Packets are muxed to FLV once, on the data thread, and pushed to a shared
+ * tag queue.  Each destination has its own connection and thread, reads the
+ * queue through its own cursor, and reconnects on its own when its
+ * connection drops, so one failing server never stops the others.
+ */
+
+#define do_log(level, format, ...)                       \
+	blog(level, "[rtmp multi stream: '%s'] " format, \
+	     obs_output_get_name(stream->output), ##__VA_ARGS__)
+
+#define warn(format, ...) do_log(LOG_WARNING, format, ##__VA_ARGS__)
+#define info(format, ...) do_log(LOG_INFO, format, ##__VA_ARGS__)
+
+#define dest_log(level, format, ...)                             \
+	blog(level, "[rtmp multi stream: '%s' -> '%s'] " format, \
+	     obs_output_get_name(dest->stream->output),         \
+	     dest->name.array, ##__VA_ARGS__)
+
+#define dest_warn(format, ...) dest_log(LOG_WARNING, format, ##__VA_ARGS__)
+#define dest_info(format, ...) dest_log(LOG_INFO, format, ##__VA_ARGS__)
+
+#define OPT_DESTINATIONS "destinations"
+#define OPT_DROP_THRESHOLD "drop_threshold_ms"
+#define OPT_MAX_BUFFER "max_buffer_ms"
+#define OPT_RECONNECT_DELAY_SEC "reconnect_delay_sec"
+#define OPT_MAX_SHUTDOWN_TIME_SEC "max_shutdown_time_sec"
+#define OPT_BIND_IP "bind_ip"
+
+/* per destination */
+#define OPT_NAME "name"
+#define OPT_SERVER "server"
+#define OPT_KEY "key"
+#define OPT_USERNAME "username"
+#define OPT_PASSWORD "password"
+#define OPT_ENABLED "enabled"
+#define OPT_DROP_POLICY "drop_policy"
+
+/* like rtmp_output, p-frames only start getting dropped some time after
+ * b-frames did */
+#define MSEC_TO_USEC 1000LL
+#define PFRAME_DROP_DELAY_USEC (200LL * MSEC_TO_USEC)
+#define WAIT_INTERVAL_MS 100
+
+enum drop_policy {
+	/* drop non-keyframes until the destination catches up */
+	DROP_POLICY_DROP_FRAMES,
+	/* jump straight to the newest keyframe */
+	DROP_POLICY_SKIP_TO_KEYFRAME,
+	/* drop the connection and reconnect */
+	DROP_POLICY_RECONNECT,
+};
+
+struct rtmp_multi_stream;
+
+struct rtmp_destination {
+	struct rtmp_multi_stream *stream;
+
+	struct dstr name;
+	struct dstr path, key;
+	struct dstr username, password;
+	struct dstr encoder_name;
+	enum drop_policy drop_policy;
+
+	RTMP rtmp;
+	pthread_t thread;
+	bool thread_created;
+	os_event_t *wake;
+
+	struct rtmp_tag_cursor cursor;
+	struct flv_tag header_tag;
+	DARRAY(uint8_t) header;
+	int min_priority;
+	bool has_ts_base;
+	int32_t ts_base;
+
+	/* stats, written by the destination thread */
+	volatile bool connected;
+	uint64_t total_bytes_sent;
+	long dropped_frames;
+	long reconnects;
+	int64_t buffer_usec;
+};
+
+struct rtmp_multi_stream {
+	obs_output_t *output;
+
+	pthread_mutex_t dests_mutex;
+	DARRAY(struct rtmp_destination *) dests;
+	volatile long running;
+
+	struct rtmp_tag_queue queue;
+	struct flv_tag tag;
+	bool got_first_video;
+	int32_t start_dts_offset;
+
+	volatile bool active;
+	volatile bool encode_error;
+	os_event_t *stop_event;
+	uint64_t stop_ts;
+	uint64_t shutdown_timeout_ts;
+
+	int64_t drop_threshold_usec;
+	int reconnect_delay_sec;
+	int max_shutdown_time_sec;
+	struct dstr bind_ip;
+};
+
+static const char *rtmp_multi_stream_getname(void *unused)
+{
+	UNUSED_PARAMETER(unused);
+	return obs_module_text("RTMPMultiStream");
+}
+
+static void log_rtmp(int level, const char *format, va_list args)
+{
+	if (level > RTMP_LOGWARNING)
+		return;
+
+	blogva(LOG_INFO, format, args);
+}
+
+static inline bool stopping(struct rtmp_multi_stream *stream)
+{
+	return os_event_try(stream->stop_event) != EAGAIN;
+}
+
+static inline bool active(struct rtmp_multi_stream *stream)
+{
+	return os_atomic_load_bool(&stream->active);
+}
+
+static void wake_destinations(struct rtmp_multi_stream *stream)
+{
+	for (size_t i = 0; i < stream->dests.num; i++)
+		os_event_signal(stream->dests.array[i]->wake);
+}
+
+/* ------------------------------------------------------------------------- */
+/* destination connection                                                    */
+
+static inline void set_rtmp_dstr(AVal *val, struct dstr *str)
+{
+	bool valid = !dstr_is_empty(str);
+	val->av_val = valid ? str->array : NULL;
+	val->av_len = valid ? (int)str->len : 0;
+}
+
+static bool discard_recv_data(struct rtmp_destination *dest)
+{
+	RTMP *rtmp = &dest->rtmp;
+	int recv_size = 0;
+	uint8_t buf[512];
+	int ret;
+
+#ifdef _WIN32
+	ret = ioctlsocket(rtmp->m_sb.sb_socket, FIONREAD, (u_long *)&recv_size);
+#else
+	ret = ioctl(rtmp->m_sb.sb_socket, FIONREAD, &recv_size);
+#endif
+
+	while (ret >= 0 && recv_size > 0) {
+		int bytes = recv_size > 512 ? 512 : recv_size;
+
+		ret = (int)recv(rtmp->m_sb.sb_socket, buf, bytes, 0);
+		if (ret <= 0)
+			return false;
+
+		recv_size -= ret;
+	}
+
+	return true;
+}
+
+static bool write_tag(struct rtmp_destination *dest, const uint8_t *header,
+		      size_t header_size, const uint8_t *payload,
+		      size_t payload_size, const uint8_t *trailer,
+		      size_t trailer_size, size_t idx)
+{
+	AVal vec[3] = {
+		{(char *)header, (int)header_size},
+		{(char *)payload, (int)payload_size},
+		{(char *)trailer, (int)trailer_size},
+	};
+
+	if (RTMP_WriteV(&dest->rtmp, vec, 3, (int)idx) < 0)
+		return false;
+
+	dest->total_bytes_sent += header_size + payload_size + trailer_size;
+	return true;
+}
+
+static bool send_header_packet(struct rtmp_destination *dest,
+			       struct encoder_packet *packet, size_t idx)
+{
+	struct flv_tag *tag = &dest->header_tag;
+	bool success = false;
+	bool muxed;
+
+	if (idx > 0)
+		muxed = flv_additional_packet_mux_tag(tag, packet, 0, true,
+						      idx);
+	else
+		muxed = flv_packet_mux_tag(tag, packet, 0, true);
+
+	if (muxed)
+		success = write_tag(dest, flv_tag_header(tag), tag->header_size,
+				    tag->payload, tag->payload_size,
+				    flv_tag_trailer(tag),
+				    flv_tag_trailer_size(tag), idx);
+
+	bfree(packet->data);
+	return success;
+}
+
+static bool send_audio_header(struct rtmp_destination *dest, size_t idx,
+			      bool *next)
+{
+	obs_output_t *context = dest->stream->output;
+	obs_encoder_t *aencoder = obs_output_get_audio_encoder(context, idx);
+	uint8_t *header;
+
+	struct encoder_packet packet = {.type = OBS_ENCODER_AUDIO,
+					.timebase_den = 1};
+
+	if (!aencoder) {
+		*next = false;
+		return true;
+	}
+
+	obs_encoder_get_extra_data(aencoder, &header, &packet.size);
+	packet.data = bmemdup(header, packet.size);
+	return send_header_packet(dest, &packet, idx);
+}
+
+static bool send_video_header(struct rtmp_destination *dest)
+{
+	obs_output_t *context = dest->stream->output;
+	obs_encoder_t *vencoder = obs_output_get_video_encoder(context);
+	uint8_t *header;
+	size_t size;
+
+	struct encoder_packet packet = {
+		.type = OBS_ENCODER_VIDEO, .timebase_den = 1, .keyframe = true};
+
+	obs_encoder_get_extra_data(vencoder, &header, &size);
+	packet.size = obs_parse_avc_header(&packet.data, header, size);
+	return send_header_packet(dest, &packet, 0);
+}
+
+static bool send_headers(struct rtmp_destination *dest)
+{
+	size_t i = 0;
+	bool next = true;
+
+	if (!send_audio_header(dest, i++, &next))
+		return false;
+	if (!send_video_header(dest))
+		return false;
+
+	while (next) {
+		if (!send_audio_header(dest, i++, &next))
+			return false;
+	}
+
+	return true;
+}
+
+static bool send_meta_data(struct rtmp_destination *dest)
+{
+	obs_output_t *context = dest->stream->output;
+	uint8_t *meta_data;
+	size_t meta_data_size;
+	bool success;
+
+	flv_meta_data(context, &meta_data, &meta_data_size, false);
+	success = RTMP_Write(&dest->rtmp, (char *)meta_data,
+			     (int)meta_data_size, 0) >= 0;
+	bfree(meta_data);
+
+	if (success && obs_output_get_audio_encoder(context, 1)) {
+		flv_additional_meta_data(context, &meta_data, &meta_data_size);
+		success = RTMP_Write(&dest->rtmp, (char *)meta_data,
+				     (int)meta_data_size, 0) >= 0;
+		bfree(meta_data);
+	}
+
+	return success;
+}
+
+static bool connect_destination(struct rtmp_destination *dest)
+{
+	struct rtmp_multi_stream *stream = dest->stream;
+
+	dest_info("Connecting to RTMP URL %s...", dest->path.array);
+
+	RTMP_Reset(&dest->rtmp);
+	memset(&dest->rtmp.Link, 0, sizeof(dest->rtmp.Link));
+	dest->rtmp.last_error_code = 0;
+
+	if (!RTMP_SetupURL(&dest->rtmp, dest->path.array)) {
+		dest_warn("Invalid URL");
+		return false;
+	}
+
+	RTMP_EnableWrite(&dest->rtmp);
+
+	dstr_copy(&dest->encoder_name, "FMLE/3.0 (compatible; FMSc/1.0)");
+
+	set_rtmp_dstr(&dest->rtmp.Link.pubUser, &dest->username);
+	set_rtmp_dstr(&dest->rtmp.Link.pubPasswd, &dest->password);
+	set_rtmp_dstr(&dest->rtmp.Link.flashVer, &dest->encoder_name);
+	dest->rtmp.Link.swfUrl = dest->rtmp.Link.tcUrl;
+
+	memset(&dest->rtmp.m_bindIP, 0, sizeof(dest->rtmp.m_bindIP));
+	if (!dstr_is_empty(&stream->bind_ip) &&
+	    dstr_cmp(&stream->bind_ip, "default") != 0)
+		netif_str_to_addr(&dest->rtmp.m_bindIP.addr,
+				  &dest->rtmp.m_bindIP.addrLen,
+				  stream->bind_ip.array);
+
+	RTMP_AddStream(&dest->rtmp, dest->key.array);
+
+	dest->rtmp.m_outChunkSize = 4096;
+	dest->rtmp.m_bSendChunkSizeInfo = true;
+	dest->rtmp.m_bUseNagle = true;
+
+	if (!RTMP_Connect(&dest->rtmp, NULL)) {
+		dest_warn("Connection failed: %d", dest->rtmp.last_error_code);
+		return false;
+	}
+	if (!RTMP_ConnectStream(&dest->rtmp, 0)) {
+		dest_warn("Invalid stream");
+		return false;
+	}
+
+	if (!send_meta_data(dest) || !send_headers(dest)) {
+		dest_warn("Disconnected while sending stream headers");
+		return false;
+	}
+
+	dest_info("Connection to %s successful", dest->path.array);
+	return true;
+}
+
+/* ------------------------------------------------------------------------- */
+/* destination send loop                                                     */
+
+static bool send_tag(struct rtmp_destination *dest, struct rtmp_tag *tag)
+{
+	int32_t ts;
+
+	if (!discard_recv_data(dest))
+		return false;
+
+	/* every connection starts its timestamps from zero, so the stored
+	 * header gets its timestamp rewritten */
+	if (!dest->has_ts_base) {
+		dest->ts_base = tag->timestamp;
+		dest->has_ts_base = true;
+	}
+
+	ts = tag->timestamp - dest->ts_base;
+	if (ts < 0)
+		ts = 0;
+
+	da_copy_array(dest->header, rtmp_tag_header(tag), tag->header_size);
+	dest->header.array[4] = (uint8_t)(ts >> 16);
+	dest->header.array[5] = (uint8_t)(ts >> 8);
+	dest->header.array[6] = (uint8_t)ts;
+	dest->header.array[7] = (uint8_t)((ts >> 24) & 0x7F);
+
+	return write_tag(dest, dest->header.array, dest->header.num,
+			 tag->packet.data, tag->packet.size,
+			 rtmp_tag_trailer(tag), tag->trailer_size,
+			 tag->packet.track_idx);
+}
+
+/* returns true if the tag should be dropped for this destination */
+static bool drop_tag(struct rtmp_destination *dest, struct rtmp_tag *tag)
+{
+	if (tag->packet.type != OBS_ENCODER_VIDEO)
+		return false;
+
+	if (tag->packet.drop_priority < dest->min_priority) {
+		dest->dropped_frames++;
+		return true;
+	}
+
+	dest->min_priority = 0;
+	return false;
+}
+
+/* returns false if the destination should reconnect */
+static bool check_buffer(struct rtmp_destination *dest)
+{
+	struct rtmp_multi_stream *stream = dest->stream;
+	int64_t threshold = stream->drop_threshold_usec;
+	int64_t buffer_usec;
+	long skipped;
+
+	buffer_usec = rtmp_tag_queue_buffered_usec(&stream->queue,
+						   &dest->cursor);
+	dest->buffer_usec = buffer_usec;
+
+	if (buffer_usec <= threshold)
+		return true;
+
+	switch (dest->drop_policy) {
+	case DROP_POLICY_DROP_FRAMES:
+		if (buffer_usec > threshold + PFRAME_DROP_DELAY_USEC)
+			dest->min_priority = OBS_NAL_PRIORITY_HIGHEST;
+		else if (dest->min_priority < OBS_NAL_PRIORITY_HIGH)
+			dest->min_priority = OBS_NAL_PRIORITY_HIGH;
+		break;
+
+	case DROP_POLICY_SKIP_TO_KEYFRAME:
+		skipped = rtmp_tag_queue_skip(&stream->queue, &dest->cursor);
+		dest->dropped_frames += skipped;
+		break;
+
+	case DROP_POLICY_RECONNECT:
+		dest_warn("Fell %" PRId64 " ms behind, reconnecting",
+			  buffer_usec / 1000);
+		return false;
+	}
+
+	return true;
+}
+
+static inline bool can_shutdown(struct rtmp_multi_stream *stream,
+				struct rtmp_tag *tag)
+{
+	if (stream->stop_ts == 0)
+		return true;
+	if (os_gettime_ns() >= stream->shutdown_timeout_ts)
+		return true;
+
+	return tag && tag->packet.sys_dts_usec >= (int64_t)stream->stop_ts;
+}
+
+/* returns true once the stream is stopped, false if the connection failed
+ * and the destination should reconnect */
+static bool send_loop(struct rtmp_destination *dest)
+{
+	struct rtmp_multi_stream *stream = dest->stream;
+
+	for (;;) {
+		struct rtmp_tag *tag;
+		bool success;
+
+		if (!check_buffer(dest))
+			return false;
+
+		tag = rtmp_tag_queue_next(&stream->queue, &dest->cursor);
+
+		if (stopping(stream) && can_shutdown(stream, tag)) {
+			rtmp_tag_release(tag);
+			return true;
+		}
+
+		if (!tag) {
+			os_event_timedwait(dest->wake, WAIT_INTERVAL_MS);
+			continue;
+		}
+
+		success = drop_tag(dest, tag) || send_tag(dest, tag);
+		rtmp_tag_release(tag);
+
+		if (!success) {
+			dest_warn("Disconnected from %s", dest->path.array);
+			return false;
+		}
+	}
+}
+
+static void finish_stream(struct rtmp_multi_stream *stream)
+{
+	if (os_atomic_load_bool(&stream->encode_error)) {
+		info("Encoder error, disconnecting");
+		obs_output_signal_stop(stream->output, OBS_OUTPUT_ENCODE_ERROR);
+	} else {
+		info("User stopped the stream");
+		obs_output_end_data_capture(stream->output);
+	}
+
+	os_atomic_set_bool(&stream->active, false);
+	rtmp_tag_queue_clear(&stream->queue);
+}
+
+static void *destination_thread(void *data)
+{
+	struct rtmp_destination *dest = data;
+	struct rtmp_multi_stream *stream = dest->stream;
+
+	os_set_thread_name("rtmp-multi-stream: destination_thread");
+
+	while (!stopping(stream)) {
+		unsigned long delay_ms;
+
+		if (connect_destination(dest)) {
+			dest->min_priority = 0;
+			dest->has_ts_base = false;
+			rtmp_tag_queue_attach(&stream->queue, &dest->cursor);
+			os_atomic_set_bool(&dest->connected, true);
+
+			send_loop(dest);
+
+			os_atomic_set_bool(&dest->connected, false);
+			rtmp_tag_queue_detach(&stream->queue, &dest->cursor);
+			dest->buffer_usec = 0;
+		}
+
+		RTMP_Close(&dest->rtmp);
+
+		if (stopping(stream))
+			break;
+
+		delay_ms = (unsigned long)stream->reconnect_delay_sec * 1000;
+		dest_info("Reconnecting in %d seconds...",
+			  stream->reconnect_delay_sec);
+		dest->reconnects++;
+
+		if (os_event_timedwait(stream->stop_event, delay_ms) == 0)
+			break;
+	}
+
+	if (os_atomic_dec_long(&stream->running) == 0)
+		finish_stream(stream);
+
+	return NULL;
+}
+
+/* ------------------------------------------------------------------------- */
+/* destinations                                                              */
+
+static void destination_destroy(struct rtmp_destination *dest)
+{
+	if (!dest)
+		return;
+
+	RTMP_TLS_Free(&dest->rtmp);
+	os_event_destroy(dest->wake);
+	flv_tag_free(&dest->header_tag);
+	da_free(dest->header);
+	dstr_free(&dest->name);
+	dstr_free(&dest->path);
+	dstr_free(&dest->key);
+	dstr_free(&dest->username);
+	dstr_free(&dest->password);
+	dstr_free(&dest->encoder_name);
+	bfree(dest);
+}
+
+static enum drop_policy get_drop_policy(const char *policy)
+{
+	if (strcmp(policy, "skip_to_keyframe") == 0)
+		return DROP_POLICY_SKIP_TO_KEYFRAME;
+	if (strcmp(policy, "reconnect") == 0)
+		return DROP_POLICY_RECONNECT;
+	return DROP_POLICY_DROP_FRAMES;
+}
+
+static struct rtmp_destination *
+destination_create(struct rtmp_multi_stream *stream, obs_data_t *settings,
+		   size_t idx)
+{
+	struct rtmp_destination *dest = bzalloc(sizeof(*dest));
+	const char *name = obs_data_get_string(settings, OPT_NAME);
+
+	dest->stream = stream;
+	flv_tag_init(&dest->header_tag);
+	RTMP_Init(&dest->rtmp);
+
+	if (*name)
+		dstr_copy(&dest->name, name);
+	else
+		dstr_printf(&dest->name, "%d", (int)idx);
+
+	dstr_copy(&dest->path, obs_data_get_string(settings, OPT_SERVER));
+	dstr_copy(&dest->key, obs_data_get_string(settings, OPT_KEY));
+	dstr_copy(&dest->username, obs_data_get_string(settings, OPT_USERNAME));
+	dstr_copy(&dest->password, obs_data_get_string(settings, OPT_PASSWORD));
+	dstr_depad(&dest->path);
+	dstr_depad(&dest->key);
+	dest->drop_policy =
+		get_drop_policy(obs_data_get_string(settings, OPT_DROP_POLICY));
+
+	if (os_event_init(&dest->wake, OS_EVENT_TYPE_AUTO) != 0) {
+		destination_destroy(dest);
+		return NULL;
+	}
+
+	return dest;
+}
+
+static void join_destinations(struct rtmp_multi_stream *stream)
+{
+	for (size_t i = 0; i < stream->dests.num; i++) {
+		struct rtmp_destination *dest = stream->dests.array[i];
+
+		if (dest->thread_created) {
+			pthread_join(dest->thread, NULL);
+			dest->thread_created = false;
+		}
+	}
+}
+
+static void free_destinations(struct rtmp_multi_stream *stream)
+{
+	for (size_t i = 0; i < stream->dests.num; i++)
+		destination_destroy(stream->dests.array[i]);
+	da_free(stream->dests);
+}
+
+static bool load_destinations(struct rtmp_multi_stream *stream,
+			      obs_data_t *settings)
+{
+	obs_data_array_t *array = obs_data_get_array(settings, OPT_DESTINATIONS);
+	size_t count = obs_data_array_count(array);
+
+	pthread_mutex_lock(&stream->dests_mutex);
+	free_destinations(stream);
+
+	for (size_t i = 0; i < count; i++) {
+		obs_data_t *item = obs_data_array_item(array, i);
+		struct rtmp_destination *dest = NULL;
+		bool enabled = !obs_data_has_user_value(item, OPT_ENABLED) ||
+			       obs_data_get_bool(item, OPT_ENABLED);
+
+		if (!enabled) {
+			obs_data_release(item);
+			continue;
+		}
+
+		if (!*obs_data_get_string(item, OPT_SERVER))
+			warn("Destination %d has no server, ignoring", (int)i);
+		else
+			dest = destination_create(stream, item, i);
+
+		if (dest)
+			da_push_back(stream->dests, &dest);
+		obs_data_release(item);
+	}
+
+	pthread_mutex_unlock(&stream->dests_mutex);
+	obs_data_array_release(array);
+	return stream->dests.num > 0;
+}
+
+/* ------------------------------------------------------------------------- */
+
+static void rtmp_multi_stream_destroy(void *data)
+{
+	struct rtmp_multi_stream *stream = data;
+
+	if (active(stream)) {
+		stream->stop_ts = 0;
+		os_event_signal(stream->stop_event);
+		wake_destinations(stream);
+	}
+
+	join_destinations(stream);
+	free_destinations(stream);
+
+	rtmp_tag_queue_free(&stream->queue);
+	flv_tag_free(&stream->tag);
+	os_event_destroy(stream->stop_event);
+	pthread_mutex_destroy(&stream->dests_mutex);
+	dstr_free(&stream->bind_ip);
+	bfree(stream);
+}
+
+static void get_destination_count(void *data, calldata_t *cd)
+{
+	struct rtmp_multi_stream *stream = data;
+
+	pthread_mutex_lock(&stream->dests_mutex);
+	calldata_set_int(cd, "count", (long long)stream->dests.num);
+	pthread_mutex_unlock(&stream->dests_mutex);
+}
+
+static void get_destination_stats(void *data, calldata_t *cd)
+{
+	struct rtmp_multi_stream *stream = data;
+	long long idx = calldata_int(cd, "index");
+	struct rtmp_destination *dest;
+
+	pthread_mutex_lock(&stream->dests_mutex);
+
+	if (idx < 0 || (size_t)idx >= stream->dests.num) {
+		pthread_mutex_unlock(&stream->dests_mutex);
+		return;
+	}
+
+	dest = stream->dests.array[idx];
+	calldata_set_string(cd, "name", dest->name.array);
+	calldata_set_bool(cd, "connected",
+			  os_atomic_load_bool(&dest->connected));
+	calldata_set_int(cd, "total_bytes", (long long)dest->total_bytes_sent);
+	calldata_set_int(cd, "dropped_frames",
+			 dest->dropped_frames + dest->cursor.skipped_frames);
+	calldata_set_int(cd, "reconnects", dest->reconnects);
+	calldata_set_int(cd, "buffer_ms", dest->buffer_usec / 1000);
+
+	pthread_mutex_unlock(&stream->dests_mutex);
+}
+
+static void *rtmp_multi_stream_create(obs_data_t *settings,
+				      obs_output_t *output)
+{
+	struct rtmp_multi_stream *stream = bzalloc(sizeof(*stream));
+	proc_handler_t *ph = obs_output_get_proc_handler(output);
+
+	stream->output = output;
+	pthread_mutex_init_value(&stream->dests_mutex);
+	flv_tag_init(&stream->tag);
+
+	RTMP_LogSetCallback(log_rtmp);
+	RTMP_LogSetLevel(RTMP_LOGWARNING);
+
+	if (pthread_mutex_init(&stream->dests_mutex, NULL) != 0)
+		goto fail;
+	if (os_event_init(&stream->stop_event, OS_EVENT_TYPE_MANUAL) != 0)
+		goto fail;
+	if (!rtmp_tag_queue_init(&stream->queue, 0))
+		goto fail;
+
+	proc_handler_add(ph, "void get_destination_count(out int count)",
+			 get_destination_count, stream);
+	proc_handler_add(ph,
+			 "void get_destination_stats(in int index, "
+			 "out string name, out bool connected, "
+			 "out int total_bytes, out int dropped_frames, "
+			 "out int reconnects, out int buffer_ms)",
+			 get_destination_stats, stream);
+
+	UNUSED_PARAMETER(settings);
+	return stream;
+
+fail:
+	rtmp_multi_stream_destroy(stream);
+	return NULL;
+}
+
+static bool rtmp_multi_stream_start(void *data)
+{
+	struct rtmp_multi_stream *stream = data;
+	obs_data_t *settings;
+	bool success;
+
+	if (!obs_output_can_begin_data_capture(stream->output, 0))
+		return false;
+	if (!obs_output_initialize_encoders(stream->output, 0))
+		return false;
+
+	if (obs_output_get_audio_encoder(stream->output, 2) != NULL) {
+		warn("Additional audio streams not supported");
+		return false;
+	}
+
+	/* previous run, its threads have all exited by now */
+	join_destinations(stream);
+
+	settings = obs_output_get_settings(stream->output);
+	success = load_destinations(stream, settings);
+
+	stream->drop_threshold_usec =
+		obs_data_get_int(settings, OPT_DROP_THRESHOLD) * MSEC_TO_USEC;
+	stream->queue.max_usec =
+		obs_data_get_int(settings, OPT_MAX_BUFFER) * MSEC_TO_USEC;
+	stream->reconnect_delay_sec =
+		(int)obs_data_get_int(settings, OPT_RECONNECT_DELAY_SEC);
+	stream->max_shutdown_time_sec =
+		(int)obs_data_get_int(settings, OPT_MAX_SHUTDOWN_TIME_SEC);
+	dstr_copy(&stream->bind_ip, obs_data_get_string(settings, OPT_BIND_IP));
+	obs_data_release(settings);
+
+	if (!success) {
+		warn("No destinations to stream to");
+		return false;
+	}
+
+	rtmp_tag_queue_clear(&stream->queue);
+	os_event_reset(stream->stop_event);
+	os_atomic_set_bool(&stream->encode_error, false);
+	stream->got_first_video = false;
+	stream->stop_ts = 0;
+	stream->running = 0;
+
+	os_atomic_set_bool(&stream->active, true);
+
+	for (size_t i = 0; i < stream->dests.num; i++) {
+		struct rtmp_destination *dest = stream->dests.array[i];
+
+		os_atomic_inc_long(&stream->running);
+		if (pthread_create(&dest->thread, NULL, destination_thread,
+				   dest) == 0) {
+			dest->thread_created = true;
+		} else {
+			os_atomic_dec_long(&stream->running);
+			dest_warn("Failed to create destination thread");
+		}
+	}
+
+	if (!os_atomic_load_long(&stream->running)) {
+		os_atomic_set_bool(&stream->active, false);
+		return false;
+	}
+
+	info("Streaming to %d destination(s)", (int)stream->dests.num);
+	obs_output_begin_data_capture(stream->output, 0);
+	return true;
+}
+
+static void rtmp_multi_stream_stop(void *data, uint64_t ts)
+{
+	struct rtmp_multi_stream *stream = data;
+
+	if (stopping(stream) && ts != 0)
+		return;
+
+	if (!active(stream)) {
+		obs_output_signal_stop(stream->output, OBS_OUTPUT_SUCCESS);
+		return;
+	}
+
+	stream->stop_ts = ts / 1000ULL;
+	if (ts)
+		stream->shutdown_timeout_ts =
+			ts +
+			(uint64_t)stream->max_shutdown_time_sec * 1000000000ULL;
+
+	os_event_signal(stream->stop_event);
+	wake_destinations(stream);
+}
+
+static void rtmp_multi_stream_data(void *data, struct encoder_packet *packet)
+{
+	struct rtmp_multi_stream *stream = data;
+	struct encoder_packet new_packet;
+	struct rtmp_tag *tag;
+	bool muxed;
+
+	if (!active(stream))
+		return;
+
+	/* encoder fail */
+	if (!packet) {
+		os_atomic_set_bool(&stream->encode_error, true);
+		stream->stop_ts = 0;
+		os_event_signal(stream->stop_event);
+		wake_destinations(stream);
+		return;
+	}
+
+	if (packet->type == OBS_ENCODER_VIDEO) {
+		if (!stream->got_first_video) {
+			stream->start_dts_offset =
+				get_ms_time(packet, packet->dts);
+			stream->got_first_video = true;
+		}
+
+		obs_parse_avc_packet(&new_packet, packet);
+
+	} else if (stream->got_first_video) {
+		obs_encoder_packet_ref(&new_packet, packet);
+
+	} else {
+		/* every destination starts on a keyframe anyway */
+		return;
+	}
+
+	if (new_packet.track_idx > 0)
+		muxed = flv_additional_packet_mux_tag(
+			&stream->tag, &new_packet, stream->start_dts_offset,
+			false, new_packet.track_idx);
+	else
+		muxed = flv_packet_mux_tag(&stream->tag, &new_packet,
+					   stream->start_dts_offset, false);
+
+	if (!muxed) {
+		obs_encoder_packet_release(&new_packet);
+		return;
+	}
+
+	tag = rtmp_tag_create(&new_packet, flv_tag_header(&stream->tag),
+			      stream->tag.header_size,
+			      flv_tag_trailer(&stream->tag),
+			      flv_tag_trailer_size(&stream->tag));
+
+	rtmp_tag_queue_push(&stream->queue, tag);
+	wake_destinations(stream);
+}
+
+static void rtmp_multi_stream_defaults(obs_data_t *defaults)
+{
+	obs_data_set_default_int(defaults, OPT_DROP_THRESHOLD, 700);
+	obs_data_set_default_int(defaults, OPT_MAX_BUFFER, 10000);
+	obs_data_set_default_int(defaults, OPT_RECONNECT_DELAY_SEC, 10);
+	obs_data_set_default_int(defaults, OPT_MAX_SHUTDOWN_TIME_SEC, 30);
+	obs_data_set_default_string(defaults, OPT_BIND_IP, "default");
+}
+
+static obs_properties_t *rtmp_multi_stream_properties(void *unused)
+{
+	UNUSED_PARAMETER(unused);
+
+	obs_properties_t *props = obs_properties_create();
+
+	obs_properties_add_int(props, OPT_DROP_THRESHOLD,
+			       obs_module_text("RTMPStream.DropThreshold"), 200,
+			       10000, 100);
+	obs_properties_add_int(props, OPT_MAX_BUFFER,
+			       obs_module_text("RTMPMultiStream.MaxBuffer"),
+			       1000, 60000, 1000);
+	obs_properties_add_int(
+		props, OPT_RECONNECT_DELAY_SEC,
+		obs_module_text("RTMPMultiStream.ReconnectDelay"), 1, 60, 1);
+
+	return props;
+}
+
+static uint64_t rtmp_multi_stream_total_bytes_sent(void *data)
+{
+	struct rtmp_multi_stream *stream = data;
+	uint64_t total = 0;
+
+	pthread_mutex_lock(&stream->dests_mutex);
+	for (size_t i = 0; i < stream->dests.num; i++)
+		total += stream->dests.array[i]->total_bytes_sent;
+	pthread_mutex_unlock(&stream->dests_mutex);
+
+	return total;
+}
+
+static int rtmp_multi_stream_dropped_frames(void *data)
+{
+	struct rtmp_multi_stream *stream = data;
+	long total = 0;
+
+	pthread_mutex_lock(&stream->dests_mutex);
+	for (size_t i = 0; i < stream->dests.num; i++) {
+		struct rtmp_destination *dest = stream->dests.array[i];
+		total += dest->dropped_frames + dest->cursor.skipped_frames;
+	}
+	pthread_mutex_unlock(&stream->dests_mutex);
+
+	return (int)total;
+}
+
+/* reports the most congested destination */
+static float rtmp_multi_stream_congestion(void *data)
+{
+	struct rtmp_multi_stream *stream = data;
+	int64_t max_usec = 0;
+	float congestion;
+
+	if (!stream->drop_threshold_usec)
+		return 0.0f;
+
+	pthread_mutex_lock(&stream->dests_mutex);
+	for (size_t i = 0; i < stream->dests.num; i++) {
+		int64_t usec = stream->dests.array[i]->buffer_usec;
+		if (usec > max_usec)
+			max_usec = usec;
+	}
+	pthread_mutex_unlock(&stream->dests_mutex);
+
+	congestion = (float)max_usec / (float)stream->drop_threshold_usec;
+	return congestion > 1.0f ? 1.0f : congestion;
+}
+
+struct obs_output_info rtmp_multi_output_info = {
+	.id = "rtmp_multi_output",
+	.flags = OBS_OUTPUT_AV | OBS_OUTPUT_ENCODED | OBS_OUTPUT_MULTI_TRACK,
+	.encoded_video_codecs = "h264",
+	.encoded_audio_codecs = "aac",
+	.get_name = rtmp_multi_stream_getname,
+	.create = rtmp_multi_stream_create,
+	.destroy = rtmp_multi_stream_destroy,
+	.start = rtmp_multi_stream_start,
+	.stop = rtmp_multi_stream_stop,
+	.encoded_packet = rtmp_multi_stream_data,
+	.get_defaults = rtmp_multi_stream_defaults,
+	.get_properties = rtmp_multi_stream_properties,
+	.get_total_bytes = rtmp_multi_stream_total_bytes_sent,
+	.get_congestion = rtmp_multi_stream_congestion,
+	.get_dropped_frames = rtmp_multi_stream_dropped_frames,
+};
@@ -34,6 +34,12 @@
 #define DBR_TRIGGER_USEC (200ULL * MSEC_TO_USEC)
 #define MIN_ESTIMATE_DURATION_MS 1000
 #define MAX_ESTIMATE_DURATION_MS 2000
+#define DBR_MIN_BITRATE 50
+#define DBR_SAMPLE_INTERVAL_NS (100ULL * MSEC_TO_NSEC)
+
+/* every send of the new socket loop (a chunk plus its header) has to fit in
+ * the write buffer, or socket_queue_data would wait for space forever */
+#define MIN_WRITE_BUF_SIZE 131072
 
 static const char *rtmp_stream_getname(void *unused)
 {
@@ -122,17 +128,24 @@ static void rtmp_stream_destroy(void *data)
 	os_sem_destroy(stream->send_sem);
 	pthread_mutex_destroy(&stream->packets_mutex);
 	circlebuf_free(&stream->packets);
+	flv_tag_free(&stream->tag);
 #ifdef TEST_FRAMEDROPS
 	circlebuf_free(&stream->droptest_info);
 #endif
 	circlebuf_free(&stream->dbr_frames);
 	pthread_mutex_destroy(&stream->dbr_mutex);
+	if (stream->dbr_controller)
+		stream->dbr_controller->destroy(stream->dbr_controller_data);
 
 	os_event_destroy(stream->buffer_space_available_event);
 	os_event_destroy(stream->buffer_has_data_event);
 	os_event_destroy(stream->socket_available_event);
 	os_event_destroy(stream->send_thread_signaled_exit);
 	pthread_mutex_destroy(&stream->write_buf_mutex);
+#ifdef __linux__
+	if (stream->socket_wake_fd != -1)
+		close(stream->socket_wake_fd);
+#endif
 
 	if (stream->write_buf)
 		bfree(stream->write_buf);
@@ -144,6 +157,10 @@ static void *rtmp_stream_create(obs_data_t *settings, obs_output_t *output)
 	struct rtmp_stream *stream = bzalloc(sizeof(struct rtmp_stream));
 	stream->output = output;
 	pthread_mutex_init_value(&stream->packets_mutex);
+	flv_tag_init(&stream->tag);
+#ifdef __linux__
+	stream->socket_wake_fd = -1;
+#endif
 
 	RTMP_LogSetCallback(log_rtmp);
 	RTMP_Init(&stream->rtmp);
@@ -184,6 +201,13 @@ static void *rtmp_stream_create(obs_data_t *settings, obs_output_t *output)
 		warn("Failed to initialize socket exit event");
 		goto fail;
 	}
+#ifdef __linux__
+	stream->socket_wake_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+	if (stream->socket_wake_fd == -1) {
+		warn("Failed to initialize socket wake descriptor");
+		goto fail;
+	}
+#endif
 
 	UNUSED_PARAMETER(settings);
 	return stream;
@@ -363,12 +387,33 @@ static void droptest_cap_data_rate(struct rtmp_stream *stream, size_t size)
 }
 #endif
 
+static void wake_socket_thread(struct rtmp_stream *stream, bool was_empty)
+{
+	os_event_signal(stream->buffer_has_data_event);
+
+#ifdef __linux__
+	/* the socket thread keeps sending until the buffer is empty or the
+	 * socket would block, so it only needs waking when data arrives in
+	 * an empty buffer */
+	if (was_empty) {
+		uint64_t val = 1;
+		if (write(stream->socket_wake_fd, &val, sizeof(val)) == -1 &&
+		    errno != EAGAIN)
+			warn("Failed to wake socket thread: %d", errno);
+	}
+#else
+	UNUSED_PARAMETER(was_empty);
+#endif
+}
+
 static int socket_queue_data(RTMPSockBuf *sb, const char *data, int len,
 			     void *arg)
 {
 	UNUSED_PARAMETER(sb);
 
 	struct rtmp_stream *stream = arg;
+	size_t end, first;
+	bool was_empty;
 
 retry_send:
 
@@ -377,6 +422,12 @@ retry_send:
 
 	pthread_mutex_lock(&stream->write_buf_mutex);
 
+	if ((size_t)len > stream->write_buf_size) {
+		pthread_mutex_unlock(&stream->write_buf_mutex);
+		warn("%d bytes can never fit in the write buffer", len);
+		return 0;
+	}
+
 	if (stream->write_buf_len + len > stream->write_buf_size) {
 
 		pthread_mutex_unlock(&stream->write_buf_mutex);
@@ -388,12 +439,25 @@ retry_send:
 		goto retry_send;
 	}
 
-	memcpy(stream->write_buf + stream->write_buf_len, data, len);
+	/* write_buf is a ring buffer starting at write_buf_start */
+	end = stream->write_buf_start + stream->write_buf_len;
+	if (end >= stream->write_buf_size)
+		end -= stream->write_buf_size;
+
+	first = stream->write_buf_size - end;
+	if (first > (size_t)len)
+		first = (size_t)len;
+
+	memcpy(stream->write_buf + end, data, first);
+	if (first < (size_t)len)
+		memcpy(stream->write_buf, data + first, len - first);
+
+	was_empty = stream->write_buf_len == 0;
 	stream->write_buf_len += len;
 
 	pthread_mutex_unlock(&stream->write_buf_mutex);
 
-	os_event_signal(stream->buffer_has_data_event);
+	wake_socket_thread(stream, was_empty);
 
 	return len;
 }
@@ -402,10 +466,12 @@ static int send_packet(struct rtmp_stream *stream,
 		       struct encoder_packet *packet, bool is_header,
 		       size_t idx)
 {
-	uint8_t *data;
-	size_t size;
+	struct flv_tag *tag = &stream->tag;
+	int32_t dts_offset = is_header ? 0 : stream->start_dts_offset;
+	size_t size = 0;
 	int recv_size = 0;
 	int ret = 0;
+	bool muxed;
 
 	assert(idx < RTMP_MAX_STREAMS);
 
@@ -423,21 +489,29 @@ static int send_packet(struct rtmp_stream *stream,
 		}
 	}
 
-	if (idx > 0) {
-		flv_additional_packet_mux(
-			packet, is_header ? 0 : stream->start_dts_offset, &data,
-			&size, is_header, idx);
-	} else {
-		flv_packet_mux(packet, is_header ? 0 : stream->start_dts_offset,
-			       &data, &size, is_header);
-	}
+	if (idx > 0)
+		muxed = flv_additional_packet_mux_tag(tag, packet, dts_offset,
+						      is_header, idx);
+	else
+		muxed = flv_packet_mux_tag(tag, packet, dts_offset, is_header);
+
+	if (muxed) {
+		/* the payload is sent straight from the encoder packet */
+		AVal vec[3] = {
+			{(char *)flv_tag_header(tag), (int)tag->header_size},
+			{(char *)tag->payload, (int)tag->payload_size},
+			{(char *)flv_tag_trailer(tag),
+			 (int)flv_tag_trailer_size(tag)},
+		};
+
+		size = flv_tag_size(tag);
 
 #ifdef TEST_FRAMEDROPS
-	droptest_cap_data_rate(stream, size);
+		droptest_cap_data_rate(stream, size);
 #endif
 
-	ret = RTMP_Write(&stream->rtmp, (char *)data, (int)size, 0);
-	bfree(data);
+		ret = RTMP_WriteV(&stream->rtmp, vec, 3, 0);
+	}
 
 	if (is_header)
 		bfree(packet->data);
@@ -610,6 +684,11 @@ static void *send_thread(void *data)
 			break;
 		}
 
+#ifdef __linux__
+		if (!stream->new_socket_loop)
+			socket_sample_tcp_info(stream);
+#endif
+
 		if (stream->dbr_enabled) {
 			dbr_frame.send_end = os_gettime_ns();
 
@@ -631,7 +710,7 @@ static void *send_thread(void *data)
 
 	if (stream->new_socket_loop) {
 		os_event_signal(stream->send_thread_signaled_exit);
-		os_event_signal(stream->buffer_has_data_event);
+		wake_socket_thread(stream, true);
 		pthread_join(stream->socket_thread, NULL);
 		stream->socket_thread_active = false;
 		stream->rtmp.m_bCustomSend = false;
@@ -785,6 +864,11 @@ static int init_send(struct rtmp_stream *stream)
 
 	reset_semaphore(stream);
 
+#ifdef __linux__
+	stream->tcp_info_last_sample = 0;
+	os_atomic_set_bool(&stream->has_tcp_info, false);
+#endif
+
 	ret = pthread_create(&stream->send_thread, NULL, send_thread, stream);
 	if (ret != 0) {
 		RTMP_Close(&stream->rtmp);
@@ -852,15 +936,35 @@ static int init_send(struct rtmp_stream *stream)
 		// to bytes/sec
 		int ideal_buffer_size = total_bitrate * 128;
 
-		if (ideal_buffer_size < 131072)
-			ideal_buffer_size = 131072;
+		if (ideal_buffer_size < MIN_WRITE_BUF_SIZE)
+			ideal_buffer_size = MIN_WRITE_BUF_SIZE;
+
+		if (stream->write_buf_size_kb > 0) {
+			ideal_buffer_size = stream->write_buf_size_kb * 1024;
+
+			if (ideal_buffer_size < MIN_WRITE_BUF_SIZE) {
+				warn("Write buffer size of %d KB is too small, "
+				     "using %d KB",
+				     stream->write_buf_size_kb,
+				     MIN_WRITE_BUF_SIZE / 1024);
+				ideal_buffer_size = MIN_WRITE_BUF_SIZE;
+			} else {
+				info("Using write buffer size of %d KB",
+				     stream->write_buf_size_kb);
+			}
+		}
 
 		stream->write_buf_size = ideal_buffer_size;
+		stream->write_buf_start = 0;
+		stream->write_buf_len = 0;
 		stream->write_buf = bmalloc(ideal_buffer_size);
 
 #ifdef _WIN32
 		ret = pthread_create(&stream->socket_thread, NULL,
 				     socket_thread_windows, stream);
+#elif defined(__linux__)
+		ret = pthread_create(&stream->socket_thread, NULL,
+				     socket_thread_linux, stream);
 #else
 		warn("New socket loop not supported on this platform");
 		return OBS_OUTPUT_ERROR;
@@ -1029,6 +1133,33 @@ static int try_connect(struct rtmp_stream *stream)
 	return init_send(stream);
 }
 
+static void init_dbr_controller(struct rtmp_stream *stream,
+				obs_data_t *settings)
+{
+	const char *id = obs_data_get_string(settings, OPT_DBR_CONTROLLER);
+
+	if (stream->dbr_controller)
+		stream->dbr_controller->destroy(stream->dbr_controller_data);
+	stream->dbr_controller = NULL;
+	stream->dbr_controller_data = NULL;
+	stream->dbr_last_sample = 0;
+
+	if (!stream->dbr_enabled || !*id)
+		return;
+
+	stream->dbr_controller = congestion_controller_find(id);
+	if (!stream->dbr_controller) {
+		warn("Unknown dynamic bitrate controller '%s'", id);
+		return;
+	}
+
+	/* controllers work with the total bitrate, audio included */
+	stream->dbr_controller_data = stream->dbr_controller->create(
+		stream->dbr_orig_bitrate + stream->audio_bitrate,
+		DBR_MIN_BITRATE + stream->audio_bitrate);
+	info("Dynamic bitrate controller: %s", id);
+}
+
 static bool init_connect(struct rtmp_stream *stream)
 {
 	obs_service_t *service;
@@ -1095,6 +1226,8 @@ static bool init_connect(struct rtmp_stream *stream)
 		info("Dynamic bitrate enabled.  Dropped frames begone!");
 	}
 
+	init_dbr_controller(stream, settings);
+
 	obs_data_release(vsettings);
 	obs_data_release(asettings);
 
@@ -1111,6 +1244,8 @@ static bool init_connect(struct rtmp_stream *stream)
 		obs_data_get_bool(settings, OPT_NEWSOCKETLOOP_ENABLED);
 	stream->low_latency_mode =
 		obs_data_get_bool(settings, OPT_LOWLATENCY_ENABLED);
+	stream->write_buf_size_kb =
+		(int)obs_data_get_int(settings, OPT_WRITE_BUFFER_SIZE);
 
 	obs_data_release(settings);
 	return true;
@@ -1322,6 +1457,49 @@ static void dbr_inc_bitrate(struct rtmp_stream *stream)
 	}
 }
 
+static void dbr_controller_update(struct rtmp_stream *stream)
+{
+	struct congestion_sample sample = {0};
+	struct encoder_packet first;
+	uint64_t t = os_gettime_ns();
+	long bitrate, diff;
+
+	if (t - stream->dbr_last_sample < DBR_SAMPLE_INTERVAL_NS)
+		return;
+	stream->dbr_last_sample = t;
+
+	sample.time_ns = t;
+	sample.bytes_sent = stream->total_bytes_sent;
+	if (find_first_video_packet(stream, &first))
+		sample.buffer_usec = stream->last_dts_usec - first.dts_usec;
+#ifdef __linux__
+	socket_get_tcp_info(stream, &sample);
+#endif
+
+	bitrate = stream->dbr_controller->update(stream->dbr_controller_data,
+						 &sample);
+	bitrate -= stream->audio_bitrate;
+	if (bitrate < DBR_MIN_BITRATE)
+		bitrate = DBR_MIN_BITRATE;
+	if (bitrate > stream->dbr_orig_bitrate)
+		bitrate = stream->dbr_orig_bitrate;
+
+	/* the controller ramps smoothly, so only reconfigure the encoder
+	 * once the change is big enough to matter */
+	diff = labs(bitrate - stream->dbr_cur_bitrate);
+	if (diff * 20 < stream->dbr_cur_bitrate &&
+	    bitrate != stream->dbr_orig_bitrate)
+		return;
+	if (!diff)
+		return;
+
+	debug("bitrate %s to: %ld",
+	      bitrate < stream->dbr_cur_bitrate ? "decreased" : "increased",
+	      bitrate);
+	stream->dbr_cur_bitrate = bitrate;
+	dbr_set_bitrate(stream);
+}
+
 static void check_to_drop_frames(struct rtmp_stream *stream, bool pframes)
 {
 	struct encoder_packet first;
@@ -1333,7 +1511,10 @@ static void check_to_drop_frames(struct rtmp_stream *stream, bool pframes)
 	int64_t drop_threshold = pframes ? stream->pframe_drop_threshold_usec
 					 : stream->drop_threshold_usec;
 
-	if (!pframes && stream->dbr_enabled) {
+	if (!pframes && stream->dbr_controller) {
+		dbr_controller_update(stream);
+
+	} else if (!pframes && stream->dbr_enabled) {
 		if (stream->dbr_inc_timeout) {
 			uint64_t t = os_gettime_ns();
 
@@ -1370,7 +1551,7 @@ static void check_to_drop_frames(struct rtmp_stream *stream, bool pframes)
 	if (stream->dbr_enabled) {
 		bool bitrate_changed = false;
 
-		if (pframes) {
+		if (pframes || stream->dbr_controller) {
 			return;
 		}
 
@@ -1465,6 +1646,8 @@ static void rtmp_stream_defaults(obs_data_t *defaults)
 	obs_data_set_default_string(defaults, OPT_BIND_IP, "default");
 	obs_data_set_default_bool(defaults, OPT_NEWSOCKETLOOP_ENABLED, false);
 	obs_data_set_default_bool(defaults, OPT_LOWLATENCY_ENABLED, false);
+	obs_data_set_default_int(defaults, OPT_WRITE_BUFFER_SIZE, 0);
+	obs_data_set_default_string(defaults, OPT_DBR_CONTROLLER, "");
 }
 
 static obs_properties_t *rtmp_stream_properties(void *unused)
@@ -1497,6 +1680,18 @@ static obs_properties_t *rtmp_stream_properties(void *unused)
 				obs_module_text("RTMPStream.NewSocketLoop"));
 	obs_properties_add_bool(props, OPT_LOWLATENCY_ENABLED,
 				obs_module_text("RTMPStream.LowLatencyMode"));
+	obs_properties_add_int(props, OPT_WRITE_BUFFER_SIZE,
+			       obs_module_text("RTMPStream.WriteBufferSize"),
+			       0, 65536, 64);
+
+	p = obs_properties_add_list(props, OPT_DBR_CONTROLLER,
+				    obs_module_text("RTMPStream.DbrController"),
+				    OBS_COMBO_TYPE_LIST,
+				    OBS_COMBO_FORMAT_STRING);
+	obs_property_list_add_string(p, obs_module_text("Default"), "");
+	obs_property_list_add_string(
+		p, obs_module_text("RTMPStream.DbrController.DelayGradient"),
+		delay_gradient_controller.id);
 
 	return props;
 }
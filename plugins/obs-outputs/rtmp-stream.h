@@ -9,6 +9,7 @@
 #include "librtmp/log.h"
 #include "flv-mux.h"
 #include "net-if.h"
+#include "rtmp-congestion.h"
 
 #ifdef _WIN32
 #include <Iphlpapi.h>
@@ -16,6 +17,11 @@
 #include <sys/ioctl.h>
 #endif
 
+#ifdef __linux__
+#include <sys/eventfd.h>
+#include <unistd.h>
+#endif
+
 #define do_log(level, format, ...)                 \
 	blog(level, "[rtmp stream: '%s'] " format, \
 	     obs_output_get_name(stream->output), ##__VA_ARGS__)
@@ -25,12 +31,14 @@
 #define debug(format, ...) do_log(LOG_DEBUG, format, ##__VA_ARGS__)
 
 #define OPT_DYN_BITRATE "dyn_bitrate"
+#define OPT_DBR_CONTROLLER "dbr_controller"
 #define OPT_DROP_THRESHOLD "drop_threshold_ms"
 #define OPT_PFRAME_DROP_THRESHOLD "pframe_drop_threshold_ms"
 #define OPT_MAX_SHUTDOWN_TIME_SEC "max_shutdown_time_sec"
 #define OPT_BIND_IP "bind_ip"
 #define OPT_NEWSOCKETLOOP_ENABLED "new_socket_loop_enabled"
 #define OPT_LOWLATENCY_ENABLED "low_latency_mode_enabled"
+#define OPT_WRITE_BUFFER_SIZE "write_buffer_size_kb"
 #define OPT_METADATA_MULTITRACK "metadata_multitrack"
 
 //#define TEST_FRAMEDROPS
@@ -91,6 +99,8 @@ struct rtmp_stream {
 
 	int64_t last_dts_usec;
 
+	struct flv_tag tag;
+
 	uint64_t total_bytes_sent;
 	int dropped_frames;
 
@@ -113,6 +123,20 @@ struct rtmp_stream {
 	long dbr_inc_bitrate;
 	bool dbr_enabled;
 
+	/* replaces the estimate above when a controller is selected */
+	const struct congestion_controller_info *dbr_controller;
+	void *dbr_controller_data;
+	uint64_t dbr_last_sample;
+
+#ifdef __linux__
+	/* TCP_INFO as last sampled by the thread doing the socket I/O */
+	uint64_t tcp_info_last_sample;
+	volatile bool has_tcp_info;
+	volatile long tcp_rtt_usec;
+	volatile long tcp_cwnd_bytes;
+	volatile long tcp_queued_bytes;
+#endif
+
 	RTMP rtmp;
 
 	bool new_socket_loop;
@@ -120,7 +144,9 @@ struct rtmp_stream {
 	bool disable_send_window_optimization;
 	bool socket_thread_active;
 	pthread_t socket_thread;
+	int write_buf_size_kb;
 	uint8_t *write_buf;
+	size_t write_buf_start;
 	size_t write_buf_len;
 	size_t write_buf_size;
 	pthread_mutex_t write_buf_mutex;
@@ -128,8 +154,16 @@ struct rtmp_stream {
 	os_event_t *buffer_has_data_event;
 	os_event_t *socket_available_event;
 	os_event_t *send_thread_signaled_exit;
+#ifdef __linux__
+	int socket_wake_fd;
+#endif
 };
 
 #ifdef _WIN32
 void *socket_thread_windows(void *data);
+#elif defined(__linux__)
+void *socket_thread_linux(void *data);
+void socket_sample_tcp_info(struct rtmp_stream *stream);
+void socket_get_tcp_info(struct rtmp_stream *stream,
+			 struct congestion_sample *sample);
 #endif
@@ -0,0 +1,232 @@
+#include "rtmp-tag-queue.h"
+
+#include <util/bmem.h>
+
+struct rtmp_tag *rtmp_tag_create(struct encoder_packet *packet,
+				 const uint8_t *header, size_t header_size,
+				 const uint8_t *trailer, size_t trailer_size)
+{
+	struct rtmp_tag *tag =
+		bmalloc(sizeof(*tag) + header_size + trailer_size);
+
+	tag->refs = 1;
+	tag->packet = *packet;
+	tag->header_size = header_size;
+	tag->trailer_size = trailer_size;
+	memcpy(tag->data, header, header_size);
+	memcpy(tag->data + header_size, trailer, trailer_size);
+
+	/* FLV tag timestamp: 24 bits at offset 4, upper 8 bits at offset 7 */
+	if (header_size >= 8)
+		tag->timestamp = (int32_t)((uint32_t)header[7] << 24 |
+					   (uint32_t)header[4] << 16 |
+					   (uint32_t)header[5] << 8 |
+					   (uint32_t)header[6]);
+	else
+		tag->timestamp = 0;
+	return tag;
+}
+
+void rtmp_tag_addref(struct rtmp_tag *tag)
+{
+	os_atomic_inc_long(&tag->refs);
+}
+
+void rtmp_tag_release(struct rtmp_tag *tag)
+{
+	if (tag && os_atomic_dec_long(&tag->refs) == 0) {
+		obs_encoder_packet_release(&tag->packet);
+		bfree(tag);
+	}
+}
+
+/* ------------------------------------------------------------------------- */
+
+static inline struct rtmp_tag *tag_at(struct rtmp_tag_queue *queue,
+				      uint64_t seq)
+{
+	size_t offset = (size_t)(seq - queue->first_seq) * sizeof(void *);
+	return *(struct rtmp_tag **)circlebuf_data(&queue->tags, offset);
+}
+
+static long skip_to_keyframe(struct rtmp_tag_queue *queue,
+			     struct rtmp_tag_cursor *cursor)
+{
+	long skipped = 0;
+
+	if (!queue->has_keyframe || queue->keyframe_seq <= cursor->seq)
+		return 0;
+
+	for (uint64_t seq = cursor->seq; seq < queue->keyframe_seq; seq++) {
+		if (tag_at(queue, seq)->packet.type == OBS_ENCODER_VIDEO)
+			skipped++;
+	}
+
+	cursor->seq = queue->keyframe_seq;
+	return skipped;
+}
+
+static int64_t buffered_usec(struct rtmp_tag_queue *queue,
+			     struct rtmp_tag_cursor *cursor)
+{
+	uint64_t end = rtmp_tag_queue_end(queue);
+	struct rtmp_tag *first;
+	struct rtmp_tag *last;
+
+	if (cursor->seq >= end)
+		return 0;
+
+	first = tag_at(queue, cursor->seq);
+	last = tag_at(queue, end - 1);
+	return last->packet.dts_usec - first->packet.dts_usec;
+}
+
+/* frees every tag that no cursor can read anymore */
+static void trim(struct rtmp_tag_queue *queue)
+{
+	uint64_t limit = queue->has_keyframe ? queue->keyframe_seq
+					     : rtmp_tag_queue_end(queue);
+
+	for (size_t i = 0; i < queue->cursors.num; i++) {
+		struct rtmp_tag_cursor *cursor = queue->cursors.array[i];
+		if (cursor->seq < limit)
+			limit = cursor->seq;
+	}
+
+	while (queue->first_seq < limit) {
+		struct rtmp_tag *tag;
+		circlebuf_pop_front(&queue->tags, &tag, sizeof(tag));
+		rtmp_tag_release(tag);
+		queue->first_seq++;
+	}
+}
+
+bool rtmp_tag_queue_init(struct rtmp_tag_queue *queue, int64_t max_usec)
+{
+	memset(queue, 0, sizeof(*queue));
+	queue->max_usec = max_usec;
+	return pthread_mutex_init(&queue->mutex, NULL) == 0;
+}
+
+void rtmp_tag_queue_free(struct rtmp_tag_queue *queue)
+{
+	rtmp_tag_queue_clear(queue);
+	circlebuf_free(&queue->tags);
+	da_free(queue->cursors);
+	pthread_mutex_destroy(&queue->mutex);
+}
+
+void rtmp_tag_queue_clear(struct rtmp_tag_queue *queue)
+{
+	pthread_mutex_lock(&queue->mutex);
+
+	while (queue->tags.size) {
+		struct rtmp_tag *tag;
+		circlebuf_pop_front(&queue->tags, &tag, sizeof(tag));
+		rtmp_tag_release(tag);
+		queue->first_seq++;
+	}
+
+	queue->has_keyframe = false;
+
+	for (size_t i = 0; i < queue->cursors.num; i++)
+		queue->cursors.array[i]->seq = queue->first_seq;
+
+	pthread_mutex_unlock(&queue->mutex);
+}
+
+void rtmp_tag_queue_push(struct rtmp_tag_queue *queue, struct rtmp_tag *tag)
+{
+	pthread_mutex_lock(&queue->mutex);
+
+	if (tag->packet.type == OBS_ENCODER_VIDEO && tag->packet.keyframe) {
+		queue->keyframe_seq = rtmp_tag_queue_end(queue);
+		queue->has_keyframe = true;
+	}
+
+	circlebuf_push_back(&queue->tags, &tag, sizeof(tag));
+
+	for (size_t i = 0; i < queue->cursors.num; i++) {
+		struct rtmp_tag_cursor *cursor = queue->cursors.array[i];
+		if (buffered_usec(queue, cursor) > queue->max_usec)
+			cursor->skipped_frames +=
+				skip_to_keyframe(queue, cursor);
+	}
+
+	trim(queue);
+	pthread_mutex_unlock(&queue->mutex);
+}
+
+void rtmp_tag_queue_attach(struct rtmp_tag_queue *queue,
+			   struct rtmp_tag_cursor *cursor)
+{
+	pthread_mutex_lock(&queue->mutex);
+
+	if (!cursor->attached) {
+		cursor->attached = true;
+		da_push_back(queue->cursors, &cursor);
+	}
+
+	cursor->seq = queue->has_keyframe ? queue->keyframe_seq
+					  : rtmp_tag_queue_end(queue);
+
+	pthread_mutex_unlock(&queue->mutex);
+}
+
+void rtmp_tag_queue_detach(struct rtmp_tag_queue *queue,
+			   struct rtmp_tag_cursor *cursor)
+{
+	pthread_mutex_lock(&queue->mutex);
+
+	if (cursor->attached) {
+		cursor->attached = false;
+		da_erase_item(queue->cursors, &cursor);
+		trim(queue);
+	}
+
+	pthread_mutex_unlock(&queue->mutex);
+}
+
+struct rtmp_tag *rtmp_tag_queue_next(struct rtmp_tag_queue *queue,
+				     struct rtmp_tag_cursor *cursor)
+{
+	struct rtmp_tag *tag = NULL;
+
+	pthread_mutex_lock(&queue->mutex);
+
+	if (cursor->attached && cursor->seq < rtmp_tag_queue_end(queue)) {
+		tag = tag_at(queue, cursor->seq++);
+		rtmp_tag_addref(tag);
+	}
+
+	pthread_mutex_unlock(&queue->mutex);
+	return tag;
+}
+
+long rtmp_tag_queue_skip(struct rtmp_tag_queue *queue,
+			 struct rtmp_tag_cursor *cursor)
+{
+	long skipped = 0;
+
+	pthread_mutex_lock(&queue->mutex);
+	if (cursor->attached) {
+		skipped = skip_to_keyframe(queue, cursor);
+		trim(queue);
+	}
+	pthread_mutex_unlock(&queue->mutex);
+
+	return skipped;
+}
+
+int64_t rtmp_tag_queue_buffered_usec(struct rtmp_tag_queue *queue,
+				     struct rtmp_tag_cursor *cursor)
+{
+	int64_t usec = 0;
+
+	pthread_mutex_lock(&queue->mutex);
+	if (cursor->attached)
+		usec = buffered_usec(queue, cursor);
+	pthread_mutex_unlock(&queue->mutex);
+
+	return usec;
+}
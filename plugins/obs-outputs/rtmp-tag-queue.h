@@ -0,0 +1,112 @@
+#pragma once
+
+#include <obs.h>
+#include <util/circlebuf.h>
+#include <util/darray.h>
+#include <util/threading.h>
+
+/*
+ *   Shared queue of muxed FLV tags for sending the same stream to several
+ * destinations.
+ *
+ *   Each packet is muxed once into an rtmp_tag, which keeps a reference to
+ * the encoder packet for its payload and only stores the tag header and
+ * trailer itself.  Every destination reads the queue through its own
+ * cursor, and takes a reference to the tags it is sending so that it never
+ * holds the queue lock while writing to its socket.
+ *
+ *   Tags stay in the queue until every attached cursor has read them, but
+ * the queue never keeps more than max_usec of data for a single cursor:
+ * a cursor that falls that far behind is moved forward to the newest
+ * keyframe, so one stalled destination cannot hold the memory of all of
+ * them.  With no cursors attached, only the tags from the newest keyframe
+ * onward are kept, which is where a newly attached cursor starts.
+ */
+
+struct rtmp_tag {
+	volatile long refs;
+	struct encoder_packet packet;
+	int32_t timestamp;
+
+	size_t header_size;
+	size_t trailer_size;
+	uint8_t data[];
+};
+
+static inline const uint8_t *rtmp_tag_header(const struct rtmp_tag *tag)
+{
+	return tag->data;
+}
+
+static inline const uint8_t *rtmp_tag_trailer(const struct rtmp_tag *tag)
+{
+	return tag->data + tag->header_size;
+}
+
+static inline size_t rtmp_tag_size(const struct rtmp_tag *tag)
+{
+	return tag->header_size + tag->packet.size + tag->trailer_size;
+}
+
+/* takes ownership of the packet reference */
+extern struct rtmp_tag *rtmp_tag_create(struct encoder_packet *packet,
+					const uint8_t *header,
+					size_t header_size,
+					const uint8_t *trailer,
+					size_t trailer_size);
+extern void rtmp_tag_addref(struct rtmp_tag *tag);
+extern void rtmp_tag_release(struct rtmp_tag *tag);
+
+struct rtmp_tag_cursor {
+	uint64_t seq;
+	bool attached;
+
+	/* video frames skipped by the queue because the cursor fell behind */
+	long skipped_frames;
+};
+
+struct rtmp_tag_queue {
+	pthread_mutex_t mutex;
+	struct circlebuf tags;
+	uint64_t first_seq;
+	uint64_t keyframe_seq;
+	bool has_keyframe;
+	int64_t max_usec;
+
+	DARRAY(struct rtmp_tag_cursor *) cursors;
+};
+
+static inline uint64_t rtmp_tag_queue_end(const struct rtmp_tag_queue *queue)
+{
+	return queue->first_seq + queue->tags.size / sizeof(struct rtmp_tag *);
+}
+
+extern bool rtmp_tag_queue_init(struct rtmp_tag_queue *queue,
+				int64_t max_usec);
+extern void rtmp_tag_queue_free(struct rtmp_tag_queue *queue);
+
+/* releases every tag, keeping cursors attached */
+extern void rtmp_tag_queue_clear(struct rtmp_tag_queue *queue);
+
+/* takes ownership of the tag reference */
+extern void rtmp_tag_queue_push(struct rtmp_tag_queue *queue,
+				struct rtmp_tag *tag);
+
+/* starts reading from the newest keyframe */
+extern void rtmp_tag_queue_attach(struct rtmp_tag_queue *queue,
+				  struct rtmp_tag_cursor *cursor);
+extern void rtmp_tag_queue_detach(struct rtmp_tag_queue *queue,
+				  struct rtmp_tag_cursor *cursor);
+
+/* returns a new reference to the next tag, or NULL if there is none */
+extern struct rtmp_tag *rtmp_tag_queue_next(struct rtmp_tag_queue *queue,
+					    struct rtmp_tag_cursor *cursor);
+
+/* moves the cursor forward to the newest keyframe, returns the number of
+ * video frames skipped */
+extern long rtmp_tag_queue_skip(struct rtmp_tag_queue *queue,
+				struct rtmp_tag_cursor *cursor);
+
+/* duration of the tags the cursor has yet to read */
+extern int64_t rtmp_tag_queue_buffered_usec(struct rtmp_tag_queue *queue,
+					    struct rtmp_tag_cursor *cursor);
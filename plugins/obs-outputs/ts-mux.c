@@ -0,0 +1,358 @@
+#include "ts-mux.h"
+
+#include <util/bmem.h>
+
+#define TS_SYNC_BYTE 0x47
+#define TS_PAYLOAD_SIZE (TS_PACKET_SIZE - 4)
+
+#define STREAM_TYPE_H264 0x1B
+#define STREAM_TYPE_AAC 0x0F
+#define STREAM_ID_VIDEO 0xE0
+#define STREAM_ID_AUDIO 0xC0
+
+/* 90 kHz clock */
+#define TS_CLOCK 90000LL
+#define TS_MASK 0x1FFFFFFFFLL
+#define PSI_INTERVAL (TS_CLOCK / 10)
+
+/* the first timestamp is moved to one second in, so that audio starting
+ * before video and b-frame PTS never go negative */
+#define START_OFFSET TS_CLOCK
+#define PCR_DELAY (TS_CLOCK / 10)
+
+static const uint8_t access_unit_delimiter[] = {0, 0, 0, 1, 0x09, 0xF0};
+
+static const uint32_t aac_sample_rates[] = {96000, 88200, 64000, 48000,
+					    44100, 32000, 24000, 22050,
+					    16000, 12000, 11025, 8000,
+					    7350};
+
+static uint32_t crc32_mpeg(const uint8_t *data, size_t size)
+{
+	uint32_t crc = 0xFFFFFFFF;
+
+	for (size_t i = 0; i < size; i++) {
+		crc ^= (uint32_t)data[i] << 24;
+		for (int bit = 0; bit < 8; bit++)
+			crc = (crc & 0x80000000) ? (crc << 1) ^ 0x04C11DB7
+						 : crc << 1;
+	}
+
+	return crc;
+}
+
+void ts_mux_init(struct ts_mux *mux, ts_mux_write_cb write, void *param)
+{
+	memset(mux, 0, sizeof(*mux));
+	mux->write = write;
+	mux->param = param;
+}
+
+void ts_mux_free(struct ts_mux *mux)
+{
+	da_free(mux->video_header);
+	da_free(mux->pes);
+	da_free(mux->out);
+}
+
+void ts_mux_set_video_header(struct ts_mux *mux, const uint8_t *data,
+			     size_t size)
+{
+	da_copy_array(mux->video_header, data, size);
+}
+
+bool ts_mux_set_audio_header(struct ts_mux *mux, const uint8_t *data,
+			     size_t size)
+{
+	uint8_t profile, freq_idx, channels;
+
+	if (size < 2)
+		return false;
+
+	profile = data[0] >> 3;
+	freq_idx = ((data[0] & 0x7) << 1) | (data[1] >> 7);
+	channels = (data[1] >> 3) & 0xF;
+
+	/* ADTS can only signal the first four profiles and indexed rates */
+	if (!profile || profile > 4 ||
+	    freq_idx >= sizeof(aac_sample_rates) / sizeof(aac_sample_rates[0]))
+		return false;
+
+	mux->has_audio = true;
+	mux->aac_profile = profile;
+	mux->aac_freq_idx = freq_idx;
+	mux->aac_channels = channels;
+	return true;
+}
+
+/* ------------------------------------------------------------------------- */
+
+static uint8_t *new_ts_packet(struct ts_mux *mux)
+{
+	size_t pos = mux->out.num;
+
+	da_resize(mux->out, pos + TS_PACKET_SIZE);
+	return mux->out.array + pos;
+}
+
+static inline void write_ts_header(uint8_t *p, uint16_t pid, bool start,
+				   bool adaptation, uint8_t *cc)
+{
+	p[0] = TS_SYNC_BYTE;
+	p[1] = (start ? 0x40 : 0) | ((pid >> 8) & 0x1F);
+	p[2] = pid & 0xFF;
+	p[3] = (adaptation ? 0x30 : 0x10) | (*cc & 0xF);
+	*cc = (*cc + 1) & 0xF;
+}
+
+static void write_psi(struct ts_mux *mux, uint16_t pid, uint8_t *cc,
+		      const uint8_t *section, size_t size)
+{
+	uint8_t *p = new_ts_packet(mux);
+
+	write_ts_header(p, pid, true, false, cc);
+	p[4] = 0; /* pointer field */
+	memcpy(p + 5, section, size);
+	memset(p + 5 + size, 0xFF, TS_PACKET_SIZE - 5 - size);
+}
+
+static size_t finish_section(uint8_t *section, size_t size)
+{
+	uint32_t crc;
+
+	/* section_length counts everything after it, CRC included */
+	section[1] = 0xB0 | (uint8_t)(((size + 4 - 3) >> 8) & 0x0F);
+	section[2] = (uint8_t)(size + 4 - 3);
+
+	crc = crc32_mpeg(section, size);
+	section[size++] = (uint8_t)(crc >> 24);
+	section[size++] = (uint8_t)(crc >> 16);
+	section[size++] = (uint8_t)(crc >> 8);
+	section[size++] = (uint8_t)crc;
+	return size;
+}
+
+static void write_pat_pmt(struct ts_mux *mux)
+{
+	uint8_t section[64];
+	size_t size = 0;
+
+	/* PAT */
+	section[size++] = 0x00;
+	size += 2;
+	section[size++] = 0x00; /* transport stream id */
+	section[size++] = 0x01;
+	section[size++] = 0xC1; /* version 0, current */
+	section[size++] = 0x00;
+	section[size++] = 0x00;
+	section[size++] = 0x00; /* program 1 */
+	section[size++] = 0x01;
+	section[size++] = 0xE0 | (TS_PID_PMT >> 8);
+	section[size++] = TS_PID_PMT & 0xFF;
+	size = finish_section(section, size);
+	write_psi(mux, 0, &mux->cc_pat, section, size);
+
+	/* PMT */
+	size = 0;
+	section[size++] = 0x02;
+	size += 2;
+	section[size++] = 0x00; /* program 1 */
+	section[size++] = 0x01;
+	section[size++] = 0xC1;
+	section[size++] = 0x00;
+	section[size++] = 0x00;
+	section[size++] = 0xE0 | (TS_PID_VIDEO >> 8); /* PCR PID */
+	section[size++] = TS_PID_VIDEO & 0xFF;
+	section[size++] = 0xF0; /* no program info */
+	section[size++] = 0x00;
+
+	section[size++] = STREAM_TYPE_H264;
+	section[size++] = 0xE0 | (TS_PID_VIDEO >> 8);
+	section[size++] = TS_PID_VIDEO & 0xFF;
+	section[size++] = 0xF0;
+	section[size++] = 0x00;
+
+	if (mux->has_audio) {
+		section[size++] = STREAM_TYPE_AAC;
+		section[size++] = 0xE0 | (TS_PID_AUDIO >> 8);
+		section[size++] = TS_PID_AUDIO & 0xFF;
+		section[size++] = 0xF0;
+		section[size++] = 0x00;
+	}
+
+	size = finish_section(section, size);
+	write_psi(mux, TS_PID_PMT, &mux->cc_pmt, section, size);
+}
+
+static inline void write_timestamp(uint8_t *p, uint8_t marker, int64_t ts)
+{
+	ts &= TS_MASK;
+	p[0] = marker | (uint8_t)((ts >> 29) & 0x0E) | 1;
+	p[1] = (uint8_t)(ts >> 22);
+	p[2] = (uint8_t)((ts >> 14) & 0xFE) | 1;
+	p[3] = (uint8_t)(ts >> 7);
+	p[4] = (uint8_t)((ts << 1) & 0xFE) | 1;
+}
+
+static inline void write_pcr(uint8_t *p, int64_t pcr)
+{
+	pcr &= TS_MASK;
+	p[0] = (uint8_t)(pcr >> 25);
+	p[1] = (uint8_t)(pcr >> 17);
+	p[2] = (uint8_t)(pcr >> 9);
+	p[3] = (uint8_t)(pcr >> 1);
+	p[4] = (uint8_t)((pcr & 1) << 7) | 0x7E;
+	p[5] = 0;
+}
+
+static void begin_pes(struct ts_mux *mux, uint8_t stream_id, int64_t pts,
+		      int64_t dts)
+{
+	bool has_dts = pts != dts;
+	uint8_t *p;
+
+	da_resize(mux->pes, has_dts ? 19 : 14);
+	p = mux->pes.array;
+
+	p[0] = 0;
+	p[1] = 0;
+	p[2] = 1;
+	p[3] = stream_id;
+	p[4] = 0; /* length, filled in for audio */
+	p[5] = 0;
+	p[6] = 0x80;
+	p[7] = has_dts ? 0xC0 : 0x80;
+	p[8] = has_dts ? 10 : 5;
+	write_timestamp(p + 9, has_dts ? 0x30 : 0x20, pts);
+	if (has_dts)
+		write_timestamp(p + 14, 0x10, dts);
+}
+
+static void packetize_pes(struct ts_mux *mux, uint16_t pid, uint8_t *cc,
+			  bool random_access, bool has_pcr, int64_t pcr)
+{
+	const uint8_t *data = mux->pes.array;
+	size_t remaining = mux->pes.num;
+	bool first = true;
+
+	while (remaining) {
+		bool flags = first && (random_access || has_pcr);
+		size_t af_size = flags ? (has_pcr && first ? 8 : 2) : 0;
+		size_t payload = TS_PAYLOAD_SIZE - af_size;
+		uint8_t *p = new_ts_packet(mux);
+
+		if (payload > remaining)
+			payload = remaining;
+
+		/* adaptation field size including its length byte, padded
+		 * with stuffing to fill the packet */
+		af_size = TS_PAYLOAD_SIZE - payload;
+
+		write_ts_header(p, pid, first, af_size > 0, cc);
+
+		if (af_size) {
+			uint8_t *af = p + 4;
+
+			af[0] = (uint8_t)(af_size - 1);
+			if (af_size > 1) {
+				af[1] = 0;
+				if (first && random_access)
+					af[1] |= 0x40;
+				if (first && has_pcr) {
+					af[1] |= 0x10;
+					write_pcr(af + 2, pcr);
+					memset(af + 8, 0xFF, af_size - 8);
+				} else {
+					memset(af + 2, 0xFF, af_size - 2);
+				}
+			}
+		}
+
+		memcpy(p + 4 + af_size, data, payload);
+		data += payload;
+		remaining -= payload;
+		first = false;
+	}
+}
+
+static void mux_video(struct ts_mux *mux, struct encoder_packet *packet,
+		      int64_t pts, int64_t dts)
+{
+	begin_pes(mux, STREAM_ID_VIDEO, pts, dts);
+
+	da_push_back_array(mux->pes, access_unit_delimiter,
+			   sizeof(access_unit_delimiter));
+	if (packet->keyframe)
+		da_push_back_array(mux->pes, mux->video_header.array,
+				   mux->video_header.num);
+	da_push_back_array(mux->pes, packet->data, packet->size);
+
+	packetize_pes(mux, TS_PID_VIDEO, &mux->cc_video, packet->keyframe,
+		      true, dts - PCR_DELAY);
+}
+
+static void mux_audio(struct ts_mux *mux, struct encoder_packet *packet,
+		      int64_t pts)
+{
+	size_t frame_size = packet->size + 7;
+	uint8_t adts[7];
+	size_t pes_size;
+
+	adts[0] = 0xFF;
+	adts[1] = 0xF1;
+	adts[2] = (uint8_t)((mux->aac_profile - 1) << 6) |
+		  (uint8_t)(mux->aac_freq_idx << 2) |
+		  (uint8_t)(mux->aac_channels >> 2);
+	adts[3] = (uint8_t)((mux->aac_channels & 3) << 6) |
+		  (uint8_t)(frame_size >> 11);
+	adts[4] = (uint8_t)(frame_size >> 3);
+	adts[5] = (uint8_t)((frame_size & 7) << 5) | 0x1F;
+	adts[6] = 0xFC;
+
+	begin_pes(mux, STREAM_ID_AUDIO, pts, pts);
+	da_push_back_array(mux->pes, adts, sizeof(adts));
+	da_push_back_array(mux->pes, packet->data, packet->size);
+
+	pes_size = mux->pes.num - 6;
+	if (pes_size <= 0xFFFF) {
+		mux->pes.array[4] = (uint8_t)(pes_size >> 8);
+		mux->pes.array[5] = (uint8_t)pes_size;
+	}
+
+	packetize_pes(mux, TS_PID_AUDIO, &mux->cc_audio, false, false, 0);
+}
+
+void ts_mux_packet(struct ts_mux *mux, struct encoder_packet *packet)
+{
+	bool video = packet->type == OBS_ENCODER_VIDEO;
+	int64_t dts = packet->dts_usec * 9 / 100;
+	int64_t pts;
+
+	if (!video && (!mux->has_audio || packet->track_idx != 0))
+		return;
+
+	if (!mux->has_offset) {
+		mux->ts_offset = START_OFFSET - dts;
+		mux->last_psi = -PSI_INTERVAL;
+		mux->has_offset = true;
+	}
+
+	dts += mux->ts_offset;
+	pts = dts + (packet->pts - packet->dts) * TS_CLOCK *
+			    packet->timebase_num / packet->timebase_den;
+
+	mux->out.num = 0;
+
+	if ((video && packet->keyframe) ||
+	    dts - mux->last_psi >= PSI_INTERVAL) {
+		write_pat_pmt(mux);
+		mux->last_psi = dts;
+	}
+
+	if (video)
+		mux_video(mux, packet, pts, dts);
+	else
+		mux_audio(mux, packet, pts);
+
+	mux->write(mux->param, mux->out.array, mux->out.num);
+}
@@ -0,0 +1,59 @@
+#pragma once
+
+#include <obs.h>
+#include <util/darray.h>
+
+/*
+ *   Minimal MPEG-TS muxer for one H.264 video and one AAC audio stream.
+ *
+ *   Encoder packets go in, and whole 188 byte transport stream packets come
+ * out through the write callback, one call per encoder packet.  PAT and PMT
+ * are repeated before every keyframe and at least every 100 ms, and the PCR
+ * is carried on the video PID.
+ */
+
+#define TS_PACKET_SIZE 188
+
+#define TS_PID_PMT 0x1000
+#define TS_PID_VIDEO 0x100
+#define TS_PID_AUDIO 0x101
+
+typedef void (*ts_mux_write_cb)(void *param, const uint8_t *data,
+				size_t size);
+
+struct ts_mux {
+	ts_mux_write_cb write;
+	void *param;
+
+	uint8_t cc_pat;
+	uint8_t cc_pmt;
+	uint8_t cc_video;
+	uint8_t cc_audio;
+
+	/* annex B SPS/PPS, repeated before every keyframe */
+	DARRAY(uint8_t) video_header;
+
+	bool has_audio;
+	uint8_t aac_profile;
+	uint8_t aac_freq_idx;
+	uint8_t aac_channels;
+
+	bool has_offset;
+	int64_t ts_offset;
+	int64_t last_psi;
+
+	DARRAY(uint8_t) pes;
+	DARRAY(uint8_t) out;
+};
+
+extern void ts_mux_init(struct ts_mux *mux, ts_mux_write_cb write,
+			void *param);
+extern void ts_mux_free(struct ts_mux *mux);
+
+extern void ts_mux_set_video_header(struct ts_mux *mux, const uint8_t *data,
+				    size_t size);
+/* takes an AudioSpecificConfig, returns false if it is not valid */
+extern bool ts_mux_set_audio_header(struct ts_mux *mux, const uint8_t *data,
+				    size_t size);
+
+extern void ts_mux_packet(struct ts_mux *mux, struct encoder_packet *packet);
@@ -0,0 +1,515 @@
+#include "udp-arq.h"
+
+#include <string.h>
+#include <util/bmem.h>
+
+#define ACK_INTERVAL_US 10000
+#define MIN_NACK_INTERVAL_US 5000
+#define MAX_RTT_US 10000000
+
+/* enough for the latency window and a couple of seconds of backlog */
+#define MIN_SENDER_SLOTS 1024
+#define MAX_SENDER_SLOTS 65536
+#define SENDER_HISTORY_US 2000000
+
+struct arq_sender_slot {
+	uint64_t seq;
+	uint64_t sent_us;
+	uint64_t last_sent_us;
+	bool sent;
+	bool queued;
+	uint16_t size;
+	uint8_t data[ARQ_MAX_PAYLOAD];
+};
+
+struct arq_receiver_slot {
+	uint64_t seq;
+	uint64_t detect_us;
+	uint64_t last_nack_us;
+	bool received;
+	bool nacked;
+	uint16_t size;
+	uint8_t data[ARQ_MAX_PAYLOAD];
+};
+
+static inline void write_be16(uint8_t *p, uint16_t val)
+{
+	p[0] = (uint8_t)(val >> 8);
+	p[1] = (uint8_t)val;
+}
+
+static inline void write_be32(uint8_t *p, uint32_t val)
+{
+	p[0] = (uint8_t)(val >> 24);
+	p[1] = (uint8_t)(val >> 16);
+	p[2] = (uint8_t)(val >> 8);
+	p[3] = (uint8_t)val;
+}
+
+static inline uint32_t read_be32(const uint8_t *p)
+{
+	return (uint32_t)p[0] << 24 | (uint32_t)p[1] << 16 |
+	       (uint32_t)p[2] << 8 | (uint32_t)p[3];
+}
+
+static inline void write_header(uint8_t *p, enum arq_type type, uint8_t flags,
+				uint32_t seq, uint32_t timestamp)
+{
+	p[0] = (uint8_t)(ARQ_VERSION << 4) | (uint8_t)type;
+	p[1] = flags;
+	write_be16(p + 2, 0);
+	write_be32(p + 4, seq);
+	write_be32(p + 8, timestamp);
+}
+
+static inline bool read_header(const uint8_t *p, size_t size,
+			       enum arq_type *type)
+{
+	if (size < ARQ_HEADER_SIZE || (p[0] >> 4) != ARQ_VERSION)
+		return false;
+
+	*type = (enum arq_type)(p[0] & 0xF);
+	return true;
+}
+
+/* extends a 32 bit sequence number to 64 bits around a known one */
+static inline bool unwrap_seq(uint32_t seq, uint64_t ref, uint64_t *out)
+{
+	int64_t diff = (int32_t)(seq - (uint32_t)ref);
+
+	if (diff < 0 && (uint64_t)-diff > ref)
+		return false;
+
+	*out = (uint64_t)((int64_t)ref + diff);
+	return true;
+}
+
+static size_t round_up_pow2(size_t val)
+{
+	size_t pow2 = 1;
+	while (pow2 < val)
+		pow2 <<= 1;
+	return pow2;
+}
+
+/* ------------------------------------------------------------------------- */
+/* sender                                                                    */
+
+bool arq_sender_init(struct arq_sender *sender, uint64_t latency_us,
+		     uint64_t max_bytes_per_sec, uint64_t now_us)
+{
+	uint64_t per_sec = max_bytes_per_sec / ARQ_MAX_PAYLOAD + 128;
+	uint64_t count = per_sec * (latency_us + SENDER_HISTORY_US) / 1000000;
+
+	memset(sender, 0, sizeof(*sender));
+
+	if (!max_bytes_per_sec)
+		return false;
+
+	if (count < MIN_SENDER_SLOTS)
+		count = MIN_SENDER_SLOTS;
+	if (count > MAX_SENDER_SLOTS)
+		count = MAX_SENDER_SLOTS;
+
+	sender->capacity = round_up_pow2((size_t)count);
+	sender->slots = bzalloc(sizeof(*sender->slots) * sender->capacity);
+	sender->start_us = now_us;
+	sender->latency_us = latency_us;
+	sender->last_refill = now_us;
+
+	/* allow bursts of up to 5 ms worth of data, but at least a few
+	 * datagrams */
+	sender->bytes_per_us = (double)max_bytes_per_sec / 1000000.0;
+	sender->max_tokens = sender->bytes_per_us * 5000.0;
+	if (sender->max_tokens < ARQ_MAX_DATAGRAM * 4)
+		sender->max_tokens = ARQ_MAX_DATAGRAM * 4;
+	sender->tokens = sender->max_tokens;
+	return true;
+}
+
+void arq_sender_free(struct arq_sender *sender)
+{
+	bfree(sender->slots);
+	circlebuf_free(&sender->retransmits);
+	sender->slots = NULL;
+}
+
+static inline struct arq_sender_slot *sender_slot(struct arq_sender *sender,
+						  uint64_t seq)
+{
+	return &sender->slots[seq & (sender->capacity - 1)];
+}
+
+bool arq_sender_push(struct arq_sender *sender, const uint8_t *data,
+		     size_t size)
+{
+	struct arq_sender_slot *slot;
+
+	if (size > ARQ_MAX_PAYLOAD)
+		return false;
+	if (sender->next_seq - sender->send_seq >= sender->capacity)
+		return false;
+
+	slot = sender_slot(sender, sender->next_seq);
+	slot->seq = sender->next_seq++;
+	slot->sent = false;
+	slot->queued = false;
+	slot->size = (uint16_t)size;
+	memcpy(slot->data, data, size);
+
+	sender->pending_bytes += ARQ_HEADER_SIZE + size;
+	return true;
+}
+
+static inline bool can_retransmit(struct arq_sender *sender,
+				  struct arq_sender_slot *slot, uint64_t seq,
+				  uint64_t now_us)
+{
+	return slot->seq == seq && slot->sent &&
+	       now_us - slot->sent_us <= sender->latency_us;
+}
+
+size_t arq_sender_next(struct arq_sender *sender, uint64_t now_us,
+		       uint8_t *buf, uint64_t *wait_us)
+{
+	struct arq_sender_slot *slot = NULL;
+	bool retransmit = false;
+	size_t size;
+
+	sender->tokens +=
+		(double)(now_us - sender->last_refill) * sender->bytes_per_us;
+	if (sender->tokens > sender->max_tokens)
+		sender->tokens = sender->max_tokens;
+	sender->last_refill = now_us;
+
+	/* retransmissions go first, as long as they can still make it */
+	while (sender->retransmits.size) {
+		uint64_t seq;
+		circlebuf_peek_front(&sender->retransmits, &seq, sizeof(seq));
+
+		slot = sender_slot(sender, seq);
+		if (can_retransmit(sender, slot, seq, now_us)) {
+			retransmit = true;
+			break;
+		}
+
+		slot->queued = slot->seq == seq ? false : slot->queued;
+		circlebuf_pop_front(&sender->retransmits, NULL, sizeof(seq));
+		slot = NULL;
+	}
+
+	if (!slot && sender->send_seq < sender->next_seq)
+		slot = sender_slot(sender, sender->send_seq);
+
+	if (!slot) {
+		*wait_us = UINT64_MAX;
+		return 0;
+	}
+
+	size = ARQ_HEADER_SIZE + slot->size;
+	if (sender->tokens < (double)size) {
+		*wait_us = (uint64_t)(((double)size - sender->tokens) /
+				      sender->bytes_per_us) +
+			   1;
+		return 0;
+	}
+
+	sender->tokens -= (double)size;
+	*wait_us = 0;
+
+	write_header(buf, ARQ_DATA, retransmit ? ARQ_FLAG_RETRANSMIT : 0,
+		     (uint32_t)slot->seq,
+		     (uint32_t)(now_us - sender->start_us));
+	memcpy(buf + ARQ_HEADER_SIZE, slot->data, slot->size);
+
+	if (retransmit) {
+		circlebuf_pop_front(&sender->retransmits, NULL,
+				    sizeof(uint64_t));
+		slot->queued = false;
+		sender->packets_retransmitted++;
+	} else {
+		slot->sent = true;
+		slot->sent_us = now_us;
+		sender->send_seq++;
+		sender->pending_bytes -= size;
+	}
+
+	slot->last_sent_us = now_us;
+	sender->packets_sent++;
+	sender->bytes_sent += size;
+	return size;
+}
+
+static void sender_handle_ack(struct arq_sender *sender, uint64_t now_us,
+			      const uint8_t *payload, size_t size)
+{
+	uint32_t now = (uint32_t)(now_us - sender->start_us);
+	uint32_t rtt;
+
+	if (size < 8)
+		return;
+
+	rtt = now - read_be32(payload) - read_be32(payload + 4);
+	if (rtt > MAX_RTT_US)
+		return;
+
+	sender->rtt_us = sender->rtt_us ? (sender->rtt_us * 7 + rtt) / 8 : rtt;
+	sender->last_ack_us = now_us;
+}
+
+static void sender_handle_nack(struct arq_sender *sender, uint64_t now_us,
+			       const uint8_t *payload, size_t size)
+{
+	sender->nacks_received++;
+
+	for (; size >= 8; payload += 8, size -= 8) {
+		uint32_t count = read_be32(payload + 4);
+		uint64_t first;
+
+		if (!unwrap_seq(read_be32(payload), sender->send_seq, &first))
+			continue;
+		if (count > sender->capacity)
+			count = (uint32_t)sender->capacity;
+
+		for (uint64_t seq = first; seq < first + count; seq++) {
+			struct arq_sender_slot *slot = sender_slot(sender, seq);
+
+			if (slot->queued ||
+			    !can_retransmit(sender, slot, seq, now_us))
+				continue;
+
+			/* the last copy may well still be on its way */
+			if (now_us - slot->last_sent_us < sender->rtt_us)
+				continue;
+
+			slot->queued = true;
+			circlebuf_push_back(&sender->retransmits, &seq,
+					    sizeof(seq));
+		}
+	}
+}
+
+void arq_sender_receive(struct arq_sender *sender, uint64_t now_us,
+			const uint8_t *buf, size_t size)
+{
+	enum arq_type type;
+
+	if (!read_header(buf, size, &type))
+		return;
+
+	if (type == ARQ_ACK)
+		sender_handle_ack(sender, now_us, buf + ARQ_HEADER_SIZE,
+				  size - ARQ_HEADER_SIZE);
+	else if (type == ARQ_NACK)
+		sender_handle_nack(sender, now_us, buf + ARQ_HEADER_SIZE,
+				   size - ARQ_HEADER_SIZE);
+}
+
+/* ------------------------------------------------------------------------- */
+/* receiver                                                                  */
+
+bool arq_receiver_init(struct arq_receiver *receiver, uint64_t latency_us,
+		       size_t capacity)
+{
+	memset(receiver, 0, sizeof(*receiver));
+
+	if (!capacity)
+		return false;
+
+	receiver->capacity = round_up_pow2(capacity);
+	receiver->slots =
+		bzalloc(sizeof(*receiver->slots) * receiver->capacity);
+	receiver->latency_us = latency_us;
+	receiver->nack_interval_us = latency_us / 4;
+	if (receiver->nack_interval_us < MIN_NACK_INTERVAL_US)
+		receiver->nack_interval_us = MIN_NACK_INTERVAL_US;
+	return true;
+}
+
+void arq_receiver_free(struct arq_receiver *receiver)
+{
+	bfree(receiver->slots);
+	receiver->slots = NULL;
+}
+
+static inline struct arq_receiver_slot *
+receiver_slot(struct arq_receiver *receiver, uint64_t seq)
+{
+	return &receiver->slots[seq & (receiver->capacity - 1)];
+}
+
+/* makes room for seq by giving up on the oldest holes */
+static void receiver_advance(struct arq_receiver *receiver, uint64_t seq)
+{
+	uint64_t next = seq - receiver->capacity + 1;
+
+	for (uint64_t s = receiver->next_seq; s < next; s++) {
+		if (s >= receiver->end_seq ||
+		    !receiver_slot(receiver, s)->received)
+			receiver->packets_lost++;
+	}
+
+	receiver->next_seq = next;
+	if (receiver->end_seq < next)
+		receiver->end_seq = next;
+}
+
+void arq_receiver_receive(struct arq_receiver *receiver, uint64_t now_us,
+			  const uint8_t *buf, size_t size)
+{
+	struct arq_receiver_slot *slot;
+	enum arq_type type;
+	uint64_t seq;
+
+	if (!read_header(buf, size, &type) || type != ARQ_DATA)
+		return;
+	if (size - ARQ_HEADER_SIZE > ARQ_MAX_PAYLOAD)
+		return;
+
+	if (!receiver->started) {
+		receiver->started = true;
+		receiver->next_seq = read_be32(buf + 4);
+		receiver->end_seq = receiver->next_seq;
+	}
+
+	if (!unwrap_seq(read_be32(buf + 4), receiver->end_seq, &seq))
+		return;
+
+	receiver->last_timestamp = read_be32(buf + 8);
+	receiver->last_timestamp_us = now_us;
+	receiver->ack_pending = true;
+
+	if (seq < receiver->next_seq) {
+		receiver->packets_duplicate++;
+		return;
+	}
+
+	if (seq >= receiver->end_seq) {
+		if (seq - receiver->next_seq >= receiver->capacity)
+			receiver_advance(receiver, seq);
+
+		for (uint64_t s = receiver->end_seq; s < seq; s++) {
+			slot = receiver_slot(receiver, s);
+			slot->seq = s;
+			slot->received = false;
+			slot->nacked = false;
+			slot->detect_us = now_us;
+		}
+
+		receiver->end_seq = seq + 1;
+		slot = receiver_slot(receiver, seq);
+		slot->seq = seq;
+
+	} else {
+		slot = receiver_slot(receiver, seq);
+		if (slot->seq != seq || slot->received) {
+			receiver->packets_duplicate++;
+			return;
+		}
+
+		receiver->packets_recovered++;
+	}
+
+	slot->received = true;
+	slot->size = (uint16_t)(size - ARQ_HEADER_SIZE);
+	memcpy(slot->data, buf + ARQ_HEADER_SIZE, slot->size);
+	receiver->packets_received++;
+}
+
+size_t arq_receiver_read(struct arq_receiver *receiver, uint64_t now_us,
+			 uint8_t *data)
+{
+	while (receiver->next_seq < receiver->end_seq) {
+		struct arq_receiver_slot *slot =
+			receiver_slot(receiver, receiver->next_seq);
+
+		if (slot->received) {
+			memcpy(data, slot->data, slot->size);
+			receiver->next_seq++;
+			return slot->size;
+		}
+
+		if (now_us - slot->detect_us < receiver->latency_us)
+			break;
+
+		receiver->packets_lost++;
+		receiver->next_seq++;
+	}
+
+	return 0;
+}
+
+static size_t build_nack(struct arq_receiver *receiver, uint64_t now_us,
+			 uint8_t *buf)
+{
+	uint8_t *ranges = buf + ARQ_HEADER_SIZE;
+	size_t count = 0;
+	uint64_t first = 0;
+	uint32_t length = 0;
+
+	for (uint64_t seq = receiver->next_seq; seq < receiver->end_seq;
+	     seq++) {
+		struct arq_receiver_slot *slot = receiver_slot(receiver, seq);
+		bool due = !slot->received &&
+			   now_us - slot->detect_us < receiver->latency_us &&
+			   (!slot->nacked ||
+			    now_us - slot->last_nack_us >=
+				    receiver->nack_interval_us);
+
+		if (due && length && first + length == seq) {
+			length++;
+		} else if (due) {
+			if (length) {
+				write_be32(ranges + count * 8, (uint32_t)first);
+				write_be32(ranges + count * 8 + 4, length);
+				if (++count == ARQ_MAX_NACK_RANGES) {
+					length = 0;
+					break;
+				}
+			}
+			first = seq;
+			length = 1;
+		} else {
+			continue;
+		}
+
+		slot->nacked = true;
+		slot->last_nack_us = now_us;
+	}
+
+	if (length) {
+		write_be32(ranges + count * 8, (uint32_t)first);
+		write_be32(ranges + count * 8 + 4, length);
+		count++;
+	}
+
+	if (!count)
+		return 0;
+
+	write_header(buf, ARQ_NACK, 0, (uint32_t)receiver->next_seq, 0);
+	return ARQ_HEADER_SIZE + count * 8;
+}
+
+size_t arq_receiver_control(struct arq_receiver *receiver, uint64_t now_us,
+			    uint8_t *buf)
+{
+	size_t size = build_nack(receiver, now_us, buf);
+	uint32_t held;
+
+	if (size)
+		return size;
+
+	if (!receiver->ack_pending ||
+	    now_us - receiver->last_ack_us < ACK_INTERVAL_US)
+		return 0;
+
+	held = (uint32_t)(now_us - receiver->last_timestamp_us);
+
+	write_header(buf, ARQ_ACK, 0, (uint32_t)receiver->next_seq, 0);
+	write_be32(buf + ARQ_HEADER_SIZE, receiver->last_timestamp);
+	write_be32(buf + ARQ_HEADER_SIZE + 4, held);
+
+	receiver->last_ack_us = now_us;
+	receiver->ack_pending = false;
+	return ARQ_HEADER_SIZE + 8;
+}
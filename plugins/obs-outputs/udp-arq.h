@@ -0,0 +1,146 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <util/circlebuf.h>
+
+/*
+ *   Loss recovery for a stream of datagrams, in the style of SRT and RIST.
+ *
+ *   The sender numbers every datagram and keeps it around for the latency
+ * window.  The receiver reports the holes in the sequence with NACKs, which
+ * the sender answers with retransmissions for as long as they can still
+ * arrive in time, and it regularly sends ACKs which also measure the RTT.
+ * Fresh data is paced out at a fixed maximum rate instead of in bursts, so
+ * that keyframes do not overrun shallow router queues.
+ *
+ *   Neither side touches sockets or clocks: datagrams are passed in and
+ * out as buffers, and every call takes the current time, so the exact same
+ * code can run over a real socket or a simulated link.
+ *
+ *   Wire format, all fields big endian:
+ *
+ *     0  version (4 bits), type (4 bits)
+ *     1  flags
+ *     2  reserved (16 bits)
+ *     4  sequence number (32 bits)
+ *     8  sender timestamp in microseconds (32 bits)
+ *    12  payload
+ *
+ *   DATA carries up to ARQ_MAX_PAYLOAD bytes.  ACK carries the next
+ * sequence number the receiver is waiting for in the sequence field, and
+ * the last sender timestamp it saw plus how long it held on to it as its
+ * payload.  NACK carries up to ARQ_MAX_NACK_RANGES pairs of first missing
+ * sequence number and count.
+ */
+
+#define ARQ_VERSION 1
+#define ARQ_HEADER_SIZE 12
+#define ARQ_MAX_PAYLOAD 1316
+#define ARQ_MAX_DATAGRAM (ARQ_HEADER_SIZE + ARQ_MAX_PAYLOAD)
+#define ARQ_MAX_NACK_RANGES ((ARQ_MAX_DATAGRAM - ARQ_HEADER_SIZE) / 8)
+
+#define ARQ_FLAG_RETRANSMIT 0x01
+
+enum arq_type {
+	ARQ_DATA = 0,
+	ARQ_ACK = 1,
+	ARQ_NACK = 2,
+};
+
+struct arq_sender_slot;
+struct arq_receiver_slot;
+
+struct arq_sender {
+	uint64_t start_us;
+	uint64_t latency_us;
+
+	struct arq_sender_slot *slots;
+	size_t capacity;
+	uint64_t next_seq;
+	uint64_t send_seq;
+	size_t pending_bytes;
+	struct circlebuf retransmits;
+
+	/* pacing */
+	double bytes_per_us;
+	double tokens;
+	double max_tokens;
+	uint64_t last_refill;
+
+	uint32_t rtt_us;
+	uint64_t last_ack_us;
+
+	uint64_t packets_sent;
+	uint64_t packets_retransmitted;
+	uint64_t bytes_sent;
+	uint64_t nacks_received;
+};
+
+/* max_bytes_per_sec is the pacing rate, retransmissions included */
+extern bool arq_sender_init(struct arq_sender *sender, uint64_t latency_us,
+			    uint64_t max_bytes_per_sec, uint64_t now_us);
+extern void arq_sender_free(struct arq_sender *sender);
+
+/* queues a payload for sending, returns false if the history is full of
+ * data that has not even been sent yet */
+extern bool arq_sender_push(struct arq_sender *sender, const uint8_t *data,
+			    size_t size);
+
+/* builds the next datagram to send into buf and returns its size.  returns
+ * 0 if there is nothing that may be sent right now, with wait_us set to how
+ * long until there might be. */
+extern size_t arq_sender_next(struct arq_sender *sender, uint64_t now_us,
+			      uint8_t *buf, uint64_t *wait_us);
+
+/* handles an ACK or NACK from the receiver */
+extern void arq_sender_receive(struct arq_sender *sender, uint64_t now_us,
+			       const uint8_t *buf, size_t size);
+
+/* how long the fresh data still waiting to be paced out will take */
+static inline uint64_t arq_sender_backlog_us(const struct arq_sender *sender)
+{
+	return (uint64_t)((double)sender->pending_bytes / sender->bytes_per_us);
+}
+
+struct arq_receiver {
+	uint64_t latency_us;
+	uint64_t nack_interval_us;
+
+	struct arq_receiver_slot *slots;
+	size_t capacity;
+	bool started;
+	uint64_t next_seq;
+	uint64_t end_seq;
+
+	uint32_t last_timestamp;
+	uint64_t last_timestamp_us;
+	uint64_t last_ack_us;
+	bool ack_pending;
+
+	uint64_t packets_received;
+	uint64_t packets_recovered;
+	uint64_t packets_lost;
+	uint64_t packets_duplicate;
+};
+
+extern bool arq_receiver_init(struct arq_receiver *receiver,
+			      uint64_t latency_us, size_t capacity);
+extern void arq_receiver_free(struct arq_receiver *receiver);
+
+/* handles a DATA datagram from the sender */
+extern void arq_receiver_receive(struct arq_receiver *receiver,
+				 uint64_t now_us, const uint8_t *buf,
+				 size_t size);
+
+/* copies the next payload in sequence into data and returns its size, or
+ * returns 0 if it has not arrived yet.  payloads that could not be
+ * recovered within the latency window are skipped. */
+extern size_t arq_receiver_read(struct arq_receiver *receiver, uint64_t now_us,
+				uint8_t *data);
+
+/* builds the next ACK or NACK to send back into buf and returns its size,
+ * or 0 if there is nothing to send right now */
+extern size_t arq_receiver_control(struct arq_receiver *receiver,
+				   uint64_t now_us, uint8_t *buf);
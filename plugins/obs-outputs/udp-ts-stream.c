@@ -0,0 +1,765 @@
+#include <obs-module.h>
+#include <inttypes.h>
+#include <util/dstr.h>
+#include <util/platform.h>
+#include <util/threading.h>
+#include "ts-mux.h"
+#include "udp-arq.h"
+
+#ifdef _WIN32
+#include <winsock2.h>
+#include <ws2tcpip.h>
+typedef SOCKET socket_t;
+#define INVALID_SOCK INVALID_SOCKET
+#define close_socket closesocket
+#define socket_error() WSAGetLastError()
+#define SOCK_WOULDBLOCK WSAEWOULDBLOCK
+#else
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/select.h>
+#include <sys/ioctl.h>
+#include <netinet/in.h>
+#include <netdb.h>
+#include <unistd.h>
+#include <errno.h>
+typedef int socket_t;
+#define INVALID_SOCK -1
+#define close_socket close
+#define socket_error() errno
+#define SOCK_WOULDBLOCK EWOULDBLOCK
+#endif
+
+/*
+ *   MPEG-TS over UDP with ARQ loss recovery.
+ *
+ *   Packets are muxed to MPEG-TS on the data thread and grouped into
+ * datagrams of up to seven TS packets, which are handed to the ARQ sender.
+ * The send thread paces them out, answers NACKs from the receiver with
+ * retransmissions within the latency window, and tracks the RTT from ACKs.
+ * Unlike RTMP, a lost packet only ever delays the stream by the latency
+ * window instead of stalling the whole connection.
+ */
+
+#define do_log(level, format, ...)                  \
+	blog(level, "[udp ts stream: '%s'] " format, \
+	     obs_output_get_name(stream->output), ##__VA_ARGS__)
+
+#define warn(format, ...) do_log(LOG_WARNING, format, ##__VA_ARGS__)
+#define info(format, ...) do_log(LOG_INFO, format, ##__VA_ARGS__)
+
+#define OPT_URL "url"
+#define OPT_LATENCY "latency_ms"
+#define OPT_PACING_OVERHEAD "pacing_overhead_percent"
+#define OPT_DROP_THRESHOLD "drop_threshold_ms"
+#define OPT_MAX_SHUTDOWN_TIME_SEC "max_shutdown_time_sec"
+
+/* newly queued data wakes the send thread, so it only sleeps this long to
+ * check the shutdown timeout, or without a wake socket to poll for data */
+#define MAX_WAIT_US 100000ULL
+#define POLL_WAIT_US 2000ULL
+#define MIN_PACING_BYTES_PER_SEC (1000000 / 8)
+
+struct udp_ts_stream {
+	obs_output_t *output;
+
+	pthread_mutex_t mutex;
+	struct ts_mux mux;
+	struct arq_sender sender;
+	bool ready;
+
+	uint8_t datagram[ARQ_MAX_PAYLOAD];
+	size_t datagram_size;
+
+	pthread_t send_thread;
+	bool thread_created;
+	volatile bool active;
+	volatile bool encode_error;
+	volatile bool flushed;
+	os_event_t *stop_event;
+	uint64_t stop_ts;
+	uint64_t shutdown_timeout_ts;
+
+	struct dstr url;
+	socket_t sock;
+	socket_t wake_sock;
+	bool wake_pending;
+	uint64_t latency_us;
+	uint64_t drop_threshold_us;
+	int pacing_overhead;
+	int max_shutdown_time_sec;
+
+	bool dropping;
+	int dropped_frames;
+	int dropped_datagrams;
+};
+
+static const char *udp_ts_stream_getname(void *unused)
+{
+	UNUSED_PARAMETER(unused);
+	return obs_module_text("UDPTSStream");
+}
+
+static inline bool stopping(struct udp_ts_stream *stream)
+{
+	return os_event_try(stream->stop_event) != EAGAIN;
+}
+
+static inline bool active(struct udp_ts_stream *stream)
+{
+	return os_atomic_load_bool(&stream->active);
+}
+
+static inline uint64_t now_us(void)
+{
+	return os_gettime_ns() / 1000;
+}
+
+/* the send thread also has to wait for ACKs and NACKs, which an os_event
+ * can't be selected on together with, so it's woken through a loopback
+ * socket connected to itself instead */
+static void wake_send_thread(struct udp_ts_stream *stream)
+{
+	char byte = 0;
+
+	if (stream->wake_sock != INVALID_SOCK)
+		send(stream->wake_sock, &byte, 1, 0);
+}
+
+/* ------------------------------------------------------------------------- */
+/* muxing, on the data thread                                                */
+
+static void flush_datagram(struct udp_ts_stream *stream)
+{
+	if (!stream->datagram_size)
+		return;
+
+	if (arq_sender_push(&stream->sender, stream->datagram,
+			    stream->datagram_size)) {
+		if (stream->dropped_datagrams) {
+			info("Send buffer has room again, dropped %d "
+			     "datagrams",
+			     stream->dropped_datagrams);
+			stream->dropped_datagrams = 0;
+		}
+		stream->wake_pending = true;
+
+	} else if (!stream->dropped_datagrams++) {
+		warn("Send buffer full, dropping data");
+	}
+
+	stream->datagram_size = 0;
+}
+
+static void write_ts(void *param, const uint8_t *data, size_t size)
+{
+	struct udp_ts_stream *stream = param;
+
+	while (size) {
+		size_t space = ARQ_MAX_PAYLOAD - stream->datagram_size;
+		size_t copy = size < space ? size : space;
+
+		memcpy(stream->datagram + stream->datagram_size, data, copy);
+		stream->datagram_size += copy;
+		data += copy;
+		size -= copy;
+
+		if (stream->datagram_size == ARQ_MAX_PAYLOAD)
+			flush_datagram(stream);
+	}
+
+	/* don't hold back the end of a frame waiting for the next one */
+	flush_datagram(stream);
+}
+
+static bool drop_packet(struct udp_ts_stream *stream,
+			struct encoder_packet *packet)
+{
+	uint64_t backlog;
+
+	if (packet->type != OBS_ENCODER_VIDEO)
+		return false;
+
+	/* once the backlog gets too long, drop video until the next
+	 * keyframe, like the frame dropping in rtmp_output */
+	backlog = arq_sender_backlog_us(&stream->sender);
+	if (backlog > stream->drop_threshold_us && !stream->dropping) {
+		info("Send backlog at %d ms, dropping frames",
+		     (int)(backlog / 1000));
+		stream->dropping = true;
+	}
+
+	if (stream->dropping && packet->keyframe)
+		stream->dropping = false;
+	if (stream->dropping)
+		stream->dropped_frames++;
+
+	return stream->dropping;
+}
+
+static void udp_ts_stream_data(void *data, struct encoder_packet *packet)
+{
+	struct udp_ts_stream *stream = data;
+	bool queued;
+
+	if (!active(stream))
+		return;
+
+	/* encoder fail */
+	if (!packet) {
+		os_atomic_set_bool(&stream->encode_error, true);
+		stream->stop_ts = 0;
+		os_event_signal(stream->stop_event);
+		wake_send_thread(stream);
+		return;
+	}
+
+	if (stopping(stream)) {
+		if (stream->stop_ts == 0 ||
+		    packet->sys_dts_usec >= (int64_t)stream->stop_ts) {
+			os_atomic_set_bool(&stream->flushed, true);
+			wake_send_thread(stream);
+			return;
+		}
+	}
+
+	pthread_mutex_lock(&stream->mutex);
+	if (stream->ready && !drop_packet(stream, packet))
+		ts_mux_packet(&stream->mux, packet);
+	queued = stream->wake_pending;
+	stream->wake_pending = false;
+	pthread_mutex_unlock(&stream->mutex);
+
+	if (queued)
+		wake_send_thread(stream);
+}
+
+/* ------------------------------------------------------------------------- */
+/* socket                                                                    */
+
+/* accepts "udp://host:port", "host:port" and "[ipv6]:port" */
+static bool parse_url(const char *url, struct dstr *host, struct dstr *port)
+{
+	const char *sep;
+
+	if (astrcmpi_n(url, "udp://", 6) == 0)
+		url += 6;
+
+	if (*url == '[') {
+		const char *end = strchr(url, ']');
+		if (!end || end[1] != ':')
+			return false;
+
+		dstr_ncopy(host, url + 1, end - url - 1);
+		sep = end + 1;
+	} else {
+		sep = strrchr(url, ':');
+		if (!sep)
+			return false;
+
+		dstr_ncopy(host, url, sep - url);
+	}
+
+	dstr_copy(port, sep + 1);
+	return !dstr_is_empty(host) && !dstr_is_empty(port);
+}
+
+static int open_socket(struct udp_ts_stream *stream)
+{
+	struct addrinfo hints = {0};
+	struct addrinfo *res = NULL;
+	struct dstr host = {0};
+	struct dstr port = {0};
+	int ret = OBS_OUTPUT_SUCCESS;
+
+	if (!parse_url(stream->url.array, &host, &port)) {
+		warn("Invalid URL '%s'", stream->url.array);
+		ret = OBS_OUTPUT_BAD_PATH;
+		goto exit;
+	}
+
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_DGRAM;
+	hints.ai_protocol = IPPROTO_UDP;
+
+	if (getaddrinfo(host.array, port.array, &hints, &res) != 0 || !res) {
+		warn("Failed to resolve '%s'", host.array);
+		ret = OBS_OUTPUT_CONNECT_FAILED;
+		goto exit;
+	}
+
+	stream->sock = socket(res->ai_family, SOCK_DGRAM, IPPROTO_UDP);
+	if (stream->sock == INVALID_SOCK) {
+		warn("Failed to create socket: %d", socket_error());
+		ret = OBS_OUTPUT_ERROR;
+		goto exit;
+	}
+
+	/* a connected socket also receives the receiver's ACKs and NACKs,
+	 * and nothing from anywhere else */
+	if (connect(stream->sock, res->ai_addr, (int)res->ai_addrlen) != 0) {
+		warn("Failed to connect socket: %d", socket_error());
+		ret = OBS_OUTPUT_CONNECT_FAILED;
+		goto exit;
+	}
+
+	{
+#ifdef _WIN32
+		u_long one = 1;
+		ioctlsocket(stream->sock, FIONBIO, &one);
+#else
+		int one = 1;
+		ioctl(stream->sock, FIONBIO, &one);
+#endif
+	}
+
+	info("Sending to %s:%s", host.array, port.array);
+
+exit:
+	if (ret != OBS_OUTPUT_SUCCESS && stream->sock != INVALID_SOCK) {
+		close_socket(stream->sock);
+		stream->sock = INVALID_SOCK;
+	}
+	if (res)
+		freeaddrinfo(res);
+	dstr_free(&host);
+	dstr_free(&port);
+	return ret;
+}
+
+static void receive_control(struct udp_ts_stream *stream)
+{
+	uint8_t buf[ARQ_MAX_DATAGRAM];
+	int size;
+
+	while ((size = (int)recv(stream->sock, (char *)buf, sizeof(buf), 0)) >
+	       0) {
+		pthread_mutex_lock(&stream->mutex);
+		arq_sender_receive(&stream->sender, now_us(), buf,
+				   (size_t)size);
+		pthread_mutex_unlock(&stream->mutex);
+	}
+}
+
+static socket_t open_wake_socket(void)
+{
+	struct sockaddr_in addr = {0};
+	socklen_t len = sizeof(addr);
+	socket_t sock = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+
+	if (sock == INVALID_SOCK)
+		return INVALID_SOCK;
+
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+	if (bind(sock, (struct sockaddr *)&addr, sizeof(addr)) != 0 ||
+	    getsockname(sock, (struct sockaddr *)&addr, &len) != 0 ||
+	    connect(sock, (struct sockaddr *)&addr, sizeof(addr)) != 0) {
+		close_socket(sock);
+		return INVALID_SOCK;
+	}
+
+	{
+#ifdef _WIN32
+		u_long one = 1;
+		ioctlsocket(sock, FIONBIO, &one);
+#else
+		int one = 1;
+		ioctl(sock, FIONBIO, &one);
+#endif
+	}
+
+	return sock;
+}
+
+/* sleeps until the next datagram is due, a control datagram arrives or the
+ * data thread queues more data */
+static void wait_socket(struct udp_ts_stream *stream, uint64_t wait_us)
+{
+	socket_t max_sock = stream->sock;
+	struct timeval tv;
+	fd_set fds;
+	char buf[16];
+
+	if (stream->wake_sock == INVALID_SOCK && wait_us > POLL_WAIT_US)
+		wait_us = POLL_WAIT_US;
+	else if (wait_us > MAX_WAIT_US)
+		wait_us = MAX_WAIT_US;
+
+	tv.tv_sec = 0;
+	tv.tv_usec = (long)wait_us;
+
+	FD_ZERO(&fds);
+	FD_SET(stream->sock, &fds);
+	if (stream->wake_sock != INVALID_SOCK) {
+		FD_SET(stream->wake_sock, &fds);
+		if (stream->wake_sock > max_sock)
+			max_sock = stream->wake_sock;
+	}
+
+	if (select((int)max_sock + 1, &fds, NULL, NULL, &tv) <= 0)
+		return;
+
+	if (stream->wake_sock != INVALID_SOCK &&
+	    FD_ISSET(stream->wake_sock, &fds)) {
+		while (recv(stream->wake_sock, buf, sizeof(buf), 0) > 0)
+			;
+	}
+}
+
+static bool init_sender(struct udp_ts_stream *stream)
+{
+	obs_output_t *context = stream->output;
+	obs_encoder_t *vencoder = obs_output_get_video_encoder(context);
+	obs_encoder_t *aencoder = obs_output_get_audio_encoder(context, 0);
+	obs_data_t *vsettings = obs_encoder_get_settings(vencoder);
+	obs_data_t *asettings = obs_encoder_get_settings(aencoder);
+	uint64_t bytes_per_sec;
+	uint8_t *header;
+	size_t size;
+	bool success;
+
+	bytes_per_sec = (uint64_t)(obs_data_get_int(vsettings, "bitrate") +
+				   obs_data_get_int(asettings, "bitrate")) *
+			1000 / 8;
+	bytes_per_sec = bytes_per_sec * (100 + stream->pacing_overhead) / 100;
+	if (bytes_per_sec < MIN_PACING_BYTES_PER_SEC)
+		bytes_per_sec = MIN_PACING_BYTES_PER_SEC;
+
+	obs_data_release(vsettings);
+	obs_data_release(asettings);
+
+	pthread_mutex_lock(&stream->mutex);
+
+	ts_mux_free(&stream->mux);
+	ts_mux_init(&stream->mux, write_ts, stream);
+
+	obs_encoder_get_extra_data(vencoder, &header, &size);
+	ts_mux_set_video_header(&stream->mux, header, size);
+
+	if (aencoder && obs_encoder_get_extra_data(aencoder, &header, &size) &&
+	    !ts_mux_set_audio_header(&stream->mux, header, size))
+		warn("Unsupported AAC configuration, not sending audio");
+
+	arq_sender_free(&stream->sender);
+	success = arq_sender_init(&stream->sender, stream->latency_us,
+				  bytes_per_sec, now_us());
+
+	stream->datagram_size = 0;
+	stream->wake_pending = false;
+	stream->dropped_datagrams = 0;
+	stream->dropping = false;
+	stream->ready = success;
+	pthread_mutex_unlock(&stream->mutex);
+
+	info("Latency %d ms, pacing at %d kbps",
+	     (int)(stream->latency_us / 1000), (int)(bytes_per_sec * 8 / 1000));
+	return success;
+}
+
+static bool send_done(struct udp_ts_stream *stream)
+{
+	bool backlog;
+
+	if (!stopping(stream))
+		return false;
+	if (stream->stop_ts == 0)
+		return true;
+	if (os_gettime_ns() >= stream->shutdown_timeout_ts) {
+		info("Stream shutdown timeout reached (%d second(s))",
+		     stream->max_shutdown_time_sec);
+		return true;
+	}
+
+	pthread_mutex_lock(&stream->mutex);
+	backlog = stream->sender.send_seq < stream->sender.next_seq;
+	pthread_mutex_unlock(&stream->mutex);
+
+	return os_atomic_load_bool(&stream->flushed) && !backlog;
+}
+
+static void *send_thread(void *data)
+{
+	struct udp_ts_stream *stream = data;
+	uint8_t buf[ARQ_MAX_DATAGRAM];
+	bool reported_error = false;
+	int ret;
+
+	os_set_thread_name("udp-ts-stream: send_thread");
+
+	ret = open_socket(stream);
+	if (ret == OBS_OUTPUT_SUCCESS && !init_sender(stream))
+		ret = OBS_OUTPUT_ERROR;
+
+	if (ret != OBS_OUTPUT_SUCCESS) {
+		os_atomic_set_bool(&stream->active, false);
+		obs_output_signal_stop(stream->output, ret);
+		return NULL;
+	}
+
+	obs_output_begin_data_capture(stream->output, 0);
+
+	while (!send_done(stream)) {
+		uint64_t wait_us;
+		size_t size;
+
+		receive_control(stream);
+
+		pthread_mutex_lock(&stream->mutex);
+		size = arq_sender_next(&stream->sender, now_us(), buf,
+				       &wait_us);
+		pthread_mutex_unlock(&stream->mutex);
+
+		if (!size) {
+			wait_socket(stream, wait_us);
+			continue;
+		}
+
+		/* nobody listening yet is not an error for a UDP stream */
+		if (send(stream->sock, (const char *)buf, (int)size, 0) < 0 &&
+		    socket_error() != SOCK_WOULDBLOCK && !reported_error) {
+			warn("Send failed: %d", socket_error());
+			reported_error = true;
+		}
+	}
+
+	pthread_mutex_lock(&stream->mutex);
+	stream->ready = false;
+	pthread_mutex_unlock(&stream->mutex);
+
+	close_socket(stream->sock);
+	stream->sock = INVALID_SOCK;
+
+	info("Sent %" PRIu64 " packets, %" PRIu64 " retransmitted",
+	     stream->sender.packets_sent, stream->sender.packets_retransmitted);
+	if (stream->dropped_datagrams)
+		info("Dropped %d datagrams while the send buffer was full",
+		     stream->dropped_datagrams);
+
+	if (os_atomic_load_bool(&stream->encode_error)) {
+		info("Encoder error, disconnecting");
+		obs_output_signal_stop(stream->output, OBS_OUTPUT_ENCODE_ERROR);
+	} else {
+		info("User stopped the stream");
+		obs_output_end_data_capture(stream->output);
+	}
+
+	os_atomic_set_bool(&stream->active, false);
+	return NULL;
+}
+
+/* ------------------------------------------------------------------------- */
+
+static void get_transport_stats(void *data, calldata_t *cd)
+{
+	struct udp_ts_stream *stream = data;
+
+	pthread_mutex_lock(&stream->mutex);
+	calldata_set_int(cd, "rtt_ms", stream->sender.rtt_us / 1000);
+	calldata_set_int(cd, "packets_sent",
+			 (long long)stream->sender.packets_sent);
+	calldata_set_int(cd, "packets_retransmitted",
+			 (long long)stream->sender.packets_retransmitted);
+	calldata_set_int(cd, "nacks_received",
+			 (long long)stream->sender.nacks_received);
+	pthread_mutex_unlock(&stream->mutex);
+}
+
+static void udp_ts_stream_destroy(void *data)
+{
+	struct udp_ts_stream *stream = data;
+
+	if (active(stream)) {
+		stream->stop_ts = 0;
+		os_event_signal(stream->stop_event);
+		wake_send_thread(stream);
+	}
+	if (stream->thread_created)
+		pthread_join(stream->send_thread, NULL);
+
+	if (stream->wake_sock != INVALID_SOCK)
+		close_socket(stream->wake_sock);
+
+	ts_mux_free(&stream->mux);
+	arq_sender_free(&stream->sender);
+	os_event_destroy(stream->stop_event);
+	pthread_mutex_destroy(&stream->mutex);
+	dstr_free(&stream->url);
+	bfree(stream);
+}
+
+static void *udp_ts_stream_create(obs_data_t *settings, obs_output_t *output)
+{
+	struct udp_ts_stream *stream = bzalloc(sizeof(*stream));
+	proc_handler_t *ph = obs_output_get_proc_handler(output);
+
+	stream->output = output;
+	stream->sock = INVALID_SOCK;
+	stream->wake_sock = INVALID_SOCK;
+	pthread_mutex_init_value(&stream->mutex);
+	ts_mux_init(&stream->mux, write_ts, stream);
+
+	if (pthread_mutex_init(&stream->mutex, NULL) != 0)
+		goto fail;
+	if (os_event_init(&stream->stop_event, OS_EVENT_TYPE_MANUAL) != 0)
+		goto fail;
+
+	stream->wake_sock = open_wake_socket();
+	if (stream->wake_sock == INVALID_SOCK)
+		warn("Failed to create wake socket, polling for data");
+
+	proc_handler_add(ph,
+			 "void get_transport_stats(out int rtt_ms, "
+			 "out int packets_sent, out int packets_retransmitted, "
+			 "out int nacks_received)",
+			 get_transport_stats, stream);
+
+	UNUSED_PARAMETER(settings);
+	return stream;
+
+fail:
+	udp_ts_stream_destroy(stream);
+	return NULL;
+}
+
+static bool udp_ts_stream_start(void *data)
+{
+	struct udp_ts_stream *stream = data;
+	obs_data_t *settings;
+
+	if (!obs_output_can_begin_data_capture(stream->output, 0))
+		return false;
+	if (!obs_output_initialize_encoders(stream->output, 0))
+		return false;
+
+	if (stream->thread_created) {
+		pthread_join(stream->send_thread, NULL);
+		stream->thread_created = false;
+	}
+
+	settings = obs_output_get_settings(stream->output);
+	dstr_copy(&stream->url, obs_data_get_string(settings, OPT_URL));
+	dstr_depad(&stream->url);
+	stream->latency_us =
+		(uint64_t)obs_data_get_int(settings, OPT_LATENCY) * 1000;
+	stream->drop_threshold_us =
+		(uint64_t)obs_data_get_int(settings, OPT_DROP_THRESHOLD) * 1000;
+	stream->pacing_overhead =
+		(int)obs_data_get_int(settings, OPT_PACING_OVERHEAD);
+	stream->max_shutdown_time_sec =
+		(int)obs_data_get_int(settings, OPT_MAX_SHUTDOWN_TIME_SEC);
+	obs_data_release(settings);
+
+	os_event_reset(stream->stop_event);
+	os_atomic_set_bool(&stream->encode_error, false);
+	os_atomic_set_bool(&stream->flushed, false);
+	stream->stop_ts = 0;
+	stream->dropped_frames = 0;
+
+	os_atomic_set_bool(&stream->active, true);
+	if (pthread_create(&stream->send_thread, NULL, send_thread, stream) !=
+	    0) {
+		os_atomic_set_bool(&stream->active, false);
+		warn("Failed to create send thread");
+		return false;
+	}
+
+	stream->thread_created = true;
+	return true;
+}
+
+static void udp_ts_stream_stop(void *data, uint64_t ts)
+{
+	struct udp_ts_stream *stream = data;
+
+	if (stopping(stream) && ts != 0)
+		return;
+
+	if (!active(stream)) {
+		obs_output_signal_stop(stream->output, OBS_OUTPUT_SUCCESS);
+		return;
+	}
+
+	stream->stop_ts = ts / 1000ULL;
+	if (ts)
+		stream->shutdown_timeout_ts =
+			ts +
+			(uint64_t)stream->max_shutdown_time_sec * 1000000000ULL;
+
+	os_event_signal(stream->stop_event);
+	wake_send_thread(stream);
+}
+
+static void udp_ts_stream_defaults(obs_data_t *defaults)
+{
+	obs_data_set_default_int(defaults, OPT_LATENCY, 120);
+	obs_data_set_default_int(defaults, OPT_PACING_OVERHEAD, 25);
+	obs_data_set_default_int(defaults, OPT_DROP_THRESHOLD, 700);
+	obs_data_set_default_int(defaults, OPT_MAX_SHUTDOWN_TIME_SEC, 30);
+}
+
+static obs_properties_t *udp_ts_stream_properties(void *unused)
+{
+	UNUSED_PARAMETER(unused);
+
+	obs_properties_t *props = obs_properties_create();
+
+	obs_properties_add_text(props, OPT_URL,
+				obs_module_text("UDPTSStream.URL"),
+				OBS_TEXT_DEFAULT);
+	obs_properties_add_int(props, OPT_LATENCY,
+			       obs_module_text("UDPTSStream.Latency"), 20, 5000,
+			       10);
+	obs_properties_add_int(props, OPT_PACING_OVERHEAD,
+			       obs_module_text("UDPTSStream.PacingOverhead"), 5,
+			       200, 5);
+	obs_properties_add_int(props, OPT_DROP_THRESHOLD,
+			       obs_module_text("RTMPStream.DropThreshold"), 200,
+			       10000, 100);
+
+	return props;
+}
+
+static uint64_t udp_ts_stream_total_bytes_sent(void *data)
+{
+	struct udp_ts_stream *stream = data;
+	return stream->sender.bytes_sent;
+}
+
+static int udp_ts_stream_dropped_frames(void *data)
+{
+	struct udp_ts_stream *stream = data;
+	return stream->dropped_frames;
+}
+
+static float udp_ts_stream_congestion(void *data)
+{
+	struct udp_ts_stream *stream = data;
+	float congestion;
+
+	if (!stream->drop_threshold_us || !stream->sender.bytes_per_us)
+		return 0.0f;
+
+	congestion = (float)arq_sender_backlog_us(&stream->sender) /
+		     (float)stream->drop_threshold_us;
+	return congestion > 1.0f ? 1.0f : congestion;
+}
+
+struct obs_output_info udp_ts_output_info = {
+	.id = "udp_ts_output",
+	.flags = OBS_OUTPUT_AV | OBS_OUTPUT_ENCODED,
+	.encoded_video_codecs = "h264",
+	.encoded_audio_codecs = "aac",
+	.get_name = udp_ts_stream_getname,
+	.create = udp_ts_stream_create,
+	.destroy = udp_ts_stream_destroy,
+	.start = udp_ts_stream_start,
+	.stop = udp_ts_stream_stop,
+	.encoded_packet = udp_ts_stream_data,
+	.get_defaults = udp_ts_stream_defaults,
+	.get_properties = udp_ts_stream_properties,
+	.get_total_bytes = udp_ts_stream_total_bytes_sent,
+	.get_congestion = udp_ts_stream_congestion,
+	.get_dropped_frames = udp_ts_stream_dropped_frames,
+};
@@ -0,0 +1,162 @@
+/*
+ * Compares rendering independent audio sources serially and on a separate
+ * worker pool, the way audio_callback() does it, to check where
+ * MIN_PARALLEL_AUDIO_NS should sit on a given machine.  Each fake source does
+ * roughly what obs_source_audio_render() does for a leaf source: apply its
+ * volume to a tick of audio for every mix and channel.
+ *
+ * Also times a wake-up round trip between two threads, which is roughly what
+ * the pool adds to every tick it is used on, and prints the smallest serial
+ * cost at which the pool came out ahead.  The pool comparison is only
+ * meaningful with more than THREADS logical cores.
+ *
+ * Not run by ctest; build the bench_audio_render target and run it by hand.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <util/worker-pool.h>
+#include <util/threading.h>
+#include <util/platform.h>
+#include <util/bmem.h>
+
+#define FRAMES 1024
+#define CHANNELS 2
+#define MIXES 6
+#define TICKS 2000
+#define THREADS 2
+
+struct fake_source {
+	float in[CHANNELS][FRAMES];
+	float out[MIXES][CHANNELS][FRAMES];
+	float volume;
+};
+
+struct bench {
+	struct fake_source *sources;
+	size_t num;
+	size_t parts;
+};
+
+static void render_source(struct fake_source *source)
+{
+	for (size_t mix = 0; mix < MIXES; mix++) {
+		for (size_t ch = 0; ch < CHANNELS; ch++) {
+			float *out = source->out[mix][ch];
+			const float *in = source->in[ch];
+
+			for (size_t i = 0; i < FRAMES; i++)
+				out[i] = in[i] * source->volume;
+		}
+	}
+}
+
+static void render_part(void *param, size_t idx)
+{
+	struct bench *b = param;
+	size_t start = idx * b->num / b->parts;
+	size_t end = (idx + 1) * b->num / b->parts;
+
+	for (size_t i = start; i < end; i++)
+		render_source(&b->sources[i]);
+}
+
+struct ping_pong {
+	os_event_t *ping;
+	os_event_t *pong;
+	int rounds;
+};
+
+static void *pong_thread(void *param)
+{
+	struct ping_pong *pp = param;
+
+	for (int i = 0; i < pp->rounds; i++) {
+		os_event_wait(pp->ping);
+		os_event_signal(pp->pong);
+	}
+	return NULL;
+}
+
+/* average time to wake a blocked thread and be woken back by it */
+static double wake_round_trip_us(void)
+{
+	struct ping_pong pp = {.rounds = TICKS};
+	pthread_t thread;
+	uint64_t start;
+
+	os_event_init(&pp.ping, OS_EVENT_TYPE_AUTO);
+	os_event_init(&pp.pong, OS_EVENT_TYPE_AUTO);
+	pthread_create(&thread, NULL, pong_thread, &pp);
+
+	start = os_gettime_ns();
+	for (int i = 0; i < pp.rounds; i++) {
+		os_event_signal(pp.ping);
+		os_event_wait(pp.pong);
+	}
+
+	pthread_join(thread, NULL);
+	os_event_destroy(pp.ping);
+	os_event_destroy(pp.pong);
+	return (double)(os_gettime_ns() - start) / 1000.0 / pp.rounds;
+}
+
+static double ticks_us(uint64_t start)
+{
+	return (double)(os_gettime_ns() - start) / 1000.0 / TICKS;
+}
+
+int main(void)
+{
+	static const size_t counts[] = {4, 8, 12, 16, 24, 32, 64, 128};
+	worker_pool_t *pool = worker_pool_create(THREADS, "bench pool");
+	double break_even = 0.0;
+	struct bench b = {0};
+	uint64_t start;
+
+	printf("logical cores: %d, pool threads: %d\n",
+	       os_get_logical_cores(), THREADS);
+	printf("wake round trip: %.1f us\n", wake_round_trip_us());
+
+	printf("%8s %12s %12s\n", "sources", "serial us", "pool us");
+
+	for (size_t c = 0; c < sizeof(counts) / sizeof(counts[0]); c++) {
+		double serial, pooled;
+
+		b.num = counts[c];
+		b.sources = bzalloc(sizeof(struct fake_source) * b.num);
+		for (size_t i = 0; i < b.num; i++)
+			b.sources[i].volume = 0.5f;
+
+		b.parts = 1;
+		start = os_gettime_ns();
+		for (int t = 0; t < TICKS; t++)
+			render_part(&b, 0);
+		serial = ticks_us(start);
+
+		b.parts = THREADS + 1;
+		start = os_gettime_ns();
+		for (int t = 0; t < TICKS; t++)
+			worker_pool_run(pool, render_part, &b, b.parts);
+		pooled = ticks_us(start);
+
+		/* where the pool stays ahead for every larger count */
+		if (pooled >= serial)
+			break_even = 0.0;
+		else if (break_even == 0.0)
+			break_even = serial;
+
+		printf("%8zu %12.1f %12.1f\n", b.num, serial, pooled);
+		bfree(b.sources);
+	}
+
+	if (break_even != 0.0)
+		printf("pool ahead from %.1f us of serial rendering\n",
+		       break_even);
+	else
+		printf("pool never ahead\n");
+
+	worker_pool_destroy(pool);
+	return 0;
+}
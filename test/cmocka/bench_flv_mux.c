@@ -0,0 +1,169 @@
+/*
+ * Compares muxing encoder packets into FLV tags and sending them through
+ * librtmp the old way, copying each payload into a flat tag that goes to
+ * RTMP_Write, with flv_packet_mux_tag() and RTMP_WriteV(), which send the
+ * payload straight from the packet.  Sent bytes go to a custom send function
+ * that drops them, so only the muxing and chunking are timed.
+ *
+ * Not run by ctest; build the bench_flv_mux target and run it by hand.
+ */
+
+#include <stdio.h>
+
+#include <util/array-serializer.h>
+#include <util/platform.h>
+
+#include "flv-mux.h"
+#include "rtmp-helpers.h"
+
+#define PACKETS 20000
+#define CHUNK_SIZE 4096
+
+static uint8_t payload[256 * 1024];
+
+/* the flat muxer flv-mux.c used before tags were split around the payload */
+static void old_packet_mux(struct encoder_packet *packet, bool is_header,
+			   struct array_output_data *out)
+{
+	int32_t time_ms = get_ms_time(packet, packet->dts);
+	struct serializer s;
+
+	array_output_serializer_init(&s, out);
+
+	if (packet->type == OBS_ENCODER_VIDEO) {
+		int64_t offset = packet->pts - packet->dts;
+
+		s_w8(&s, RTMP_PACKET_TYPE_VIDEO);
+		s_wb24(&s, (uint32_t)packet->size + 5);
+		s_wb24(&s, time_ms);
+		s_w8(&s, (time_ms >> 24) & 0x7F);
+		s_wb24(&s, 0);
+		s_w8(&s, packet->keyframe ? 0x17 : 0x27);
+		s_w8(&s, is_header ? 0 : 1);
+		s_wb24(&s, get_ms_time(packet, offset));
+	} else {
+		s_w8(&s, RTMP_PACKET_TYPE_AUDIO);
+		s_wb24(&s, (uint32_t)packet->size + 2);
+		s_wb24(&s, time_ms);
+		s_w8(&s, (time_ms >> 24) & 0x7F);
+		s_wb24(&s, 0);
+		s_w8(&s, 0xaf);
+		s_w8(&s, is_header ? 0 : 1);
+	}
+
+	s_write(&s, packet->data, packet->size);
+	s_wb32(&s, (uint32_t)serializer_get_pos(&s) - 1);
+}
+
+static int drop_send(RTMPSockBuf *sb, const char *data, int len, void *arg)
+{
+	uint64_t *sent = arg;
+	*sent += len;
+	(void)sb;
+	(void)data;
+	return len;
+}
+
+static void rtmp_init_sink(RTMP *r, uint64_t *sent)
+{
+	RTMP_Init(r);
+	r->m_bCustomSend = 1;
+	r->m_customSendFunc = drop_send;
+	r->m_customSendParam = sent;
+	r->m_outChunkSize = CHUNK_SIZE;
+	r->Link.streams[0].id = 1;
+	r->m_sb.sb_socket = -1;
+}
+
+static struct encoder_packet make_packet(enum obs_encoder_type type,
+					 size_t size, int64_t dts)
+{
+	struct encoder_packet packet = {
+		.type = type,
+		.data = payload,
+		.size = size,
+		.timebase_num = 1,
+		.timebase_den = 1000,
+		.dts = dts,
+		.pts = dts,
+	};
+	return packet;
+}
+
+static double run_old(size_t size, enum obs_encoder_type type)
+{
+	uint64_t sent = 0;
+	uint64_t start;
+	RTMP r;
+
+	rtmp_init_sink(&r, &sent);
+
+	start = os_gettime_ns();
+	for (int i = 0; i < PACKETS; i++) {
+		struct encoder_packet packet = make_packet(type, size, i * 33);
+		struct array_output_data flat;
+
+		old_packet_mux(&packet, false, &flat);
+		RTMP_Write(&r, (char *)flat.bytes.array, (int)flat.bytes.num,
+			   0);
+		array_output_serializer_free(&flat);
+	}
+
+	RTMP_Close(&r);
+	return (double)(os_gettime_ns() - start) / PACKETS;
+}
+
+static double run_new(size_t size, enum obs_encoder_type type)
+{
+	uint64_t sent = 0;
+	uint64_t start;
+	struct flv_tag tag;
+	RTMP r;
+
+	rtmp_init_sink(&r, &sent);
+	flv_tag_init(&tag);
+
+	start = os_gettime_ns();
+	for (int i = 0; i < PACKETS; i++) {
+		struct encoder_packet packet = make_packet(type, size, i * 33);
+		AVal vec[3];
+
+		flv_packet_mux_tag(&tag, &packet, 0, false);
+		vec[0].av_val = (char *)flv_tag_header(&tag);
+		vec[0].av_len = (int)tag.header_size;
+		vec[1].av_val = (char *)tag.payload;
+		vec[1].av_len = (int)tag.payload_size;
+		vec[2].av_val = (char *)flv_tag_trailer(&tag);
+		vec[2].av_len = (int)flv_tag_trailer_size(&tag);
+		RTMP_WriteV(&r, vec, 3, 0);
+	}
+
+	flv_tag_free(&tag);
+	RTMP_Close(&r);
+	return (double)(os_gettime_ns() - start) / PACKETS;
+}
+
+int main(void)
+{
+	static const size_t sizes[] = {512, 4096, 32768, 131072, 262144};
+
+	for (size_t i = 0; i < sizeof(payload); i++)
+		payload[i] = (uint8_t)(i * 7);
+
+	printf("%8s %6s %12s %12s\n", "bytes", "type", "old ns/pkt",
+	       "new ns/pkt");
+
+	for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+		for (int video = 0; video < 2; video++) {
+			enum obs_encoder_type type = video ? OBS_ENCODER_VIDEO
+							   : OBS_ENCODER_AUDIO;
+			double old_ns = run_old(sizes[i], type);
+			double new_ns = run_new(sizes[i], type);
+
+			printf("%8zu %6s %12.0f %12.0f\n", sizes[i],
+			       video ? "video" : "audio", old_ns, new_ns);
+		}
+	}
+
+	return 0;
+}
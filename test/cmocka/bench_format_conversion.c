@@ -0,0 +1,175 @@
+/*
+ * Times the UYVX conversions used by video output on a 1080p frame with a
+ * plain C version of each, the SSE2 path and, if the CPU has it, the AVX2
+ * path, selected with format_conversion_set_path().
+ *
+ * Not run by ctest; build the bench_format_conversion target and run it by
+ * hand.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <util/platform.h>
+#include <util/bmem.h>
+#include <media-io/format-conversion.h>
+
+#define WIDTH 1920
+#define HEIGHT 1080
+#define FRAMES 200
+
+typedef void (*convert_func_t)(const uint8_t *input, uint32_t in_linesize,
+			       uint32_t start_y, uint32_t end_y,
+			       uint8_t *output[],
+			       const uint32_t out_linesize[]);
+
+static inline uint8_t avg_chroma(const uint8_t *line1, const uint8_t *line2,
+				 int ch)
+{
+	return (uint8_t)((line1[ch] + line1[4 + ch] + line2[ch] +
+			  line2[4 + ch]) /
+			 4);
+}
+
+static void scalar_uyvx_to_i420(const uint8_t *input, uint32_t in_linesize,
+				uint32_t start_y, uint32_t end_y,
+				uint8_t *output[],
+				const uint32_t out_linesize[])
+{
+	for (uint32_t y = start_y; y < end_y; y += 2) {
+		const uint8_t *line1 = input + y * in_linesize;
+		const uint8_t *line2 = line1 + in_linesize;
+		uint8_t *lum1 = output[0] + y * out_linesize[0];
+		uint8_t *lum2 = lum1 + out_linesize[0];
+		uint8_t *u = output[1] + (y / 2) * out_linesize[1];
+		uint8_t *v = output[2] + (y / 2) * out_linesize[2];
+
+		for (uint32_t x = 0; x < WIDTH; x += 2) {
+			const uint8_t *p1 = line1 + x * 4;
+			const uint8_t *p2 = line2 + x * 4;
+
+			lum1[x] = p1[1];
+			lum1[x + 1] = p1[5];
+			lum2[x] = p2[1];
+			lum2[x + 1] = p2[5];
+			u[x / 2] = avg_chroma(p1, p2, 0);
+			v[x / 2] = avg_chroma(p1, p2, 2);
+		}
+	}
+}
+
+static void scalar_uyvx_to_nv12(const uint8_t *input, uint32_t in_linesize,
+				uint32_t start_y, uint32_t end_y,
+				uint8_t *output[],
+				const uint32_t out_linesize[])
+{
+	for (uint32_t y = start_y; y < end_y; y += 2) {
+		const uint8_t *line1 = input + y * in_linesize;
+		const uint8_t *line2 = line1 + in_linesize;
+		uint8_t *lum1 = output[0] + y * out_linesize[0];
+		uint8_t *lum2 = lum1 + out_linesize[0];
+		uint8_t *uv = output[1] + (y / 2) * out_linesize[1];
+
+		for (uint32_t x = 0; x < WIDTH; x += 2) {
+			const uint8_t *p1 = line1 + x * 4;
+			const uint8_t *p2 = line2 + x * 4;
+
+			lum1[x] = p1[1];
+			lum1[x + 1] = p1[5];
+			lum2[x] = p2[1];
+			lum2[x + 1] = p2[5];
+			uv[x] = avg_chroma(p1, p2, 0);
+			uv[x + 1] = avg_chroma(p1, p2, 2);
+		}
+	}
+}
+
+static void scalar_uyvx_to_i444(const uint8_t *input, uint32_t in_linesize,
+				uint32_t start_y, uint32_t end_y,
+				uint8_t *output[],
+				const uint32_t out_linesize[])
+{
+	for (uint32_t y = start_y; y < end_y; y++) {
+		const uint8_t *line = input + y * in_linesize;
+		uint8_t *lum = output[0] + y * out_linesize[0];
+		uint8_t *u = output[1] + y * out_linesize[1];
+		uint8_t *v = output[2] + y * out_linesize[2];
+
+		for (uint32_t x = 0; x < WIDTH; x++) {
+			u[x] = line[x * 4];
+			lum[x] = line[x * 4 + 1];
+			v[x] = line[x * 4 + 2];
+		}
+	}
+}
+
+struct conversion {
+	const char *name;
+	convert_func_t scalar;
+	convert_func_t simd;
+	uint32_t linesize[3];
+};
+
+static double time_ms(convert_func_t func, const uint8_t *input,
+		      uint8_t *output[], const uint32_t linesize[])
+{
+	uint64_t start = os_gettime_ns();
+
+	for (int i = 0; i < FRAMES; i++)
+		func(input, WIDTH * 4, 0, HEIGHT, output, linesize);
+
+	return (double)(os_gettime_ns() - start) / 1000000.0 / FRAMES;
+}
+
+int main(void)
+{
+	static const struct conversion conversions[] = {
+		{"uyvx_to_i420", scalar_uyvx_to_i420, compress_uyvx_to_i420,
+		 {WIDTH, WIDTH / 2, WIDTH / 2}},
+		{"uyvx_to_nv12", scalar_uyvx_to_nv12, compress_uyvx_to_nv12,
+		 {WIDTH, WIDTH, 0}},
+		{"uyvx_to_i444", scalar_uyvx_to_i444, convert_uyvx_to_i444,
+		 {WIDTH, WIDTH, WIDTH}},
+	};
+	uint8_t *input = bmalloc(WIDTH * HEIGHT * 4);
+	uint8_t *output[3];
+
+	for (size_t i = 0; i < 3; i++)
+		output[i] = bmalloc(WIDTH * HEIGHT);
+	for (size_t i = 0; i < WIDTH * HEIGHT * 4; i++)
+		input[i] = (uint8_t)rand();
+
+	printf("%dx%d, ms per frame\n", WIDTH, HEIGHT);
+	printf("%14s %8s %8s %8s\n", "conversion", "scalar", "SSE2", "AVX2");
+
+	for (size_t i = 0; i < sizeof(conversions) / sizeof(conversions[0]);
+	     i++) {
+		const struct conversion *c = &conversions[i];
+		double scalar, sse2, avx2 = 0.0;
+		bool has_avx2;
+
+		scalar = time_ms(c->scalar, input, output, c->linesize);
+
+		format_conversion_set_path(FORMAT_CONVERSION_PATH_SSE2);
+		sse2 = time_ms(c->simd, input, output, c->linesize);
+
+		has_avx2 = format_conversion_set_path(
+			FORMAT_CONVERSION_PATH_AVX2);
+		if (has_avx2)
+			avx2 = time_ms(c->simd, input, output, c->linesize);
+
+		if (has_avx2)
+			printf("%14s %8.3f %8.3f %8.3f\n", c->name, scalar,
+			       sse2, avx2);
+		else
+			printf("%14s %8.3f %8.3f %8s\n", c->name, scalar,
+			       sse2, "n/a");
+	}
+
+	format_conversion_set_path(FORMAT_CONVERSION_PATH_AUTO);
+
+	for (size_t i = 0; i < 3; i++)
+		bfree(output[i]);
+	bfree(input);
+	return 0;
+}
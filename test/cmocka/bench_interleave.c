@@ -0,0 +1,168 @@
+/*
+ * Compares the per-track interleave queues with the single sorted array that
+ * obs_output used before them.  Packets are fed in the order they would
+ * arrive when video comes out of its encoder some time behind audio, and
+ * after each one the earliest packet is sent once a packet of the other type
+ * with a later timestamp has been queued, the way interleave_packets() does.
+ * The more audio tracks and the longer the lag, the longer the backlog that
+ * the sorted array has to scan and move on every packet.
+ *
+ * Not run by ctest; build the bench_interleave target and run it by hand.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <util/platform.h>
+#include <util/bmem.h>
+#include <obs-interleave.h>
+
+#define VIDEO_USEC 33333
+#define AUDIO_USEC 21333
+#define DURATION_USEC (600 * 1000000LL)
+
+typedef DARRAY(struct encoder_packet) packet_array_t;
+
+struct arrival {
+	struct encoder_packet packet;
+	int64_t arrive_usec;
+};
+
+static int cmp_arrival(const void *a, const void *b)
+{
+	const struct arrival *aa = a;
+	const struct arrival *ab = b;
+
+	if (aa->arrive_usec != ab->arrive_usec)
+		return aa->arrive_usec < ab->arrive_usec ? -1 : 1;
+	if (aa->packet.type != ab->packet.type)
+		return aa->packet.type == OBS_ENCODER_VIDEO ? -1 : 1;
+	return (int)aa->packet.track_idx - (int)ab->packet.track_idx;
+}
+
+static struct arrival *make_arrivals(size_t tracks, int64_t video_lag,
+				     size_t *count)
+{
+	size_t num_video = DURATION_USEC / VIDEO_USEC;
+	size_t num_audio = DURATION_USEC / AUDIO_USEC;
+	struct arrival *arrivals =
+		bzalloc(sizeof(*arrivals) * (num_video + num_audio * tracks));
+	size_t num = 0;
+
+	for (size_t i = 0; i < num_video; i++) {
+		struct arrival *a = &arrivals[num++];
+		a->packet.type = OBS_ENCODER_VIDEO;
+		a->packet.dts_usec = (int64_t)i * VIDEO_USEC;
+		a->arrive_usec = a->packet.dts_usec + video_lag;
+	}
+
+	for (size_t t = 0; t < tracks; t++) {
+		for (size_t i = 0; i < num_audio; i++) {
+			struct arrival *a = &arrivals[num++];
+			a->packet.type = OBS_ENCODER_AUDIO;
+			a->packet.track_idx = t;
+			a->packet.dts_usec = (int64_t)i * AUDIO_USEC;
+			a->arrive_usec = a->packet.dts_usec;
+		}
+	}
+
+	qsort(arrivals, num, sizeof(*arrivals), cmp_arrival);
+	*count = num;
+	return arrivals;
+}
+
+static inline bool has_higher_opposing_ts(const int64_t highest[2],
+					  const struct encoder_packet *packet)
+{
+	return packet->type == OBS_ENCODER_VIDEO
+		       ? highest[OBS_ENCODER_AUDIO] > packet->dts_usec
+		       : highest[OBS_ENCODER_VIDEO] > packet->dts_usec;
+}
+
+static inline void set_higher_ts(int64_t highest[2],
+				 const struct encoder_packet *packet)
+{
+	if (highest[packet->type] < packet->dts_usec)
+		highest[packet->type] = packet->dts_usec;
+}
+
+/* insert_interleaved_packet() and send_interleaved() as they were */
+static double run_array(const struct arrival *arrivals, size_t count)
+{
+	int64_t highest[2] = {-1, -1};
+	packet_array_t array = {0};
+	uint64_t start = os_gettime_ns();
+
+	for (size_t i = 0; i < count; i++) {
+		const struct encoder_packet *packet = &arrivals[i].packet;
+		size_t idx;
+
+		for (idx = 0; idx < array.num; idx++) {
+			struct encoder_packet *cur = array.array + idx;
+
+			if (packet->dts_usec == cur->dts_usec &&
+			    packet->type == OBS_ENCODER_VIDEO)
+				break;
+			else if (packet->dts_usec < cur->dts_usec)
+				break;
+		}
+
+		da_insert(array, idx, packet);
+		set_higher_ts(highest, packet);
+
+		if (has_higher_opposing_ts(highest, array.array))
+			da_erase(array, 0);
+	}
+
+	da_free(array);
+	return (double)(os_gettime_ns() - start) / count;
+}
+
+static double run_queues(const struct arrival *arrivals, size_t count)
+{
+	struct interleave_queue queues[INTERLEAVE_TRACKS] = {0};
+	int64_t highest[2] = {-1, -1};
+	uint64_t start = os_gettime_ns();
+
+	for (size_t i = 0; i < count; i++) {
+		const struct encoder_packet *packet = &arrivals[i].packet;
+		struct interleave_queue *q;
+		struct encoder_packet out;
+
+		interleave_insert(queues, packet);
+		set_higher_ts(highest, packet);
+
+		q = interleave_first_queue(queues);
+		if (has_higher_opposing_ts(highest, interleave_queue_front(q)))
+			interleave_queue_pop_front(q, &out);
+	}
+
+	interleave_free(queues);
+	return (double)(os_gettime_ns() - start) / count;
+}
+
+int main(void)
+{
+	static const size_t tracks[] = {1, 2, 6};
+	static const int64_t lags_ms[] = {0, 100, 500, 2000};
+
+	printf("%6s %8s %14s %14s\n", "tracks", "lag ms", "array ns/pkt",
+	       "queues ns/pkt");
+
+	for (size_t t = 0; t < sizeof(tracks) / sizeof(tracks[0]); t++) {
+		for (size_t l = 0; l < sizeof(lags_ms) / sizeof(lags_ms[0]);
+		     l++) {
+			size_t count;
+			struct arrival *arrivals = make_arrivals(
+				tracks[t], lags_ms[l] * 1000, &count);
+			double array_ns = run_array(arrivals, count);
+			double queues_ns = run_queues(arrivals, count);
+
+			printf("%6zu %8lld %14.1f %14.1f\n", tracks[t],
+			       (long long)lags_ms[l], array_ns, queues_ns);
+			bfree(arrivals);
+		}
+	}
+
+	return 0;
+}
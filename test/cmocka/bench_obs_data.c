@@ -0,0 +1,100 @@
+/*
+ * Times loading, looking up every setting of, and saving a synthetic scene
+ * collection with NUM_SOURCES sources, each with a settings object, plus one
+ * object keyed by source name, to compare obs_data changes on large
+ * collections.
+ *
+ * Not run by ctest; build the bench_obs_data target and run it by hand.
+ */
+
+#include <stdio.h>
+
+#include <util/dstr.h>
+#include <util/platform.h>
+#include <obs-data.h>
+
+#define NUM_SOURCES 5000
+#define NUM_SETTINGS 32
+
+static char *make_collection(void)
+{
+	struct dstr json = {0};
+
+	dstr_copy(&json, "{\"current_scene\":\"Scene\",\"name\":\"Benchmark\","
+			 "\"sources\":[");
+
+	for (int i = 0; i < NUM_SOURCES; i++) {
+		if (i)
+			dstr_cat_ch(&json, ',');
+		dstr_catf(&json,
+			  "{\"enabled\":true,\"id\":\"color_source\","
+			  "\"muted\":false,\"name\":\"Source %05d\","
+			  "\"settings\":{",
+			  i);
+		for (int k = 0; k < NUM_SETTINGS; k++)
+			dstr_catf(&json, "%s\"setting_%02d\":%d", k ? "," : "",
+				  k, i + k);
+		dstr_cat(&json, "},\"volume\":1.0}");
+	}
+
+	dstr_cat(&json, "],\"source_order\":{");
+	for (int i = 0; i < NUM_SOURCES; i++)
+		dstr_catf(&json, "%s\"Source %05d\":%d", i ? "," : "", i, i);
+	dstr_cat(&json, "}}");
+
+	return json.array;
+}
+
+static double ms(uint64_t start, uint64_t end)
+{
+	return (double)(end - start) / 1000000.0;
+}
+
+int main(void)
+{
+	char *json = make_collection();
+	long long sum = 0;
+	char name[32];
+
+	uint64_t start = os_gettime_ns();
+	obs_data_t *data = obs_data_create_from_json(json);
+	uint64_t loaded = os_gettime_ns();
+	if (!data) {
+		printf("failed to load the collection\n");
+		return 1;
+	}
+
+	obs_data_array_t *sources = obs_data_get_array(data, "sources");
+	obs_data_t *order = obs_data_get_obj(data, "source_order");
+
+	for (int i = 0; i < NUM_SOURCES; i++) {
+		obs_data_t *source = obs_data_array_item(sources, i);
+		obs_data_t *settings = obs_data_get_obj(source, "settings");
+
+		for (int k = 0; k < NUM_SETTINGS; k++) {
+			snprintf(name, sizeof(name), "setting_%02d", k);
+			sum += obs_data_get_int(settings, name);
+		}
+
+		snprintf(name, sizeof(name), "Source %05d", i);
+		sum += obs_data_get_int(order, name);
+
+		obs_data_release(settings);
+		obs_data_release(source);
+	}
+
+	uint64_t looked_up = os_gettime_ns();
+	const char *saved_json = obs_data_get_json(data);
+	uint64_t saved = os_gettime_ns();
+
+	printf("%d sources, %zu bytes of json (checksum %lld)\n", NUM_SOURCES,
+	       saved_json ? strlen(saved_json) : 0, sum);
+	printf("load %.1f ms, lookups %.1f ms, save %.1f ms\n",
+	       ms(start, loaded), ms(loaded, looked_up), ms(looked_up, saved));
+
+	obs_data_release(order);
+	obs_data_array_release(sources);
+	obs_data_release(data);
+	bfree(json);
+	return 0;
+}
@@ -0,0 +1,199 @@
+#include <stdarg.h>
+#include <stddef.h>
+#include <setjmp.h>
+#include <cmocka.h>
+
+#include <obs.h>
+
+#define WIDTH 16
+#define HEIGHT 16
+
+/* MAX_ASYNC_FRAMES in obs-source.c */
+#define MAX_QUEUED 30
+
+/* internal, normally called by the graphics thread */
+extern void obs_source_video_tick(obs_source_t *source, float seconds);
+
+static const char *test_get_name(void *type_data)
+{
+	UNUSED_PARAMETER(type_data);
+	return "test async source";
+}
+
+static void *test_create(obs_data_t *settings, obs_source_t *source)
+{
+	UNUSED_PARAMETER(settings);
+	return source;
+}
+
+static void test_destroy(void *data)
+{
+	UNUSED_PARAMETER(data);
+}
+
+static struct obs_source_info test_async_source = {
+	.id = "test_async_source",
+	.type = OBS_SOURCE_TYPE_INPUT,
+	.output_flags = OBS_SOURCE_ASYNC_VIDEO,
+	.get_name = test_get_name,
+	.create = test_create,
+	.destroy = test_destroy,
+};
+
+struct borrowed_plane {
+	uint8_t data[WIDTH * HEIGHT * 4];
+	long releases;
+};
+
+static void release_plane(void *param)
+{
+	struct borrowed_plane *plane = param;
+	plane->releases++;
+}
+
+static void output_borrowed(obs_source_t *source, struct borrowed_plane *plane,
+			    uint64_t timestamp)
+{
+	struct obs_source_frame2 frame = {
+		.data = {plane->data},
+		.linesize = {WIDTH * 4},
+		.width = WIDTH,
+		.height = HEIGHT,
+		.timestamp = timestamp,
+		.format = VIDEO_FORMAT_BGRA,
+		.range = VIDEO_RANGE_FULL,
+	};
+
+	obs_source_output_video2_borrowed(source, &frame, release_plane, plane);
+}
+
+static int setup(void **state)
+{
+	if (!obs_startup("en-US", NULL, NULL)) {
+		*state = NULL;
+		return 0;
+	}
+
+	obs_register_source(&test_async_source);
+	*state = obs_source_create_private("test_async_source", "test", NULL);
+	return 0;
+}
+
+static int teardown(void **state)
+{
+	if (*state)
+		obs_source_release(*state);
+	if (obs_initialized())
+		obs_shutdown();
+	return 0;
+}
+
+static obs_source_t *get_source(void **state)
+{
+	/* obs_startup needs a windowing system for hotkeys */
+	if (!*state)
+		skip();
+	return *state;
+}
+
+static void borrowed_frame_lifecycle_test(void **state)
+{
+	obs_source_t *source = get_source(state);
+	struct borrowed_plane plane = {0};
+	struct obs_source_frame *frame;
+
+	output_borrowed(source, &plane, 1);
+	assert_int_equal(plane.releases, 0);
+
+	obs_source_video_tick(source, 0.0f);
+	frame = obs_source_get_frame(source);
+	assert_non_null(frame);
+	assert_true(frame->borrowed);
+	assert_ptr_equal(frame->data[0], plane.data);
+	assert_int_equal(plane.releases, 0);
+
+	/* the planes have to go back to the source even when the frame is
+	 * released without one */
+	obs_source_release_frame(NULL, frame);
+	assert_int_equal(plane.releases, 1);
+
+	obs_source_video_tick(source, 0.0f);
+	assert_null(obs_source_get_frame(source));
+	assert_int_equal(plane.releases, 1);
+}
+
+static void borrowed_frame_dropped_test(void **state)
+{
+	obs_source_t *source = get_source(state);
+	struct borrowed_plane planes[MAX_QUEUED + 1] = {0};
+
+	/* once the queue is full it is flushed, and the frame that didn't fit
+	 * is handed straight back */
+	for (size_t i = 0; i < MAX_QUEUED + 1; i++)
+		output_borrowed(source, &planes[i], i + 1);
+
+	for (size_t i = 0; i < MAX_QUEUED + 1; i++)
+		assert_int_equal(planes[i].releases, 1);
+}
+
+static void borrowed_frame_destroy_test(void **state)
+{
+	obs_source_t *source = get_source(state);
+	struct borrowed_plane planes[2] = {0};
+	struct obs_source_frame *frame;
+
+	output_borrowed(source, &planes[0], 1);
+	output_borrowed(source, &planes[1], 2);
+
+	obs_source_video_tick(source, 0.0f);
+	frame = obs_source_get_frame(source);
+	assert_non_null(frame);
+	obs_source_release_frame(source, frame);
+	assert_int_equal(planes[0].releases, 1);
+
+	obs_source_release(source);
+	*state = NULL;
+	assert_int_equal(planes[1].releases, 1);
+}
+
+static void cached_frame_not_borrowed_test(void **state)
+{
+	obs_source_t *source = get_source(state);
+	struct borrowed_plane plane = {0};
+	struct obs_source_frame2 frame = {
+		.data = {plane.data},
+		.linesize = {WIDTH * 4},
+		.width = WIDTH,
+		.height = HEIGHT,
+		.timestamp = 1,
+		.format = VIDEO_FORMAT_BGRA,
+		.range = VIDEO_RANGE_FULL,
+	};
+	struct obs_source_frame *out;
+
+	obs_source_output_video2(source, &frame);
+
+	obs_source_video_tick(source, 0.0f);
+	out = obs_source_get_frame(source);
+	assert_non_null(out);
+	assert_false(out->borrowed);
+	assert_ptr_not_equal(out->data[0], plane.data);
+	obs_source_release_frame(source, out);
+	assert_int_equal(plane.releases, 0);
+}
+
+int main()
+{
+	const struct CMUnitTest tests[] = {
+		cmocka_unit_test_setup_teardown(borrowed_frame_lifecycle_test,
+						setup, teardown),
+		cmocka_unit_test_setup_teardown(borrowed_frame_dropped_test,
+						setup, teardown),
+		cmocka_unit_test_setup_teardown(borrowed_frame_destroy_test,
+						setup, teardown),
+		cmocka_unit_test_setup_teardown(cached_frame_not_borrowed_test,
+						setup, teardown),
+	};
+
+	return cmocka_run_group_tests(tests, NULL, NULL);
+}
@@ -0,0 +1,69 @@
+#include <stdarg.h>
+#include <stddef.h>
+#include <setjmp.h>
+#include <cmocka.h>
+
+#include <util/bmem.h>
+
+static void bmem_pool_reuse_test(void **state)
+{
+	struct bpool_stats before, after;
+	long allocs = bnum_allocs();
+	uint8_t *a, *b;
+
+	bpool_trim();
+	bpool_get_stats(&before);
+
+	a = bpool_malloc(1000);
+	assert_non_null(a);
+	assert_int_equal(((uintptr_t)a) % base_get_alignment(), 0);
+	memset(a, 0xAB, 1000);
+	assert_int_equal(bnum_allocs(), allocs + 1);
+
+	bpool_free(a);
+	assert_int_equal(bnum_allocs(), allocs);
+
+	/* same size class, should get the cached block back */
+	b = bpool_malloc(600);
+	assert_ptr_equal(a, b);
+	bpool_free(b);
+
+	bpool_get_stats(&after);
+	assert_int_equal(after.allocs - before.allocs, 2);
+	assert_int_equal(after.reused - before.reused, 1);
+	assert_int_equal(after.cached_blocks, 1);
+	assert_int_equal(after.cached_bytes, 1024);
+
+	bpool_trim();
+	bpool_get_stats(&after);
+	assert_int_equal(after.cached_blocks, 0);
+}
+
+static void bmem_pool_oversized_test(void **state)
+{
+	struct bpool_stats before, after;
+	size_t size = 16 * 1024 * 1024;
+	uint8_t *a;
+
+	bpool_get_stats(&before);
+
+	a = bpool_malloc(size);
+	assert_non_null(a);
+	a[0] = 1;
+	a[size - 1] = 1;
+	bpool_free(a);
+
+	bpool_get_stats(&after);
+	assert_int_equal(after.oversized - before.oversized, 1);
+	assert_int_equal(after.cached_blocks, before.cached_blocks);
+}
+
+int main()
+{
+	const struct CMUnitTest tests[] = {
+		cmocka_unit_test(bmem_pool_reuse_test),
+		cmocka_unit_test(bmem_pool_oversized_test),
+	};
+
+	return cmocka_run_group_tests(tests, NULL, NULL);
+}
@@ -0,0 +1,220 @@
+#include <stdarg.h>
+#include <stddef.h>
+#include <setjmp.h>
+#include <cmocka.h>
+
+#include <string.h>
+
+#include "rtmp-congestion.h"
+
+/* ------------------------------------------------------------------------- */
+/* simulated link
+ *
+ * Everything runs on a virtual clock in 10 ms ticks, so the results are the
+ * same on every run.  The encoder produces whatever the controller asks for
+ * into the output queue, which is moved into a fixed size socket buffer,
+ * which drains at the link capacity of the current trace step.  Whatever is
+ * sitting in the socket buffer adds to the RTT, like a bottleneck queue. */
+
+#define TICK_NS (10ULL * 1000000ULL)
+#define SAMPLE_TICKS 10
+#define BASE_RTT_USEC 40000
+#define SOCKET_BUFFER (512 * 1024)
+#define MAX_KBPS 6000
+#define MIN_KBPS 300
+
+struct trace_step {
+	double seconds;
+	double capacity_kbps;
+};
+
+struct sim_stats {
+	double min_kbps;
+	double max_kbps;
+	double avg_kbps;
+	double max_delay_usec;
+	double last_kbps;
+};
+
+struct sim {
+	const struct congestion_controller_info *cc;
+	void *data;
+	bool tcp_info;
+
+	uint64_t time_ns;
+	uint64_t ticks;
+	double target_kbps;
+	double queue;
+	double socket;
+	uint64_t bytes_sent;
+};
+
+static void sim_init(struct sim *sim, bool tcp_info)
+{
+	memset(sim, 0, sizeof(*sim));
+	sim->cc = congestion_controller_find("delay_gradient");
+	sim->data = sim->cc->create(MAX_KBPS, MIN_KBPS);
+	sim->tcp_info = tcp_info;
+	sim->target_kbps = MAX_KBPS;
+}
+
+static void sim_free(struct sim *sim)
+{
+	sim->cc->destroy(sim->data);
+}
+
+/* runs one step of the trace, only collecting stats after settle seconds */
+static void sim_run(struct sim *sim, const struct trace_step *step,
+		    double settle, struct sim_stats *stats)
+{
+	const double tick = (double)TICK_NS / 1000000000.0;
+	uint64_t ticks = (uint64_t)(step->seconds / tick);
+	uint64_t settle_ticks = (uint64_t)(settle / tick);
+	double capacity = step->capacity_kbps * 1000.0 / 8.0;
+	double total_kbps = 0.0;
+
+	stats->min_kbps = 1e12;
+	stats->max_kbps = 0.0;
+	stats->max_delay_usec = 0.0;
+
+	for (uint64_t i = 0; i < ticks; i++) {
+		double produced = sim->target_kbps * 1000.0 / 8.0 * tick;
+		double space = SOCKET_BUFFER - sim->socket;
+		double moved = sim->queue + produced < space
+				       ? sim->queue + produced
+				       : space;
+		double drained;
+		double buffer_usec =
+			sim->queue / (sim->target_kbps * 1000.0 / 8.0) * 1e6;
+		double rtt_usec = BASE_RTT_USEC + sim->socket / capacity * 1e6;
+
+		sim->queue += produced - moved;
+		sim->socket += moved;
+		sim->bytes_sent += (uint64_t)moved;
+
+		drained = capacity * tick;
+		sim->socket = sim->socket > drained ? sim->socket - drained
+						    : 0.0;
+
+		sim->time_ns += TICK_NS;
+		sim->ticks++;
+
+		if (sim->ticks % SAMPLE_TICKS == 0) {
+			struct congestion_sample sample = {
+				.time_ns = sim->time_ns,
+				.bytes_sent = sim->bytes_sent,
+				.buffer_usec = (int64_t)buffer_usec,
+			};
+
+			if (sim->tcp_info) {
+				sample.has_tcp_info = true;
+				sample.rtt_usec = (uint32_t)rtt_usec;
+				sample.cwnd_bytes = SOCKET_BUFFER;
+				sample.unacked_bytes = (uint32_t)sim->socket;
+			}
+
+			sim->target_kbps =
+				(double)sim->cc->update(sim->data, &sample);
+		}
+
+		if (i < settle_ticks)
+			continue;
+
+		if (sim->target_kbps < stats->min_kbps)
+			stats->min_kbps = sim->target_kbps;
+		if (sim->target_kbps > stats->max_kbps)
+			stats->max_kbps = sim->target_kbps;
+		total_kbps += sim->target_kbps;
+		if (buffer_usec + rtt_usec - BASE_RTT_USEC >
+		    stats->max_delay_usec)
+			stats->max_delay_usec =
+				buffer_usec + rtt_usec - BASE_RTT_USEC;
+	}
+
+	stats->avg_kbps = total_kbps / (double)(ticks - settle_ticks);
+	stats->last_kbps = sim->target_kbps;
+}
+
+/* ------------------------------------------------------------------------- */
+
+static void congestion_find_test(void **state)
+{
+	assert_ptr_equal(congestion_controller_find("delay_gradient"),
+			 &delay_gradient_controller);
+	assert_null(congestion_controller_find("nope"));
+	assert_null(congestion_controller_find(NULL));
+}
+
+static void congestion_unconstrained_test(void **state)
+{
+	const struct trace_step step = {30.0, 20000.0};
+	struct sim_stats stats;
+	struct sim sim;
+
+	sim_init(&sim, true);
+	sim_run(&sim, &step, 0.0, &stats);
+
+	/* plenty of capacity, the bitrate should never be touched */
+	assert_true(stats.min_kbps >= MAX_KBPS);
+	assert_true(stats.max_delay_usec < 30000.0);
+
+	sim_free(&sim);
+}
+
+static void congestion_cellular_test(void **state)
+{
+	const struct trace_step good = {20.0, 8000.0};
+	const struct trace_step bad = {40.0, 2500.0};
+	const struct trace_step recovered = {40.0, 8000.0};
+	struct sim_stats stats;
+	struct sim sim;
+
+	sim_init(&sim, true);
+	sim_run(&sim, &good, 0.0, &stats);
+	assert_true(stats.min_kbps >= MAX_KBPS);
+
+	/* settles around the new capacity without a sawtooth, and without
+	 * letting the queue grow into seconds of latency */
+	sim_run(&sim, &bad, 10.0, &stats);
+	assert_true(stats.max_kbps <= 2500.0 * 1.05);
+	assert_true(stats.min_kbps >= 2500.0 * 0.9);
+	assert_true(stats.max_delay_usec < 100000.0);
+
+	/* and finds its way back up once the link recovers */
+	sim_run(&sim, &recovered, 0.0, &stats);
+	assert_true(stats.last_kbps >= MAX_KBPS * 0.9);
+
+	sim_free(&sim);
+}
+
+static void congestion_no_tcp_info_test(void **state)
+{
+	const struct trace_step good = {10.0, 8000.0};
+	const struct trace_step bad = {60.0, 2500.0};
+	struct sim_stats stats;
+	struct sim sim;
+
+	/* without socket state only the output queue can be watched, which
+	 * only starts growing once the socket buffer is full, so it overshoots
+	 * more, but it still has to track the link capacity */
+	sim_init(&sim, false);
+	sim_run(&sim, &good, 0.0, &stats);
+	sim_run(&sim, &bad, 20.0, &stats);
+	assert_true(stats.avg_kbps <= 2500.0 * 1.2);
+	assert_true(stats.avg_kbps >= 2500.0 * 0.8);
+	assert_true(stats.max_delay_usec < 3000000.0);
+
+	sim_free(&sim);
+}
+
+int main()
+{
+	const struct CMUnitTest tests[] = {
+		cmocka_unit_test(congestion_find_test),
+		cmocka_unit_test(congestion_unconstrained_test),
+		cmocka_unit_test(congestion_cellular_test),
+		cmocka_unit_test(congestion_no_tcp_info_test),
+	};
+
+	return cmocka_run_group_tests(tests, NULL, NULL);
+}
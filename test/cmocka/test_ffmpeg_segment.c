@@ -0,0 +1,257 @@
+#include <stdarg.h>
+#include <stddef.h>
+#include <setjmp.h>
+#include <cmocka.h>
+
+#include <stdio.h>
+#include <string.h>
+#include <media-io/media-remux.h>
+#include <util/platform.h>
+#include <util/threading.h>
+
+#include "obs-ffmpeg-remux.h"
+#include "obs-ffmpeg-segment.h"
+
+#define SEC_USEC 1000000LL
+#define WAIT_MS 5000
+
+/* ------------------------------------------------------------------------- */
+/* split decision and segment names                                          */
+
+static struct encoder_packet video_packet(bool keyframe, int64_t dts_usec)
+{
+	struct encoder_packet packet = {
+		.type = OBS_ENCODER_VIDEO,
+		.size = 1000,
+		.keyframe = keyframe,
+		.dts_usec = dts_usec,
+	};
+	return packet;
+}
+
+static void split_only_on_first_video_keyframe_test(void **state)
+{
+	struct encoder_packet packet = video_packet(true, 0);
+
+	assert_true(ffmpeg_segment_should_split(&packet, 1, 0, 0, 0, true));
+
+	packet.keyframe = false;
+	assert_false(ffmpeg_segment_should_split(&packet, 1, 0, 0, 0, true));
+
+	packet.keyframe = true;
+	packet.track_idx = 1;
+	assert_false(ffmpeg_segment_should_split(&packet, 1, 0, 0, 0, true));
+
+	packet.track_idx = 0;
+	packet.type = OBS_ENCODER_AUDIO;
+	assert_false(ffmpeg_segment_should_split(&packet, 1, 0, 0, 0, true));
+
+	/* nothing written to the current file yet */
+	packet.type = OBS_ENCODER_VIDEO;
+	assert_false(ffmpeg_segment_should_split(&packet, 0, 0, 0, 0, true));
+	UNUSED_PARAMETER(state);
+}
+
+static void split_on_limits_test(void **state)
+{
+	struct encoder_packet packet = video_packet(true, 10 * SEC_USEC);
+
+	/* no limits, no split */
+	assert_false(
+		ffmpeg_segment_should_split(&packet, 1 << 30, 0, 0, 0, false));
+
+	/* the packet that would reach the size limit starts the next file */
+	assert_false(
+		ffmpeg_segment_should_split(&packet, 8999, 0, 10000, 0, false));
+	assert_true(
+		ffmpeg_segment_should_split(&packet, 9000, 0, 10000, 0, false));
+
+	/* time is measured from the first dts of the current file */
+	assert_true(ffmpeg_segment_should_split(&packet, 1, 0, 0,
+						10 * SEC_USEC, false));
+	assert_false(ffmpeg_segment_should_split(&packet, 1, 1, 0,
+						 10 * SEC_USEC, false));
+	UNUSED_PARAMETER(state);
+}
+
+static void check_path(const char *base_path, int segment,
+		       const char *expected)
+{
+	struct dstr path = {0};
+
+	ffmpeg_segment_path(&path, base_path, segment);
+	assert_string_equal(path.array, expected);
+	dstr_free(&path);
+}
+
+static void segment_path_test(void **state)
+{
+	check_path("/rec/a.mp4", 2, "/rec/a_002.mp4");
+	check_path("/rec/a.b.mkv", 12, "/rec/a.b_012.mkv");
+	check_path("/rec/a.mp4", 1000, "/rec/a_1000.mp4");
+	check_path("/rec/a", 3, "/rec/a_003");
+	check_path("/rec.d/a", 3, "/rec.d/a_003");
+	check_path("a.mov", 4, "a_004.mov");
+	UNUSED_PARAMETER(state);
+}
+
+/* ------------------------------------------------------------------------- */
+/* remux queue, with a fake remuxer that runs until finished or cancelled  */
+
+struct media_remux_job {
+	char *out;
+};
+
+static volatile long jobs_started;
+static volatile long jobs_cancelled;
+static volatile bool jobs_finish;
+
+bool media_remux_job_create(media_remux_job_t *job, const char *in_filename,
+			    const char *out_filename)
+{
+	FILE *f = os_fopen(out_filename, "wb");
+
+	if (!f)
+		return false;
+
+	fputs("progressive", f);
+	fclose(f);
+
+	*job = bzalloc(sizeof(struct media_remux_job));
+	(*job)->out = bstrdup(out_filename);
+	UNUSED_PARAMETER(in_filename);
+	return true;
+}
+
+bool media_remux_job_process(media_remux_job_t job,
+			     media_remux_progress_callback callback,
+			     void *data)
+{
+	os_atomic_inc_long(&jobs_started);
+
+	while (!os_atomic_load_bool(&jobs_finish)) {
+		if (!callback(data, 50.0f)) {
+			os_atomic_inc_long(&jobs_cancelled);
+			return false;
+		}
+		os_sleep_ms(1);
+	}
+
+	UNUSED_PARAMETER(job);
+	return true;
+}
+
+void media_remux_job_destroy(media_remux_job_t job)
+{
+	bfree(job->out);
+	bfree(job);
+}
+
+static void write_file(const char *path, const char *text)
+{
+	FILE *f = os_fopen(path, "wb");
+	assert_non_null(f);
+	fputs(text, f);
+	fclose(f);
+}
+
+static bool file_is(const char *path, const char *text)
+{
+	char buf[32] = {0};
+	FILE *f = os_fopen(path, "rb");
+	bool same;
+
+	if (!f)
+		return false;
+
+	same = fgets(buf, sizeof(buf), f) && strcmp(buf, text) == 0;
+	fclose(f);
+	return same;
+}
+
+static bool wait_until(volatile long *val, long target)
+{
+	for (int i = 0; i < WAIT_MS; i++) {
+		if (os_atomic_load_long(val) >= target)
+			return true;
+		os_sleep_ms(1);
+	}
+	return false;
+}
+
+static void remux_replaces_file_test(void **state)
+{
+	os_atomic_set_long(&jobs_started, 0);
+	os_atomic_set_bool(&jobs_finish, true);
+
+	write_file("segment_001.mp4", "fragmented");
+	ffmpeg_remux_queue_add("segment_001.mp4");
+
+	for (int i = 0; i < WAIT_MS; i++) {
+		if (file_is("segment_001.mp4", "progressive"))
+			break;
+		os_sleep_ms(1);
+	}
+
+	ffmpeg_remux_queue_free();
+
+	assert_true(file_is("segment_001.mp4", "progressive"));
+	assert_false(os_file_exists("segment_001.remux.mp4"));
+	assert_int_equal(jobs_started, 1);
+
+	os_unlink("segment_001.mp4");
+	UNUSED_PARAMETER(state);
+}
+
+static void remux_cancelled_on_free_test(void **state)
+{
+	static const char *paths[] = {"segment_001.mp4", "segment_002.mp4",
+				      "segment_003.mp4", "segment_004.mp4",
+				      "segment_005.mp4"};
+	static const char *temp_paths[] = {
+		"segment_001.remux.mp4", "segment_002.remux.mp4",
+		"segment_003.remux.mp4", "segment_004.remux.mp4",
+		"segment_005.remux.mp4"};
+	const size_t count = sizeof(paths) / sizeof(paths[0]);
+
+	os_atomic_set_long(&jobs_started, 0);
+	os_atomic_set_long(&jobs_cancelled, 0);
+	os_atomic_set_bool(&jobs_finish, false);
+
+	/* more files than there can be remux threads, so some are still
+	 * queued when the module unloads */
+	for (size_t i = 0; i < count; i++) {
+		write_file(paths[i], "fragmented");
+		ffmpeg_remux_queue_add(paths[i]);
+	}
+
+	assert_true(wait_until(&jobs_started, 1));
+
+	/* unloading cancels the running jobs and drops the queued ones,
+	 * leaving every file as it was */
+	ffmpeg_remux_queue_free();
+
+	assert_true(jobs_started < (long)count);
+	assert_int_equal(jobs_cancelled, jobs_started);
+
+	for (size_t i = 0; i < count; i++) {
+		assert_true(file_is(paths[i], "fragmented"));
+		assert_false(os_file_exists(temp_paths[i]));
+		os_unlink(paths[i]);
+	}
+
+	UNUSED_PARAMETER(state);
+}
+
+int main()
+{
+	const struct CMUnitTest tests[] = {
+		cmocka_unit_test(split_only_on_first_video_keyframe_test),
+		cmocka_unit_test(split_on_limits_test),
+		cmocka_unit_test(segment_path_test),
+		cmocka_unit_test(remux_replaces_file_test),
+		cmocka_unit_test(remux_cancelled_on_free_test),
+	};
+
+	return cmocka_run_group_tests(tests, NULL, NULL);
+}
@@ -0,0 +1,444 @@
+#include <stdarg.h>
+#include <stddef.h>
+#include <setjmp.h>
+#include <cmocka.h>
+
+#include <util/darray.h>
+#include <util/array-serializer.h>
+
+#include "flv-mux.h"
+#include "rtmp-helpers.h"
+
+#define STREAM_ID 1
+
+/* ------------------------------------------------------------------------- */
+/* the flat muxer flv-mux.c used before tags were split around the payload   */
+
+static void ref_tag_header(struct serializer *s, uint8_t type, size_t size,
+			   int32_t time_ms)
+{
+	s_w8(s, type);
+	s_wb24(s, (uint32_t)size);
+	s_wb24(s, time_ms);
+	s_w8(s, (time_ms >> 24) & 0x7F);
+	s_wb24(s, 0);
+}
+
+static void ref_packet_mux(struct encoder_packet *packet, int32_t dts_offset,
+			   bool is_header, struct array_output_data *out)
+{
+	int32_t time_ms = get_ms_time(packet, packet->dts) - dts_offset;
+	struct serializer s;
+
+	array_output_serializer_init(&s, out);
+
+	if (!packet->data || !packet->size)
+		return;
+
+	if (packet->type == OBS_ENCODER_VIDEO) {
+		int64_t offset = packet->pts - packet->dts;
+
+		ref_tag_header(&s, RTMP_PACKET_TYPE_VIDEO, packet->size + 5,
+			       time_ms);
+		s_w8(&s, packet->keyframe ? 0x17 : 0x27);
+		s_w8(&s, is_header ? 0 : 1);
+		s_wb24(&s, get_ms_time(packet, offset));
+	} else {
+		ref_tag_header(&s, RTMP_PACKET_TYPE_AUDIO, packet->size + 2,
+			       time_ms);
+		s_w8(&s, 0xaf);
+		s_w8(&s, is_header ? 0 : 1);
+	}
+
+	s_write(&s, packet->data, packet->size);
+	s_wb32(&s, (uint32_t)serializer_get_pos(&s) - 1);
+}
+
+static void s_conststring(struct serializer *s, const char *str)
+{
+	s_wb16(s, (uint16_t)strlen(str));
+	s_write(s, str, strlen(str));
+}
+
+static void ref_additional_packet_mux(struct encoder_packet *packet,
+				      int32_t dts_offset, bool is_header,
+				      struct array_output_data *out)
+{
+	int32_t time_ms = get_ms_time(packet, packet->dts) - dts_offset;
+	uint32_t u29 = 1 | (((uint32_t)packet->size + 2) << 1);
+	struct array_output_data body;
+	struct serializer s, b;
+
+	array_output_serializer_init(&s, out);
+
+	if (!packet->data || !packet->size)
+		return;
+
+	array_output_serializer_init(&b, &body);
+	s_w8(&b, AMF_STRING);
+	s_conststring(&b, "additionalMedia");
+	s_w8(&b, AMF_OBJECT);
+	s_conststring(&b, "id");
+	s_w8(&b, AMF_STRING);
+	s_conststring(&b, "stream0");
+	s_conststring(&b, "media");
+	s_w8(&b, AMF_AVMPLUS);
+	s_w8(&b, AMF3_BYTE_ARRAY);
+
+	/* the test packets stay below 0x1FFFFF */
+	if (u29 > 0x3FFF)
+		s_w8(&b, 0x80 | (u29 >> 14));
+	if (u29 > 0x7F)
+		s_w8(&b, 0x80 | ((u29 >> 7) & 0x7F));
+	s_w8(&b, u29 & 0x7F);
+
+	s_w8(&b, 0xaf);
+	s_w8(&b, is_header ? 0 : 1);
+	s_write(&b, packet->data, packet->size);
+	s_wb24(&b, AMF_OBJECT_END);
+
+	ref_tag_header(&s, RTMP_PACKET_TYPE_INFO, body.bytes.num, time_ms);
+	s_write(&s, body.bytes.array, body.bytes.num);
+	s_wb32(&s, (uint32_t)serializer_get_pos(&s) - 1);
+
+	array_output_serializer_free(&body);
+}
+
+/* ------------------------------------------------------------------------- */
+
+static uint8_t payload[70000];
+
+static struct encoder_packet make_packet(enum obs_encoder_type type,
+					 size_t size, int64_t dts)
+{
+	struct encoder_packet packet = {
+		.type = type,
+		.data = size ? payload : NULL,
+		.size = size,
+		.timebase_num = 1,
+		.timebase_den = 1000,
+		.dts = dts,
+		.pts = dts + 66,
+	};
+	return packet;
+}
+
+static void flatten_tag(const struct flv_tag *tag,
+			struct array_output_data *out)
+{
+	struct serializer s;
+
+	array_output_serializer_init(&s, out);
+	s_write(&s, flv_tag_header(tag), tag->header_size);
+	s_write(&s, tag->payload, tag->payload_size);
+	s_write(&s, flv_tag_trailer(tag), flv_tag_trailer_size(tag));
+}
+
+static void assert_same_bytes(struct array_output_data *a,
+			      struct array_output_data *b)
+{
+	assert_int_equal(a->bytes.num, b->bytes.num);
+	assert_memory_equal(a->bytes.array, b->bytes.array, a->bytes.num);
+}
+
+static const size_t sizes[] = {1, 5, 127, 128, 129, 4096, 69999};
+#define NUM_SIZES (sizeof(sizes) / sizeof(sizes[0]))
+
+/* 0x1000000 and above only fit with the extended timestamp byte */
+static const int64_t times[] = {0, 33, 0xFFFFFF, 0x1000000, 0x7FFFFFF0};
+
+static void flv_tag_matches_old_test(void **state)
+{
+	struct flv_tag tag;
+
+	flv_tag_init(&tag);
+
+	for (size_t si = 0; si < NUM_SIZES; si++) {
+		for (size_t ti = 0; ti < sizeof(times) / sizeof(times[0]);
+		     ti++) {
+			for (int variant = 0; variant < 8; variant++) {
+				struct encoder_packet packet = make_packet(
+					(variant & 1) ? OBS_ENCODER_VIDEO
+						      : OBS_ENCODER_AUDIO,
+					sizes[si], times[ti]);
+				bool is_header = !!(variant & 2);
+				int32_t dts_offset = (variant & 4) ? 5 : 0;
+				struct array_output_data ref, got;
+
+				packet.keyframe = !!(variant & 4);
+
+				ref_packet_mux(&packet, dts_offset, is_header,
+					       &ref);
+				assert_true(flv_packet_mux_tag(
+					&tag, &packet, dts_offset, is_header));
+				assert_ptr_equal(tag.payload, payload);
+				assert_int_equal(tag.payload_size, sizes[si]);
+
+				flatten_tag(&tag, &got);
+				assert_same_bytes(&ref, &got);
+				assert_int_equal(flv_tag_size(&tag),
+						 ref.bytes.num);
+
+				array_output_serializer_free(&ref);
+				array_output_serializer_free(&got);
+			}
+		}
+	}
+
+	flv_tag_free(&tag);
+	UNUSED_PARAMETER(state);
+}
+
+static void flv_additional_tag_matches_old_test(void **state)
+{
+	struct flv_tag tag;
+
+	flv_tag_init(&tag);
+
+	for (size_t si = 0; si < NUM_SIZES; si++) {
+		for (size_t ti = 0; ti < sizeof(times) / sizeof(times[0]);
+		     ti++) {
+			struct encoder_packet packet = make_packet(
+				OBS_ENCODER_AUDIO, sizes[si], times[ti]);
+			struct array_output_data ref, got;
+			bool is_header = ti == 0;
+
+			ref_additional_packet_mux(&packet, 5, is_header, &ref);
+			assert_true(flv_additional_packet_mux_tag(
+				&tag, &packet, 5, is_header, 1));
+			assert_ptr_equal(tag.payload, payload);
+
+			flatten_tag(&tag, &got);
+			assert_same_bytes(&ref, &got);
+
+			array_output_serializer_free(&ref);
+			array_output_serializer_free(&got);
+		}
+	}
+
+	flv_tag_free(&tag);
+	UNUSED_PARAMETER(state);
+}
+
+static void flv_empty_packet_test(void **state)
+{
+	struct encoder_packet video = make_packet(OBS_ENCODER_VIDEO, 0, 0);
+	struct encoder_packet audio = make_packet(OBS_ENCODER_AUDIO, 0, 0);
+	struct flv_tag tag;
+
+	flv_tag_init(&tag);
+	assert_false(flv_packet_mux_tag(&tag, &video, 0, false));
+	assert_false(flv_packet_mux_tag(&tag, &audio, 0, true));
+	assert_false(flv_additional_packet_mux_tag(&tag, &audio, 0, false, 1));
+	flv_tag_free(&tag);
+	UNUSED_PARAMETER(state);
+}
+
+/* ------------------------------------------------------------------------- */
+
+struct capture {
+	DARRAY(uint8_t) bytes;
+};
+
+static int capture_send(RTMPSockBuf *sb, const char *data, int len, void *arg)
+{
+	struct capture *cap = arg;
+	da_push_back_array(cap->bytes, (const uint8_t *)data, len);
+	UNUSED_PARAMETER(sb);
+	return len;
+}
+
+static void rtmp_init_capture(RTMP *r, struct capture *cap, int chunk_size)
+{
+	RTMP_Init(r);
+	r->m_bCustomSend = 1;
+	r->m_customSendFunc = capture_send;
+	r->m_customSendParam = cap;
+	r->m_outChunkSize = chunk_size;
+	r->Link.streams[0].id = STREAM_ID;
+	r->m_sb.sb_socket = -1;
+}
+
+static void rtmp_free_capture(RTMP *r, struct capture *cap)
+{
+	RTMP_Close(r);
+	da_free(cap->bytes);
+}
+
+/* sends the tag with RTMP_WriteV, with the header split in two so the tag
+ * header is read across buffers as well */
+static int write_tag_v(RTMP *r, const struct flv_tag *tag)
+{
+	const uint8_t *header = flv_tag_header(tag);
+	AVal vec[4] = {
+		{(char *)header, 3},
+		{(char *)header + 3, (int)tag->header_size - 3},
+		{(char *)tag->payload, (int)tag->payload_size},
+		{(char *)flv_tag_trailer(tag), (int)flv_tag_trailer_size(tag)},
+	};
+
+	return RTMP_WriteV(r, vec, 4, 0);
+}
+
+static void rtmp_writev_matches_write(int chunk_size)
+{
+	struct capture old_cap = {0}, new_cap = {0};
+	RTMP old_rtmp, new_rtmp;
+	struct flv_tag tag;
+	int64_t dts = 0;
+
+	rtmp_init_capture(&old_rtmp, &old_cap, chunk_size);
+	rtmp_init_capture(&new_rtmp, &new_cap, chunk_size);
+	flv_tag_init(&tag);
+
+	for (int i = 0; i < 200; i++) {
+		/* repeat sizes and timestamps now and then so every header
+		 * compression level gets used */
+		size_t size = sizes[(i / 3) % NUM_SIZES];
+		enum obs_encoder_type type = (i % 3) ? OBS_ENCODER_AUDIO
+						     : OBS_ENCODER_VIDEO;
+		struct encoder_packet packet;
+		struct array_output_data flat;
+
+		if (i == 100)
+			dts = 0xFFFF00;
+		else if (i % 4)
+			dts += 21;
+
+		packet = make_packet(type, size, dts);
+		assert_true(flv_packet_mux_tag(&tag, &packet, 0, i < 2));
+		flatten_tag(&tag, &flat);
+
+		assert_int_equal(RTMP_Write(&old_rtmp, (char *)flat.bytes.array,
+					    (int)flat.bytes.num, 0),
+				 (int)flat.bytes.num);
+		assert_int_equal(write_tag_v(&new_rtmp, &tag),
+				 (int)flat.bytes.num);
+
+		array_output_serializer_free(&flat);
+	}
+
+	assert_int_equal(old_cap.bytes.num, new_cap.bytes.num);
+	assert_memory_equal(old_cap.bytes.array, new_cap.bytes.array,
+			    old_cap.bytes.num);
+
+	flv_tag_free(&tag);
+	rtmp_free_capture(&old_rtmp, &old_cap);
+	rtmp_free_capture(&new_rtmp, &new_cap);
+}
+
+static void rtmp_writev_matches_write_test(void **state)
+{
+	rtmp_writev_matches_write(128);
+	rtmp_writev_matches_write(4096);
+	UNUSED_PARAMETER(state);
+}
+
+static void rtmp_writev_chunk_header_test(void **state)
+{
+	struct encoder_packet packet = make_packet(OBS_ENCODER_AUDIO, 298, 0);
+	struct capture cap = {0};
+	struct flv_tag tag;
+	RTMP r;
+	uint8_t *b;
+
+	rtmp_init_capture(&r, &cap, 128);
+	flv_tag_init(&tag);
+
+	/* a 300 byte body at timestamp 0 gets a full 12 byte header and is
+	 * split into 128 + 128 + 44 byte chunks */
+	assert_true(flv_packet_mux_tag(&tag, &packet, 0, false));
+	assert_int_equal(write_tag_v(&r, &tag), flv_tag_size(&tag));
+	assert_int_equal(cap.bytes.num, 12 + 300 + 2);
+
+	b = cap.bytes.array;
+	assert_int_equal(b[0], 0x04);
+	assert_int_equal(b[1] << 16 | b[2] << 8 | b[3], 0);
+	assert_int_equal(b[4] << 16 | b[5] << 8 | b[6], 300);
+	assert_int_equal(b[7], RTMP_PACKET_TYPE_AUDIO);
+	assert_int_equal(b[8] | b[9] << 8 | b[10] << 16 | b[11] << 24,
+			 STREAM_ID);
+	assert_int_equal(b[12], 0xaf);
+	assert_int_equal(b[13], 1);
+	assert_memory_equal(b + 14, payload, 126);
+	assert_int_equal(b[12 + 128], 0xc4);
+	assert_memory_equal(b + 12 + 129, payload + 126, 128);
+	assert_int_equal(b[12 + 129 + 128], 0xc4);
+	assert_memory_equal(b + 12 + 129 + 129, payload + 254, 44);
+
+	/* a delta of 0xFFFFFF or more is sent as 0xFFFFFF followed by the full
+	 * delta after the 8 byte type 1 header */
+	cap.bytes.num = 0;
+	packet.size = 299;
+	packet.dts = 0x1000000;
+	assert_true(flv_packet_mux_tag(&tag, &packet, 0, false));
+	assert_int_equal(write_tag_v(&r, &tag), flv_tag_size(&tag));
+	assert_int_equal(cap.bytes.num, 8 + 4 + 301 + 2);
+
+	b = cap.bytes.array;
+	assert_int_equal(b[0], 0x44);
+	assert_int_equal(b[1] << 16 | b[2] << 8 | b[3], 0xFFFFFF);
+	assert_int_equal(b[4] << 16 | b[5] << 8 | b[6], 301);
+	assert_int_equal(b[7], RTMP_PACKET_TYPE_AUDIO);
+	assert_int_equal(b[8] << 24 | b[9] << 16 | b[10] << 8 | b[11],
+			 0x1000000);
+	assert_int_equal(b[12 + 128], 0xc4);
+
+	/* same size and type, small delta: type 2 header, delta only */
+	cap.bytes.num = 0;
+	packet.dts = 0x1000000 + 21;
+	assert_true(flv_packet_mux_tag(&tag, &packet, 0, false));
+	assert_int_equal(write_tag_v(&r, &tag), flv_tag_size(&tag));
+	assert_int_equal(cap.bytes.num, 4 + 301 + 2);
+
+	b = cap.bytes.array;
+	assert_int_equal(b[0], 0x84);
+	assert_int_equal(b[1] << 16 | b[2] << 8 | b[3], 21);
+
+	flv_tag_free(&tag);
+	rtmp_free_capture(&r, &cap);
+	UNUSED_PARAMETER(state);
+}
+
+static void rtmp_writev_short_test(void **state)
+{
+	struct encoder_packet packet = make_packet(OBS_ENCODER_VIDEO, 100, 0);
+	struct capture cap = {0};
+	struct flv_tag tag;
+	RTMP r;
+
+	rtmp_init_capture(&r, &cap, 128);
+	flv_tag_init(&tag);
+	assert_true(flv_packet_mux_tag(&tag, &packet, 0, false));
+
+	/* less than a tag header */
+	AVal small = {(char *)flv_tag_header(&tag), 10};
+	assert_int_equal(RTMP_WriteV(&r, &small, 1, 0), 0);
+
+	/* a body size larger than the data given */
+	AVal header_only = {(char *)flv_tag_header(&tag),
+			    (int)tag.header_size};
+	assert_int_equal(RTMP_WriteV(&r, &header_only, 1, 0), 0);
+	assert_int_equal(cap.bytes.num, 0);
+
+	flv_tag_free(&tag);
+	rtmp_free_capture(&r, &cap);
+	UNUSED_PARAMETER(state);
+}
+
+int main()
+{
+	for (size_t i = 0; i < sizeof(payload); i++)
+		payload[i] = (uint8_t)(i * 7);
+
+	const struct CMUnitTest tests[] = {
+		cmocka_unit_test(flv_tag_matches_old_test),
+		cmocka_unit_test(flv_additional_tag_matches_old_test),
+		cmocka_unit_test(flv_empty_packet_test),
+		cmocka_unit_test(rtmp_writev_matches_write_test),
+		cmocka_unit_test(rtmp_writev_chunk_header_test),
+		cmocka_unit_test(rtmp_writev_short_test),
+	};
+
+	return cmocka_run_group_tests(tests, NULL, NULL);
+}
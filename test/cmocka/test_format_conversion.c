@@ -0,0 +1,257 @@
+#include <stdarg.h>
+#include <stddef.h>
+#include <setjmp.h>
+#include <stdlib.h>
+#include <string.h>
+#include <cmocka.h>
+
+#include <util/bmem.h>
+#include <media-io/format-conversion.h>
+
+/* odd block count so both the wide kernels and the remainder are used */
+#define WIDTH 44
+#define HEIGHT 6
+
+static const enum format_conversion_path paths[] = {
+	FORMAT_CONVERSION_PATH_SSE2,
+	FORMAT_CONVERSION_PATH_AVX2,
+};
+
+static const char *path_names[] = {"SSE2", "AVX2"};
+
+/* checks the conversion against the scalar reference with every path the
+ * CPU supports */
+static void for_each_path(void (*check)(void))
+{
+	for (size_t i = 0; i < sizeof(paths) / sizeof(paths[0]); i++) {
+		if (!format_conversion_set_path(paths[i])) {
+			print_message("%s not supported, skipped\n",
+				      path_names[i]);
+			continue;
+		}
+
+		check();
+	}
+
+	format_conversion_set_path(FORMAT_CONVERSION_PATH_AUTO);
+}
+
+static uint8_t *create_uyvx(void)
+{
+	uint8_t *data = bmalloc(WIDTH * HEIGHT * 4);
+
+	srand(1);
+	for (size_t i = 0; i < WIDTH * HEIGHT * 4; i++)
+		data[i] = (uint8_t)rand();
+	return data;
+}
+
+static inline const uint8_t *pixel(const uint8_t *uyvx, int x, int y)
+{
+	return uyvx + (y * WIDTH + x) * 4;
+}
+
+static inline int avg_chroma(const uint8_t *uyvx, int x, int y, int ch)
+{
+	return (pixel(uyvx, x, y)[ch] + pixel(uyvx, x + 1, y)[ch] +
+		pixel(uyvx, x, y + 1)[ch] + pixel(uyvx, x + 1, y + 1)[ch]) /
+	       4;
+}
+
+static void check_uyvx_to_i420(void)
+{
+	uint8_t *uyvx = create_uyvx();
+	uint8_t lum[WIDTH * HEIGHT];
+	uint8_t u[WIDTH * HEIGHT / 4];
+	uint8_t v[WIDTH * HEIGHT / 4];
+	uint8_t *output[] = {lum, u, v};
+	uint32_t linesize[] = {WIDTH, WIDTH / 2, WIDTH / 2};
+
+	compress_uyvx_to_i420(uyvx, WIDTH * 4, 0, HEIGHT, output, linesize);
+
+	for (int y = 0; y < HEIGHT; y++) {
+		for (int x = 0; x < WIDTH; x++)
+			assert_int_equal(lum[y * WIDTH + x],
+					 pixel(uyvx, x, y)[1]);
+	}
+
+	for (int y = 0; y < HEIGHT; y += 2) {
+		for (int x = 0; x < WIDTH; x += 2) {
+			int pos = y / 2 * WIDTH / 2 + x / 2;
+			assert_int_equal(u[pos], avg_chroma(uyvx, x, y, 0));
+			assert_int_equal(v[pos], avg_chroma(uyvx, x, y, 2));
+		}
+	}
+
+	bfree(uyvx);
+}
+
+static void check_uyvx_to_nv12(void)
+{
+	uint8_t *uyvx = create_uyvx();
+	uint8_t lum[WIDTH * HEIGHT];
+	uint8_t uv[WIDTH * HEIGHT / 2];
+	uint8_t *output[] = {lum, uv};
+	uint32_t linesize[] = {WIDTH, WIDTH};
+
+	compress_uyvx_to_nv12(uyvx, WIDTH * 4, 0, HEIGHT, output, linesize);
+
+	for (int y = 0; y < HEIGHT; y++) {
+		for (int x = 0; x < WIDTH; x++)
+			assert_int_equal(lum[y * WIDTH + x],
+					 pixel(uyvx, x, y)[1]);
+	}
+
+	for (int y = 0; y < HEIGHT; y += 2) {
+		for (int x = 0; x < WIDTH; x += 2) {
+			int pos = y / 2 * WIDTH + x;
+			assert_int_equal(uv[pos], avg_chroma(uyvx, x, y, 0));
+			assert_int_equal(uv[pos + 1],
+					 avg_chroma(uyvx, x, y, 2));
+		}
+	}
+
+	bfree(uyvx);
+}
+
+static void check_uyvx_to_i444(void)
+{
+	uint8_t *uyvx = create_uyvx();
+	uint8_t lum[WIDTH * HEIGHT];
+	uint8_t u[WIDTH * HEIGHT];
+	uint8_t v[WIDTH * HEIGHT];
+	uint8_t *output[] = {lum, u, v};
+	uint32_t linesize[] = {WIDTH, WIDTH, WIDTH};
+
+	convert_uyvx_to_i444(uyvx, WIDTH * 4, 0, HEIGHT, output, linesize);
+
+	for (int y = 0; y < HEIGHT; y++) {
+		for (int x = 0; x < WIDTH; x++) {
+			int pos = y * WIDTH + x;
+			assert_int_equal(lum[pos], pixel(uyvx, x, y)[1]);
+			assert_int_equal(u[pos], pixel(uyvx, x, y)[0]);
+			assert_int_equal(v[pos], pixel(uyvx, x, y)[2]);
+		}
+	}
+
+	bfree(uyvx);
+}
+
+static void check_decompress_420(void)
+{
+	uint8_t *planes = create_uyvx();
+	const uint8_t *input[] = {planes, planes + WIDTH * HEIGHT,
+				  planes + WIDTH * HEIGHT * 5 / 4};
+	uint32_t linesize[] = {WIDTH, WIDTH / 2, WIDTH / 2};
+	uint32_t output[WIDTH * HEIGHT];
+
+	decompress_420(input, linesize, 0, HEIGHT, (uint8_t *)output,
+		       WIDTH * 4);
+
+	for (int y = 0; y < HEIGHT; y++) {
+		for (int x = 0; x < WIDTH; x++) {
+			int chroma = y / 2 * WIDTH / 2 + x / 2;
+			uint32_t expected = (input[0][y * WIDTH + x] << 16) |
+					    (input[1][chroma] << 8) |
+					    input[2][chroma];
+			assert_int_equal(output[y * WIDTH + x], expected);
+		}
+	}
+
+	bfree(planes);
+}
+
+static void check_decompress_nv12(void)
+{
+	uint8_t *planes = create_uyvx();
+	const uint8_t *input[] = {planes, planes + WIDTH * HEIGHT};
+	uint32_t linesize[] = {WIDTH, WIDTH};
+	uint32_t output[WIDTH * HEIGHT];
+
+	decompress_nv12(input, linesize, 0, HEIGHT, (uint8_t *)output,
+			WIDTH * 4);
+
+	for (int y = 0; y < HEIGHT; y++) {
+		for (int x = 0; x < WIDTH; x++) {
+			const uint8_t *uv = input[1] + y / 2 * WIDTH + x / 2 * 2;
+			uint32_t expected = input[0][y * WIDTH + x] |
+					    (uv[0] << 8) | (uv[1] << 16);
+			assert_int_equal(output[y * WIDTH + x], expected);
+		}
+	}
+
+	bfree(planes);
+}
+
+static void check_decompress_422(bool leading_lum)
+{
+	uint8_t *packed = create_uyvx();
+	uint8_t output[WIDTH * HEIGHT * 4];
+
+	/* the width is taken from the linesizes as linesize / 2 input dwords,
+	 * so convert one line at a time */
+	for (int y = 0; y < HEIGHT; y++)
+		decompress_422(packed + y * WIDTH * 2, WIDTH, 0, 1,
+			       output + y * WIDTH * 4, WIDTH, leading_lum);
+
+	for (int y = 0; y < HEIGHT; y++) {
+		for (int x = 0; x < WIDTH; x += 2) {
+			const uint8_t *in = packed + y * WIDTH * 2 + x * 2;
+			const uint8_t *out = output + (y * WIDTH + x) * 4;
+
+			/* the first pixel is copied as is, the second one gets
+			 * the second luma value */
+			assert_memory_equal(out, in, 4);
+			if (leading_lum) {
+				assert_int_equal(out[4], in[2]);
+				assert_int_equal(out[5], in[1]);
+			} else {
+				assert_int_equal(out[4], in[0]);
+				assert_int_equal(out[5], in[3]);
+			}
+			assert_int_equal(out[6], in[2]);
+			assert_int_equal(out[7], in[3]);
+		}
+	}
+
+	bfree(packed);
+}
+
+static void check_decompress_yuy2(void)
+{
+	check_decompress_422(true);
+}
+
+static void check_decompress_uyvy(void)
+{
+	check_decompress_422(false);
+}
+
+#define PATH_TEST(name)                       \
+	static void name##_test(void **state) \
+	{                                     \
+		for_each_path(check_##name);  \
+	}
+
+PATH_TEST(uyvx_to_i420)
+PATH_TEST(uyvx_to_nv12)
+PATH_TEST(uyvx_to_i444)
+PATH_TEST(decompress_420)
+PATH_TEST(decompress_nv12)
+PATH_TEST(decompress_yuy2)
+PATH_TEST(decompress_uyvy)
+
+int main()
+{
+	const struct CMUnitTest tests[] = {
+		cmocka_unit_test(uyvx_to_i420_test),
+		cmocka_unit_test(uyvx_to_nv12_test),
+		cmocka_unit_test(uyvx_to_i444_test),
+		cmocka_unit_test(decompress_420_test),
+		cmocka_unit_test(decompress_nv12_test),
+		cmocka_unit_test(decompress_yuy2_test),
+		cmocka_unit_test(decompress_uyvy_test),
+	};
+
+	return cmocka_run_group_tests(tests, NULL, NULL);
+}
@@ -0,0 +1,474 @@
+#include <stdarg.h>
+#include <stddef.h>
+#include <setjmp.h>
+#include <cmocka.h>
+
+#include <stdio.h>
+#include <string.h>
+#include <util/bmem.h>
+
+#include "hls-packager.h"
+
+#define FPS 30
+#define GOP_FRAMES 60
+#define SAMPLE_RATE 48000
+
+struct file {
+	char *name;
+	DARRAY(uint8_t) data;
+	int writes;
+	bool removed;
+};
+
+struct files {
+	DARRAY(struct file) files;
+};
+
+static struct file *find_file(struct files *files, const char *name)
+{
+	for (size_t i = 0; i < files->files.num; i++) {
+		if (strcmp(files->files.array[i].name, name) == 0)
+			return &files->files.array[i];
+	}
+
+	return NULL;
+}
+
+static void write_file(void *param, const char *name, const uint8_t *data,
+		       size_t size)
+{
+	struct files *files = param;
+	struct file *file = find_file(files, name);
+
+	if (!file) {
+		file = da_push_back_new(files->files);
+		file->name = bstrdup(name);
+	}
+
+	da_copy_array(file->data, data, size);
+	file->writes++;
+	file->removed = false;
+}
+
+static void remove_file(void *param, const char *name)
+{
+	struct files *files = param;
+	struct file *file = find_file(files, name);
+
+	assert_non_null(file);
+	assert_false(file->removed);
+	file->removed = true;
+}
+
+static void free_files(struct files *files)
+{
+	for (size_t i = 0; i < files->files.num; i++) {
+		bfree(files->files.array[i].name);
+		da_free(files->files.array[i].data);
+	}
+	da_free(files->files);
+}
+
+/* ------------------------------------------------------------------------- */
+/* boxes                                                                     */
+
+static inline uint32_t rb32(const uint8_t *p)
+{
+	return (uint32_t)p[0] << 24 | (uint32_t)p[1] << 16 |
+	       (uint32_t)p[2] << 8 | (uint32_t)p[3];
+}
+
+/* finds a box along a path like "moof/traf/trun", checking every size */
+static const uint8_t *find_box(const uint8_t *data, size_t size,
+			       const char *path, size_t *box_size)
+{
+	const uint8_t *end = data + size;
+
+	while (data + 8 <= end) {
+		uint32_t len = rb32(data);
+
+		assert_true(len >= 8);
+		assert_true(data + len <= end);
+
+		if (memcmp(data + 4, path, 4) == 0) {
+			if (!path[4]) {
+				*box_size = len;
+				return data;
+			}
+			return find_box(data + 8, len - 8, path + 5, box_size);
+		}
+
+		data += len;
+	}
+
+	assert_true(data == end);
+	return NULL;
+}
+
+/* ------------------------------------------------------------------------- */
+
+static const uint8_t avcc[] = {0x01, 0x42, 0x00, 0x1F, 0xFF, 0xE1, 0x00,
+			       0x04, 0x67, 0x42, 0x00, 0x1F, 0x01, 0x00,
+			       0x02, 0x68, 0xCE};
+static const uint8_t asc[] = {0x11, 0x90};
+
+static void init_packager(struct hls_packager *pkg, struct files *files,
+			  uint32_t part_ms, size_t playlist_size)
+{
+	struct mp4_frag_video video = {1280, 720, avcc, sizeof(avcc)};
+	struct mp4_frag_audio audio = {SAMPLE_RATE, 2, asc, sizeof(asc)};
+	struct hls_packager_info info = {0};
+
+	info.playlist_name = "live.m3u8";
+	info.segment_ms = 2000;
+	info.keyint_ms = GOP_FRAMES * 1000 / FPS;
+	info.part_ms = part_ms;
+	info.playlist_size = playlist_size;
+	info.delete_segments = true;
+	info.video = &video;
+	info.audio = &audio;
+	info.write = write_file;
+	info.remove = remove_file;
+	info.param = files;
+
+	memset(files, 0, sizeof(*files));
+	assert_true(hls_packager_init(pkg, &info));
+}
+
+/* video frames have an access unit delimiter that must not end up in the
+ * samples, followed by a slice of frame dependent size */
+static void push_video_gop(struct hls_packager *pkg, int64_t frame,
+			   int64_t gop_frames)
+{
+	struct encoder_packet packet = {0};
+	uint8_t data[6 + 4 + 200];
+	size_t size = 6 + 4 + 100 + (size_t)(frame % 100);
+
+	memset(data, 0xAA, sizeof(data));
+	memcpy(data, "\0\0\0\1\x09\xF0\0\0\0\1", 10);
+	data[10] = frame % gop_frames == 0 ? 0x65 : 0x41;
+
+	packet.type = OBS_ENCODER_VIDEO;
+	packet.data = data;
+	packet.size = size;
+	packet.keyframe = frame % gop_frames == 0;
+	packet.timebase_num = 1;
+	packet.timebase_den = FPS;
+	packet.pts = frame;
+	packet.dts = frame;
+	packet.dts_usec = frame * 1000000 / FPS;
+	hls_packager_packet(pkg, &packet);
+}
+
+static inline void push_video(struct hls_packager *pkg, int64_t frame)
+{
+	push_video_gop(pkg, frame, GOP_FRAMES);
+}
+
+static void push_audio(struct hls_packager *pkg, int64_t index)
+{
+	struct encoder_packet packet = {0};
+	uint8_t data[300];
+
+	memset(data, (int)index, sizeof(data));
+	packet.type = OBS_ENCODER_AUDIO;
+	packet.data = data;
+	packet.size = sizeof(data);
+	packet.timebase_num = 1;
+	packet.timebase_den = SAMPLE_RATE;
+	packet.pts = index * 1024;
+	packet.dts = index * 1024;
+	packet.dts_usec = index * 1024 * 1000000 / SAMPLE_RATE;
+	hls_packager_packet(pkg, &packet);
+}
+
+/* interleaves audio and video by time, like the output core does */
+static void push_stream(struct hls_packager *pkg, int64_t frames,
+			int64_t *audio_index)
+{
+	for (int64_t frame = 0; frame < frames; frame++) {
+		int64_t frame_usec = frame * 1000000 / FPS;
+
+		while (*audio_index * 1024 * 1000000 / SAMPLE_RATE <
+		       frame_usec)
+			push_audio(pkg, (*audio_index)++);
+
+		push_video(pkg, frame);
+	}
+}
+
+static void init_segment_test(void **state)
+{
+	struct hls_packager pkg;
+	struct files files;
+	struct file *init;
+	const uint8_t *box;
+	size_t size;
+
+	init_packager(&pkg, &files, 500, 6);
+
+	init = find_file(&files, "live_init.mp4");
+	assert_non_null(init);
+
+	box = find_box(init->data.array, init->data.num, "ftyp", &size);
+	assert_ptr_equal(box, init->data.array);
+	assert_memory_equal(box + 8, "iso6", 4);
+
+	box = find_box(init->data.array, init->data.num,
+		       "moov/trak/mdia/minf/stbl/stsd", &size);
+	assert_non_null(box);
+	/* avc1 sample entry with the avcC at its fixed offset */
+	assert_memory_equal(box + 16 + 4, "avc1", 4);
+	assert_memory_equal(box + 16 + 86 + 8, avcc, sizeof(avcc));
+
+	box = find_box(init->data.array, init->data.num, "moov/mvex", &size);
+	assert_non_null(box);
+	assert_int_equal(size, 8 + 2 * 32);
+
+	hls_packager_free(&pkg);
+	free_files(&files);
+
+	UNUSED_PARAMETER(state);
+}
+
+static void check_fragment(const uint8_t *data, size_t size,
+			   size_t *video_samples, size_t *audio_samples)
+{
+	const uint8_t *moof, *mdat, *traf, *trun;
+	size_t moof_size, mdat_size, traf_size, trun_size;
+	size_t total = 0;
+
+	moof = find_box(data, size, "moof", &moof_size);
+	mdat = find_box(data, size, "mdat", &mdat_size);
+	assert_ptr_equal(moof, data);
+	assert_ptr_equal(mdat, data + moof_size);
+	assert_int_equal(moof_size + mdat_size, size);
+
+	*video_samples = 0;
+	*audio_samples = 0;
+
+	traf = moof + 8 + 16; /* after mfhd */
+	while (traf < moof + moof_size) {
+		const uint8_t *tfhd;
+		size_t tfhd_size, count, entry;
+		uint32_t flags, offset;
+
+		assert_memory_equal(traf + 4, "traf", 4);
+		traf_size = rb32(traf);
+
+		tfhd = find_box(traf + 8, traf_size - 8, "tfhd", &tfhd_size);
+		trun = find_box(traf + 8, traf_size - 8, "trun", &trun_size);
+		assert_non_null(tfhd);
+		assert_non_null(trun);
+
+		flags = rb32(trun + 8) & 0xFFFFFF;
+		count = rb32(trun + 12);
+		offset = rb32(trun + 16);
+		entry = flags & 0x800 ? 16 : 12;
+		assert_int_equal(trun_size, 20 + count * entry);
+
+		/* each run's data starts right after the previous one's */
+		assert_int_equal(offset, moof_size + 8 + total);
+		for (size_t i = 0; i < count; i++)
+			total += rb32(trun + 20 + i * entry + 4);
+
+		if (rb32(tfhd + 12) == MP4_FRAG_VIDEO_TRACK)
+			*video_samples = count;
+		else
+			*audio_samples = count;
+
+		traf += traf_size;
+	}
+
+	assert_int_equal(total, mdat_size - 8);
+}
+
+static void low_latency_test(void **state)
+{
+	struct hls_packager pkg;
+	struct files files;
+	struct file *playlist, *segment;
+	DARRAY(uint8_t) joined;
+	int64_t audio_index = 0;
+	size_t video_total = 0;
+	size_t audio_total = 0;
+	char name[64];
+
+	init_packager(&pkg, &files, 500, 6);
+
+	/* two and a half segments */
+	push_stream(&pkg, GOP_FRAMES * 2 + 30, &audio_index);
+
+	playlist = find_file(&files, "live.m3u8");
+	assert_non_null(playlist);
+	da_push_back(playlist->data, "\0");
+
+	assert_non_null(strstr((char *)playlist->data.array,
+			       "#EXT-X-PART-INF:PART-TARGET=0.500\n"));
+	assert_non_null(strstr((char *)playlist->data.array,
+			       "#EXT-X-SERVER-CONTROL:PART-HOLD-BACK=1.500\n"));
+	assert_non_null(strstr((char *)playlist->data.array,
+			       "#EXT-X-MAP:URI=\"live_init.mp4\"\n"));
+	assert_non_null(strstr((char *)playlist->data.array,
+			       "#EXTINF:2.000,\nlive_0.m4s\n"));
+	assert_non_null(strstr((char *)playlist->data.array,
+			       "#EXTINF:2.000,\nlive_1.m4s\n"));
+	assert_non_null(strstr(
+		(char *)playlist->data.array,
+		"#EXT-X-PART:DURATION=0.500,URI=\"live_0.0.m4s\","
+		"INDEPENDENT=YES\n"));
+	assert_non_null(strstr((char *)playlist->data.array,
+			       "URI=\"live_2.0.m4s\",INDEPENDENT=YES\n"
+			       "#EXT-X-PRELOAD-HINT:TYPE=PART,"
+			       "URI=\"live_2.1.m4s\"\n"));
+	assert_null(strstr((char *)playlist->data.array, "ENDLIST"));
+
+	/* every segment is exactly its parts back to back, and every part
+	 * is a valid fragment */
+	da_init(joined);
+	for (int seq = 0; seq < 2; seq++) {
+		joined.num = 0;
+
+		for (int part = 0; part < 4; part++) {
+			struct file *file;
+			size_t video, audio;
+
+			snprintf(name, sizeof(name), "live_%d.%d.m4s", seq,
+				 part);
+			file = find_file(&files, name);
+			assert_non_null(file);
+
+			check_fragment(file->data.array, file->data.num, &video,
+				       &audio);
+			assert_int_equal(video, 15);
+			video_total += video;
+			audio_total += audio;
+
+			da_push_back_array(joined, file->data.array,
+					   file->data.num);
+		}
+
+		snprintf(name, sizeof(name), "live_%d.4.m4s", seq);
+		assert_null(find_file(&files, name));
+
+		snprintf(name, sizeof(name), "live_%d.m4s", seq);
+		segment = find_file(&files, name);
+		assert_non_null(segment);
+		assert_int_equal(segment->data.num, joined.num);
+		assert_memory_equal(segment->data.array, joined.array,
+				    joined.num);
+	}
+
+	/* all audio before the cut went into the first two segments */
+	assert_int_equal(video_total, GOP_FRAMES * 2);
+	assert_int_equal(audio_total, (4 * SAMPLE_RATE + 1023) / 1024);
+
+	/* the end flushes the open segment and closes the playlist */
+	hls_packager_finish(&pkg);
+
+	playlist = find_file(&files, "live.m3u8");
+	da_push_back(playlist->data, "\0");
+	assert_non_null(strstr((char *)playlist->data.array,
+			       "#EXTINF:1.000,\nlive_2.m4s\n#EXT-X-ENDLIST\n"));
+	assert_null(strstr((char *)playlist->data.array, "PRELOAD-HINT"));
+
+	da_free(joined);
+	hls_packager_free(&pkg);
+	free_files(&files);
+
+	UNUSED_PARAMETER(state);
+}
+
+static void sliding_window_test(void **state)
+{
+	struct hls_packager pkg;
+	struct files files;
+	struct file *playlist;
+	int64_t audio_index = 0;
+	char name[64];
+
+	/* no parts, three segments in the playlist */
+	init_packager(&pkg, &files, 0, 3);
+	push_stream(&pkg, GOP_FRAMES * 10 + 1, &audio_index);
+
+	playlist = find_file(&files, "live.m3u8");
+	da_push_back(playlist->data, "\0");
+
+	/* ten segments done, the last three listed */
+	assert_non_null(strstr((char *)playlist->data.array,
+			       "#EXT-X-MEDIA-SEQUENCE:7\n"));
+	assert_null(strstr((char *)playlist->data.array, "live_6.m4s"));
+	assert_non_null(strstr((char *)playlist->data.array, "live_9.m4s"));
+	assert_null(strstr((char *)playlist->data.array, "EXT-X-PART"));
+
+	/* and old ones deleted with a little delay */
+	for (int seq = 0; seq < 10; seq++) {
+		struct file *file;
+
+		snprintf(name, sizeof(name), "live_%d.m4s", seq);
+		file = find_file(&files, name);
+		assert_non_null(file);
+		assert_int_equal(file->writes, 1);
+		assert_int_equal(file->removed, seq < 5);
+
+		snprintf(name, sizeof(name), "live_%d.0.m4s", seq);
+		assert_null(find_file(&files, name));
+	}
+
+	hls_packager_free(&pkg);
+	free_files(&files);
+
+	UNUSED_PARAMETER(state);
+}
+
+static void target_duration_test(void **state)
+{
+	struct hls_packager pkg;
+	struct files files;
+	struct file *playlist;
+	char name[64];
+
+	/* the encoder sends keyframes half as often as it was set up to */
+	init_packager(&pkg, &files, 0, 0);
+
+	for (int64_t frame = 0; frame < GOP_FRAMES * 5; frame++) {
+		push_video_gop(&pkg, frame, GOP_FRAMES * 2);
+
+		playlist = find_file(&files, "live.m3u8");
+		if (!playlist)
+			continue;
+
+		da_push_back(playlist->data, "\0");
+		assert_non_null(strstr((char *)playlist->data.array,
+				       "#EXT-X-TARGETDURATION:2\n"));
+	}
+
+	/* so segments are cut between keyframes instead of getting longer
+	 * than the target duration */
+	playlist = find_file(&files, "live.m3u8");
+	assert_non_null(playlist);
+	for (int seq = 0; seq < 4; seq++) {
+		snprintf(name, sizeof(name), "#EXTINF:2.000,\nlive_%d.m4s\n",
+			 seq);
+		assert_non_null(strstr((char *)playlist->data.array, name));
+	}
+	assert_null(strstr((char *)playlist->data.array,
+			   "EXT-X-INDEPENDENT-SEGMENTS"));
+
+	hls_packager_free(&pkg);
+	free_files(&files);
+
+	UNUSED_PARAMETER(state);
+}
+
+int main()
+{
+	const struct CMUnitTest tests[] = {
+		cmocka_unit_test(init_segment_test),
+		cmocka_unit_test(low_latency_test),
+		cmocka_unit_test(sliding_window_test),
+		cmocka_unit_test(target_duration_test),
+	};
+
+	return cmocka_run_group_tests(tests, NULL, NULL);
+}
@@ -0,0 +1,473 @@
+#include <stdarg.h>
+#include <stddef.h>
+#include <setjmp.h>
+#include <stdlib.h>
+#include <cmocka.h>
+
+#include <obs-interleave.h>
+
+#define VIDEO_USEC 33333
+#define AUDIO_USEC 21333
+#define PACKETS 2000
+
+/* ------------------------------------------------------------------------- */
+/* the interleaver as it was before the per-track queues: a single array of
+ * every track's packets, kept sorted by insertion */
+
+typedef DARRAY(struct encoder_packet) packet_array_t;
+
+static void ref_insert(packet_array_t *array, const struct encoder_packet *out)
+{
+	size_t idx;
+
+	for (idx = 0; idx < array->num; idx++) {
+		struct encoder_packet *cur = array->array + idx;
+
+		if (out->dts_usec == cur->dts_usec &&
+		    out->type == OBS_ENCODER_VIDEO)
+			break;
+		else if (out->dts_usec < cur->dts_usec)
+			break;
+	}
+
+	da_insert((*array), idx, out);
+}
+
+static size_t ref_get_start_idx(packet_array_t *array)
+{
+	int64_t closest_diff = 0x7FFFFFFFFFFFFFFFLL;
+	struct encoder_packet *first_video = NULL;
+	size_t video_idx = DARRAY_INVALID;
+	size_t idx = 0;
+
+	for (size_t i = 0; i < array->num; i++) {
+		if (array->array[i].type == OBS_ENCODER_VIDEO) {
+			first_video = &array->array[i];
+			break;
+		}
+	}
+
+	for (size_t i = 0; i < array->num; i++) {
+		struct encoder_packet *packet = &array->array[i];
+		int64_t diff;
+
+		if (packet->type != OBS_ENCODER_AUDIO) {
+			if (packet == first_video)
+				video_idx = i;
+			continue;
+		}
+
+		diff = llabs(packet->dts_usec - first_video->dts_usec);
+		if (diff < closest_diff) {
+			closest_diff = diff;
+			idx = i;
+		}
+	}
+
+	return video_idx < idx ? video_idx : idx;
+}
+
+/* index just past the first packet of every track */
+static size_t ref_premature_end(packet_array_t *array, size_t tracks)
+{
+	size_t max_idx = 0;
+
+	for (size_t t = 0; t < tracks; t++) {
+		for (size_t i = 0; i < array->num; i++) {
+			struct encoder_packet *p = &array->array[i];
+			bool video = p->type == OBS_ENCODER_VIDEO;
+
+			if (t == 0 ? video : !video && p->track_idx == t - 1) {
+				if (i > max_idx)
+					max_idx = i;
+				break;
+			}
+		}
+	}
+
+	return max_idx + 1;
+}
+
+/* ------------------------------------------------------------------------- */
+
+struct interleaver {
+	struct interleave_queue queues[INTERLEAVE_TRACKS];
+	packet_array_t ref;
+	packet_array_t sent;
+	packet_array_t ref_sent;
+	int64_t highest_video_ts;
+	int64_t highest_audio_ts;
+	bool received_video;
+	bool received_audio;
+};
+
+static inline bool has_higher_opposing_ts(struct interleaver *il,
+					  const struct encoder_packet *packet)
+{
+	if (packet->type == OBS_ENCODER_VIDEO)
+		return il->highest_audio_ts > packet->dts_usec;
+	else
+		return il->highest_video_ts > packet->dts_usec;
+}
+
+/* mirrors send_interleaved in obs-output.c for both implementations */
+static void send_one(struct interleaver *il)
+{
+	struct interleave_queue *q = interleave_first_queue(il->queues);
+	struct encoder_packet out;
+
+	if (q && has_higher_opposing_ts(il, interleave_queue_front(q))) {
+		interleave_queue_pop_front(q, &out);
+		da_push_back(il->sent, &out);
+		obs_encoder_packet_release(&out);
+	}
+
+	if (il->ref.num && has_higher_opposing_ts(il, il->ref.array)) {
+		da_push_back(il->ref_sent, il->ref.array);
+		da_erase(il->ref, 0);
+	}
+}
+
+/* mirrors interleave_packets in obs-output.c, minus the timestamp offsets,
+ * which move a whole track and so don't change the order */
+static void push_packet(struct interleaver *il,
+			const struct encoder_packet *packet)
+{
+	bool was_started = il->received_video && il->received_audio;
+
+	interleave_insert(il->queues, packet);
+	ref_insert(&il->ref, packet);
+
+	if (packet->type == OBS_ENCODER_VIDEO) {
+		il->received_video = true;
+		if (il->highest_video_ts < packet->dts_usec)
+			il->highest_video_ts = packet->dts_usec;
+	} else {
+		il->received_audio = true;
+		if (il->highest_audio_ts < packet->dts_usec)
+			il->highest_audio_ts = packet->dts_usec;
+	}
+
+	if (!il->received_video || !il->received_audio)
+		return;
+
+	if (!was_started) {
+		struct encoder_packet *start = interleave_get_start(il->queues);
+		size_t start_idx = ref_get_start_idx(&il->ref);
+
+		if (start)
+			interleave_discard_to(il->queues, start, false);
+		if (start_idx)
+			da_erase_range(il->ref, 0, start_idx);
+	}
+
+	send_one(il);
+}
+
+static void assert_same_order(packet_array_t *a, packet_array_t *b)
+{
+	assert_int_equal(a->num, b->num);
+	for (size_t i = 0; i < a->num; i++) {
+		assert_int_equal(a->array[i].type, b->array[i].type);
+		assert_int_equal(a->array[i].track_idx, b->array[i].track_idx);
+		assert_int_equal(a->array[i].dts_usec, b->array[i].dts_usec);
+	}
+}
+
+static void get_queued(struct interleave_queue *queues, packet_array_t *out)
+{
+	struct interleave_queue *q;
+	struct encoder_packet packet;
+
+	while ((q = interleave_first_queue(queues)) != NULL) {
+		interleave_queue_pop_front(q, &packet);
+		da_push_back((*out), &packet);
+		obs_encoder_packet_release(&packet);
+	}
+}
+
+static void interleaver_free(struct interleaver *il)
+{
+	interleave_free(il->queues);
+	da_free(il->ref);
+	da_free(il->sent);
+	da_free(il->ref_sent);
+}
+
+/* ------------------------------------------------------------------------- */
+
+/* packet data is refcounted with a long in front of it, like packets coming
+ * from encoders.  every packet starts with an extra reference held by the
+ * test, so each one must be back at exactly 1 once the interleaver is done */
+struct packet_data {
+	long refs;
+	uint8_t data[8];
+};
+
+struct stream {
+	struct encoder_packet packets[PACKETS];
+	struct packet_data data[PACKETS];
+	size_t num;
+};
+
+static void add_packet(struct stream *s, enum obs_encoder_type type,
+		       size_t track, int64_t dts_usec)
+{
+	struct encoder_packet *p = &s->packets[s->num];
+
+	s->data[s->num].refs = 2;
+	p->data = s->data[s->num].data;
+	p->size = sizeof(s->data[s->num].data);
+	p->type = type;
+	p->track_idx = track;
+	p->dts_usec = dts_usec;
+	p->keyframe = type == OBS_ENCODER_VIDEO;
+	p->timebase_num = 1;
+	p->timebase_den = 30;
+	s->num++;
+}
+
+/* builds each track in order, then shuffles the arrival order across tracks
+ * (and occasionally swaps neighbours within a track).  audio tracks are a few
+ * microseconds apart: with equal timestamps the old implementation sent them
+ * in arrival order, which interleave_tie_test covers separately */
+static void build_stream(struct stream *s, size_t audio_tracks,
+			 int64_t audio_offset, unsigned seed)
+{
+	int64_t video_ts = 0;
+	int64_t audio_ts[MAX_AUDIO_MIXES] = {0};
+	size_t next[INTERLEAVE_TRACKS] = {0};
+	int64_t tracks[INTERLEAVE_TRACKS][PACKETS];
+	size_t counts[INTERLEAVE_TRACKS] = {0};
+	size_t tracks_num = audio_tracks + 1;
+
+	srand(seed);
+	s->num = 0;
+
+	for (size_t i = 0; i < audio_tracks; i++)
+		audio_ts[i] = audio_offset + (int64_t)i * 7;
+
+	while (counts[0] < PACKETS / tracks_num) {
+		tracks[0][counts[0]] = video_ts;
+		counts[0]++;
+		video_ts += VIDEO_USEC;
+	}
+	for (size_t t = 0; t < audio_tracks; t++) {
+		while (counts[t + 1] < PACKETS / tracks_num) {
+			tracks[t + 1][counts[t + 1]] = audio_ts[t];
+			counts[t + 1]++;
+			audio_ts[t] += AUDIO_USEC;
+		}
+	}
+
+	for (;;) {
+		size_t t = (size_t)rand() % tracks_num;
+		size_t tries = 0;
+
+		while (next[t] == counts[t] && tries++ < tracks_num)
+			t = (t + 1) % tracks_num;
+		if (next[t] == counts[t])
+			break;
+
+		size_t idx = next[t]++;
+
+		/* swap with the following packet of the same track now and
+		 * then, so a track isn't always in order either */
+		if (idx + 1 < counts[t] && rand() % 16 == 0) {
+			int64_t tmp = tracks[t][idx];
+			tracks[t][idx] = tracks[t][idx + 1];
+			tracks[t][idx + 1] = tmp;
+		}
+
+		add_packet(s,
+			   t == 0 ? OBS_ENCODER_VIDEO : OBS_ENCODER_AUDIO,
+			   t == 0 ? 0 : t - 1, tracks[t][idx]);
+	}
+}
+
+static void assert_all_released(struct stream *s)
+{
+	for (size_t i = 0; i < s->num; i++)
+		assert_int_equal(s->data[i].refs, 1);
+}
+
+static void run_stream(size_t audio_tracks, int64_t audio_offset,
+		       unsigned seed)
+{
+	struct stream *s = bzalloc(sizeof(*s));
+	struct interleaver il = {0};
+	packet_array_t queued = {0};
+
+	build_stream(s, audio_tracks, audio_offset, seed);
+
+	for (size_t i = 0; i < s->num; i++)
+		push_packet(&il, &s->packets[i]);
+
+	assert_true(il.sent.num > 0);
+	assert_same_order(&il.sent, &il.ref_sent);
+
+	/* whatever is still queued when the output stops must be the same
+	 * too, and every packet has to have been released exactly once */
+	get_queued(il.queues, &queued);
+	assert_same_order(&queued, &il.ref);
+	assert_all_released(s);
+
+	da_free(queued);
+	interleaver_free(&il);
+	bfree(s);
+}
+
+static void interleave_order_test(void **state)
+{
+	for (unsigned seed = 1; seed <= 20; seed++) {
+		run_stream(1, 0, seed);
+		run_stream(2, 0, seed);
+		run_stream(3, 5000, seed);
+		run_stream(MAX_AUDIO_MIXES, -100000, seed);
+	}
+}
+
+static void interleave_tie_test(void **state)
+{
+	struct stream *s = bzalloc(sizeof(*s));
+	struct interleave_queue queues[INTERLEAVE_TRACKS] = {0};
+	packet_array_t queued = {0};
+
+	/* same dts everywhere, arriving in reverse track order: video goes
+	 * first, then the audio tracks in track order */
+	add_packet(s, OBS_ENCODER_AUDIO, 2, 1000);
+	add_packet(s, OBS_ENCODER_AUDIO, 1, 1000);
+	add_packet(s, OBS_ENCODER_AUDIO, 0, 1000);
+	add_packet(s, OBS_ENCODER_VIDEO, 0, 1000);
+
+	for (size_t i = 0; i < s->num; i++)
+		interleave_insert(queues, &s->packets[i]);
+
+	get_queued(queues, &queued);
+	assert_int_equal(queued.num, 4);
+	assert_int_equal(queued.array[0].type, OBS_ENCODER_VIDEO);
+	for (size_t i = 1; i < 4; i++) {
+		assert_int_equal(queued.array[i].type, OBS_ENCODER_AUDIO);
+		assert_int_equal(queued.array[i].track_idx, i - 1);
+	}
+	assert_all_released(s);
+
+	da_free(queued);
+	interleave_free(queues);
+	bfree(s);
+}
+
+static void interleave_prune_test(void **state)
+{
+	struct stream *s = bzalloc(sizeof(*s));
+	struct interleave_queue queues[INTERLEAVE_TRACKS] = {0};
+	packet_array_t ref = {0};
+	packet_array_t queued = {0};
+	struct encoder_packet *last;
+
+	/* video starts well before audio, so the first packet of every track
+	 * is pruned, as prune_premature_packets does */
+	add_packet(s, OBS_ENCODER_VIDEO, 0, 0);
+	add_packet(s, OBS_ENCODER_AUDIO, 0, 200000);
+	add_packet(s, OBS_ENCODER_AUDIO, 1, 200000);
+	add_packet(s, OBS_ENCODER_VIDEO, 0, VIDEO_USEC);
+	add_packet(s, OBS_ENCODER_AUDIO, 0, 200000 + AUDIO_USEC);
+	add_packet(s, OBS_ENCODER_VIDEO, 0, 2 * VIDEO_USEC);
+	add_packet(s, OBS_ENCODER_AUDIO, 1, 200000 + AUDIO_USEC);
+
+	for (size_t i = 0; i < s->num; i++) {
+		interleave_insert(queues, &s->packets[i]);
+		ref_insert(&ref, &s->packets[i]);
+	}
+
+	last = interleave_queue_front(&queues[0]);
+	for (size_t i = 1; i < 3; i++) {
+		struct encoder_packet *front = interleave_queue_front(&queues[i]);
+		if (interleave_packet_before(last, front))
+			last = front;
+	}
+
+	interleave_discard_to(queues, last, true);
+	da_erase_range(ref, 0, ref_premature_end(&ref, 3));
+
+	get_queued(queues, &queued);
+	assert_same_order(&queued, &ref);
+	assert_all_released(s);
+
+	da_free(queued);
+	da_free(ref);
+	interleave_free(queues);
+	bfree(s);
+}
+
+static void interleave_discard_before_test(void **state)
+{
+	struct stream *s = bzalloc(sizeof(*s));
+	struct interleave_queue queues[INTERLEAVE_TRACKS] = {0};
+	packet_array_t ref = {0};
+	packet_array_t queued = {0};
+	const int64_t cutoff = 10 * VIDEO_USEC;
+	size_t idx = 0;
+
+	build_stream(s, 2, 0, 7);
+
+	for (size_t i = 0; i < s->num; i++) {
+		interleave_insert(queues, &s->packets[i]);
+		ref_insert(&ref, &s->packets[i]);
+	}
+
+	interleave_discard_before(queues, cutoff);
+	while (idx < ref.num && ref.array[idx].dts_usec < cutoff)
+		idx++;
+	if (idx)
+		da_erase_range(ref, 0, idx);
+
+	get_queued(queues, &queued);
+	assert_same_order(&queued, &ref);
+	assert_all_released(s);
+
+	da_free(queued);
+	da_free(ref);
+	interleave_free(queues);
+	bfree(s);
+}
+
+static void interleave_free_test(void **state)
+{
+	struct stream *s = bzalloc(sizeof(*s));
+	struct interleave_queue queues[INTERLEAVE_TRACKS] = {0};
+	struct encoder_packet out;
+
+	build_stream(s, 3, 0, 3);
+
+	/* pop enough from one queue to have it compacted before stopping */
+	for (size_t i = 0; i < s->num; i++)
+		interleave_insert(queues, &s->packets[i]);
+	for (size_t i = 0; i < 100; i++) {
+		interleave_queue_pop_front(&queues[0], &out);
+		obs_encoder_packet_release(&out);
+	}
+
+	interleave_free(queues);
+	assert_all_released(s);
+
+	for (size_t i = 0; i < INTERLEAVE_TRACKS; i++) {
+		assert_int_equal(interleave_queue_count(&queues[i]), 0);
+		assert_null(interleave_queue_front(&queues[i]));
+	}
+
+	bfree(s);
+}
+
+int main()
+{
+	const struct CMUnitTest tests[] = {
+		cmocka_unit_test(interleave_order_test),
+		cmocka_unit_test(interleave_tie_test),
+		cmocka_unit_test(interleave_prune_test),
+		cmocka_unit_test(interleave_discard_before_test),
+		cmocka_unit_test(interleave_free_test),
+	};
+
+	return cmocka_run_group_tests(tests, NULL, NULL);
+}
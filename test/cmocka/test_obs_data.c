@@ -0,0 +1,300 @@
+#include <stdarg.h>
+#include <stddef.h>
+#include <setjmp.h>
+#include <cmocka.h>
+
+#include <limits.h>
+#include <math.h>
+#include <stdio.h>
+#include <util/dstr.h>
+#include <obs-data.h>
+
+#define NUM_ITEMS 200
+#define NUM_SOURCES 300
+#define NUM_SETTINGS 32
+
+static void get_name(char *name, size_t size, int i)
+{
+	snprintf(name, size, "item_%04d", i);
+}
+
+static size_t check_sorted(obs_data_t *data)
+{
+	obs_data_item_t *item = obs_data_first(data);
+	const char *prev = NULL;
+	size_t count = 0;
+
+	for (; item; obs_data_item_next(&item)) {
+		const char *name = obs_data_item_get_name(item);
+		if (prev)
+			assert_true(strcmp(prev, name) < 0);
+		prev = name;
+		count++;
+	}
+
+	return count;
+}
+
+static void obs_data_index_test(void **state)
+{
+	obs_data_t *data = obs_data_create();
+	char name[32];
+
+	/* out of order, so inserts can't just append */
+	for (int i = 0; i < NUM_ITEMS; i++) {
+		int n = (i * 7919) % NUM_ITEMS;
+		get_name(name, sizeof(name), n);
+		obs_data_set_int(data, name, n);
+	}
+
+	assert_int_equal(check_sorted(data), NUM_ITEMS);
+	for (int i = 0; i < NUM_ITEMS; i++) {
+		get_name(name, sizeof(name), i);
+		assert_int_equal(obs_data_get_int(data, name), i);
+	}
+	assert_false(obs_data_has_user_value(data, "item_missing"));
+
+	for (int i = 0; i < NUM_ITEMS; i += 3) {
+		get_name(name, sizeof(name), i);
+		obs_data_erase(data, name);
+	}
+
+	assert_int_equal(check_sorted(data), NUM_ITEMS - (NUM_ITEMS + 2) / 3);
+	for (int i = 0; i < NUM_ITEMS; i++) {
+		get_name(name, sizeof(name), i);
+		assert_int_equal(obs_data_has_user_value(data, name),
+				 i % 3 != 0);
+	}
+
+	/* add them back in reverse, reusing the erased slots */
+	for (int i = NUM_ITEMS - 1; i >= 0; i--) {
+		get_name(name, sizeof(name), i);
+		obs_data_set_int(data, name, i * 2);
+	}
+
+	assert_int_equal(check_sorted(data), NUM_ITEMS);
+	for (int i = 0; i < NUM_ITEMS; i++) {
+		get_name(name, sizeof(name), i);
+		assert_int_equal(obs_data_get_int(data, name), i * 2);
+	}
+
+	obs_data_release(data);
+}
+
+static void obs_data_index_realloc_test(void **state)
+{
+	obs_data_t *data = obs_data_create();
+	struct dstr val = {0};
+	char name[32];
+
+	for (int i = 0; i < 64; i++) {
+		get_name(name, sizeof(name), i);
+		obs_data_set_int(data, name, i);
+	}
+
+	/* growing the values reallocates the items */
+	for (int i = 0; i < 64; i += 2) {
+		get_name(name, sizeof(name), i);
+		dstr_free(&val);
+		for (int j = 0; j < 20; j++)
+			dstr_cat(&val, name);
+		obs_data_set_string(data, name, val.array);
+		obs_data_set_default_string(data, name, name);
+	}
+
+	for (int i = 0; i < 64; i++) {
+		get_name(name, sizeof(name), i);
+		if (i % 2) {
+			assert_int_equal(obs_data_get_int(data, name), i);
+			continue;
+		}
+
+		const char *str = obs_data_get_string(data, name);
+		assert_int_equal(strlen(str), strlen(name) * 20);
+		assert_memory_equal(str, name, strlen(name));
+		assert_string_equal(obs_data_get_default_string(data, name),
+				    name);
+	}
+
+	/* removing the last item, then appending after it */
+	obs_data_erase(data, "item_0063");
+	assert_false(obs_data_has_user_value(data, "item_0063"));
+
+	obs_data_set_int(data, "item_0070", 70);
+	obs_data_set_int(data, "item_0063", 63);
+	assert_int_equal(check_sorted(data), 65);
+	assert_int_equal(obs_data_get_int(data, "item_0070"), 70);
+	assert_int_equal(obs_data_get_int(data, "item_0063"), 63);
+
+	/* empty it completely and start over */
+	for (int i = 0; i < 64; i++) {
+		get_name(name, sizeof(name), i);
+		obs_data_erase(data, name);
+	}
+	obs_data_erase(data, "item_0070");
+	assert_int_equal(check_sorted(data), 0);
+
+	obs_data_set_int(data, "b", 2);
+	obs_data_set_int(data, "a", 1);
+	assert_int_equal(check_sorted(data), 2);
+	assert_int_equal(obs_data_get_int(data, "a"), 1);
+
+	dstr_free(&val);
+	obs_data_release(data);
+}
+
+static void obs_data_json_test(void **state)
+{
+	obs_data_t *data = obs_data_create_from_json(
+		"{ \"str\": \"a\\\"b\\\\c\\/\\n\\u00e9\\ud83d\\ude00\",\n"
+		"  \"int\": -9223372036854775808, \"real\": 2.5e-3,\n"
+		"  \"yes\": true, \"no\": false, \"nothing\": null,\n"
+		"  \"list\": [{\"a\": 1}, 2, \"skipped\", [{}], {\"b\": {}}],\n"
+		"  \"obj\": {\"z\": 1, \"y\": []} }");
+	assert_non_null(data);
+
+	assert_string_equal(obs_data_get_string(data, "str"),
+			    "a\"b\\c/\n\xc3\xa9\xf0\x9f\x98\x80");
+	assert_true(obs_data_get_int(data, "int") == LLONG_MIN);
+	assert_true(obs_data_get_double(data, "real") == 2.5e-3);
+	assert_true(obs_data_get_bool(data, "yes"));
+	assert_true(obs_data_has_user_value(data, "no"));
+	assert_false(obs_data_has_user_value(data, "nothing"));
+
+	obs_data_array_t *list = obs_data_get_array(data, "list");
+	assert_int_equal(obs_data_array_count(list), 2);
+	obs_data_array_release(list);
+
+	obs_data_set_double(data, "nan", NAN);
+	obs_data_set_string(data, "ctrl", "\x01\t");
+	obs_data_set_string(data, "bad utf-8", "\xc3");
+
+	assert_string_equal(
+		obs_data_get_json(data),
+		"{\"ctrl\":\"\\u0001\\t\",\"int\":-9223372036854775808,"
+		"\"list\":[{\"a\":1},{\"b\":{}}],\"no\":false,"
+		"\"obj\":{\"y\":[],\"z\":1},\"real\":0.0025000000000000001,"
+		"\"str\":\"a\\\"b\\\\c/\\n\xc3\xa9\xf0\x9f\x98\x80\","
+		"\"yes\":true}");
+
+	obs_data_t *copy = obs_data_create_from_json(obs_data_get_json(data));
+	assert_non_null(copy);
+	assert_string_equal(obs_data_get_json(copy),
+			    obs_data_get_last_json(data));
+	obs_data_release(copy);
+	obs_data_release(data);
+
+	data = obs_data_create_from_json("[{\"a\": 1}]");
+	assert_non_null(data);
+	assert_string_equal(obs_data_get_json(data), "{}");
+	obs_data_release(data);
+
+	static const char *invalid[] = {
+		"",
+		"\"str\"",
+		"{\"a\": 1} x",
+		"{\"a\": 1,}",
+		"{\"a\": 1, \"a\": 2}",
+		"{\"a\": [1, 2}",
+		"{\"a\": 01}",
+		"{\"a\": 1.}",
+		"{\"a\": 1e400}",
+		"{\"a\": 9223372036854775808}",
+		"{\"a\": tru}",
+		"{\"a\": \"\\u0000\"}",
+		"{\"a\": \"\\ud83d\"}",
+		"{\"a\": \"\xc3\"}",
+		"{\"a\": \"\t\"}",
+		"{\"a\": \"abc",
+	};
+
+	for (size_t i = 0; i < sizeof(invalid) / sizeof(invalid[0]); i++)
+		assert_null(obs_data_create_from_json(invalid[i]));
+}
+
+/* a scene collection with NUM_SOURCES sources, each with a settings object,
+ * plus one object keyed by source name, big enough to use the index */
+static char *make_collection(void)
+{
+	struct dstr json = {0};
+
+	dstr_copy(&json, "{\"current_scene\":\"Scene\",\"name\":\"Test\","
+			 "\"sources\":[");
+
+	for (int i = 0; i < NUM_SOURCES; i++) {
+		if (i)
+			dstr_cat_ch(&json, ',');
+		dstr_catf(&json,
+			  "{\"enabled\":true,\"id\":\"color_source\","
+			  "\"muted\":false,\"name\":\"Source %05d\","
+			  "\"settings\":{",
+			  i);
+		for (int k = 0; k < NUM_SETTINGS; k++)
+			dstr_catf(&json, "%s\"setting_%02d\":%d", k ? "," : "",
+				  k, i + k);
+		dstr_cat(&json, "},\"volume\":1.0}");
+	}
+
+	dstr_cat(&json, "],\"source_order\":{");
+	for (int i = 0; i < NUM_SOURCES; i++)
+		dstr_catf(&json, "%s\"Source %05d\":%d", i ? "," : "", i, i);
+	dstr_cat(&json, "}}");
+
+	return json.array;
+}
+
+static void obs_data_collection_test(void **state)
+{
+	char *json = make_collection();
+	char name[32];
+
+	obs_data_t *data = obs_data_create_from_json(json);
+	assert_non_null(data);
+
+	obs_data_array_t *sources = obs_data_get_array(data, "sources");
+	obs_data_t *order = obs_data_get_obj(data, "source_order");
+	assert_int_equal(obs_data_array_count(sources), NUM_SOURCES);
+	assert_int_equal(check_sorted(order), NUM_SOURCES);
+
+	for (int i = 0; i < NUM_SOURCES; i++) {
+		obs_data_t *source = obs_data_array_item(sources, i);
+		obs_data_t *settings = obs_data_get_obj(source, "settings");
+
+		for (int k = 0; k < NUM_SETTINGS; k++) {
+			snprintf(name, sizeof(name), "setting_%02d", k);
+			assert_int_equal(obs_data_get_int(settings, name),
+					 i + k);
+		}
+
+		snprintf(name, sizeof(name), "Source %05d", i);
+		assert_string_equal(obs_data_get_string(source, "name"), name);
+		assert_int_equal(obs_data_get_int(order, name), i);
+
+		obs_data_release(settings);
+		obs_data_release(source);
+	}
+
+	/* saving and loading again gives back the same collection */
+	obs_data_t *copy = obs_data_create_from_json(obs_data_get_json(data));
+	assert_non_null(copy);
+	assert_string_equal(obs_data_get_json(copy),
+			    obs_data_get_last_json(data));
+	obs_data_release(copy);
+
+	obs_data_release(order);
+	obs_data_array_release(sources);
+	obs_data_release(data);
+	bfree(json);
+}
+
+int main()
+{
+	const struct CMUnitTest tests[] = {
+		cmocka_unit_test(obs_data_index_test),
+		cmocka_unit_test(obs_data_index_realloc_test),
+		cmocka_unit_test(obs_data_json_test),
+		cmocka_unit_test(obs_data_collection_test),
+	};
+
+	return cmocka_run_group_tests(tests, NULL, NULL);
+}
@@ -0,0 +1,218 @@
+#include <stdarg.h>
+#include <stddef.h>
+#include <setjmp.h>
+#include <cmocka.h>
+
+#include <string.h>
+#include <util/platform.h>
+
+#include "obs-ffmpeg-replay-spill.h"
+
+/* a multiple of the spill file alignment */
+#define CAPACITY 4096
+
+static struct replay_spill *create_spill(void)
+{
+	struct replay_spill *spill = replay_spill_create(".", CAPACITY);
+	assert_non_null(spill);
+
+	/* the file is allocated in the background */
+	while (replay_spill_reserved(spill) < CAPACITY)
+		os_sleep_ms(1);
+
+	return spill;
+}
+
+static void fill(uint8_t *data, size_t size, uint8_t seed)
+{
+	for (size_t i = 0; i < size; i++)
+		data[i] = (uint8_t)(seed + i);
+}
+
+static void replay_spill_contains_test(void **state)
+{
+	struct replay_spill *spill = create_spill();
+	uint8_t data[100];
+	uint8_t *ptr;
+
+	fill(data, sizeof(data), 1);
+	ptr = replay_spill_push(spill, data, sizeof(data));
+	assert_non_null(ptr);
+	assert_memory_equal(ptr, data, sizeof(data));
+
+	assert_true(replay_spill_contains(spill, ptr));
+	assert_true(replay_spill_contains(spill, ptr + sizeof(data) - 1));
+	assert_false(replay_spill_contains(spill, data));
+	assert_false(replay_spill_contains(NULL, ptr));
+
+	assert_null(replay_spill_push(spill, data, 0));
+	assert_null(replay_spill_push(spill, data, CAPACITY + 1));
+
+	replay_spill_release(spill);
+	UNUSED_PARAMETER(state);
+}
+
+static void replay_spill_full_test(void **state)
+{
+	struct replay_spill *spill = create_spill();
+	uint8_t data[1000];
+	uint8_t *ptrs[4];
+
+	/* each payload takes up 1024 bytes */
+	for (size_t i = 0; i < 4; i++) {
+		fill(data, sizeof(data), (uint8_t)i);
+		ptrs[i] = replay_spill_push(spill, data, sizeof(data));
+		assert_non_null(ptrs[i]);
+	}
+
+	assert_null(replay_spill_push(spill, data, sizeof(data)));
+
+	/* dropping the oldest packet makes room for the next one in its
+	 * place */
+	replay_spill_pop(spill, ptrs[0], sizeof(data));
+	fill(data, sizeof(data), 4);
+	assert_ptr_equal(replay_spill_push(spill, data, sizeof(data)), ptrs[0]);
+	assert_memory_equal(ptrs[0], data, sizeof(data));
+
+	/* the others are untouched */
+	for (size_t i = 1; i < 4; i++) {
+		fill(data, sizeof(data), (uint8_t)i);
+		assert_memory_equal(ptrs[i], data, sizeof(data));
+	}
+
+	replay_spill_release(spill);
+	UNUSED_PARAMETER(state);
+}
+
+static void replay_spill_wrap_test(void **state)
+{
+	struct replay_spill *spill = create_spill();
+	const size_t size = 1500;
+	uint8_t data[CAPACITY];
+	uint8_t *a, *b, *c, *d;
+
+	a = replay_spill_push(spill, data, size);
+	b = replay_spill_push(spill, data, size);
+	assert_non_null(a);
+	assert_non_null(b);
+
+	/* 1024 bytes are left at the end of the file, which isn't enough, so
+	 * the next payload has to go to the start once a is gone */
+	assert_null(replay_spill_push(spill, data, size));
+	replay_spill_pop(spill, a, size);
+
+	fill(data, size, 7);
+	c = replay_spill_push(spill, data, size);
+	assert_ptr_equal(c, a);
+	assert_memory_equal(c, data, size);
+
+	/* the skipped end of the file and b are still in use */
+	assert_null(replay_spill_push(spill, data, size));
+
+	/* popping c has to skip over the unused end of the file */
+	replay_spill_pop(spill, b, size);
+	replay_spill_pop(spill, c, size);
+
+	d = replay_spill_push(spill, data, CAPACITY - 1536);
+	assert_ptr_equal(d, b);
+	assert_non_null(replay_spill_push(spill, data, 1536));
+
+	replay_spill_release(spill);
+	UNUSED_PARAMETER(state);
+}
+
+static void replay_spill_pin_test(void **state)
+{
+	struct replay_spill *spill = create_spill();
+	uint8_t data[1000];
+	uint8_t *ptrs[4];
+	uint64_t pin;
+
+	for (size_t i = 0; i < 4; i++)
+		ptrs[i] = replay_spill_push(spill, data, sizeof(data));
+
+	/* a save is reading all of it, so popped packets can't be evicted */
+	pin = replay_spill_pin(spill);
+	for (size_t i = 0; i < 4; i++)
+		replay_spill_pop(spill, ptrs[i], sizeof(data));
+	assert_null(replay_spill_push(spill, data, sizeof(data)));
+
+	replay_spill_unpin(spill, pin);
+	assert_ptr_equal(replay_spill_push(spill, data, sizeof(data)),
+			 ptrs[0]);
+
+	replay_spill_release(spill);
+	UNUSED_PARAMETER(state);
+}
+
+static void replay_spill_overlapping_pins_test(void **state)
+{
+	struct replay_spill *spill = create_spill();
+	uint8_t data[1000];
+	uint8_t *ptrs[4];
+	uint64_t first, second;
+
+	for (size_t i = 0; i < 4; i++)
+		ptrs[i] = replay_spill_push(spill, data, sizeof(data));
+
+	/* the second save starts after two packets were dropped */
+	first = replay_spill_pin(spill);
+	replay_spill_pop(spill, ptrs[0], sizeof(data));
+	replay_spill_pop(spill, ptrs[1], sizeof(data));
+	second = replay_spill_pin(spill);
+	assert_null(replay_spill_push(spill, data, sizeof(data)));
+
+	/* once the first save is done, only the second one holds data back */
+	replay_spill_unpin(spill, first);
+	assert_ptr_equal(replay_spill_push(spill, data, sizeof(data)),
+			 ptrs[0]);
+	assert_ptr_equal(replay_spill_push(spill, data, sizeof(data)),
+			 ptrs[1]);
+	assert_null(replay_spill_push(spill, data, sizeof(data)));
+
+	/* two saves pinned at the same position are released one by one */
+	first = replay_spill_pin(spill);
+	replay_spill_pop(spill, ptrs[2], sizeof(data));
+	replay_spill_unpin(spill, second);
+	assert_null(replay_spill_push(spill, data, sizeof(data)));
+	replay_spill_unpin(spill, first);
+	assert_ptr_equal(replay_spill_push(spill, data, sizeof(data)),
+			 ptrs[2]);
+
+	replay_spill_release(spill);
+	UNUSED_PARAMETER(state);
+}
+
+static void replay_spill_ref_test(void **state)
+{
+	struct replay_spill *spill = create_spill();
+	uint8_t data[100];
+	uint8_t *ptr;
+
+	fill(data, sizeof(data), 3);
+	ptr = replay_spill_push(spill, data, sizeof(data));
+
+	/* a pending save keeps the file mapped after the output lets go */
+	assert_ptr_equal(replay_spill_addref(spill), spill);
+	replay_spill_release(spill);
+	assert_memory_equal(ptr, data, sizeof(data));
+	replay_spill_release(spill);
+
+	assert_null(replay_spill_addref(NULL));
+	replay_spill_release(NULL);
+	UNUSED_PARAMETER(state);
+}
+
+int main()
+{
+	const struct CMUnitTest tests[] = {
+		cmocka_unit_test(replay_spill_contains_test),
+		cmocka_unit_test(replay_spill_full_test),
+		cmocka_unit_test(replay_spill_wrap_test),
+		cmocka_unit_test(replay_spill_pin_test),
+		cmocka_unit_test(replay_spill_overlapping_pins_test),
+		cmocka_unit_test(replay_spill_ref_test),
+	};
+
+	return cmocka_run_group_tests(tests, NULL, NULL);
+}
@@ -0,0 +1,203 @@
+#include <stdarg.h>
+#include <stddef.h>
+#include <setjmp.h>
+#include <cmocka.h>
+
+#include "rtmp-tag-queue.h"
+
+#define FRAME_USEC 33333
+#define GOP_FRAMES 30
+
+static uint8_t header[11] = {9, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0};
+static uint8_t trailer[4] = {0};
+
+static struct rtmp_tag *make_tag(int64_t frame, bool video)
+{
+	struct encoder_packet packet = {0};
+	int32_t ts = (int32_t)(frame * FRAME_USEC / 1000);
+
+	packet.type = video ? OBS_ENCODER_VIDEO : OBS_ENCODER_AUDIO;
+	packet.keyframe = video && frame % GOP_FRAMES == 0;
+	packet.dts_usec = frame * FRAME_USEC;
+
+	header[4] = (uint8_t)(ts >> 16);
+	header[5] = (uint8_t)(ts >> 8);
+	header[6] = (uint8_t)ts;
+	header[7] = (uint8_t)(ts >> 24);
+
+	return rtmp_tag_create(&packet, header, sizeof(header), trailer,
+			       sizeof(trailer));
+}
+
+static void push_frames(struct rtmp_tag_queue *queue, int64_t first,
+			int64_t count)
+{
+	for (int64_t i = first; i < first + count; i++) {
+		rtmp_tag_queue_push(queue, make_tag(i, true));
+		rtmp_tag_queue_push(queue, make_tag(i, false));
+	}
+}
+
+static size_t queued(struct rtmp_tag_queue *queue)
+{
+	return (size_t)(rtmp_tag_queue_end(queue) - queue->first_seq);
+}
+
+static int64_t read_all(struct rtmp_tag_queue *queue,
+			struct rtmp_tag_cursor *cursor)
+{
+	struct rtmp_tag *tag;
+	int64_t count = 0;
+
+	while ((tag = rtmp_tag_queue_next(queue, cursor)) != NULL) {
+		rtmp_tag_release(tag);
+		count++;
+	}
+
+	return count;
+}
+
+static void tag_timestamp_test(void **state)
+{
+	struct rtmp_tag *tag = make_tag(GOP_FRAMES * 1000, true);
+
+	assert_int_equal(tag->timestamp, GOP_FRAMES * 1000 * FRAME_USEC / 1000);
+	assert_int_equal(rtmp_tag_size(tag), sizeof(header) + sizeof(trailer));
+	rtmp_tag_release(tag);
+}
+
+static void tag_queue_fanout_test(void **state)
+{
+	struct rtmp_tag_queue queue;
+	struct rtmp_tag_cursor a = {0};
+	struct rtmp_tag_cursor b = {0};
+	struct rtmp_tag *tag;
+
+	assert_true(rtmp_tag_queue_init(&queue, 10000000));
+	rtmp_tag_queue_attach(&queue, &a);
+	rtmp_tag_queue_attach(&queue, &b);
+
+	push_frames(&queue, 0, 10);
+
+	/* both cursors see every tag, in order, from the same memory */
+	tag = rtmp_tag_queue_next(&queue, &a);
+	assert_int_equal(tag->packet.dts_usec, 0);
+	assert_true(tag->packet.keyframe);
+	rtmp_tag_release(tag);
+
+	assert_int_equal(read_all(&queue, &a), 19);
+	assert_int_equal(read_all(&queue, &b), 20);
+
+	/* tags from the newest keyframe on are kept for new cursors */
+	assert_int_equal(queued(&queue), 20);
+
+	/* once every cursor is past a keyframe, the old GOP is freed */
+	push_frames(&queue, 10, GOP_FRAMES);
+	assert_int_equal(queued(&queue), GOP_FRAMES * 2);
+	read_all(&queue, &a);
+	read_all(&queue, &b);
+	push_frames(&queue, 10 + GOP_FRAMES, 1);
+	assert_int_equal(queued(&queue), 2 * (10 + GOP_FRAMES + 1 - GOP_FRAMES));
+
+	rtmp_tag_queue_detach(&queue, &a);
+	rtmp_tag_queue_detach(&queue, &b);
+	rtmp_tag_queue_free(&queue);
+}
+
+static void tag_queue_attach_test(void **state)
+{
+	struct rtmp_tag_queue queue;
+	struct rtmp_tag_cursor cursor = {0};
+	struct rtmp_tag *tag;
+
+	assert_true(rtmp_tag_queue_init(&queue, 10000000));
+
+	/* with nothing attached only the newest GOP is kept */
+	push_frames(&queue, 0, GOP_FRAMES * 3 + 5);
+	assert_int_equal(queued(&queue), 10);
+
+	/* and a new cursor starts on its keyframe */
+	rtmp_tag_queue_attach(&queue, &cursor);
+	tag = rtmp_tag_queue_next(&queue, &cursor);
+	assert_true(tag->packet.keyframe);
+	assert_int_equal(tag->packet.dts_usec, GOP_FRAMES * 3 * FRAME_USEC);
+	rtmp_tag_release(tag);
+
+	rtmp_tag_queue_detach(&queue, &cursor);
+	rtmp_tag_queue_free(&queue);
+}
+
+static void tag_queue_slow_cursor_test(void **state)
+{
+	const int64_t max_usec = 2000000;
+	struct rtmp_tag_queue queue;
+	struct rtmp_tag_cursor fast = {0};
+	struct rtmp_tag_cursor stalled = {0};
+	size_t max_queued = 0;
+
+	assert_true(rtmp_tag_queue_init(&queue, max_usec));
+	rtmp_tag_queue_attach(&queue, &fast);
+	rtmp_tag_queue_attach(&queue, &stalled);
+
+	/* a stalled destination must not make the queue grow without bound,
+	 * and must not cost the others any frames */
+	for (int64_t i = 0; i < GOP_FRAMES * 100; i++) {
+		push_frames(&queue, i, 1);
+		assert_int_equal(read_all(&queue, &fast), 2);
+
+		if (queued(&queue) > max_queued)
+			max_queued = queued(&queue);
+		assert_true(rtmp_tag_queue_buffered_usec(&queue, &stalled) <=
+			    max_usec);
+	}
+
+	assert_true(max_queued <=
+		    2 * (max_usec / FRAME_USEC + GOP_FRAMES + 1));
+	assert_int_equal(fast.skipped_frames, 0);
+	assert_true(stalled.skipped_frames > 0);
+
+	rtmp_tag_queue_detach(&queue, &fast);
+	rtmp_tag_queue_detach(&queue, &stalled);
+	rtmp_tag_queue_free(&queue);
+}
+
+static void tag_queue_skip_test(void **state)
+{
+	struct rtmp_tag_queue queue;
+	struct rtmp_tag_cursor cursor = {0};
+	struct rtmp_tag *tag;
+
+	assert_true(rtmp_tag_queue_init(&queue, 10000000));
+	rtmp_tag_queue_attach(&queue, &cursor);
+
+	push_frames(&queue, 0, GOP_FRAMES + 5);
+	assert_int_equal(rtmp_tag_queue_buffered_usec(&queue, &cursor),
+			 (GOP_FRAMES + 4) * FRAME_USEC);
+
+	assert_int_equal(rtmp_tag_queue_skip(&queue, &cursor), GOP_FRAMES);
+	assert_int_equal(rtmp_tag_queue_skip(&queue, &cursor), 0);
+
+	tag = rtmp_tag_queue_next(&queue, &cursor);
+	assert_true(tag->packet.keyframe);
+	assert_int_equal(tag->packet.dts_usec, GOP_FRAMES * FRAME_USEC);
+	rtmp_tag_release(tag);
+
+	/* the skipped GOP is not needed by anyone anymore */
+	assert_int_equal(queued(&queue), 10);
+
+	rtmp_tag_queue_detach(&queue, &cursor);
+	rtmp_tag_queue_free(&queue);
+}
+
+int main()
+{
+	const struct CMUnitTest tests[] = {
+		cmocka_unit_test(tag_timestamp_test),
+		cmocka_unit_test(tag_queue_fanout_test),
+		cmocka_unit_test(tag_queue_attach_test),
+		cmocka_unit_test(tag_queue_slow_cursor_test),
+		cmocka_unit_test(tag_queue_skip_test),
+	};
+
+	return cmocka_run_group_tests(tests, NULL, NULL);
+}
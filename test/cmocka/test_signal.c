@@ -0,0 +1,315 @@
+#include <stdarg.h>
+#include <stddef.h>
+#include <setjmp.h>
+#include <cmocka.h>
+
+#include <util/platform.h>
+#include <util/threading.h>
+#include <callback/signal.h>
+#include <callback/proc.h>
+
+static const char *signals[] = {
+	"void first(int val)",
+	"void second(int val)",
+	"void third()",
+	NULL,
+};
+
+struct counter {
+	signal_handler_t *handler;
+	volatile long count;
+	long last;
+	bool disconnect;
+	bool remove;
+};
+
+static void count_cb(void *data, calldata_t *cd)
+{
+	struct counter *c = data;
+
+	os_atomic_inc_long(&c->count);
+	c->last = (long)calldata_int(cd, "val");
+
+	if (c->disconnect)
+		signal_handler_disconnect(c->handler, "first", count_cb, c);
+	if (c->remove)
+		signal_handler_remove_current();
+}
+
+static void global_cb(void *data, const char *signal, calldata_t *cd)
+{
+	struct counter *c = data;
+
+	os_atomic_inc_long(&c->count);
+	if (c->remove)
+		signal_handler_remove_current();
+}
+
+static void emit(signal_handler_t *handler, const char *signal, long long val)
+{
+	calldata_t cd = {0};
+	calldata_set_int(&cd, "val", val);
+	signal_handler_signal(handler, signal, &cd);
+	calldata_free(&cd);
+}
+
+static void signal_dispatch_test(void **state)
+{
+	signal_handler_t *handler = signal_handler_create();
+	struct counter a = {handler}, b = {handler}, g = {handler};
+
+	assert_true(signal_handler_add_array(handler, signals));
+	assert_false(signal_handler_add(handler, "void first()"));
+
+	signal_handler_connect(handler, "first", count_cb, &a);
+	signal_handler_connect(handler, "first", count_cb, &a);
+	signal_handler_connect(handler, "second", count_cb, &b);
+	signal_handler_connect(handler, "missing", count_cb, &b);
+	signal_handler_connect_global(handler, global_cb, &g);
+
+	emit(handler, "first", 1);
+	emit(handler, "second", 2);
+	emit(handler, "missing", 3);
+	assert_int_equal(a.count, 1);
+	assert_int_equal(a.last, 1);
+	assert_int_equal(b.count, 1);
+	assert_int_equal(b.last, 2);
+	assert_int_equal(g.count, 2);
+
+	signal_handler_disconnect(handler, "first", count_cb, &a);
+	signal_handler_disconnect_global(handler, global_cb, &g);
+	emit(handler, "first", 4);
+	emit(handler, "second", 5);
+	assert_int_equal(a.count, 1);
+	assert_int_equal(b.count, 2);
+	assert_int_equal(g.count, 2);
+
+	signal_handler_destroy(handler);
+}
+
+static void signal_remove_test(void **state)
+{
+	signal_handler_t *handler = signal_handler_create();
+	struct counter a = {handler}, b = {handler}, c = {handler};
+	struct counter g = {handler};
+
+	assert_true(signal_handler_add_array(handler, signals));
+
+	/* callbacks removing themselves while the signal is emitted */
+	a.disconnect = true;
+	b.remove = true;
+	g.remove = true;
+	signal_handler_connect(handler, "first", count_cb, &a);
+	signal_handler_connect_ref(handler, "first", count_cb, &b);
+	signal_handler_connect(handler, "first", count_cb, &c);
+	signal_handler_connect_global(handler, global_cb, &g);
+
+	emit(handler, "first", 1);
+	emit(handler, "first", 2);
+	assert_int_equal(a.count, 1);
+	assert_int_equal(b.count, 1);
+	assert_int_equal(c.count, 2);
+	assert_int_equal(c.last, 2);
+	assert_int_equal(g.count, 1);
+
+	/* the reference taken by connect_ref went away with the callback */
+	signal_handler_destroy(handler);
+}
+
+struct emitter {
+	signal_handler_t *handler;
+	volatile bool stop;
+};
+
+static void *emit_thread(void *data)
+{
+	struct emitter *e = data;
+
+	while (!os_atomic_load_bool(&e->stop))
+		emit(e->handler, "first", 1);
+	return NULL;
+}
+
+struct slow_counter {
+	volatile long count;
+	volatile bool disconnected;
+	volatile bool called_late;
+};
+
+static void slow_cb(void *data, calldata_t *cd)
+{
+	struct slow_counter *c = data;
+
+	os_atomic_inc_long(&c->count);
+	os_sleep_ms(1);
+	if (os_atomic_load_bool(&c->disconnected))
+		os_atomic_set_bool(&c->called_late, true);
+}
+
+static void signal_thread_test(void **state)
+{
+	signal_handler_t *handler = signal_handler_create();
+	struct emitter e = {handler};
+	pthread_t threads[4];
+
+	assert_true(signal_handler_add_array(handler, signals));
+
+	for (size_t i = 0; i < 4; i++)
+		pthread_create(&threads[i], NULL, emit_thread, &e);
+
+	/* once disconnect returns the callback must not be running anymore */
+	for (int i = 0; i < 50; i++) {
+		struct slow_counter c = {0};
+
+		signal_handler_connect(handler, "first", slow_cb, &c);
+		while (os_atomic_load_long(&c.count) < 4)
+			os_sleep_ms(0);
+		signal_handler_disconnect(handler, "first", slow_cb, &c);
+		os_atomic_set_bool(&c.disconnected, true);
+		os_sleep_ms(1);
+		assert_false(os_atomic_load_bool(&c.called_late));
+	}
+
+	os_atomic_set_bool(&e.stop, true);
+	for (size_t i = 0; i < 4; i++)
+		pthread_join(threads[i], NULL);
+
+	signal_handler_destroy(handler);
+}
+
+static void signal_layout_test(void **state)
+{
+	signal_handler_t *handler = signal_handler_create();
+	const calldata_layout_t *layout;
+	calldata_t cd;
+	uint8_t stack[256];
+	void *ptr;
+
+	assert_true(signal_handler_add(
+		handler, "void test(string name, ptr source, in out float vol, "
+			 "bool on, string other, int count)"));
+
+	assert_null(signal_handler_get_layout(handler, "missing"));
+	layout = signal_handler_get_layout(handler, "test");
+	assert_non_null(layout);
+	assert_int_equal(layout->num_params, 6);
+	assert_string_equal(layout->slots[2].name, "vol");
+
+	/* set by index, read by name */
+	calldata_init_fixed(&cd, stack, sizeof(stack));
+	calldata_set_layout(&cd, layout);
+	calldata_set_string_at(&cd, layout, 0, "name", "a long enough name");
+	calldata_set_ptr_at(&cd, layout, 1, "source", &cd);
+	calldata_set_float_at(&cd, layout, 2, "vol", 0.5);
+	calldata_set_bool_at(&cd, layout, 3, "on", true);
+	calldata_set_int_at(&cd, layout, 5, "count", 42);
+
+	assert_string_equal(calldata_string(&cd, "name"), "a long enough name");
+	assert_ptr_equal(calldata_ptr(&cd, "source"), &cd);
+	assert_true(calldata_float(&cd, "vol") == 0.5);
+	assert_true(calldata_bool(&cd, "on"));
+	assert_null(calldata_string(&cd, "other"));
+	assert_int_equal(calldata_int(&cd, "count"), 42);
+
+	/* set by name, read by index */
+	calldata_set_float(&cd, "vol", 2.0);
+	calldata_set_string(&cd, "other", "other");
+	calldata_set_int(&cd, "extra", 7);
+	assert_true(calldata_float_at(&cd, layout, 2, "vol") == 2.0);
+	assert_string_equal(calldata_string_at(&cd, layout, 4, "other"), "other");
+	assert_int_equal(calldata_int_at(&cd, layout, 5, "count"), 42);
+	assert_false(calldata_get_ptr_at(&cd, layout, 6, "missing", &ptr));
+
+	/* wrong types don't match, like with names */
+	long long val;
+	assert_false(calldata_get_int_at(&cd, layout, 3, "on", &val));
+
+	/* data that wasn't laid out falls back to names */
+	calldata_init_fixed(&cd, stack, sizeof(stack));
+	calldata_set_int(&cd, "count", 3);
+	calldata_set_bool(&cd, "on", true);
+	assert_int_equal(calldata_int_at(&cd, layout, 5, "count"), 3);
+	assert_true(calldata_bool_at(&cd, layout, 3, "on"));
+	assert_null(calldata_ptr_at(&cd, layout, 1, "source"));
+
+	calldata_set_float_at(&cd, layout, 2, "vol", 1.5);
+	assert_true(calldata_float(&cd, "vol") == 1.5);
+
+	/* setting a value as a different type moves it off its slot */
+	calldata_init_fixed(&cd, stack, sizeof(stack));
+	calldata_set_layout(&cd, layout);
+	calldata_set_bool(&cd, "source", true);
+	calldata_set_int_at(&cd, layout, 5, "count", 9);
+	assert_true(calldata_bool_at(&cd, layout, 1, "source"));
+	assert_int_equal(calldata_int(&cd, "count"), 9);
+
+	/* without a layout, everything goes by name */
+	calldata_init_fixed(&cd, stack, sizeof(stack));
+	calldata_set_ptr_at(&cd, NULL, 1, "source", &cd);
+	calldata_set_float_at(&cd, NULL, 2, "vol", 0.25);
+	calldata_set_string_at(&cd, NULL, 4, "other", "by name");
+	assert_ptr_equal(calldata_ptr(&cd, "source"), &cd);
+	assert_true(calldata_float_at(&cd, NULL, 2, "vol") == 0.25);
+	assert_string_equal(calldata_string_at(&cd, NULL, 4, "other"),
+			    "by name");
+	assert_false(calldata_get_int_at(&cd, NULL, 5, "count", &val));
+
+	/* too small for the layout */
+	calldata_init_fixed(&cd, stack, 16);
+	calldata_set_layout(&cd, layout);
+	assert_int_equal(cd.size, sizeof(size_t));
+
+	signal_handler_destroy(handler);
+}
+
+static const calldata_layout_t *add_layout = NULL;
+
+static void proc_add(void *data, calldata_t *cd)
+{
+	long long a = calldata_int_at(cd, add_layout, 0, "a");
+	long long b = calldata_int_at(cd, add_layout, 1, "b");
+
+	calldata_set_int_at(cd, add_layout, 2, "return", a + b);
+}
+
+static void proc_layout_test(void **state)
+{
+	proc_handler_t *handler = proc_handler_create();
+	calldata_t cd = {0};
+
+	proc_handler_add(handler, "int add(int a, int b)", proc_add, NULL);
+	add_layout = proc_handler_get_layout(handler, "add");
+	assert_non_null(add_layout);
+	assert_int_equal(add_layout->num_params, 3);
+	assert_string_equal(add_layout->slots[2].name, "return");
+
+	calldata_set_layout(&cd, add_layout);
+	calldata_set_int_at(&cd, add_layout, 0, "a", 2);
+	calldata_set_int_at(&cd, add_layout, 1, "b", 3);
+	assert_true(proc_handler_call(handler, "add", &cd));
+	assert_int_equal(calldata_int_at(&cd, add_layout, 2, "return"), 5);
+	assert_int_equal(calldata_int(&cd, "return"), 5);
+	calldata_free(&cd);
+
+	calldata_init(&cd);
+	calldata_set_int(&cd, "b", 4);
+	calldata_set_int(&cd, "a", 1);
+	assert_true(proc_handler_call(handler, "add", &cd));
+	assert_int_equal(calldata_int(&cd, "return"), 5);
+	calldata_free(&cd);
+
+	proc_handler_destroy(handler);
+}
+
+int main()
+{
+	const struct CMUnitTest tests[] = {
+		cmocka_unit_test(signal_dispatch_test),
+		cmocka_unit_test(signal_remove_test),
+		cmocka_unit_test(signal_thread_test),
+		cmocka_unit_test(signal_layout_test),
+		cmocka_unit_test(proc_layout_test),
+	};
+
+	return cmocka_run_group_tests(tests, NULL, NULL);
+}
@@ -0,0 +1,286 @@
+#include <stdarg.h>
+#include <stddef.h>
+#include <setjmp.h>
+#include <cmocka.h>
+
+#include <obs.h>
+
+/* enough sources to make the name index grow a few times */
+#define MANY_SOURCES 100
+
+static const char *test_get_name(void *type_data)
+{
+	UNUSED_PARAMETER(type_data);
+	return "test lookup source";
+}
+
+static void *test_create(obs_data_t *settings, obs_source_t *source)
+{
+	UNUSED_PARAMETER(settings);
+	return source;
+}
+
+static void test_destroy(void *data)
+{
+	UNUSED_PARAMETER(data);
+}
+
+static struct obs_source_info test_source = {
+	.id = "test_lookup_source",
+	.type = OBS_SOURCE_TYPE_INPUT,
+	.output_flags = OBS_SOURCE_ASYNC_VIDEO,
+	.get_name = test_get_name,
+	.create = test_create,
+	.destroy = test_destroy,
+};
+
+static int setup(void **state)
+{
+	UNUSED_PARAMETER(state);
+
+	if (obs_startup("en-US", NULL, NULL))
+		obs_register_source(&test_source);
+	return 0;
+}
+
+static int teardown(void **state)
+{
+	UNUSED_PARAMETER(state);
+
+	if (obs_initialized())
+		obs_shutdown();
+	return 0;
+}
+
+static inline void require_obs(void)
+{
+	/* obs_startup needs a windowing system for hotkeys */
+	if (!obs_initialized())
+		skip();
+}
+
+static inline obs_source_t *create_source(const char *name)
+{
+	return obs_source_create("test_lookup_source", name, NULL, NULL);
+}
+
+/* returns true if looking up name gives back source (or nothing, when source
+ * is NULL) */
+static bool lookup_is(const char *name, obs_source_t *source)
+{
+	obs_source_t *found = obs_get_source_by_name(name);
+
+	obs_source_release(found);
+	return found == source;
+}
+
+static void source_rename_test(void **state)
+{
+	UNUSED_PARAMETER(state);
+	require_obs();
+
+	obs_source_t *source = create_source("before");
+	assert_non_null(source);
+	assert_true(lookup_is("before", source));
+
+	obs_source_set_name(source, "after");
+	assert_true(lookup_is("before", NULL));
+	assert_true(lookup_is("after", source));
+
+	/* the old name can be taken by another source */
+	obs_source_t *other = create_source("before");
+	assert_true(lookup_is("before", other));
+	assert_true(lookup_is("after", source));
+
+	obs_source_release(other);
+	obs_source_release(source);
+}
+
+static void source_destroy_test(void **state)
+{
+	UNUSED_PARAMETER(state);
+	require_obs();
+
+	obs_source_t *sources[MANY_SOURCES];
+	char name[32];
+
+	for (size_t i = 0; i < MANY_SOURCES; i++) {
+		snprintf(name, sizeof(name), "source %zu", i);
+		sources[i] = create_source(name);
+		assert_non_null(sources[i]);
+	}
+
+	/* private sources are never indexed */
+	obs_source_t *private_source = obs_source_create_private(
+		"test_lookup_source", "private", NULL);
+	assert_true(lookup_is("private", NULL));
+	obs_source_release(private_source);
+
+	for (size_t i = 0; i < MANY_SOURCES; i++) {
+		snprintf(name, sizeof(name), "source %zu", i);
+		assert_true(lookup_is(name, sources[i]));
+	}
+
+	/* drop every other source, the rest must still be found */
+	for (size_t i = 0; i < MANY_SOURCES; i += 2)
+		obs_source_release(sources[i]);
+
+	for (size_t i = 0; i < MANY_SOURCES; i++) {
+		snprintf(name, sizeof(name), "source %zu", i);
+		assert_true(lookup_is(name, (i & 1) ? sources[i] : NULL));
+	}
+
+	for (size_t i = 1; i < MANY_SOURCES; i += 2)
+		obs_source_release(sources[i]);
+
+	assert_true(lookup_is("source 1", NULL));
+}
+
+static void sceneitem_set_id_test(void **state)
+{
+	UNUSED_PARAMETER(state);
+	require_obs();
+
+	obs_scene_t *scene = obs_scene_create("scene");
+	obs_source_t *source = create_source("item");
+	obs_sceneitem_t *item = obs_scene_add(scene, source);
+	int64_t id = obs_sceneitem_get_id(item);
+
+	assert_ptr_equal(obs_scene_find_sceneitem_by_id(scene, id), item);
+
+	obs_sceneitem_set_id(item, id + 1000);
+	assert_null(obs_scene_find_sceneitem_by_id(scene, id));
+	assert_ptr_equal(obs_scene_find_sceneitem_by_id(scene, id + 1000),
+			 item);
+
+	obs_sceneitem_remove(item);
+	assert_null(obs_scene_find_sceneitem_by_id(scene, id + 1000));
+
+	obs_source_release(source);
+	obs_scene_release(scene);
+}
+
+static void sceneitem_group_test(void **state)
+{
+	UNUSED_PARAMETER(state);
+	require_obs();
+
+	obs_scene_t *scene = obs_scene_create("scene");
+	obs_source_t *sources[3];
+	obs_sceneitem_t *items[3];
+	int64_t ids[3];
+
+	for (size_t i = 0; i < 3; i++) {
+		char name[16];
+		snprintf(name, sizeof(name), "item %zu", i);
+		sources[i] = create_source(name);
+		items[i] = obs_scene_add(scene, sources[i]);
+		ids[i] = obs_sceneitem_get_id(items[i]);
+	}
+
+	/* grouped items are only found through the group's scene */
+	obs_sceneitem_t *group =
+		obs_scene_insert_group(scene, "group", items, 2);
+	obs_scene_t *group_scene = obs_sceneitem_group_get_scene(group);
+
+	for (size_t i = 0; i < 2; i++) {
+		assert_null(obs_scene_find_sceneitem_by_id(scene, ids[i]));
+		assert_ptr_equal(
+			obs_scene_find_sceneitem_by_id(group_scene, ids[i]),
+			items[i]);
+	}
+	assert_ptr_equal(obs_scene_find_sceneitem_by_id(scene, ids[2]),
+			 items[2]);
+	assert_ptr_equal(obs_scene_find_sceneitem_by_id(
+				 scene, obs_sceneitem_get_id(group)),
+			 group);
+
+	obs_sceneitem_group_remove_item(group, items[1]);
+	assert_null(obs_scene_find_sceneitem_by_id(group_scene, ids[1]));
+	assert_ptr_equal(obs_scene_find_sceneitem_by_id(scene, ids[1]),
+			 items[1]);
+
+	obs_sceneitem_group_add_item(group, items[1]);
+	assert_null(obs_scene_find_sceneitem_by_id(scene, ids[1]));
+	assert_ptr_equal(obs_scene_find_sceneitem_by_id(group_scene, ids[1]),
+			 items[1]);
+
+	/* ungrouping moves copies of the items back into the scene */
+	obs_sceneitem_group_ungroup(group);
+
+	for (size_t i = 0; i < 2; i++) {
+		obs_sceneitem_t *item =
+			obs_scene_sceneitem_from_source(scene, sources[i]);
+		assert_non_null(item);
+		assert_ptr_equal(obs_scene_find_sceneitem_by_id(
+					 scene, obs_sceneitem_get_id(item)),
+				 item);
+		obs_sceneitem_release(item);
+	}
+
+	for (size_t i = 0; i < 3; i++)
+		obs_source_release(sources[i]);
+	obs_scene_release(scene);
+}
+
+static void sceneitem_reorder_test(void **state)
+{
+	UNUSED_PARAMETER(state);
+	require_obs();
+
+	obs_scene_t *scene = obs_scene_create("scene");
+	obs_source_t *source_a = create_source("a");
+	obs_source_t *source_b = create_source("b");
+	obs_sceneitem_t *a = obs_scene_add(scene, source_a);
+	obs_sceneitem_t *b = obs_scene_add(scene, source_b);
+	obs_sceneitem_t *group = obs_scene_add_group(scene, "group");
+	obs_scene_t *group_scene = obs_sceneitem_group_get_scene(group);
+	int64_t id_a = obs_sceneitem_get_id(a);
+	int64_t id_b = obs_sceneitem_get_id(b);
+
+	/* move a into the group and b to the bottom */
+	struct obs_sceneitem_order_info order[] = {
+		{NULL, b},
+		{NULL, group},
+		{group, a},
+	};
+
+	assert_true(obs_scene_reorder_items2(scene, order, 3));
+	assert_null(obs_scene_find_sceneitem_by_id(scene, id_a));
+	assert_ptr_equal(obs_scene_find_sceneitem_by_id(group_scene, id_a), a);
+	assert_ptr_equal(obs_scene_find_sceneitem_by_id(scene, id_b), b);
+
+	/* and back out again */
+	struct obs_sceneitem_order_info flat[] = {
+		{NULL, a},
+		{NULL, b},
+		{NULL, group},
+	};
+
+	assert_true(obs_scene_reorder_items2(scene, flat, 3));
+	assert_null(obs_scene_find_sceneitem_by_id(group_scene, id_a));
+	assert_ptr_equal(obs_scene_find_sceneitem_by_id(scene, id_a), a);
+	assert_ptr_equal(obs_scene_find_sceneitem_by_id(scene, id_b), b);
+
+	obs_source_release(source_a);
+	obs_source_release(source_b);
+	obs_scene_release(scene);
+}
+
+int main()
+{
+	const struct CMUnitTest tests[] = {
+		cmocka_unit_test_setup_teardown(source_rename_test, setup,
+						teardown),
+		cmocka_unit_test_setup_teardown(source_destroy_test, setup,
+						teardown),
+		cmocka_unit_test_setup_teardown(sceneitem_set_id_test, setup,
+						teardown),
+		cmocka_unit_test_setup_teardown(sceneitem_group_test, setup,
+						teardown),
+		cmocka_unit_test_setup_teardown(sceneitem_reorder_test, setup,
+						teardown),
+	};
+
+	return cmocka_run_group_tests(tests, NULL, NULL);
+}
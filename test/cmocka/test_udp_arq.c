@@ -0,0 +1,511 @@
+#include <stdarg.h>
+#include <stddef.h>
+#include <setjmp.h>
+#include <cmocka.h>
+
+#include <string.h>
+#include <util/darray.h>
+
+#include "udp-arq.h"
+#include "ts-mux.h"
+
+#ifndef _WIN32
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+#define LATENCY_US 200000
+#define ONE_WAY_US 20000
+#define STEP_US 250
+#define PAYLOADS 2000
+
+/* ------------------------------------------------------------------------- */
+/* simulated link: fixed one way delay, deterministic random loss            */
+
+struct datagram {
+	uint64_t arrival;
+	size_t size;
+	uint8_t data[ARQ_MAX_DATAGRAM];
+};
+
+struct link {
+	DARRAY(struct datagram) queue;
+	uint32_t rand;
+	int loss_percent;
+	int dropped;
+};
+
+static bool link_lose(struct link *link)
+{
+	link->rand = link->rand * 1103515245 + 12345;
+	return (int)((link->rand >> 16) % 100) < link->loss_percent;
+}
+
+static void link_send(struct link *link, uint64_t now, const uint8_t *data,
+		      size_t size)
+{
+	struct datagram *dg;
+
+	if (link_lose(link)) {
+		link->dropped++;
+		return;
+	}
+
+	dg = da_push_back_new(link->queue);
+	dg->arrival = now + ONE_WAY_US;
+	dg->size = size;
+	memcpy(dg->data, data, size);
+}
+
+static bool link_receive(struct link *link, uint64_t now, uint8_t *data,
+			 size_t *size)
+{
+	if (!link->queue.num || link->queue.array[0].arrival > now)
+		return false;
+
+	*size = link->queue.array[0].size;
+	memcpy(data, link->queue.array[0].data, *size);
+	da_erase(link->queue, 0);
+	return true;
+}
+
+static void fill_payload(uint8_t *data, uint32_t index)
+{
+	for (size_t i = 0; i < ARQ_MAX_PAYLOAD; i++)
+		data[i] = (uint8_t)(index * 31 + i);
+	memcpy(data, &index, sizeof(index));
+}
+
+static void lossy_link_test(void **state)
+{
+	struct arq_sender sender;
+	struct arq_receiver receiver;
+	struct link forward = {.rand = 1, .loss_percent = 5};
+	struct link backward = {.rand = 7, .loss_percent = 5};
+	uint8_t buf[ARQ_MAX_DATAGRAM];
+	uint8_t payload[ARQ_MAX_PAYLOAD];
+	uint32_t pushed = 0;
+	uint32_t received = 0;
+	uint64_t now = 1000000;
+	uint64_t end;
+
+	/* 4 Mbps of data over a 5 Mbps pacing rate */
+	assert_true(arq_sender_init(&sender, LATENCY_US, 625000, now));
+	assert_true(arq_receiver_init(&receiver, LATENCY_US, 4096));
+
+	end = now + 10000000;
+	for (; now < end && received < PAYLOADS; now += STEP_US) {
+		uint64_t wait;
+		size_t size;
+
+		while (pushed < PAYLOADS &&
+		       pushed * ARQ_MAX_PAYLOAD < (now - 1000000) / 2) {
+			fill_payload(payload, pushed++);
+			assert_true(arq_sender_push(&sender, payload,
+						    ARQ_MAX_PAYLOAD));
+		}
+
+		while ((size = arq_sender_next(&sender, now, buf, &wait)) > 0)
+			link_send(&forward, now, buf, size);
+		while (link_receive(&forward, now, buf, &size))
+			arq_receiver_receive(&receiver, now, buf, size);
+
+		while ((size = arq_receiver_read(&receiver, now, payload)) >
+		       0) {
+			uint32_t index;
+
+			assert_int_equal(size, ARQ_MAX_PAYLOAD);
+			memcpy(&index, payload, sizeof(index));
+			assert_int_equal(index, received);
+			received++;
+		}
+
+		while ((size = arq_receiver_control(&receiver, now, buf)) > 0)
+			link_send(&backward, now, buf, size);
+		while (link_receive(&backward, now, buf, &size))
+			arq_sender_receive(&sender, now, buf, size);
+	}
+
+	/* every loss was recovered in time, and everything arrived in order */
+	assert_int_equal(received, PAYLOADS);
+	assert_int_equal(receiver.packets_lost, 0);
+	assert_true(forward.dropped > 0);
+	assert_true(receiver.packets_recovered > 0);
+	assert_true(sender.packets_retransmitted >= receiver.packets_recovered);
+
+	/* ACKs measured the round trip */
+	assert_true(sender.rtt_us >= 2 * ONE_WAY_US);
+	assert_true(sender.rtt_us < 2 * ONE_WAY_US + 2 * STEP_US);
+
+	arq_sender_free(&sender);
+	arq_receiver_free(&receiver);
+	da_free(forward.queue);
+	da_free(backward.queue);
+
+	UNUSED_PARAMETER(state);
+}
+
+static void unrecoverable_loss_test(void **state)
+{
+	struct arq_sender sender;
+	struct arq_receiver receiver;
+	uint8_t buf[ARQ_MAX_DATAGRAM];
+	uint8_t payload[ARQ_MAX_PAYLOAD];
+	uint64_t now = 0;
+	uint32_t index;
+	uint64_t wait;
+	size_t size;
+
+	assert_true(arq_sender_init(&sender, LATENCY_US, 1000000, now));
+	assert_true(arq_receiver_init(&receiver, LATENCY_US, 1024));
+
+	for (uint32_t i = 0; i < 3; i++) {
+		fill_payload(payload, i);
+		assert_true(arq_sender_push(&sender, payload, 100));
+	}
+
+	/* the middle one never arrives, and NACKs are never answered */
+	for (uint32_t i = 0; i < 3; i++) {
+		size = arq_sender_next(&sender, now, buf, &wait);
+		assert_int_equal(size, ARQ_HEADER_SIZE + 100);
+		if (i != 1)
+			arq_receiver_receive(&receiver, now, buf, size);
+	}
+
+	assert_int_equal(arq_receiver_read(&receiver, now, payload), 100);
+	assert_int_equal(arq_receiver_read(&receiver, now, payload), 0);
+	assert_true(arq_receiver_control(&receiver, now, buf) > 0);
+	assert_int_equal(buf[0] & 0xF, ARQ_NACK);
+
+	/* the hole is given up on once the latency window has passed */
+	now += LATENCY_US;
+	assert_int_equal(arq_receiver_read(&receiver, now, payload), 100);
+	memcpy(&index, payload, sizeof(index));
+	assert_int_equal(index, 2);
+	assert_int_equal(receiver.packets_lost, 1);
+
+	/* and the sender no longer retransmits it either */
+	arq_sender_receive(&sender, now + 1, buf, ARQ_HEADER_SIZE + 8);
+	assert_int_equal(arq_sender_next(&sender, now + 1, buf, &wait), 0);
+
+	arq_sender_free(&sender);
+	arq_receiver_free(&receiver);
+
+	UNUSED_PARAMETER(state);
+}
+
+static void pacing_test(void **state)
+{
+	struct arq_sender sender;
+	uint8_t buf[ARQ_MAX_DATAGRAM];
+	uint8_t payload[ARQ_MAX_PAYLOAD] = {0};
+	uint64_t bytes_per_sec = 1000000;
+	uint64_t start = 5000000;
+	uint64_t sent = 0;
+	uint64_t now;
+
+	assert_true(arq_sender_init(&sender, LATENCY_US, bytes_per_sec, start));
+
+	/* a keyframe's worth of data all at once */
+	for (int i = 0; i < 500; i++)
+		assert_true(arq_sender_push(&sender, payload, ARQ_MAX_PAYLOAD));
+
+	assert_true(arq_sender_backlog_us(&sender) > 600000);
+
+	for (now = start; now <= start + 100000; now += 100) {
+		uint64_t wait;
+		size_t size;
+
+		while ((size = arq_sender_next(&sender, now, buf, &wait)) > 0)
+			sent += size;
+
+		/* never more than the burst allowance ahead of the rate */
+		assert_true((double)sent <=
+			    sender.max_tokens + (double)(now - start) *
+							sender.bytes_per_us);
+		assert_true(wait > 0);
+	}
+
+	/* and the rate is actually used */
+	assert_true(sent >= bytes_per_sec / 10);
+
+	arq_sender_free(&sender);
+
+	UNUSED_PARAMETER(state);
+}
+
+#ifndef _WIN32
+static int open_loopback(struct sockaddr_in *addr)
+{
+	socklen_t len = sizeof(*addr);
+	int sock = socket(AF_INET, SOCK_DGRAM, 0);
+
+	memset(addr, 0, sizeof(*addr));
+	addr->sin_family = AF_INET;
+	addr->sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+	assert_true(sock >= 0);
+	assert_int_equal(bind(sock, (struct sockaddr *)addr, sizeof(*addr)), 0);
+	assert_int_equal(getsockname(sock, (struct sockaddr *)addr, &len), 0);
+	fcntl(sock, F_SETFL, O_NONBLOCK);
+	return sock;
+}
+
+static void loopback_socket_test(void **state)
+{
+	struct arq_sender sender;
+	struct arq_receiver receiver;
+	struct sockaddr_in send_addr, recv_addr;
+	uint8_t buf[ARQ_MAX_DATAGRAM];
+	uint8_t payload[ARQ_MAX_PAYLOAD];
+	uint32_t received = 0;
+	uint64_t now = 0;
+	int first_sends = 0;
+	int send_sock, recv_sock;
+	ssize_t size;
+
+	send_sock = open_loopback(&send_addr);
+	recv_sock = open_loopback(&recv_addr);
+	assert_int_equal(connect(send_sock, (struct sockaddr *)&recv_addr,
+				 sizeof(recv_addr)),
+			 0);
+	assert_int_equal(connect(recv_sock, (struct sockaddr *)&send_addr,
+				 sizeof(send_addr)),
+			 0);
+
+	assert_true(arq_sender_init(&sender, LATENCY_US, 10000000, now));
+	assert_true(arq_receiver_init(&receiver, LATENCY_US, 1024));
+
+	for (uint32_t i = 0; i < 200; i++) {
+		fill_payload(payload, i);
+		assert_true(arq_sender_push(&sender, payload, ARQ_MAX_PAYLOAD));
+	}
+
+	/* simulated time, real sockets: every tenth fresh datagram is
+	 * "lost" before it reaches the socket */
+	for (; now < 2000000 && received < 200; now += 1000) {
+		uint64_t wait;
+		size_t next;
+
+		while ((next = arq_sender_next(&sender, now, buf, &wait)) > 0) {
+			if (!(buf[1] & ARQ_FLAG_RETRANSMIT) &&
+			    first_sends++ % 10 == 5)
+				continue;
+			assert_int_equal(send(send_sock, buf, next, 0),
+					 (ssize_t)next);
+		}
+
+		while ((size = recv(recv_sock, buf, sizeof(buf), 0)) > 0)
+			arq_receiver_receive(&receiver, now, buf,
+					     (size_t)size);
+
+		while ((next = arq_receiver_read(&receiver, now, payload)) >
+		       0) {
+			uint32_t index;
+			memcpy(&index, payload, sizeof(index));
+			assert_int_equal(index, received);
+			received++;
+		}
+
+		while ((next = arq_receiver_control(&receiver, now, buf)) > 0)
+			send(recv_sock, buf, next, 0);
+		while ((size = recv(send_sock, buf, sizeof(buf), 0)) > 0)
+			arq_sender_receive(&sender, now, buf, (size_t)size);
+	}
+
+	assert_int_equal(received, 200);
+	assert_int_equal(receiver.packets_lost, 0);
+	assert_int_equal(receiver.packets_recovered, 20);
+
+	arq_sender_free(&sender);
+	arq_receiver_free(&receiver);
+	close(send_sock);
+	close(recv_sock);
+
+	UNUSED_PARAMETER(state);
+}
+#endif
+
+/* ------------------------------------------------------------------------- */
+/* MPEG-TS muxer                                                             */
+
+struct ts_output {
+	DARRAY(uint8_t) data;
+	int writes;
+};
+
+static void collect_ts(void *param, const uint8_t *data, size_t size)
+{
+	struct ts_output *out = param;
+	da_push_back_array(out->data, data, size);
+	out->writes++;
+}
+
+static uint32_t crc32_mpeg(const uint8_t *data, size_t size)
+{
+	uint32_t crc = 0xFFFFFFFF;
+
+	for (size_t i = 0; i < size; i++) {
+		crc ^= (uint32_t)data[i] << 24;
+		for (int bit = 0; bit < 8; bit++)
+			crc = (crc & 0x80000000) ? (crc << 1) ^ 0x04C11DB7
+						 : crc << 1;
+	}
+
+	return crc;
+}
+
+static inline uint16_t ts_pid(const uint8_t *p)
+{
+	return (uint16_t)((p[1] & 0x1F) << 8 | p[2]);
+}
+
+/* reassembles the payload of one PID's packets */
+static void ts_payload(const struct ts_output *out, uint16_t pid,
+		       struct ts_output *payload, int *starts)
+{
+	int cc = -1;
+
+	*starts = 0;
+	for (size_t pos = 0; pos < out->data.num; pos += TS_PACKET_SIZE) {
+		const uint8_t *p = out->data.array + pos;
+		size_t offset = 4;
+
+		if (ts_pid(p) != pid)
+			continue;
+
+		/* continuity counters count up per PID */
+		if (cc >= 0)
+			assert_int_equal(p[3] & 0xF, (cc + 1) & 0xF);
+		cc = p[3] & 0xF;
+
+		if (p[1] & 0x40)
+			(*starts)++;
+		if (p[3] & 0x20)
+			offset += 1 + p[4];
+
+		da_push_back_array(payload->data, p + offset,
+				   TS_PACKET_SIZE - offset);
+	}
+}
+
+static void ts_mux_test(void **state)
+{
+	struct ts_output out = {0};
+	struct ts_mux mux;
+	struct ts_output video = {0};
+	struct ts_output audio = {0};
+	static const uint8_t sps_pps[] = {0, 0, 0, 1, 0x67, 0x42, 0, 0, 0, 1,
+					  0x68, 0xCE};
+	static const uint8_t asc[] = {0x11, 0x90}; /* LC, 48 kHz, stereo */
+	uint8_t frame[1000];
+	uint8_t aac[300];
+	struct encoder_packet packet = {0};
+	int starts;
+
+	for (size_t i = 0; i < sizeof(frame); i++)
+		frame[i] = (uint8_t)(i * 7);
+	frame[0] = 0;
+	frame[1] = 0;
+	frame[2] = 1;
+	frame[3] = 0x65;
+	memset(aac, 0xAB, sizeof(aac));
+
+	ts_mux_init(&mux, collect_ts, &out);
+	ts_mux_set_video_header(&mux, sps_pps, sizeof(sps_pps));
+	assert_true(ts_mux_set_audio_header(&mux, asc, sizeof(asc)));
+	assert_int_equal(mux.aac_freq_idx, 3);
+	assert_int_equal(mux.aac_channels, 2);
+
+	packet.type = OBS_ENCODER_VIDEO;
+	packet.timebase_num = 1;
+	packet.timebase_den = 30;
+	packet.keyframe = true;
+	packet.data = frame;
+	packet.size = sizeof(frame);
+	ts_mux_packet(&mux, &packet);
+
+	packet.type = OBS_ENCODER_AUDIO;
+	packet.timebase_den = 48000;
+	packet.keyframe = false;
+	packet.data = aac;
+	packet.size = sizeof(aac);
+	packet.dts_usec = 10000;
+	ts_mux_packet(&mux, &packet);
+
+	/* a second audio track is ignored */
+	packet.track_idx = 1;
+	ts_mux_packet(&mux, &packet);
+
+	assert_int_equal(out.writes, 2);
+	assert_int_equal(out.data.num % TS_PACKET_SIZE, 0);
+	for (size_t pos = 0; pos < out.data.num; pos += TS_PACKET_SIZE)
+		assert_int_equal(out.data.array[pos], 0x47);
+
+	/* PAT first, with a valid CRC and pointing at the PMT */
+	{
+		const uint8_t *pat = out.data.array + 5;
+		size_t length = ((pat[1] & 0xF) << 8 | pat[2]) + 3;
+
+		assert_int_equal(ts_pid(out.data.array), 0);
+		assert_int_equal(crc32_mpeg(pat, length), 0);
+		assert_int_equal((pat[10] & 0x1F) << 8 | pat[11], TS_PID_PMT);
+	}
+
+	/* the video PES carries the AUD, SPS/PPS and the frame */
+	ts_payload(&out, TS_PID_VIDEO, &video, &starts);
+	assert_int_equal(starts, 1);
+	assert_int_equal(video.data.array[3], 0xE0);
+	{
+		size_t header = 9 + video.data.array[8];
+		const uint8_t *es = video.data.array + header;
+
+		assert_int_equal(es[4], 0x09);
+		assert_memory_equal(es + 6, sps_pps, sizeof(sps_pps));
+		assert_memory_equal(es + 6 + sizeof(sps_pps), frame,
+				    sizeof(frame));
+		assert_int_equal(video.data.num,
+				 header + 6 + sizeof(sps_pps) + sizeof(frame));
+	}
+
+	/* the audio PES has an ADTS header and the exact frame length */
+	ts_payload(&out, TS_PID_AUDIO, &audio, &starts);
+	assert_int_equal(starts, 1);
+	assert_int_equal(audio.data.array[3], 0xC0);
+	{
+		size_t header = 9 + audio.data.array[8];
+		const uint8_t *adts = audio.data.array + header;
+		size_t frame_size = (size_t)(adts[3] & 3) << 11 |
+				    (size_t)adts[4] << 3 | adts[5] >> 5;
+
+		assert_int_equal(adts[0], 0xFF);
+		assert_int_equal(frame_size, sizeof(aac) + 7);
+		assert_memory_equal(adts + 7, aac, sizeof(aac));
+		assert_int_equal(audio.data.num, header + 7 + sizeof(aac));
+	}
+
+	da_free(video.data);
+	da_free(audio.data);
+	da_free(out.data);
+	ts_mux_free(&mux);
+
+	UNUSED_PARAMETER(state);
+}
+
+int main()
+{
+	const struct CMUnitTest tests[] = {
+		cmocka_unit_test(lossy_link_test),
+		cmocka_unit_test(unrecoverable_loss_test),
+		cmocka_unit_test(pacing_test),
+#ifndef _WIN32
+		cmocka_unit_test(loopback_socket_test),
+#endif
+		cmocka_unit_test(ts_mux_test),
+	};
+
+	return cmocka_run_group_tests(tests, NULL, NULL);
+}
@@ -0,0 +1,302 @@
+#include <stdarg.h>
+#include <stddef.h>
+#include <setjmp.h>
+#include <cmocka.h>
+
+#include <util/platform.h>
+#include <util/threading.h>
+#include <media-io/video-io.h>
+#include <media-io/video-frame.h>
+
+#define WIDTH 64
+#define HEIGHT 64
+#define WAIT_MS 2000
+
+static video_t *open_video_cache(size_t cache_size)
+{
+	struct video_output_info info = {
+		.name = "test",
+		.format = VIDEO_FORMAT_I420,
+		.fps_num = 30,
+		.fps_den = 1,
+		.width = WIDTH,
+		.height = HEIGHT,
+		.cache_size = cache_size,
+		.colorspace = VIDEO_CS_709,
+		.range = VIDEO_RANGE_PARTIAL,
+	};
+	video_t *video = NULL;
+
+	assert_int_equal(video_output_open(&video, &info),
+			 VIDEO_OUTPUT_SUCCESS);
+	return video;
+}
+
+static inline video_t *open_video(void)
+{
+	return open_video_cache(4);
+}
+
+static void push_frame(video_t *video, uint64_t ts)
+{
+	struct video_frame frame;
+
+	if (video_output_lock_frame(video, &frame, 1, ts)) {
+		memset(frame.data[0], (int)(ts & 0xFF),
+		       frame.linesize[0] * HEIGHT);
+		video_output_unlock_frame(video);
+	}
+}
+
+static bool wait_for(volatile long *count, long target)
+{
+	for (int i = 0; i < WAIT_MS; i++) {
+		if (os_atomic_load_long(count) >= target)
+			return true;
+		os_sleep_ms(1);
+	}
+	return false;
+}
+
+/* ------------------------------------------------------------------------- */
+
+struct self_input {
+	video_t *video;
+	volatile long count;
+	volatile long other_count;
+};
+
+static void other_cb(void *param, struct video_data *frame)
+{
+	struct self_input *si = param;
+	os_atomic_inc_long(&si->other_count);
+	UNUSED_PARAMETER(frame);
+}
+
+static void self_cb(void *param, struct video_data *frame)
+{
+	struct self_input *si = param;
+
+	if (os_atomic_inc_long(&si->count) == 3) {
+		video_output_disconnect(si->video, self_cb, si);
+		assert_true(video_output_connect(si->video, NULL, other_cb,
+						 si));
+	}
+	UNUSED_PARAMETER(frame);
+}
+
+static void video_io_self_disconnect_test(void **state)
+{
+	struct self_input si = {0};
+	uint64_t ts = 0;
+
+	si.video = open_video();
+	assert_true(video_output_connect(si.video, NULL, self_cb, &si));
+
+	for (int i = 0; i < 3; i++) {
+		push_frame(si.video, ts += 1000);
+		assert_true(wait_for(&si.count, i + 1));
+	}
+
+	/* the first input is gone, the one it connected gets the frames */
+	for (int i = 0; i < 3; i++) {
+		push_frame(si.video, ts += 1000);
+		assert_true(wait_for(&si.other_count, i + 1));
+	}
+
+	assert_int_equal(os_atomic_load_long(&si.count), 3);
+	assert_true(video_output_active(si.video));
+
+	/* connecting again reaps the stopped input thread */
+	assert_true(video_output_connect(si.video, NULL, self_cb, &si));
+	video_output_disconnect(si.video, self_cb, &si);
+	video_output_disconnect(si.video, other_cb, &si);
+	assert_false(video_output_active(si.video));
+
+	video_output_close(si.video);
+}
+
+static void self_only_cb(void *param, struct video_data *frame)
+{
+	struct self_input *si = param;
+
+	video_output_disconnect(si->video, self_only_cb, si);
+	os_sleep_ms(1);
+	os_atomic_inc_long(&si->count);
+	UNUSED_PARAMETER(frame);
+}
+
+static void video_io_self_disconnect_close_test(void **state)
+{
+	struct self_input si = {0};
+	uint64_t ts = 0;
+
+	/* closing the output while an input that disconnected itself is
+	 * still in its callback */
+	for (int run = 0; run < 20; run++) {
+		si.video = open_video();
+		assert_true(video_output_connect(si.video, NULL, self_only_cb,
+						 &si));
+		push_frame(si.video, ts += 1000);
+		while (video_output_active(si.video))
+			os_sleep_ms(0);
+		video_output_close(si.video);
+		assert_int_equal(os_atomic_load_long(&si.count), run + 1);
+	}
+}
+
+/* ------------------------------------------------------------------------- */
+
+#define SHARED_FRAMES 8
+
+struct scaled_input {
+	volatile long count;
+	uint8_t *data[SHARED_FRAMES];
+	uint32_t linesize;
+};
+
+static void scaled_cb(void *param, struct video_data *frame)
+{
+	struct scaled_input *si = param;
+	long count = os_atomic_load_long(&si->count);
+
+	if (count < SHARED_FRAMES)
+		si->data[count] = frame->data[0];
+	si->linesize = frame->linesize[0];
+	os_atomic_inc_long(&si->count);
+}
+
+static const struct video_scale_info half_size = {
+	.format = VIDEO_FORMAT_NV12,
+	.width = WIDTH / 2,
+	.height = HEIGHT / 2,
+	.range = VIDEO_RANGE_PARTIAL,
+	.colorspace = VIDEO_CS_709,
+};
+
+struct frame_pusher {
+	video_t *video;
+	volatile bool stop;
+};
+
+static void *push_thread(void *param)
+{
+	struct frame_pusher *fp = param;
+	uint64_t ts = 0;
+
+	while (!os_atomic_load_bool(&fp->stop)) {
+		push_frame(fp->video, ts += 1000);
+		os_sleep_ms(1);
+	}
+	return NULL;
+}
+
+static void video_io_shared_scaler_test(void **state)
+{
+	struct scaled_input a = {0}, b = {0};
+	struct frame_pusher fp = {0};
+	uint64_t ts = 0;
+	pthread_t thread;
+	long count;
+
+	fp.video = open_video();
+	assert_true(video_output_connect(fp.video, &half_size, scaled_cb, &a));
+	assert_true(video_output_connect(fp.video, &half_size, scaled_cb, &b));
+
+	/* both inputs get the same scaled frames */
+	for (int i = 0; i < SHARED_FRAMES; i++) {
+		push_frame(fp.video, ts += 1000);
+		assert_true(wait_for(&a.count, i + 1));
+		assert_true(wait_for(&b.count, i + 1));
+		assert_non_null(a.data[i]);
+		assert_ptr_equal(a.data[i], b.data[i]);
+	}
+	assert_true(b.linesize >= WIDTH / 2);
+
+	/* one of them disconnecting and reconnecting while frames are being
+	 * scaled must not disturb the other one */
+	pthread_create(&thread, NULL, push_thread, &fp);
+
+	for (int i = 0; i < 50; i++) {
+		count = os_atomic_load_long(&b.count);
+
+		video_output_disconnect(fp.video, scaled_cb, &a);
+		assert_true(wait_for(&b.count, count + 1));
+		assert_true(video_output_connect(fp.video, &half_size,
+						 scaled_cb, &a));
+	}
+
+	count = os_atomic_load_long(&a.count);
+	assert_true(wait_for(&a.count, count + 2));
+
+	/* the last input of the group takes the scaler with it */
+	video_output_disconnect(fp.video, scaled_cb, &a);
+	video_output_disconnect(fp.video, scaled_cb, &b);
+	assert_true(video_output_connect(fp.video, &half_size, scaled_cb, &a));
+	count = os_atomic_load_long(&a.count);
+	assert_true(wait_for(&a.count, count + 2));
+
+	os_atomic_set_bool(&fp.stop, true);
+	pthread_join(thread, NULL);
+	video_output_close(fp.video);
+}
+
+/* ------------------------------------------------------------------------- */
+
+#define SLOW_FRAMES 60
+#define FRAME_TIME (1000000000ULL / 30)
+
+struct slow_input {
+	volatile long count;
+	uint64_t timestamps[SLOW_FRAMES];
+};
+
+static void slow_cb(void *param, struct video_data *frame)
+{
+	struct slow_input *si = param;
+	long count = os_atomic_load_long(&si->count);
+
+	if (count < SLOW_FRAMES)
+		si->timestamps[count] = frame->timestamp;
+	os_sleep_ms(4);
+	os_atomic_inc_long(&si->count);
+}
+
+static void video_io_slow_input_test(void **state)
+{
+	struct slow_input si = {0};
+	uint64_t ts = 0;
+	video_t *video;
+
+	/* enough cached frames that only the input's queue overflows */
+	video = open_video_cache(16);
+	assert_true(video_output_connect(video, NULL, slow_cb, &si));
+
+	for (int i = 0; i < SLOW_FRAMES; i++) {
+		push_frame(video, ts += FRAME_TIME);
+		os_sleep_ms(1);
+	}
+
+	/* dropped frames are repeated in their own place, so the input still
+	 * sees every timestamp once and in order */
+	assert_true(wait_for(&si.count, SLOW_FRAMES));
+	assert_true(video_output_get_skipped_frames(video) > 0);
+
+	for (int i = 0; i < SLOW_FRAMES; i++)
+		assert_true(si.timestamps[i] == FRAME_TIME * (i + 1));
+
+	video_output_disconnect(video, slow_cb, &si);
+	video_output_close(video);
+}
+
+int main()
+{
+	const struct CMUnitTest tests[] = {
+		cmocka_unit_test(video_io_self_disconnect_test),
+		cmocka_unit_test(video_io_self_disconnect_close_test),
+		cmocka_unit_test(video_io_shared_scaler_test),
+		cmocka_unit_test(video_io_slow_input_test),
+	};
+
+	return cmocka_run_group_tests(tests, NULL, NULL);
+}
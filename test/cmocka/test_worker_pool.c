@@ -0,0 +1,135 @@
+#include <stdarg.h>
+#include <stddef.h>
+#include <setjmp.h>
+#include <cmocka.h>
+
+#include <util/worker-pool.h>
+#include <util/threading.h>
+
+#define PARTS 64
+
+static void count_part(void *param, size_t idx)
+{
+	volatile long *counts = param;
+	os_atomic_inc_long(&counts[idx]);
+}
+
+static void worker_pool_test(void **state)
+{
+	worker_pool_t *pool = worker_pool_create(3, "test pool");
+	volatile long counts[PARTS] = {0};
+
+	assert_non_null(pool);
+	assert_int_equal(worker_pool_threads(pool), 3);
+
+	for (int run = 0; run < 100; run++)
+		worker_pool_run(pool, count_part, (void *)counts, PARTS);
+
+	for (size_t i = 0; i < PARTS; i++)
+		assert_int_equal(counts[i], 100);
+
+	worker_pool_destroy(pool);
+}
+
+static void *run_thread(void *param)
+{
+	worker_pool_t *pool = param;
+	volatile long counts[PARTS] = {0};
+
+	for (int run = 0; run < 100; run++)
+		worker_pool_run(pool, count_part, (void *)counts, PARTS);
+
+	for (size_t i = 0; i < PARTS; i++) {
+		if (counts[i] != 100)
+			return (void *)1;
+	}
+	return NULL;
+}
+
+static void worker_pool_concurrent_test(void **state)
+{
+	worker_pool_t *pool = worker_pool_create(2, "test pool");
+	pthread_t threads[4];
+	void *ret;
+
+	for (size_t i = 0; i < 4; i++)
+		assert_int_equal(
+			pthread_create(&threads[i], NULL, run_thread, pool), 0);
+	for (size_t i = 0; i < 4; i++) {
+		pthread_join(threads[i], &ret);
+		assert_null(ret);
+	}
+
+	worker_pool_destroy(pool);
+}
+
+struct owner_batch {
+	worker_pool_t *pool;
+	pthread_t caller;
+	pthread_t ran_by[PARTS];
+	pthread_t other;
+};
+
+static void record_part(void *param, size_t idx)
+{
+	struct owner_batch *batch = param;
+	batch->ran_by[idx] = pthread_self();
+	os_sleep_ms(1);
+}
+
+static void *owner_thread(void *param)
+{
+	struct owner_batch *batch = param;
+
+	batch->caller = pthread_self();
+	worker_pool_run(batch->pool, record_part, batch, PARTS);
+	return NULL;
+}
+
+static void worker_pool_own_batch_test(void **state)
+{
+	worker_pool_t *pool = worker_pool_create(1, "test pool");
+	struct owner_batch batches[2] = {{.pool = pool}, {.pool = pool}};
+	pthread_t threads[2];
+
+	for (size_t i = 0; i < 2; i++)
+		assert_int_equal(pthread_create(&threads[i], NULL,
+						owner_thread, &batches[i]),
+				 0);
+	for (size_t i = 0; i < 2; i++)
+		pthread_join(threads[i], NULL);
+
+	/* a caller must never run parts of a batch queued by another
+	 * caller */
+	for (size_t i = 0; i < 2; i++) {
+		pthread_t other = batches[1 - i].caller;
+
+		for (size_t j = 0; j < PARTS; j++)
+			assert_false(
+				pthread_equal(batches[i].ran_by[j], other));
+	}
+
+	worker_pool_destroy(pool);
+}
+
+static void worker_pool_no_threads_test(void **state)
+{
+	volatile long counts[PARTS] = {0};
+
+	worker_pool_run(NULL, count_part, (void *)counts, PARTS);
+
+	for (size_t i = 0; i < PARTS; i++)
+		assert_int_equal(counts[i], 1);
+}
+
+int main()
+{
+	const struct CMUnitTest tests[] = {
+		cmocka_unit_test(worker_pool_test),
+		cmocka_unit_test(worker_pool_concurrent_test),
+		cmocka_unit_test(worker_pool_own_batch_test),
+		cmocka_unit_test(worker_pool_no_threads_test),
+	};
+
+	return cmocka_run_group_tests(tests, NULL, NULL);
+}